@@ -0,0 +1,265 @@
+﻿//***************************************************************************************/
+//
+// File name: Async3DCalculator.h
+//
+// Synopsis:  Contains the asynchronous 3D calculator used by the Chromasens_3DPIXA_M10PP3
+//            example. The source frames are submitted to a queue of requests
+//            that a worker thread feeds to the 3D API, one frame at a time. The
+//            disparity and rectified outputs are copied into buffers given by
+//            the caller, and each request is completed either with a callback,
+//            called from the worker thread, or by waiting on its identifier.
+//
+//            The source data and the output buffers of a request must stay
+//            valid until it is completed, and the requests in flight at the
+//            same time must each have their own. Submit() and Wait() are called
+//            from a single host thread. The blocking calculation is a submit
+//            followed by a wait.
+//
+// Copyright © 1992-2024 Zebra Technologies Corp. and/or its affiliates
+// All Rights Reserved
+
+static const MIL_INT ASYNC_3D_MAX_IN_FLIGHT = 4;
+static const MIL_INT ASYNC_3D_MAX_SOURCES   = 2;
+
+// Function called from the worker thread when a request is completed.
+typedef void (*Async3DCallback)(MIL_INT RequestId, bool Accepted, void* pUserData);
+
+// Source frame and output buffers of a request.
+struct SAsync3DRequest
+   {
+   char*           pSrcData[ASYNC_3D_MAX_SOURCES];
+   MIL_INT         NbSrc;
+   void*           pDisparityData;
+   int             DisparityPitchByte;
+   void*           pRectifiedData;       // NULL if the rectified image is not needed.
+   int             RectifiedPitchByte;
+   outImgType      RectifiedType;
+   Async3DCallback Callback;             // NULL to complete the request with Wait().
+   void*           pUserData;
+   };
+
+// State of a request slot.
+enum EAsync3DSlotState
+   {
+   ASYNC_3D_FREE,
+   ASYNC_3D_QUEUED,
+   ASYNC_3D_DONE
+   };
+
+// Request slot of the queue.
+struct SAsync3DSlot
+   {
+   SAsync3DRequest   Request;
+   MIL_INT           RequestId;
+   EAsync3DSlotState State;
+   bool              Accepted;
+   };
+
+//////////////////////////////////////////////////////////////////////////
+// Class that calculates the 3D data of the submitted frames in a worker
+// thread.
+//////////////////////////////////////////////////////////////////////////
+class CAsync3DCalculator
+   {
+   public:
+      // Constructor. Starts the worker thread, placed on the cores of a thread
+      // role if given. The 3D API must be started.
+      CAsync3DCalculator(MIL_ID MilSystem, I3DApi* p3DApi, const SThreadRoleConfig* pThreadRole = NULL)
+         : m_p3DApi(p3DApi),
+           m_pThreadRole(pThreadRole),
+           m_NextRequestId(0),
+           m_NextSlotIdx(0),
+           m_NbInFlight(0),
+           m_Stop(false)
+         {
+         memset(m_Slots, 0, sizeof(m_Slots));
+         MthrAlloc(MilSystem, M_MUTEX, M_DEFAULT, M_NULL, M_NULL, &m_MilMutex);
+         MthrAlloc(MilSystem, M_EVENT, M_NOT_SIGNALED + M_AUTO_RESET, M_NULL, M_NULL, &m_MilSubmitEvent);
+         MthrAlloc(MilSystem, M_EVENT, M_NOT_SIGNALED + M_AUTO_RESET, M_NULL, M_NULL, &m_MilCompleteEvent);
+         MthrAlloc(MilSystem, M_THREAD, M_DEFAULT, WorkerThread, this, &m_MilWorkerThread);
+         }
+
+      // Destructor. The queued requests are calculated before the worker stops.
+      virtual ~CAsync3DCalculator()
+         {
+         Lock();
+         m_Stop = true;
+         Unlock();
+         MthrControl(m_MilSubmitEvent, M_EVENT_SET, M_SIGNALED);
+         MthrWait(m_MilWorkerThread, M_THREAD_END_WAIT, M_NULL);
+         MthrFree(m_MilWorkerThread);
+         MthrFree(m_MilCompleteEvent);
+         MthrFree(m_MilSubmitEvent);
+         MthrFree(m_MilMutex);
+         }
+
+      // Function that queues a request. Blocks while the queue is full. Returns
+      // the identifier of the request.
+      MIL_INT Submit(const SAsync3DRequest& Request)
+         {
+         Lock();
+         while(m_NbInFlight == ASYNC_3D_MAX_IN_FLIGHT || m_Slots[m_NextSlotIdx].State != ASYNC_3D_FREE)
+            {
+            Unlock();
+            MthrWait(m_MilCompleteEvent, M_EVENT_WAIT, M_NULL);
+            Lock();
+            }
+         SAsync3DSlot& Slot = m_Slots[m_NextSlotIdx];
+         Slot.Request = Request;
+         Slot.RequestId = m_NextRequestId++;
+         Slot.State = ASYNC_3D_QUEUED;
+         Slot.Accepted = false;
+         m_NextSlotIdx = (m_NextSlotIdx + 1) % ASYNC_3D_MAX_IN_FLIGHT;
+         m_NbInFlight++;
+         MIL_INT RequestId = Slot.RequestId;
+         Unlock();
+
+         MthrControl(m_MilSubmitEvent, M_EVENT_SET, M_SIGNALED);
+         return RequestId;
+         }
+
+      // Function that waits for a request submitted without callback and releases
+      // it. Returns false if a source frame was not accepted by the 3D API.
+      bool Wait(MIL_INT RequestId)
+         {
+         SAsync3DSlot& Slot = m_Slots[RequestId % ASYNC_3D_MAX_IN_FLIGHT];
+         Lock();
+         while(Slot.RequestId == RequestId && Slot.State == ASYNC_3D_QUEUED)
+            {
+            Unlock();
+            MthrWait(m_MilCompleteEvent, M_EVENT_WAIT, M_NULL);
+            Lock();
+            }
+         bool Accepted = Slot.RequestId == RequestId && Slot.Accepted;
+         if(Slot.RequestId == RequestId)
+            Release(&Slot);
+         Unlock();
+         return Accepted;
+         }
+
+      // Function that calculates a frame and waits for its outputs.
+      bool Calculate(SAsync3DRequest Request)
+         {
+         Request.Callback = NULL;
+         return Wait(Submit(Request));
+         }
+
+      // Function that returns the number of requests submitted and not yet released.
+      MIL_INT GetNbInFlight()
+         {
+         Lock();
+         MIL_INT NbInFlight = m_NbInFlight;
+         Unlock();
+         return NbInFlight;
+         }
+
+      // Function that returns the number of requests waiting for or in the
+      // calculation, without the completed ones not released yet.
+      MIL_INT GetNbQueued()
+         {
+         Lock();
+         MIL_INT NbQueued = 0;
+         for(MIL_INT SlotIdx = 0; SlotIdx < ASYNC_3D_MAX_IN_FLIGHT; SlotIdx++)
+            {
+            if(m_Slots[SlotIdx].State == ASYNC_3D_QUEUED)
+               NbQueued++;
+            }
+         Unlock();
+         return NbQueued;
+         }
+
+      // Thread function that calculates the queued requests in order.
+      static MIL_UINT32 MFTYPE WorkerThread(void* pCalculatorPtr)
+         {
+         CAsync3DCalculator* pCalculator = (CAsync3DCalculator*)pCalculatorPtr;
+         if(pCalculator->m_pThreadRole)
+            PlaceCurrentThread(*pCalculator->m_pThreadRole, 0);
+         MIL_INT SlotIdx = 0;
+         while(true)
+            {
+            // Wait for the next request.
+            SAsync3DSlot& Slot = pCalculator->m_Slots[SlotIdx];
+            pCalculator->Lock();
+            while(Slot.State != ASYNC_3D_QUEUED && !pCalculator->m_Stop)
+               {
+               pCalculator->Unlock();
+               MthrWait(pCalculator->m_MilSubmitEvent, M_EVENT_WAIT, M_NULL);
+               pCalculator->Lock();
+               }
+            bool HasRequest = Slot.State == ASYNC_3D_QUEUED;
+            pCalculator->Unlock();
+            if(!HasRequest)
+               break;
+
+            // Calculate it and complete it.
+            bool Accepted = pCalculator->Process(Slot.Request);
+            pCalculator->Lock();
+            Slot.Accepted = Accepted;
+            Slot.State = ASYNC_3D_DONE;
+            Async3DCallback Callback = Slot.Request.Callback;
+            pCalculator->Unlock();
+            if(Callback)
+               {
+               Callback(Slot.RequestId, Accepted, Slot.Request.pUserData);
+               pCalculator->Lock();
+               pCalculator->Release(&Slot);
+               pCalculator->Unlock();
+               }
+            MthrControl(pCalculator->m_MilCompleteEvent, M_EVENT_SET, M_SIGNALED);
+            SlotIdx = (SlotIdx + 1) % ASYNC_3D_MAX_IN_FLIGHT;
+            }
+         return 0;
+         }
+
+   private:
+      // Disallow copy.
+      CAsync3DCalculator(const CAsync3DCalculator&);
+      CAsync3DCalculator& operator=(const CAsync3DCalculator&);
+
+      void Lock()   {MthrControl(m_MilMutex, M_LOCK, M_DEFAULT);}
+      void Unlock() {MthrControl(m_MilMutex, M_UNLOCK, M_DEFAULT);}
+
+      // Function that frees a completed slot. The mutex must be locked.
+      void Release(SAsync3DSlot* pSlot)
+         {
+         pSlot->State = ASYNC_3D_FREE;
+         m_NbInFlight--;
+         }
+
+      // Function that loads the source frame of a request in the 3D API, calculates
+      // it and copies the outputs. Returns false if a source frame was not accepted.
+      bool Process(const SAsync3DRequest& Request)
+         {
+         bool SrcImagesAccepted = true;
+         for(int SrcIdx = 0; SrcIdx < (int)Request.NbSrc; SrcIdx++)
+            {
+            if(m_p3DApi->setSrcImgPtr(SrcIdx, Request.pSrcData[SrcIdx]) < 0)
+               SrcImagesAccepted = false;
+            m_p3DApi->setSrcImgLoaded(SrcIdx);
+            }
+
+         m_p3DApi->getNextImgBlocking();
+
+         void* pDisparityData = Request.pDisparityData;
+         m_p3DApi->getLastImage(&pDisparityData, Request.DisparityPitchByte, IMG_OUT_DISP);
+         if(Request.pRectifiedData)
+            {
+            void* pRectifiedData = Request.pRectifiedData;
+            m_p3DApi->getLastImage(&pRectifiedData, Request.RectifiedPitchByte, Request.RectifiedType);
+            }
+         return SrcImagesAccepted;
+         }
+
+      I3DApi*      m_p3DApi;
+      const SThreadRoleConfig* m_pThreadRole;
+      SAsync3DSlot m_Slots[ASYNC_3D_MAX_IN_FLIGHT];
+      MIL_INT      m_NextRequestId;
+      MIL_INT      m_NextSlotIdx;
+      MIL_INT      m_NbInFlight;
+      bool         m_Stop;
+
+      MIL_ID       m_MilMutex;
+      MIL_ID       m_MilSubmitEvent;      // Signaled when a request is queued or at the stop.
+      MIL_ID       m_MilCompleteEvent;    // Signaled when a request is completed.
+      MIL_ID       m_MilWorkerThread;
+   };
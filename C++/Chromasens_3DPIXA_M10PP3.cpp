@@ -1,1225 +1,3957 @@
-﻿//***************************************************************************************/
-//
-// File name: Chromasens_3DPIXA_M10PP3.cpp
-//
-// Synopsis:  This example shows how to use the 3DPIXA camera and its CS-3D API
-//            in conjunction with MIL to solve surface inspection applications.
-//            See the PrintHeader() function below for detailed description.
-//
-// Copyright © 1992-2024 Zebra Technologies Corp. and/or its affiliates
-// All Rights Reserved
-
-#include <mil.h>
-#include "MdispD3D.h"
-
-#define USE_CS3D_API 0
-
-#if USE_CS3D_API 
-   
-   #if defined(WIN32)
-      #error "Chromasens CS3D api cannot be used in a 32-bit application."
-   #endif
-   
-   #include "C:\\Program Files\\Chromasens\\3D\\3dapi\\includes\\CS3DApiDll.h"
-   using namespace CS3D;
-   
-   static MIL_CONST_TEXT_PTR CS3D_DLL_PATH  = MIL_TEXT("C:\\Program Files\\Chromasens\\3D\\dlls");
-#else
-   #include "StandaloneCS3DApi.h"
-#endif
-
-///***************************************************************************
-// Example description.
-///***************************************************************************
-void PrintHeader()   
-   {
-   MosPrintf(MIL_TEXT("[EXAMPLE NAME]\n")
-             MIL_TEXT("Chromasens_3DPIXA_M10PP3\n\n")
-
-             MIL_TEXT("[SYNOPSIS]\n")
-             MIL_TEXT("This example shows how to use the 3DPIXA camera and its CS-3D API\n")
-             MIL_TEXT("in conjunction with MIL to develop surface inspection applications.\n")
-             MIL_TEXT("The example is able to run without the Chromasens CS3D API by\n")
-             MIL_TEXT("loading from file the expected output images.\n\n")
-             
-             MIL_TEXT("[MODULES USED]\n")
-             MIL_TEXT("Modules used: application, system, display, buffer,\n")
-             MIL_TEXT("graphic, calibration, image processing.\n\n"));
-
-   MosPrintf(MIL_TEXT("Press <Enter> to continue.\n\n"));
-   MosGetch();
-   }
-
-//*****************************************************************************
-// Camera source parameters.
-// 
-// The required Matrox board-specific DCF files for the Chromasens 3DPIXA camera 
-// are available from the Interfacing Cameras section under the Support section of
-// www.matrox.com/imaging 
-//
-//*****************************************************************************
-
-static MIL_CONST_TEXT_PTR SOLIOS_DCF_PATH = M_NULL;
-static MIL_CONST_TEXT_PTR RADIENT_DCF_PATH = M_NULL;
-
-static MIL_CONST_TEXT_PTR COMPACT_STANDALONE_IMAGE_PATH         = M_IMAGE_PATH MIL_TEXT("Chromasens_3DPIXA_M10PP3\\Compact.avi");
-static MIL_CONST_TEXT_PTR COMPACT_STANDALONE_OUTPUT_IMAGE_PATH  = M_IMAGE_PATH MIL_TEXT("Chromasens_3DPIXA_M10PP3\\CompactOutput");
-static MIL_CONST_TEXT_PTR COMPACT_DATA_FORMAT[3]         = {COMPACT_STANDALONE_IMAGE_PATH, SOLIOS_DCF_PATH, RADIENT_DCF_PATH};
-
-static char*              COMPACT_CONFIG_FILE       = "CompactConfig.ini";
-
-static MIL_CONST_TEXT_PTR SYSTEM_DESCRIPTOR[3] = {M_SYSTEM_HOST, M_SYSTEM_SOLIOS, M_SYSTEM_RADIENT};
-static const MIL_INT SYSTEM_TO_USE = 0;
-
-//*****************************************************************************
-// Useful struct.
-//*****************************************************************************
-struct SGrabStruct
-   {
-   MIL_ID MilDisplay;
-   MIL_ID MilDigitizer;
-   MIL_ID MilGrabImage;
-   };
-
-//*****************************************************************************
-// Example prototypes.
-//*****************************************************************************
-void ParticleBoardInspectionExample(MIL_ID MilSystem, MIL_ID MilDisplay, MIL_ID MilDigitizer, MIL_ID MilGrabImage, I3DApi* p3DApi, config3DApi *pConfig);
-void SandPaperInspectionExample(MIL_ID MilSystem, MIL_ID MilDisplay, MIL_ID MilDigitizer, MIL_ID MilGrabImage, I3DApi* p3DApi, config3DApi *pConfig);
-
-//*****************************************************************************
-// General function prototypes.
-//*****************************************************************************
-// 3D API functions.
-bool AccessDll(HINSTANCE* phDll, I3DApi** pp3DApi, config3DApi **ppConfig, MIL_CONST_TEXT_PTR DllName, char* FactoryProcName, char* ConfigFile);
-void FreeDll(HINSTANCE* phDll, I3DApi** pp3DApi);
-bool Initialize3DApi(I3DApi* p3DApi,
-                     config3DApi *pConfig,
-                     MIL_ID MilSystem,
-                     MIL_ID* pMilSrcImages,
-                     MIL_INT NbSrcImage,
-                     MIL_ID* pMilDisparityImage,
-                     MIL_ID* pMilRectifiedImage,
-                     MIL_INT* pWorkSizeX,
-                     MIL_INT* pWorkSizeY);
-
-// Depth map processing functions.
-void FillHolesAndSmooth(MIL_ID MilDisplay, MIL_ID MilDepthMap, MIL_ID MilFilledHolesDepthMap, MIL_INT FilterSize);
-void CorrectHorizontalCurve(MIL_ID MilDepthMap, MIL_INT ChildOffsetY, MIL_INT ChildSizeY);
-
-// Utility functions.
-void GrabImage(I3DApi* p3DApi,
-               MIL_ID* pMilDisplays,
-               MIL_ID* pMilDigitizers,
-               MIL_ID* pMilGrabImages,
-               MIL_INT NbCamera);
-
-void Calculate3D(I3DApi* p3DApi,
-                 MIL_ID* pMilDisplays,
-                 MIL_ID* pMilSrcImages,
-                 MIL_INT NbSrcImage,
-                 MIL_ID MilDisparityImage,
-                 MIL_ID MilrectifiedImage,
-                 MIL_ID MilCorrectedWorkDepthMap,
-                 MIL_ID MilCorrectedWorkColorMap);
-MIL_INT GenAverageCircleKernel(MIL_ID MilAverageKernel);
-MIL_DOUBLE CalibrateDepthMap(MIL_ID MilDepthMap, I3DApi* p3DApi, config3DApi *pConfig, MIL_DOUBLE XYMultFactor, MIL_DOUBLE ZMultFactor);
-void ShowImage(MIL_ID MilDisplay, MIL_ID MilImage, bool Autoscale);
-MIL_UINT32 MFTYPE StartScan(void *UserDataPtr);
-
-bool CheckForRequiredMILFile(MIL_CONST_TEXT_PTR  FileName);
-
-//*****************************************************************************
-// Useful defines.
-//*****************************************************************************
-static const MIL_INT BORDER_SIZE_X = 64;
-static const MIL_DOUBLE DISPLAY_ZOOM_FACTOR = 0.125;
-static const MIL_INT WINDOWS_OFFSET_X = 15;
-
-//*****************************************************************************
-// Main.
-//*****************************************************************************
-int MosMain(void)
-   {
-   // Allocate the MIL objects.
-   MIL_ID MilApplication = MappAlloc(M_NULL, M_DEFAULT, M_NULL);
-   MIL_ID MilSystem      = MsysAlloc(M_DEFAULT, SYSTEM_DESCRIPTOR[SYSTEM_TO_USE], M_DEFAULT, M_DEFAULT, M_NULL);  
-   MIL_ID pMilDisplay[2];
-   MdispAlloc(MilSystem, M_DEFAULT, MIL_TEXT("M_DEFAULT"), M_WINDOWED, &pMilDisplay[0]);
-   MdispAlloc(MilSystem, M_DEFAULT, MIL_TEXT("M_DEFAULT"), M_WINDOWED, &pMilDisplay[1]);
-   MdispZoom(pMilDisplay[0], DISPLAY_ZOOM_FACTOR, DISPLAY_ZOOM_FACTOR);
-   MdispZoom(pMilDisplay[1], DISPLAY_ZOOM_FACTOR, DISPLAY_ZOOM_FACTOR);
-
-   // Print Header.
-   PrintHeader();
-
-   // If the DCF file hasn't been specified.
-   if(SYSTEM_TO_USE != 0 && COMPACT_DATA_FORMAT[SYSTEM_TO_USE] == NULL)
-      {
-      MosPrintf(MIL_TEXT("Please set a valid DCF path to run the example with a digitizer.\n")
-                MIL_TEXT("The required Matrox board-specific DCF files for the Chromasens 3DPIXA\n") 
-                MIL_TEXT("are available from the Interfacing Cameras section under the\n") 
-                MIL_TEXT("Support section of www.matrox.com/imaging\n\n")
-                MIL_TEXT("Press <Enter> to end.\n\n"));
-      MosGetch();
-      }
-   else
-      {
-      // Check if the footage is available when using emulated grab on host system.
-      if(SYSTEM_TO_USE != 0 || CheckForRequiredMILFile(COMPACT_DATA_FORMAT[SYSTEM_TO_USE]))
-         {
-         // Allocate the digitizer and image for the compact Chromasens camera.
-         MIL_ID pMilDigitizer[2];
-         MdigAlloc(MilSystem, M_DEFAULT, COMPACT_DATA_FORMAT[SYSTEM_TO_USE], M_DEFAULT, &pMilDigitizer[0]);
-         MIL_INT GrabImageSizeX = MdigInquire(pMilDigitizer[0], M_SIZE_X, M_NULL);
-         MIL_INT GrabImageSizeY = MdigInquire(pMilDigitizer[0], M_SIZE_Y, M_NULL);
-         MIL_ID pMilGrabImage[2];
-         MbufAllocColor(MilSystem, 3, GrabImageSizeX, GrabImageSizeY, 8+M_UNSIGNED, M_IMAGE + M_PROC + M_DISP + M_BGR32 + M_GRAB, &pMilGrabImage[0]);
-
-         // Get the path to the config file.
-         char CompactConfigFilePath[MAX_PATH];
-         char* MilPath;
-         size_t Len;
-         _dupenv_s(&MilPath, &Len, "MIL_PATH");
-         sprintf_s(CompactConfigFilePath, MAX_PATH, "%s\\..\\..\\Images\\Chromasens_3DPIXA_M10PP3\\%s", MilPath, COMPACT_CONFIG_FILE);
-         free(MilPath);
-
-         // Allocate Chromasens 3DAPI for the compact Chromasens camera.
-         HINSTANCE hDll;
-         I3DApi* p3DApi = NULL;
-         config3DApi *pConfig = NULL;
-
-         if(AccessDll(&hDll, &p3DApi, &pConfig, MIL_TEXT("CS3DApi64.dll"), "CS3DApiCreate", CompactConfigFilePath))
-            {
-            // Set the image height according to the digitizer.
-            pConfig->imgHeight = (int)GrabImageSizeY;
-            pConfig->oriImgHeight = (int)GrabImageSizeY;
-
-            // Run the particle board example
-            ParticleBoardInspectionExample(MilSystem, pMilDisplay[0], pMilDigitizer[0], pMilGrabImage[0], p3DApi, pConfig);
-
-            // Run the sand paper example.
-            SandPaperInspectionExample(MilSystem, pMilDisplay[0], pMilDigitizer[0], pMilGrabImage[0], p3DApi, pConfig);
-            }
-
-         // Free the Chromasens 3dAPI.
-         FreeDll(&hDll, &p3DApi);
-
-         // Free the grab image.
-         MbufFree(pMilGrabImage[0]);
-
-         // Free the digitizers.
-         MdigFree(pMilDigitizer[0]);
-         }
-      }
-
-   // Free MIL objects.
-   MdispFree(pMilDisplay[0]);
-   MdispFree(pMilDisplay[1]);
-   MsysFree(MilSystem);
-   MappFree(MilApplication);
-   }
-
-//*****************************************************************************
-// Particle board inspection example parameters.
-//*****************************************************************************
-static const MIL_INT D3D_DISPLAY_SIZE_X = 640;
-static const MIL_INT D3D_DISPLAY_SIZE_Y = 480;
-static const MIL_DOUBLE D3D_DISPLAY_SUBSAMPLING = 0.25;
-
-static const MIL_DOUBLE PLANE_OUTLIER_DISTANCE_RANGE_FACTOR = 0.1;
-
-static const MIL_INT HORIZONTAL_CURVE_CORRECTION_CHILD_OFFSET_Y = 0;
-static const MIL_INT HORIZONTAL_CURVE_CORRECTION_CHILD_SIZE_Y = 1000;
-
-static const MIL_DOUBLE DEFECT_THRESHOLD_HIGH = 0.096; // in mm
-static const MIL_DOUBLE DEFECT_THRESHOLD_LOW = 0.048; // in mm
-
-static const MIL_INT PARTICLEBOARD_KERNEL_SIZE = 51;
-
-static const MIL_DOUBLE PARTICLEBOARD_Z_MULT_FACTOR = 8.333333;
-//*****************************************************************************
-// ParticleBoardInspectionExample.  
-//*****************************************************************************
-void ParticleBoardInspectionExample(MIL_ID MilSystem, MIL_ID MilDisplay, MIL_ID MilDigitizer, MIL_ID MilGrabImage, I3DApi* p3DApi, config3DApi *pConfig)
-   {
-   MosPrintf(MIL_TEXT("[PARTICLE BOARD FLATNESS INSPECTION]\n\n")
-             MIL_TEXT("In this example, a textured particle board is scanned to generate a depth map.\n")
-             MIL_TEXT("The depth map is analyzed to detect depressions on the surface of the \n")
-             MIL_TEXT("particle board.\n\n")
-             MIL_TEXT("Press <Enter> to start.\n\n"));
-   MosGetch();
-
-   // Set the configuration parameters of Chromasens 3D API.
-
-   MIL_ID MilDisparityImage;
-   MIL_ID MilRectifiedImage;
-   MIL_INT WorkSizeX;
-   MIL_INT WorkSizeY;
-   if(Initialize3DApi(p3DApi, pConfig, MilSystem, &MilGrabImage, 1, &MilDisparityImage, &MilRectifiedImage, &WorkSizeX, &WorkSizeY))
-      {
-      // Allocate the work images.
-      MIL_ID MilCorrectedDepthMap  = MbufAlloc2d(MilSystem, WorkSizeX, WorkSizeY, 16+M_UNSIGNED, M_IMAGE + M_PROC + M_DISP, M_NULL);
-      MIL_ID MilCorrectedWorkDepthMap  = MbufAlloc2d(MilSystem, WorkSizeX, WorkSizeY, 16+M_UNSIGNED, M_IMAGE + M_PROC + M_DISP, M_NULL);
-      MIL_ID MilCorrectedWorkColorMap  = MbufAllocColor(MilSystem, 3, WorkSizeX, WorkSizeY, 8+M_UNSIGNED, M_IMAGE + M_PROC + M_DISP, M_NULL);
-      MIL_ID MilDefectImage        = MbufAlloc2d(MilSystem, WorkSizeX, WorkSizeY, 8+M_UNSIGNED, M_IMAGE + M_PROC + M_DISP, M_NULL);
-      MIL_ID MilPseudoColoredMap   = MbufAllocColor(MilSystem, 3, WorkSizeX, WorkSizeY, 8+M_UNSIGNED, M_IMAGE + M_PROC + M_DISP, M_NULL);
-
-      // Allocate the images for the 3D display.
-      MIL_INT Display3DSizeX = (MIL_INT)(WorkSizeX * D3D_DISPLAY_SUBSAMPLING);
-      MIL_INT Display3DSizeY = (MIL_INT)(WorkSizeY * D3D_DISPLAY_SUBSAMPLING);
-      MIL_ID Mil3DDisplayDepthMap  = MbufAlloc2d(MilSystem, Display3DSizeX, Display3DSizeY, 16+M_UNSIGNED, M_IMAGE + M_PROC + M_DISP, M_NULL);
-      MIL_ID Mil3DDisplayColorMap  = MbufAllocColor(MilSystem, 3, Display3DSizeX, Display3DSizeY, 8+M_UNSIGNED, M_IMAGE + M_PROC + M_DISP, M_NULL);
-         
-      // Allocate the jet color LUT.
-      MIL_ID MilColorLut = MbufAllocColor(MilSystem, 3, MIL_UINT16_MAX, 1, 8+M_UNSIGNED, M_LUT, M_NULL);
-         
-      // Allocate the plane geometry.
-      MIL_ID MilPlaneFit = M3dmapAlloc(MilSystem, M_GEOMETRY, M_DEFAULT, M_NULL);
-
-      // Allocate blob objects.
-      MIL_ID MilBlobResult;
-      MIL_ID MilBlobContext;
-
-      MblobAlloc(MilSystem, M_DEFAULT, M_DEFAULT, &MilBlobContext);
-      MblobAllocResult(MilSystem, M_DEFAULT, M_DEFAULT, &MilBlobResult);
-      MblobControl(MilBlobContext, M_MIN_PIXEL, M_ENABLE);
-
-      //Allocate graphics context
-      MIL_ID BlobGraphicsContext;
-
-      MgraAlloc(MilSystem, &BlobGraphicsContext);
-      MgraColor(BlobGraphicsContext, 0);
-
-      // Grab and calculate 3D.
-      GrabImage(p3DApi, &MilDisplay, &MilDigitizer, &MilGrabImage, 1);
-      Calculate3D(p3DApi, &MilDisplay, &MilGrabImage, 1, MilDisparityImage, MilRectifiedImage, MilCorrectedWorkDepthMap, MilCorrectedWorkColorMap);
-         
-      // Fill the holes of the depth map.
-      FillHolesAndSmooth(MilDisplay, MilCorrectedWorkDepthMap, MilCorrectedDepthMap, PARTICLEBOARD_KERNEL_SIZE); 
-         
-      // Calibrate the depth map.
-      MIL_DOUBLE ZRange = CalibrateDepthMap(MilCorrectedDepthMap, p3DApi, pConfig, 1, PARTICLEBOARD_Z_MULT_FACTOR);
-
-      // Calculate a plane on the data. 
-      M3dmapSetGeometry(MilPlaneFit, M_PLANE, M_FIT, (MIL_DOUBLE)MilCorrectedDepthMap, M_NULL, ZRange * PLANE_OUTLIER_DISTANCE_RANGE_FACTOR, M_DEFAULT, M_DEFAULT); 
-
-      // Remove the plane from the depth map.
-      M3dmapArith(MilCorrectedDepthMap, MilPlaneFit, MilCorrectedDepthMap, M_NULL, M_SUB, M_SET_WORLD_OFFSET_Z);
-                       
-      // Show the depth map corrected for the plane error.
-      MosPrintf(MIL_TEXT("A plane, fitted on the data, was subtracted from the depth map.\n")
-                  MIL_TEXT("The depth map now represents the heights relative to the fitted plane.\n\n")
-                  MIL_TEXT("Press <Enter> to continue.\n\n"));
-      ShowImage(MilDisplay, MilCorrectedDepthMap, true); 
-
-      // Correct curve.
-      CorrectHorizontalCurve(MilCorrectedDepthMap, HORIZONTAL_CURVE_CORRECTION_CHILD_OFFSET_Y, HORIZONTAL_CURVE_CORRECTION_CHILD_SIZE_Y);               
-         
-      // Show the depth map where the horizontal curve is corrected.
-      MosPrintf(MIL_TEXT("Remaining horizontal lens distortion was corrected. The curve, obtained\n")
-                  MIL_TEXT("using the average value of each column, was subtracted.\n\n")
-                  MIL_TEXT("Press <Enter> to continue.\n\n"));
-      ShowImage(MilDisplay, MilCorrectedDepthMap, true); 
-
-      // Show the depth map in a 3d display.
-      MIL_DISP_D3D_HANDLE DispHandle;
-      MimResize(MilCorrectedDepthMap, Mil3DDisplayDepthMap, D3D_DISPLAY_SUBSAMPLING, D3D_DISPLAY_SUBSAMPLING, M_AVERAGE);
-      MimResize(MilCorrectedWorkColorMap, Mil3DDisplayColorMap, D3D_DISPLAY_SUBSAMPLING, D3D_DISPLAY_SUBSAMPLING, M_AVERAGE);
-      CalibrateDepthMap(Mil3DDisplayDepthMap, p3DApi, pConfig, 1.0 / D3D_DISPLAY_SUBSAMPLING, PARTICLEBOARD_Z_MULT_FACTOR);
-      DispHandle = MdepthD3DAlloc(Mil3DDisplayDepthMap, Mil3DDisplayColorMap,
-                                    D3D_DISPLAY_SIZE_X,
-                                    D3D_DISPLAY_SIZE_Y,
-                                    M_DEFAULT,
-                                    M_DEFAULT,
-                                    M_DEFAULT,
-                                    M_DEFAULT,
-                                    M_DEFAULT,
-                                    M_DEFAULT,
-                                    0);
-
-      if (DispHandle != NULL)
-         {
-         MdispD3DShow(DispHandle);
-         MdispD3DPrintHelp(DispHandle);
-         }
-         
-      MosPrintf(MIL_TEXT("A 3D display of the particle board surface after rectification is shown.\n")
-                  MIL_TEXT("For display purposes, the surface heights have been magnified by %.2f.\n\n")
-                  MIL_TEXT("Press <Enter> to continue.\n\n"),
-                  PARTICLEBOARD_Z_MULT_FACTOR);
-      MosGetch();
-
-      // Get the gray value at 0 height.
-      MIL_DOUBLE FinalWorldPosZ;
-      MIL_DOUBLE FinalGrayLevelSizeZ;
-      McalInquire(MilCorrectedDepthMap, M_WORLD_POS_Z, &FinalWorldPosZ);
-      McalInquire(MilCorrectedDepthMap, M_GRAY_LEVEL_SIZE_Z, &FinalGrayLevelSizeZ);
-      MIL_DOUBLE DefectThresholdLowGray  = (DEFECT_THRESHOLD_LOW * PARTICLEBOARD_Z_MULT_FACTOR - FinalWorldPosZ) / FinalGrayLevelSizeZ;
-      MIL_DOUBLE DefectThresholdHighGray = (DEFECT_THRESHOLD_HIGH * PARTICLEBOARD_Z_MULT_FACTOR- FinalWorldPosZ) / FinalGrayLevelSizeZ;
-
-      // Get the possible defects.
-      MimBinarize(MilCorrectedDepthMap, MilDefectImage, M_FIXED + M_LESS, DefectThresholdLowGray, M_NULL);
-         
-      // Perform seed recontruction using blob. 
-      MblobCalculate(MilBlobContext, MilDefectImage, MilCorrectedDepthMap, MilBlobResult);
-      MblobSelect(MilBlobResult, M_INCLUDE_ONLY, M_MIN_PIXEL, M_LESS, DefectThresholdHighGray, M_NULL);
-
-      MIL_INT NbDefects;
-      MblobGetResult(MilBlobResult, M_GENERAL, M_NUMBER + M_TYPE_MIL_INT, &NbDefects);
-      if(NbDefects>0)
-         {
-         MblobDraw(BlobGraphicsContext, MilBlobResult, MilDefectImage, M_DRAW_BLOBS, M_EXCLUDED_BLOBS, M_DEFAULT);
-            
-         // Color the defect blob with a color lut in the color map.
-         MIL_ID MilColorLutChild = MbufChild1d(MilColorLut, (MIL_INT)DefectThresholdHighGray, (MIL_INT)DefectThresholdLowGray - (MIL_INT)DefectThresholdHighGray + 1, M_NULL);
-         MbufClear(MilColorLut, M_RGB888(0,0,128));
-         MgenLutFunction(MilColorLutChild, M_COLORMAP_JET, M_DEFAULT, M_DEFAULT, M_DEFAULT, M_DEFAULT, M_DEFAULT, M_DEFAULT);
-         MimLutMap(MilCorrectedDepthMap, MilPseudoColoredMap, MilColorLut);
-         MbufCopyCond(MilPseudoColoredMap, MilCorrectedWorkColorMap, MilDefectImage, M_EQUAL, 255);  
-         MbufFree(MilColorLutChild);
-         }
-         
-      // Show the defect in overlay of the displayed depth image.
-      MIL_ID MilOverlay = MdispInquire(MilDisplay, M_OVERLAY_ID, M_NULL);
-      MbufCopyCond(MilPseudoColoredMap, MilOverlay, MilDefectImage, M_EQUAL, 255);
-
-      // Show the defect in the 3D display.
-      if (DispHandle != NULL)
-         {
-         MimResize(MilCorrectedWorkColorMap, Mil3DDisplayColorMap, D3D_DISPLAY_SUBSAMPLING, D3D_DISPLAY_SUBSAMPLING, M_AVERAGE);
-         MdepthD3DSetImages(DispHandle, Mil3DDisplayDepthMap, Mil3DDisplayColorMap);
-         }
-      MosPrintf(MIL_TEXT("The defects were extracted using an hysteresis threshold defined in world\n")
-                  MIL_TEXT("units. A first low height threshold(set to %.2f um) identifies groups of\n")
-                  MIL_TEXT("pixels that could be defects. To be considered defects, the group of \n")
-                  MIL_TEXT("pixels must have a least one height value greater than a second higher\n")
-                  MIL_TEXT("threshold (set to %.2f um).\n\n")
-                  MIL_TEXT("Press <Enter> to continue.\n\n"),
-                  DEFECT_THRESHOLD_LOW * 1000,
-                  DEFECT_THRESHOLD_HIGH* 1000);
-      ShowImage(MilDisplay, MilCorrectedDepthMap, true);  
-
-      // Clear the overlay and deselect the image.
-      MdispControl(MilDisplay, M_OVERLAY_CLEAR, M_DEFAULT);
-         
-      // Stop the calculation.
-      p3DApi->stopBlocking();
-
-      // Free the 3D display.
-      if(DispHandle)
-         MdispD3DFree(DispHandle);
-
-      // Free the plane.
-      M3dmapFree(MilPlaneFit);
-
-      // Free blob.
-      MblobFree(MilBlobContext);
-      MblobFree(MilBlobResult);
-
-      // Free the color lut.
-      MbufFree(MilColorLut);
-
-      // Free the work images.
-      MbufFree(Mil3DDisplayColorMap);
-      MbufFree(Mil3DDisplayDepthMap);
-      MbufFree(MilPseudoColoredMap);
-      MbufFree(MilDefectImage);
-      MbufFree(MilCorrectedWorkColorMap);
-      MbufFree(MilCorrectedWorkDepthMap);
-      MbufFree(MilCorrectedDepthMap);
-
-      //Free graphics context
-      MgraFree(BlobGraphicsContext);
-         
-      // Free output images.
-      if(MilRectifiedImage)
-         MbufFree(MilRectifiedImage);
-      MbufFree(MilDisparityImage);
-      }
-   }
-
-//*****************************************************************************
-// Sand paper inspection example parameters.
-//*****************************************************************************
-static const int           SAND_PAPER_3DAPI_DSTART       = -20;
-static const int           SAND_PAPER_3DAPI_DEND         = 10;
-static const int           SAND_PAPER_3DAPI_WINDOW_TYPE  = 0; // 27x27
-static const double        SAND_PAPER_3DAPI_MIN_STD_DEV  = 0.5; 
-static const int           SAND_PAPER_3DAPI_MIN_GRAY     = 10;
-static const MIL_DOUBLE    SAND_PAPER_3DAPI_MIN_KKF      = 0.5;
-
-static const MIL_INT    RESIZE_DOWN_NEIGHBORHOOD = 10;
-static const MIL_DOUBLE RESIZE_DOWN_FACTOR       = 1.0/RESIZE_DOWN_NEIGHBORHOOD; 
-
-static const MIL_INT LOCAL_DENSITY_KERNEL_SIZE = 45;
-
-static const MIL_DOUBLE MIN_PEAK_HEIGHT = 0.25; // in mm
-
-static const MIL_INT SAND_PAPER_KERNEL_SIZE = 51;
-
-static const MIL_DOUBLE SAND_PAPER_Z_MULT_FACTOR = 4;
-//*****************************************************************************
-// SandPaperInspectionExample.  
-//*****************************************************************************
-void SandPaperInspectionExample(MIL_ID MilSystem, MIL_ID MilDisplay, MIL_ID MilDigitizer, MIL_ID MilGrabImage, I3DApi* p3DApi, config3DApi *pConfig)
-   {
-   MosPrintf(MIL_TEXT("[SAND PAPER DENSITY INSPECTION]\n\n")
-             MIL_TEXT("In this example, a piece of sand paper is scanned to generate a depth map.\n")
-             MIL_TEXT("The depth map is analyzed to generate a local density map of the peaks.\n\n")
-             MIL_TEXT("Press <Enter> to start.\n\n"));
-   MosGetch();
-
-   // Allocate the graphic list.
-   MIL_ID MilGraList = MgraAllocList(MilSystem, M_DEFAULT, M_NULL);
-
-   // Set the configuration parameters of Chromasens 3D API.
-   pConfig->dStart = SAND_PAPER_3DAPI_DSTART;
-   pConfig->dEnd   = SAND_PAPER_3DAPI_DEND;
-   pConfig->windowType = SAND_PAPER_3DAPI_WINDOW_TYPE;
-   pConfig->minStdDevA = SAND_PAPER_3DAPI_MIN_STD_DEV;
-   pConfig->mingw = SAND_PAPER_3DAPI_MIN_GRAY;
-   pConfig->minKkf = SAND_PAPER_3DAPI_MIN_KKF;
-
-   MIL_ID MilDisparityImage;
-   MIL_ID MilRectifiedImage;
-   MIL_INT WorkSizeX;
-   MIL_INT WorkSizeY;
-   if(Initialize3DApi(p3DApi, pConfig, MilSystem, &MilGrabImage, 1, &MilDisparityImage, &MilRectifiedImage, &WorkSizeX, &WorkSizeY))
-      {
-      // Calculate the subsampled image size.
-      MIL_INT SubsampledSizeX = (MIL_INT)(WorkSizeX * RESIZE_DOWN_FACTOR);
-      MIL_INT SubsampledSizeY = (MIL_INT)(WorkSizeY * RESIZE_DOWN_FACTOR);
-
-      // Allocate the work images.
-      MIL_ID MilCorrectedDepthMap  = MbufAlloc2d(MilSystem, WorkSizeX, WorkSizeY, 16+M_UNSIGNED, M_IMAGE + M_PROC + M_DISP, M_NULL);
-      MIL_ID MilCorrectedWorkDepthMap  = MbufAlloc2d(MilSystem, WorkSizeX, WorkSizeY, 16+M_UNSIGNED, M_IMAGE + M_PROC + M_DISP, M_NULL);
-      MIL_ID MilCorrectedWorkColorMap  = MbufAllocColor(MilSystem, 3, WorkSizeX, WorkSizeY, 8+M_UNSIGNED, M_IMAGE + M_PROC + M_DISP, M_NULL);
-      MIL_ID MilSubsampledDepthMap = MbufAlloc2d(MilSystem, SubsampledSizeX, SubsampledSizeY, 16+M_UNSIGNED, M_IMAGE + M_PROC + M_DISP, M_NULL); 
-      MIL_ID MilPeakImage = MbufAlloc2d(MilSystem, SubsampledSizeX, SubsampledSizeY, 8+M_UNSIGNED, M_IMAGE + M_PROC + M_DISP, M_NULL);
-      MIL_ID MilZoneOfInfluenceImage = MbufAlloc2d(MilSystem, SubsampledSizeX, SubsampledSizeY, 16+M_UNSIGNED, M_IMAGE + M_PROC + M_DISP, M_NULL);
-
-      // Allocate the images for the 3D display.
-      MIL_INT Display3DSizeX = (MIL_INT)(WorkSizeX * D3D_DISPLAY_SUBSAMPLING);
-      MIL_INT Display3DSizeY = (MIL_INT)(WorkSizeY * D3D_DISPLAY_SUBSAMPLING);
-      MIL_ID Mil3DDisplayDepthMap  = MbufAlloc2d(MilSystem, Display3DSizeX, Display3DSizeY, 16+M_UNSIGNED, M_IMAGE + M_PROC + M_DISP, M_NULL);
-      MIL_ID Mil3DDisplayColorMap  = MbufAllocColor(MilSystem, 3, Display3DSizeX, Display3DSizeY, 8+M_UNSIGNED, M_IMAGE + M_PROC + M_DISP, M_NULL);
-
-      // Allocate the image to compute the local density.
-      MIL_DOUBLE LocalPixelSize = pConfig->resolutionX / (RESIZE_DOWN_FACTOR);
-      MIL_DOUBLE KernelSizeInMm = LocalPixelSize * LOCAL_DENSITY_KERNEL_SIZE;
-      MIL_DOUBLE KernelSizeInMmSquare = KernelSizeInMm * KernelSizeInMm;
-      MIL_DOUBLE KernelSizeInPixelSquare = LOCAL_DENSITY_KERNEL_SIZE * LOCAL_DENSITY_KERNEL_SIZE;
-      MIL_ID MilLocalDensityImage = MbufAlloc2d(MilSystem, SubsampledSizeX, SubsampledSizeY, 8+M_UNSIGNED, M_IMAGE+M_PROC, M_NULL);
-      MIL_ID MilLocalDensityFullSizeImage = MbufAlloc2d(MilSystem, WorkSizeX, WorkSizeY, 8+M_UNSIGNED, M_IMAGE+M_PROC+M_DISP, M_NULL);
-         
-      // Allocate the average kernel.
-      MIL_ID MilAverageKernel = MbufAlloc2d(MilSystem, LOCAL_DENSITY_KERNEL_SIZE, LOCAL_DENSITY_KERNEL_SIZE, 8+M_UNSIGNED, M_KERNEL, M_NULL);
-      MIL_INT KernelArea = GenAverageCircleKernel(MilAverageKernel);
-      MIL_DOUBLE CircleKernelSizeInMmSquare = ((MIL_DOUBLE)KernelArea/KernelSizeInPixelSquare) * KernelSizeInMmSquare;
-         
-      // Allocate the peak list.
-      MIL_INT MaxNbEvents = SubsampledSizeX * SubsampledSizeY / 9;
-      MIL_ID MilPeakList = MimAllocResult(MilSystem, MaxNbEvents, M_EVENT_LIST, M_NULL);
-
-      // Allocate the stat context.
-      MIL_ID MilStatContext = MimAlloc(MilSystem, M_STATISTICS_CONTEXT, M_DEFAULT, M_NULL);
-
-      // Enable statistics to use.
-      MimControl(MilStatContext, M_STAT_MAX, M_ENABLE);
-
-      // Allocate the stat result.
-      MIL_ID MilStatResult = MimAllocResult(MilSystem, M_DEFAULT, M_STATISTICS_RESULT, M_NULL);
-
-      // Allocate blob objects.
-      MIL_ID MilBlobResult;
-      MIL_ID MilBlobContext;
-
-      MblobAlloc(MilSystem, M_DEFAULT, M_DEFAULT, &MilBlobContext);
-      MblobAllocResult(MilSystem, M_DEFAULT, M_DEFAULT, &MilBlobResult);
-      MblobControl(MilBlobContext, M_BLOB_IDENTIFICATION_MODE, M_LABELED_TOUCHING);
-      MblobControl(MilBlobContext, M_MIN_PIXEL, M_ENABLE);
-      MblobControl(MilBlobContext, M_MAX_PIXEL, M_ENABLE);
-
-      // Grab and calculate 3D.
-      GrabImage(p3DApi, &MilDisplay, &MilDigitizer, &MilGrabImage, 1);
-      Calculate3D(p3DApi, &MilDisplay, &MilGrabImage, 1, MilDisparityImage, MilRectifiedImage, MilCorrectedWorkDepthMap, MilCorrectedWorkColorMap);         
-
-      // Fill the holes of the depth map.
-      FillHolesAndSmooth(MilDisplay, MilCorrectedWorkDepthMap, MilCorrectedDepthMap, SAND_PAPER_KERNEL_SIZE); 
-         
-      // Calibrate the depth map.
-      CalibrateDepthMap(MilCorrectedDepthMap, p3DApi, pConfig, 1, SAND_PAPER_Z_MULT_FACTOR);
-         
-      // Subsample the depth map.
-      MimResize(MilCorrectedDepthMap, MilSubsampledDepthMap, RESIZE_DOWN_FACTOR, RESIZE_DOWN_FACTOR, M_AVERAGE);
-
-      // Locate the possible peaks.
-      MimLocateEvent(MilSubsampledDepthMap, MilPeakList,  M_ALL+M_LOCAL_MAX_STRICT_MEDIUM, M_NULL, M_NULL);
-      MIL_INT NbEvent;
-      MimGetResult(MilPeakList, M_NB_EVENT + M_TYPE_MIL_INT, &NbEvent);
-      MIL_INT* pCoordX = new MIL_INT[MaxNbEvents];
-      MIL_INT* pCoordY = new MIL_INT[MaxNbEvents];
-      MimGetResult(MilPeakList, M_POSITION_X + M_TYPE_MIL_INT, pCoordX);
-      MimGetResult(MilPeakList, M_POSITION_Y + M_TYPE_MIL_INT, pCoordY);
-
-      // Create a peak image an get their zone of influence.
-      MgraColor(M_DEFAULT, 255);
-      MbufClear(MilPeakImage, 0);
-      MgraDots(M_DEFAULT, MilPeakImage, NbEvent, pCoordX, pCoordY, M_DEFAULT);
-      MimZoneOfInfluence(MilPeakImage, MilZoneOfInfluenceImage, M_CHAMFER_3_4);
-
-      // Filter the peaks based on their contrast.
-      MIL_INT* pValidCoordX = new MIL_INT[NbEvent];
-      MIL_INT* pValidCoordY = new MIL_INT[NbEvent];
-      MIL_INT NbBlobs = 0;
-      MIL_INT NbValidPeak = 0;
-
-      MblobCalculate(MilBlobContext, MilZoneOfInfluenceImage, MilSubsampledDepthMap, MilBlobResult);
-      MblobGetResult(MilBlobResult, M_GENERAL, M_NUMBER + M_TYPE_MIL_INT, &NbBlobs);
-
-      // NbBlobs should be equal to NbEvents.
-      if(NbBlobs == NbEvent)
-         {
-         // Get the minimum value in the zone of influence.
-         MIL_INT* pMinValue = new MIL_INT[NbBlobs];
-         MblobGetResult(MilBlobResult, M_DEFAULT, M_MIN_PIXEL + M_TYPE_MIL_INT, pMinValue);
-            
-         // Get the data pointer and the pitch of the subsampled and zone of influence image to access values directly.
-         MIL_UINT16* pZoneOfInfluenceData = (MIL_UINT16*)MbufInquire(MilZoneOfInfluenceImage, M_HOST_ADDRESS, M_NULL);
-         MIL_INT ZonePitch = MbufInquire(MilZoneOfInfluenceImage, M_PITCH, M_NULL);
-         MIL_UINT16* pSubsampledImageData = (MIL_UINT16*)MbufInquire(MilSubsampledDepthMap, M_HOST_ADDRESS, M_NULL);
-         MIL_INT SubsampledPitch = MbufInquire(MilSubsampledDepthMap, M_PITCH, M_NULL);
-            
-         for(MIL_INT PeakIdx = 0; PeakIdx < NbEvent; PeakIdx++)
-            {
-            // Get the gray value at the peak.
-            MIL_INT PeakValue = pSubsampledImageData[pCoordX[PeakIdx] + SubsampledPitch*pCoordY[PeakIdx]];
-               
-            // Get the minimum value in the zone of influence associated to the peak.
-            MIL_INT PeakLabel = pZoneOfInfluenceData[pCoordX[PeakIdx] + ZonePitch*pCoordY[PeakIdx]];
-
-            // Calculate the height associated to the gray value contrast.
-            MIL_INT PeakContrast =  PeakValue - pMinValue[PeakLabel-1];
-            float MinZ;
-            p3DApi->grayToMm(MinZ, (unsigned short)1);
-            float PeakHeight;
-            p3DApi->grayToMm(PeakHeight, (unsigned short)PeakContrast);
-            PeakHeight = MinZ - PeakHeight;
-               
-            // If the peak height is above the threshold, keep the peak.
-            if(PeakHeight >= MIN_PEAK_HEIGHT)
-               {
-               pValidCoordX[NbValidPeak] = pCoordX[PeakIdx];
-               pValidCoordY[NbValidPeak] = pCoordY[PeakIdx];
-               NbValidPeak++;
-               }
-            }
-         delete [] pMinValue;
-             
-         // Draw the valid peaks over the original image.
-         MgraColor(M_DEFAULT, M_COLOR_GREEN);   
-         for(MIL_INT PeakIdx = 0; PeakIdx < NbValidPeak; PeakIdx++)
-            MgraArcFill(M_DEFAULT, MilGraList, pValidCoordX[PeakIdx], pValidCoordY[PeakIdx], 0.5, 0.5, 0, 360);
-         MgraControlList(MilGraList, M_ALL, M_DEFAULT, M_DRAW_ZOOM_X, RESIZE_DOWN_NEIGHBORHOOD);
-         MgraControlList(MilGraList, M_ALL, M_DEFAULT, M_DRAW_ZOOM_Y, RESIZE_DOWN_NEIGHBORHOOD);
-            
-         // Draw the peaks in the rectified color image.
-         MgraDraw(MilGraList, MilCorrectedWorkColorMap, M_DEFAULT);
-         
-         // Associate the graphic list to the display.
-         MdispControl(MilDisplay, M_ASSOCIATED_GRAPHIC_LIST_ID, MilGraList);
-
-         // Show the depth map in a 3D display.
-         MIL_DISP_D3D_HANDLE DispHandle;
-         MimResize(MilCorrectedDepthMap, Mil3DDisplayDepthMap, D3D_DISPLAY_SUBSAMPLING, D3D_DISPLAY_SUBSAMPLING, M_AVERAGE);
-         MimResize(MilCorrectedWorkColorMap, Mil3DDisplayColorMap, D3D_DISPLAY_SUBSAMPLING, D3D_DISPLAY_SUBSAMPLING, M_AVERAGE);
-         CalibrateDepthMap(Mil3DDisplayDepthMap, p3DApi, pConfig, 1.0 / D3D_DISPLAY_SUBSAMPLING, SAND_PAPER_Z_MULT_FACTOR);
-         DispHandle = MdepthD3DAlloc(Mil3DDisplayDepthMap, Mil3DDisplayColorMap,
-                                       D3D_DISPLAY_SIZE_X,
-                                       D3D_DISPLAY_SIZE_Y,
-                                       M_DEFAULT,
-                                       M_DEFAULT,
-                                       M_DEFAULT,
-                                       M_DEFAULT,
-                                       M_DEFAULT,
-                                       M_DEFAULT,
-                                       0);
-
-         if (DispHandle != NULL)
-            {
-            MdispD3DShow(DispHandle);
-            MdispD3DPrintHelp(DispHandle);
-            }
-            
-         MosPrintf(MIL_TEXT("A 3D display of the sand paper is shown.\n")
-                     MIL_TEXT("For display purposes, the surface heights have been magnified by %.2f.\n")
-                     MIL_TEXT("The peaks have been detected and are identified in green.\n\n")
-                     MIL_TEXT("Press <Enter> to continue.\n\n"),
-                     SAND_PAPER_Z_MULT_FACTOR);
-         ShowImage(MilDisplay, MilCorrectedDepthMap, true); 
-            
-         // Calculate the global peak density in peak/cm^2.
-         MIL_DOUBLE GlobalPeakDensity = 100 * (MIL_DOUBLE)NbValidPeak / (WorkSizeX * WorkSizeY* pConfig->resolutionX * pConfig->resolutionX);
-
-         // Generate an image indicating the local peak density per KernelSizeInMmSquare. 
-         MbufClear(MilPeakImage, 0);
-         MgraColor(M_DEFAULT, 1);
-         MgraDots(M_DEFAULT, MilPeakImage, NbValidPeak, pValidCoordX, pValidCoordY, M_DEFAULT);
-         MimConvolve(MilPeakImage, MilLocalDensityImage, MilAverageKernel);
-            
-         // Put the density per cm^2.
-         MimArith(MilLocalDensityImage, 100.0/CircleKernelSizeInMmSquare, MilLocalDensityImage, M_MULT_CONST+M_FLOAT_PROC+M_SATURATION);
-
-         // Increase contrast.
-         MIL_DOUBLE MaxDensity;
-         MimStatCalculate(MilStatContext, MilLocalDensityImage, MilStatResult, M_DEFAULT);
-
-         MimGetResult(MilStatResult, M_STAT_MAX, &MaxDensity);
-         MimArith(MilLocalDensityImage, 255.0/MaxDensity, MilLocalDensityImage, M_MULT_CONST + M_SATURATION + M_FLOAT_PROC);
-
-         // Resize to fit in the full image.
-         MimResize(MilLocalDensityImage, MilLocalDensityFullSizeImage, (MIL_DOUBLE)RESIZE_DOWN_NEIGHBORHOOD, (MIL_DOUBLE)RESIZE_DOWN_NEIGHBORHOOD, M_INTERPOLATE);
-            
-         // Show the peak density. 
-         if (DispHandle != NULL)
-            {
-            MimResize(MilLocalDensityFullSizeImage, Mil3DDisplayColorMap, D3D_DISPLAY_SUBSAMPLING, D3D_DISPLAY_SUBSAMPLING, M_AVERAGE);
-            MdepthD3DSetImages(DispHandle, Mil3DDisplayDepthMap, Mil3DDisplayColorMap);
-            }
-         MosPrintf(MIL_TEXT("The 3D display now shows the local density of peaks.\n")
-                     MIL_TEXT("The global average density is %.2f peaks/cm^2.\n")
-                     MIL_TEXT("The maximum local density (in white) is %.2f peak/cm^2.\n\n")
-                     MIL_TEXT("Press <Enter> to continue.\n\n"),
-                     GlobalPeakDensity,
-                     MaxDensity);
-         ShowImage(MilDisplay, MilLocalDensityFullSizeImage, false);
-
-         // Free the 3D display.
-         if(DispHandle)
-            MdispD3DFree(DispHandle);
-         }
-      else
-         MosPrintf(MIL_TEXT("The number of possible peaks should be equal to nb of zone of influence.\n\n"));
-         
-      // Free the allocated arrays.
-      delete [] pValidCoordY;
-      delete [] pValidCoordX;
-      delete [] pCoordY;
-      delete [] pCoordX;
-
-      // Stop the calculation.
-      p3DApi->stopBlocking();
-
-      // Free blob.
-      MblobFree(MilBlobContext);
-      MblobFree(MilBlobResult);
-
-      // Free the average kernel.
-      MbufFree(MilAverageKernel);
-         
-      // Free the stat list
-      MimFree(MilStatResult);
-
-      // Free the stat context.
-      MimFree(MilStatContext);
-
-      // Free the peak list.
-      MimFree(MilPeakList);
-
-      // Free the work images.
-      MbufFree(Mil3DDisplayColorMap);
-      MbufFree(Mil3DDisplayDepthMap);
-      MbufFree(MilLocalDensityFullSizeImage);
-      MbufFree(MilLocalDensityImage);
-      MbufFree(MilZoneOfInfluenceImage);
-      MbufFree(MilPeakImage);
-      MbufFree(MilSubsampledDepthMap);
-      MbufFree(MilCorrectedWorkColorMap);
-      MbufFree(MilCorrectedWorkDepthMap);
-      MbufFree(MilCorrectedDepthMap);
-         
-      // Free output images.
-      if(MilRectifiedImage)
-         MbufFree(MilRectifiedImage);
-      MbufFree(MilDisparityImage);
-      }
-
-   // Free the graphic list
-   MgraFree(MilGraList);
-   }
-
-//*****************************************************************************
-// GrabImage. Grabs the image from the 3DPIXA.
-//*****************************************************************************
-void GrabImage(I3DApi* p3DApi, MIL_ID* pMilDisplays, MIL_ID* pMilDigitizers, MIL_ID* pMilGrabImages, MIL_INT NbCamera)
-   {
-   MIL_CONST_TEXT_PTR ImageText = NbCamera == 1 ? MIL_TEXT("An image") : MIL_TEXT("Two images");
-   if(SYSTEM_TO_USE == 0)
-      {
-      MosPrintf(MIL_TEXT("%s, grabbed with the the 3DPIXA camera, will be loaded.\n\n")
-                MIL_TEXT("Press <Enter> to grab.\n\n"),
-                ImageText);
-      }
-   else
-      {
-      MosPrintf(MIL_TEXT("%s will be grabbed with the the 3DPIXA camera.\n\n")
-                MIL_TEXT("Press <Enter> to grab.\n\n"),
-                ImageText);
-      }   
-   MosGetch();
-
-   // Start thread to generate movement of the object and send the trigger to the frame grabber.
-   MIL_ID MilSystem = MdigInquire(pMilDigitizers[0], M_OWNER_SYSTEM, M_NULL);
-   MIL_ID MilStartScanThread = MthrAlloc(MilSystem, M_THREAD, M_DEFAULT, StartScan, M_NULL, M_NULL);
-
-   // Set the second digitizer to be asynchronous and start the grab.
-   if(NbCamera == 2)
-      {
-      if(SYSTEM_TO_USE != 0)
-         MdigControl(pMilDigitizers[1], M_GRAB_MODE, M_ASYNCHRONOUS);
-      MdigGrab(pMilDigitizers[1], pMilGrabImages[1]);
-      }
-   MdigGrab(pMilDigitizers[0], pMilGrabImages[0]);
-
-   // Free the thread.
-   MthrFree(MilStartScanThread);
-
-   // Show the grabbed image.
-   MosPrintf(MIL_TEXT("The displayed image was grabbed with the 3DPIXA camera.\n\n")
-             MIL_TEXT("Press <Enter> to continue.\n\n"));
-   ShowImage(pMilDisplays[0], pMilGrabImages[0], false);
-   if(NbCamera == 2)
-      {
-      MosPrintf(MIL_TEXT("The displayed image was grabbed with the 3DPIXA camera.\n\n")
-                MIL_TEXT("Press <Enter> to continue.\n\n"));
-      ShowImage(pMilDisplays[1], pMilGrabImages[1], false);
-      }
-   }
-
-//*****************************************************************************
-// Calculate3D. Calculates the 3D data with the CS3D API.
-//*****************************************************************************
-void Calculate3D(I3DApi* p3DApi, MIL_ID* pMilDisplays, MIL_ID* pMilSrcImages, MIL_INT NbSrcImage, MIL_ID MilDisparityImage, MIL_ID MilRectifiedImage, MIL_ID MilCorrectedWorkDepthMap, MIL_ID MilCorrectedWorkColorMap)
-      {
-   // Load the source images in the 3D API.
-   for(int SrcIdx = 0; SrcIdx < NbSrcImage; SrcIdx++)
-      {
-      char* pImageData = (char*)MbufInquire(pMilSrcImages[SrcIdx], M_HOST_ADDRESS, M_NULL);
-      MosPrintf(MIL_TEXT("CS3D: Loading the image from grab %i in the CS3D API..."), SrcIdx);
-      if(p3DApi->setSrcImgPtr(SrcIdx, pImageData) < 0)
-         MosPrintf(MIL_TEXT("Image info not acceptable for calculation.\n"));
-      else
-         MosPrintf(MIL_TEXT("Done.\n"));
-      p3DApi->setSrcImgLoaded(SrcIdx);
-      }
-   MosPrintf(MIL_TEXT("\n"));
-
-   // Get the resulting image.
-   MosPrintf(MIL_TEXT("CS3D: Calculating the depth map..."));
-   p3DApi->getNextImgBlocking();
-
-   void* pDisparityData = (void*)MbufInquire(MilDisparityImage, M_HOST_ADDRESS, M_NULL);
-   int DisparityPitchByte = (int)MbufInquire(MilDisparityImage, M_PITCH_BYTE, M_NULL);
-   p3DApi->getLastImage(&pDisparityData, DisparityPitchByte, IMG_OUT_DISP);
-   
-   if(MilRectifiedImage)
-      {
-      void* pRectifiedData = (void*)MbufInquire(MilRectifiedImage, M_HOST_ADDRESS, M_NULL);
-      int RectifiedPitchByte = (int)MbufInquire(MilRectifiedImage, M_PITCH_BYTE, M_NULL);
-      MIL_INT SizeBand = MbufInquire(MilRectifiedImage, M_SIZE_BAND, M_NULL);
-      p3DApi->getLastImage(&pRectifiedData, (int)RectifiedPitchByte, SizeBand == 1 ? IMG_OUT_GRAY : IMG_OUT_BGRA);
-      }
-   MosPrintf(MIL_TEXT("Done\n\n"));
-
-   // Get only the workable area of the disparity map.
-   MIL_INT WorkSizeX = MbufInquire(MilCorrectedWorkDepthMap, M_SIZE_X, M_NULL);
-   MIL_INT WorkSizeY = MbufInquire(MilCorrectedWorkDepthMap, M_SIZE_Y, M_NULL);
-   MbufCopyColor2d(MilDisparityImage, MilCorrectedWorkDepthMap, 0, BORDER_SIZE_X, 0, 0, 0, 0, WorkSizeX, WorkSizeY);
-   MIL_ID MilSourceRectifiedImage = MilRectifiedImage == 0 ? MilDisparityImage : MilRectifiedImage;
-   MbufCopyColor2d(MilSourceRectifiedImage, MilCorrectedWorkColorMap, M_ALL_BANDS, BORDER_SIZE_X, 0, M_ALL_BANDS, 0, 0, WorkSizeX, WorkSizeY);
-
-   // Show the disparity image.
-   MosPrintf(MIL_TEXT("The depth map is displayed.\n\n")
-             MIL_TEXT("Press <Enter> to continue.\n\n"));
-   if(NbSrcImage == 2)
-      MdispSelect(pMilDisplays[1], M_NULL);
-   ShowImage(pMilDisplays[0], MilCorrectedWorkDepthMap, true);
-   }
-
-
-//*****************************************************************************
-// FillHolesAndSmooth. Smooths the depth map and fills its hole. Invalid pixels
-//                     whose neighborhood contains at least 10% of valid pixels
-//                     are replaced by the average of the valid neighbors.
-//*****************************************************************************
-void FillHolesAndSmooth(MIL_ID MilDisplay, MIL_ID MilDepthMap, MIL_ID MilFilledHolesDepthMap, MIL_INT FilterSize)
-   {
-   MIL_ID MilSystem = MbufInquire(MilDepthMap, M_OWNER_SYSTEM, M_NULL);
-   MIL_INT ImageSizeX = MbufInquire(MilDepthMap, M_SIZE_X, M_NULL);
-   MIL_INT ImageSizeY = MbufInquire(MilDepthMap, M_SIZE_Y, M_NULL);
-
-   // Allocate the work images.
-   MIL_ID MilValidImage = MbufAlloc2d(MilSystem, ImageSizeX, ImageSizeY, 16+M_UNSIGNED, M_IMAGE+M_PROC, M_NULL);
-   MIL_ID MilNormImage = MbufAlloc2d(MilSystem, ImageSizeX, ImageSizeY, 16+M_UNSIGNED, M_IMAGE+M_PROC, M_NULL);
-   MIL_ID MilTempFilledHolesDepthMap32 = MbufAlloc2d(MilSystem, ImageSizeX, ImageSizeY, 32 + M_UNSIGNED, M_IMAGE + M_PROC, M_NULL);
-
-   // Create the valid image.
-   MimBinarize(MilDepthMap, MilValidImage, M_FIXED + M_GREATER, 0, M_NULL);
-
-   MIL_ID MilUniformKernel = MbufAlloc2d(MilSystem, FilterSize, FilterSize, 8+M_UNSIGNED, M_KERNEL, M_NULL);
-   MbufClear(MilUniformKernel, 1);
-   MbufControl(MilUniformKernel, M_NORMALIZATION_FACTOR, FilterSize*FilterSize);
-   MimConvolve(MilValidImage, MilNormImage, MilUniformKernel);
-   MimConvolve(MilDepthMap, MilFilledHolesDepthMap, MilUniformKernel);
-   
-   // Normalize the values.
-   MimShift(MilFilledHolesDepthMap, MilTempFilledHolesDepthMap32, 16);
-   MimArith(MilTempFilledHolesDepthMap32, MilNormImage, MilFilledHolesDepthMap, M_DIV);
-
-   // Invalidate the data of values that do not have enough valid values in their neighborhood.
-   MimBinarize(MilNormImage, MilValidImage, M_GREATER, 0.1 * MIL_UINT16_MAX, M_NULL);
-   MbufClearCond(MilFilledHolesDepthMap, MIL_UINT16_MAX, M_NULL, M_NULL, MilValidImage, M_EQUAL, 0);
-
-   // Show the depth map without the holes.
-   MosPrintf(MIL_TEXT("The depth map was smoothed and its holes were filled.\n\n")
-             MIL_TEXT("Press <Enter> to continue.\n\n"));
-   ShowImage(MilDisplay, MilFilledHolesDepthMap, true);
-
-   MbufFree(MilUniformKernel);
-   MbufFree(MilTempFilledHolesDepthMap32);
-   MbufFree(MilNormImage);
-   MbufFree(MilValidImage);
-   }
-
-//*****************************************************************************
-// CorrectHorizontalCurve. Corrects the horizontal curve of the depth map, 
-//                         assuming that it should be flat.
-//*****************************************************************************
-void CorrectHorizontalCurve(MIL_ID MilDepthMap, MIL_INT ChildOffsetY, MIL_INT ChildSizeY)
-   {
-   MIL_ID MilSystem = MbufInquire(MilDepthMap, M_OWNER_SYSTEM, M_NULL);
-   MIL_INT ImageSizeX = MbufInquire(MilDepthMap, M_SIZE_X, M_NULL);
-   MIL_INT ImageSizeY = MbufInquire(MilDepthMap, M_SIZE_Y, M_NULL);
-   
-   // Allocate the temporary images and get the child.
-   MIL_ID MilCorrectionSourceChild = MbufChild2d(MilDepthMap, 0, ChildOffsetY, ImageSizeX, ChildSizeY, M_NULL);
-   MIL_ID MilAverageColumn = MbufAlloc2d(MilSystem, ImageSizeX, 1, 16+M_UNSIGNED, M_IMAGE+M_PROC, M_NULL);
-   MIL_ID MilAverageImage = MbufAlloc2d(MilSystem, ImageSizeX, ImageSizeY, 16+M_UNSIGNED, M_IMAGE+M_PROC, M_NULL);
-   
-   // Get the average of each column to get an estimation of the horizontal curve.
-   MimResize(MilCorrectionSourceChild, MilAverageColumn, M_FILL_DESTINATION, M_FILL_DESTINATION, M_AVERAGE);
-   MimResize(MilAverageColumn, MilAverageImage, M_FILL_DESTINATION, M_FILL_DESTINATION, M_NEAREST_NEIGHBOR);
-   
-   // Remove the curve.
-   McalAssociate(MilDepthMap, MilAverageImage, M_DEFAULT);
-   M3dmapArith(MilDepthMap, MilAverageImage, MilDepthMap, M_NULL, M_SUB, M_SET_WORLD_OFFSET_Z);
-
-   // Free the allocations.
-   MbufFree(MilAverageImage);
-   MbufFree(MilAverageColumn);
-   MbufFree(MilCorrectionSourceChild);
-   }
-
-//*****************************************************************************
-// CalibrateDepthMap. Calibrates the depth map based on the configuration of the
-//                    3DPIXA. Returns the Z-range.
-//*****************************************************************************
-MIL_DOUBLE CalibrateDepthMap(MIL_ID MilDepthMap, I3DApi* p3DApi, config3DApi *pConfig, MIL_DOUBLE XYMultFactor, MIL_DOUBLE ZMultFactor)
-   {
-   MIL_DOUBLE PixelSize = pConfig->resolutionX * XYMultFactor;
-   McalUniform(MilDepthMap, 0, 0, PixelSize, PixelSize, 0.0, M_DEFAULT);
-   float MinZ;
-   p3DApi->grayToMm(MinZ, (unsigned short)65535);
-   float MaxZ;
-   p3DApi->grayToMm(MaxZ, (unsigned short)1);
-   MinZ *= (float)ZMultFactor;
-   MaxZ *= (float)ZMultFactor;
-   McalControl(MilDepthMap, M_WORLD_POS_Z, MaxZ);
-   McalControl(MilDepthMap, M_GRAY_LEVEL_SIZE_Z, (MinZ - MaxZ) / 65535);
-   return MaxZ - MinZ;
-   }
-
-//*****************************************************************************
-// GenAverageCircleKernel. Generates an average circle kernel and returns the
-//                         circle's area.
-//*****************************************************************************
-MIL_INT GenAverageCircleKernel(MIL_ID MilAverageKernel)
-   {
-   // Get the kernel information.
-   MIL_ID MilSystem = MbufInquire(MilAverageKernel, M_OWNER_SYSTEM, M_NULL);
-   MIL_ID KernelSize = MbufInquire(MilAverageKernel, M_SIZE_X, M_NULL);
-   MIL_INT KernelPitch = MbufInquire(MilAverageKernel, M_PITCH, M_NULL);
-
-   // Allocate the stat context.
-   MIL_ID MilStatContext = MimAlloc(MilSystem, M_STATISTICS_CONTEXT, M_DEFAULT, M_NULL);
-
-   // Enable statistics to use.
-   MimControl(MilStatContext, M_STAT_NUMBER,    M_ENABLE);
-   MimControl(MilStatContext, M_CONDITION, M_EQUAL);
-   MimControl(MilStatContext, M_COND_LOW,  1);
-
-   // Allocate a stat result.
-   MIL_ID MilStatResult = MimAllocResult(MilSystem, M_DEFAULT, M_STATISTICS_RESULT, M_NULL);
-
-   // Create an image on top of the kernel.
-   MIL_ID MilAverageKernelImage = MbufCreate2d(MilSystem, M_DEFAULT, M_DEFAULT, M_DEFAULT, M_IMAGE+M_PROC, M_MIL_ID+M_PITCH, KernelPitch, (void*)MilAverageKernel, M_NULL); 
-
-   // Clear the kernel.
-   MbufClear(MilAverageKernel, 0);
-     
-   // Draw a circle in the middle of the kernel.
-   MgraColor(M_DEFAULT, 1);
-   MIL_INT CircleRadius = (KernelSize-1)/2;
-   MgraArcFill(M_DEFAULT, MilAverageKernelImage, CircleRadius, CircleRadius, CircleRadius, CircleRadius, 0, 360);
-   
-   // Get the area of the circle.
-   MimStatCalculate(MilStatContext, MilAverageKernelImage, MilStatResult, M_DEFAULT);
-
-   MIL_INT CircleArea;
-   MimGetResult(MilStatResult, M_STAT_NUMBER + M_TYPE_MIL_INT, &CircleArea);
-
-   // Free the image created on the kernel.
-   MbufFree(MilAverageKernelImage);
-
-   // Free the stat result.
-   MimFree(MilStatResult);
-
-   // Free the stat context.
-   MimFree(MilStatContext);
-
-   return CircleArea;
-   }
-
-//*****************************************************************************
-// ShowImage. Shows an image and waits for the user to press a key.
-//*****************************************************************************
-void ShowImage(MIL_ID MilDisplay, MIL_ID MilImage, bool AutoScale)
-   {
-   // Set the scale mode.
-   MdispControl(MilDisplay, M_VIEW_MODE, AutoScale ? M_AUTO_SCALE : M_DEFAULT);
-
-   // Select the image.
-   MdispSelect(MilDisplay, MilImage);
-
-   // Enable the display updates.
-   MdispControl(MilDisplay, M_UPDATE, M_ENABLE);
-   
-   // Wait for the user to press a key.
-   MosGetch();
-
-   // Disable the display updates.
-   MdispControl(MilDisplay, M_UPDATE, M_DISABLE);
-   }
-
-//*****************************************************************************
-// StartScan Thread used to start the scanning of the object.
-//*****************************************************************************
-MIL_UINT32 MFTYPE StartScan(void *UserDataPtr)
-   {
-   // Open the communication with the scanner.
-
-   // Send a command to start the scanner script.
-   // By using a scanner with a controller, the command 
-   // starts a program that initiates the movement
-   // and sends the trigger to the frame grabber to start
-   // grabbing.
-
-   // Close the communication with the scanner.
-
-   return 0;
-   }
-
-//*****************************************************************************
-// AccessDll. Create the 3DAPI object.
-//*****************************************************************************
-typedef int (*newFunc)(void*, void*);
-bool AccessDll(HINSTANCE* phDll, I3DApi** pp3DApi, config3DApi **ppConfig, MIL_CONST_TEXT_PTR DllName, char* FactoryProcName, char* ConfigFile)
-   {
-#if USE_CS3D_API
-
-   MIL_TEXT_CHAR DllPath[MAX_PATH];
-   MosSprintf(DllPath, MAX_PATH, MIL_TEXT("%s\\%s"), CS3D_DLL_PATH, DllName);
-
-   // Load the DLL.
-   *phDll = LoadLibrary(DllPath);
-   if(*phDll == 0)
-      {
-      DWORD LastError = GetLastError();
-      MosPrintf(MIL_TEXT("Error loading dll %s\n"), DllName);
-      MosPrintf(MIL_TEXT("Error code: %d\n"), LastError);
-      *pp3DApi = 0;
-      return false;
-      }
-
-   // Get address of the factory function.
-   newFunc CreateFuncAddr  = (newFunc)GetProcAddress(*phDll, FactoryProcName);
-
-   if(CreateFuncAddr == 0)
-      {
-      MosPrintf(MIL_TEXT("Error: Cannot find function %s\n"), FactoryProcName);
-      *phDll = 0;
-      *pp3DApi = 0;
-      return false;
-      }
-
-   // Use create-function with parameter.
-   if(CreateFuncAddr(pp3DApi, ConfigFile) < 0)
-      {
-      MosPrintf(MIL_TEXT("Error: unable to create dll object\n"));
-      *phDll = 0;
-      *pp3DApi = 0;
-      return false;
-      }
-
-   // Get the 3DPIXA configuration.
-   *ppConfig = (*pp3DApi)->getConfig();
-   if(!*ppConfig)
-      {
-      MosPrintf(MIL_TEXT("Error: unable to get 3d API configuration.\n"));
-      return false;
-      }
-
-   return true;
-
-# else
-
-   // Allocate the stub I3DApi and get the pointer to the config.
-   *pp3DApi = new I3DApi(COMPACT_STANDALONE_OUTPUT_IMAGE_PATH);
-   *ppConfig = (*pp3DApi)->getConfig();
-   return true;
-
-#endif
-   }
-
-//*****************************************************************************
-// Initialize3DApi. Initialize the 3DAPI object.
-//*****************************************************************************
-bool Initialize3DApi(I3DApi* p3DApi,
-                     config3DApi *pConfig,
-                     MIL_ID MilSystem,
-                     MIL_ID* pMilSrcImages,
-                     MIL_INT NbSrcImages,
-                     MIL_ID* pMilDisparityImage,
-                     MIL_ID* pMilRectifiedImage,
-                     MIL_INT* pWorkSizeX,
-                     MIL_INT* pWorkSizeY)
-   {
-   // Initialize the API.
-   if(p3DApi->initialize(pConfig) >= 0)
-      {
-      // Set the source image information.
-      for(int SrcIdx = 0; SrcIdx < NbSrcImages; SrcIdx++)
-         {
-         int ImageSizeX = (int)MbufInquire(pMilSrcImages[SrcIdx], M_SIZE_X, M_NULL);
-         int ImageSizeY = (int)MbufInquire(pMilSrcImages[SrcIdx], M_SIZE_Y, M_NULL);
-         char* pImageData = (char*)MbufInquire(pMilSrcImages[SrcIdx], M_HOST_ADDRESS, M_NULL);
-         int ImagePitchByte = (int)MbufInquire(pMilSrcImages[SrcIdx], M_PITCH_BYTE, M_NULL);
-         MIL_INT NbBands = MbufInquire(pMilSrcImages[SrcIdx], M_SIZE_BAND, M_NULL);
-         if(NbBands == 3)
-            {
-            p3DApi->setSrcImgChannelOrder(SrcIdx, CO_BGRA);
-            p3DApi->setSrcImgInfo(SrcIdx, ImageSizeX, ImageSizeY, 3, 32, ImagePitchByte, ImageSizeX*ImageSizeY*4);
-            }
-         else
-            {
-            p3DApi->setSrcImgChannelOrder(SrcIdx, CO_GRAY);
-            p3DApi->setSrcImgInfo(SrcIdx, ImageSizeX, ImageSizeY, 1, 8, ImagePitchByte, ImageSizeX*ImageSizeY);
-            }
-         if(p3DApi->setSrcImgPtr(SrcIdx, pImageData) < 0)
-            {
-            MosPrintf(MIL_TEXT("Image %i info not acceptable for calculation.\n"), SrcIdx);
-            return false;
-            }
-         }
-
-      // Allocate MIL disparity output images.
-      int DestSizeX;
-      int DestSizeY;
-      int DestChannel;
-      unsigned long long DestSizeByte;
-      p3DApi->getDestImgInfo(IMG_OUT_DISP, DestSizeX, DestSizeY, DestChannel, DestSizeByte);
-      if(DestSizeX != -1)
-         MbufAlloc2d(MilSystem, DestSizeX, DestSizeY, 16+M_UNSIGNED, M_IMAGE + M_PROC + M_DISP, pMilDisparityImage);
-      else
-         {
-         MosPrintf(MIL_TEXT("Unable to get the output disparity image.\n"));
-         return false;
-         }
-      
-      // Allocate the color or gray image.
-      MIL_INT ColorAttribute = M_BGR32;
-      outImgType DestImageType = IMG_OUT_BGRA;
-      if(pConfig->numChannelsUsedForCalculation == 1)
-         {
-         ColorAttribute = M_NULL;
-         DestImageType = IMG_OUT_GRAY;
-         }
-      p3DApi->getDestImgInfo(DestImageType, DestSizeX, DestSizeY, DestChannel, DestSizeByte);
-      if(DestSizeX != -1)
-         MbufAllocColor(MilSystem, pConfig->numChannelsUsedForCalculation, DestSizeX, DestSizeY, 8+M_UNSIGNED, M_IMAGE + M_PROC + M_DISP + ColorAttribute, pMilRectifiedImage);
-      else
-         MosPrintf(MIL_TEXT("Unable to get the output color or grayscale rectified image.\n"));
-      
-      // Calculate the work size.
-      *pWorkSizeX = DestSizeX - 2 * BORDER_SIZE_X;
-      *pWorkSizeY = DestSizeY;
-
-      // Start the calculation.
-      MosPrintf(MIL_TEXT("CS3D: Starting the CS3D api..."));
-      if(p3DApi->start() < 0)
-         {
-         MosPrintf(MIL_TEXT("Unable to start CS3D api.\n"));
-         return false;
-         }
-      else
-         {
-         MosPrintf(MIL_TEXT("Done.\n\n"));
-         }
-      }
-   else
-      {
-      MosPrintf(MIL_TEXT("Unable to initialize the CS3D api."));
-      return false;
-      }
-
-   return true;
-   }
-
-//*****************************************************************************
-// FreeDll. Free the 3DAPI object.
-//*****************************************************************************
-void FreeDll(HINSTANCE* phDll, I3DApi** pp3DApi)
-   {
-   if(*pp3DApi)
-      {
-      delete *pp3DApi;
-      *pp3DApi = 0;
-      }
-#if USE_CS3D_API
-   if(*phDll)
-      {
-      FreeLibrary(*phDll);
-      *phDll = 0;
-      }
-#endif
-   }
-
-//*******************************************************************************
-// CheckForRequiredMILFile. Checks that required avi is present to run the example.
-//                          Generates an error if it's not present.
-//*******************************************************************************
-bool CheckForRequiredMILFile(MIL_CONST_TEXT_PTR  FileName)
-   {
-   MIL_INT FilePresent;
-   MappFileOperation(M_DEFAULT, FileName, M_NULL, M_NULL, M_FILE_EXISTS, M_DEFAULT, &FilePresent);
-   if (FilePresent == M_NO)
-      {
-      MosPrintf(MIL_TEXT("The footage needed to run this example is missing. You need \n")
-                MIL_TEXT("to obtain and apply a separate specific update to have it.\n\n"));
-
-      MosPrintf(MIL_TEXT("Press <Enter> to end.\n\n"));
-      MosGetch();
-      }
-   return FilePresent == M_YES;
-   }
+﻿//***************************************************************************************/
+//
+// File name: Chromasens_3DPIXA_M10PP3.cpp
+//
+// Synopsis:  This example shows how to use the 3DPIXA camera and its CS-3D API
+//            in conjunction with MIL to solve surface inspection applications.
+//            See the PrintHeader() function below for detailed description.
+//
+// Copyright © 1992-2024 Zebra Technologies Corp. and/or its affiliates
+// All Rights Reserved
+
+#include <mil.h>
+#include "MdispD3D.h"
+#include "PipelineThreadPool.h"
+
+#define USE_CS3D_API 0
+
+// Without the CS3D api, calculate the disparity of the grabbed images on the CPU
+// instead of loading the expected outputs.
+#define USE_CPU_STEREO 0
+
+#if USE_CS3D_API 
+   
+   #if defined(WIN32)
+      #error "Chromasens CS3D api cannot be used in a 32-bit application."
+   #endif
+   
+   #include "C:\\Program Files\\Chromasens\\3D\\3dapi\\includes\\CS3DApiDll.h"
+   using namespace CS3D;
+   
+   static MIL_CONST_TEXT_PTR CS3D_DLL_PATH  = MIL_TEXT("C:\\Program Files\\Chromasens\\3D\\dlls");
+#else
+   #include "StandaloneCS3DApi.h"
+#endif
+
+#include "InspectionPipeline.h"
+#include "ScanQualityGate.h"
+#include "Async3DCalculator.h"
+#include "ScanResultStream.h"
+#include "DepthMapCodec.h"
+#include "RegressionBenchmark.h"
+#include "SyntheticScene.h"
+#include "PushPullHoleFiller.h"
+#include "PackedColorKernels.h"
+#include "PipelineTelemetry.h"
+#include "StageQueue.h"
+#include "LineSourceSimulator.h"
+#include "DeadlineScheduler.h"
+#include "ReferenceSurface.h"
+#include "LabelStatistics.h"
+#include "DepthMapMesh.h"
+#include "ScanShardRing.h"
+
+///***************************************************************************
+// Example description.
+///***************************************************************************
+void PrintHeader()   
+   {
+   MosPrintf(MIL_TEXT("[EXAMPLE NAME]\n")
+             MIL_TEXT("Chromasens_3DPIXA_M10PP3\n\n")
+
+             MIL_TEXT("[SYNOPSIS]\n")
+             MIL_TEXT("This example shows how to use the 3DPIXA camera and its CS-3D API\n")
+             MIL_TEXT("in conjunction with MIL to develop surface inspection applications.\n")
+             MIL_TEXT("The example is able to run without the Chromasens CS3D API by\n")
+             MIL_TEXT("loading from file the expected output images.\n\n")
+             
+             MIL_TEXT("[MODULES USED]\n")
+             MIL_TEXT("Modules used: application, system, display, buffer,\n")
+             MIL_TEXT("graphic, calibration, image processing.\n\n"));
+
+   MosPrintf(MIL_TEXT("Press <Enter> to continue.\n\n"));
+   MosGetch();
+   }
+
+//*****************************************************************************
+// Camera source parameters.
+// 
+// The required Matrox board-specific DCF files for the Chromasens 3DPIXA camera 
+// are available from the Interfacing Cameras section under the Support section of
+// www.matrox.com/imaging 
+//
+//*****************************************************************************
+
+static MIL_CONST_TEXT_PTR SOLIOS_DCF_PATH = M_NULL;
+static MIL_CONST_TEXT_PTR RADIENT_DCF_PATH = M_NULL;
+
+static MIL_CONST_TEXT_PTR COMPACT_STANDALONE_IMAGE_PATH         = M_IMAGE_PATH MIL_TEXT("Chromasens_3DPIXA_M10PP3\\Compact.avi");
+static MIL_CONST_TEXT_PTR COMPACT_STANDALONE_OUTPUT_IMAGE_PATH  = M_IMAGE_PATH MIL_TEXT("Chromasens_3DPIXA_M10PP3\\CompactOutput");
+static MIL_CONST_TEXT_PTR COMPACT_DATA_FORMAT[3]         = {COMPACT_STANDALONE_IMAGE_PATH, SOLIOS_DCF_PATH, RADIENT_DCF_PATH};
+
+static char*              COMPACT_CONFIG_FILE       = "CompactConfig.ini";
+
+static MIL_CONST_TEXT_PTR SYSTEM_DESCRIPTOR[3] = {M_SYSTEM_HOST, M_SYSTEM_SOLIOS, M_SYSTEM_RADIENT};
+static const MIL_INT SYSTEM_TO_USE = 0;
+
+// Run the regression benchmark, without user interaction, instead of the examples.
+// The example then returns 1 if a regression is found.
+static const bool RUN_REGRESSION_BENCHMARK = false;
+
+// Run the kernel microbenchmark on synthetic frames, without user interaction,
+// instead of the examples.
+static const bool RUN_KERNEL_MICROBENCHMARK = false;
+
+// Run the inspections on a simulated line source, at the conveyor speed and with
+// the encoder behavior of the line rate stress parameters, without user
+// interaction, instead of the examples.
+static const bool RUN_LINE_RATE_STRESS = false;
+
+// Run the inspections in worker processes that claim the scans written by this
+// process in a shared memory ring, without user interaction, instead of the
+// examples. The worker processes are this executable started with
+// SCAN_SHARD_WORKER_ARGUMENT.
+static const bool RUN_SCAN_SHARDING = false;
+
+// Placement of the threads. The acquisition and the 3D calculation each have a
+// dedicated core, the post-processing workers are pinned one per remaining core
+// and steal the stages of each other, and the host thread (I/O and display) is
+// left to the OS. Set NbCores to 0 to leave a role unpinned.
+enum EThreadRole
+   {
+   THREAD_ROLE_ACQUISITION,
+   THREAD_ROLE_3D,
+   THREAD_ROLE_POST_PROCESSING,
+   THREAD_ROLE_HOST,
+   NB_THREAD_ROLES
+   };
+static const SThreadRoleConfig THREAD_ROLES[NB_THREAD_ROLES] =
+   {
+   // Name               First core  Nb cores               Pin each  Priority                           Nb threads
+   {"acquisition",      0,          1,                     false,    THREAD_POOL_PRIORITY_HIGHEST,      0},
+   {"3d",               1,          1,                     false,    THREAD_POOL_PRIORITY_ABOVE_NORMAL, 0},
+   {"post-processing",  2,          THREAD_POOL_ALL_CORES, true,     THREAD_POOL_PRIORITY_NORMAL,       THREAD_POOL_ALL_CORES},
+   {"host",             0,          0,                     false,    THREAD_POOL_PRIORITY_NORMAL,       0}
+   };
+
+//*****************************************************************************
+// Useful struct.
+//*****************************************************************************
+struct SGrabStruct
+   {
+   MIL_ID MilDisplay;
+   MIL_ID MilDigitizer;
+   MIL_ID MilGrabImage;
+   };
+
+// Parameters of the CS3D API that change from one product to the other.
+struct S3DApiRecipe
+   {
+   int    dStart;
+   int    dEnd;
+   int    windowType;
+   double minStdDevA;
+   double mingw;
+   double minKkf;
+   bool   Pyramidal;   // Coarse-to-fine disparity search, used by the CPU calculation only.
+   };
+
+// Calibration of the depth maps of a 3D API context. The height is linear in
+// the gray level between the ones of gray levels 1 and 65535.
+struct SDepthCalibration
+   {
+   MIL_DOUBLE PixelSizeX;     // In mm.
+   MIL_DOUBLE PixelSizeY;
+   MIL_DOUBLE FirstGrayZ;     // Height of gray level 1, in mm.
+   MIL_DOUBLE LastGrayZ;      // Height of gray level 65535, in mm.
+   };
+
+// Pre-initialized CS3D API context and output buffers of a recipe.
+struct S3DApiContext
+   {
+   S3DApiRecipe Recipe;
+   HINSTANCE    hDll;
+   I3DApi*      p3DApi;
+   config3DApi* pConfig;
+   CAsync3DCalculator* pCalculator;
+   CScanResultRecord*  pScanResultRecord;   // Record of the scan being inspected, NULL if none.
+   MIL_ID       MilDisparityImage;
+   MIL_ID       MilRectifiedImage;
+   MIL_INT      WorkSizeX;
+   MIL_INT      WorkSizeY;
+   SDepthCalibration  Calibration;         // Of the depth maps, used by the post-processing.
+   CReferenceSurface* pReferenceSurface;   // Learned flat surface of the depth maps.
+   MIL_UINT32   RecipeId;                   // Hash of the config file and the recipe, names the reference surface file.
+   CPushPullHoleFiller HoleFiller;          // Pyramid of the pushpull stage, kept between the scans.
+   MIL_INT      RegionOffsetX;              // Of the region given to the pipeline, in the depth map.
+   };
+
+// Reference surface file of each recipe id, saved when the recipe cache is freed.
+static const char* REFERENCE_SURFACE_FILE_FORMAT = "Chromasens_3DPIXA_M10PP3_Reference%08X.ref";
+
+// Bounding box of the valid pixels of a depth map.
+struct SValidRegion
+   {
+   MIL_INT OffsetX;
+   MIL_INT OffsetY;
+   MIL_INT SizeX;
+   MIL_INT SizeY;
+   MIL_INT NbValidRows;
+   };
+
+// Cache of the pre-initialized CS3D API contexts, one per recipe.
+static const MIL_INT MAX_NB_RECIPES = 8;
+struct SRecipeCache
+   {
+   MIL_ID        MilSystem;
+   MIL_ID        MilGrabImage;
+   char*         ConfigFile;
+   S3DApiRecipe  DefaultRecipe;
+   MIL_INT       NbContexts;
+   S3DApiContext Contexts[MAX_NB_RECIPES];
+   CPipelineThreadPool* pThreadPool;   // Workers of the post-processing stages.
+   bool          SaveReferenceSurfaces;   // When the cache is freed.
+   };
+
+// Depth map archive, with the codec and its buffers kept between the scans.
+struct SDepthMapArchive
+   {
+   CDepthMapCodec Codec;
+   MIL_UINT8*     pStream;
+   MIL_INT        StreamCapacity;
+   MIL_UINT16*    pDecodedData;     // Allocated only when a scan is verified.
+   MIL_INT        DecodedCapacity;
+   MIL_INT        NbArchived;
+   };
+
+// Recipe with the calibration and the size of its depth maps, which is enough
+// to post-process them without the 3D API.
+struct SCalibratedRecipe
+   {
+   S3DApiRecipe      Recipe;
+   SDepthCalibration Calibration;
+   MIL_INT32         WorkSizeX;     // 0 if the 3D API context of the recipe failed.
+   MIL_INT32         WorkSizeY;
+   MIL_UINT32        RecipeId;      // Of the reference surface file.
+   };
+
+// Scan calculated in its own grab and output buffers, so that the 3D of the
+// next scan is calculated while the current one is post-processed.
+struct SPipelinedScan
+   {
+   S3DApiContext* pContext;            // NULL if the scan was not submitted.
+   MIL_ID         MilGrabImage;
+   MIL_ID         MilDisparityImage;
+   MIL_ID         MilRectifiedImage;
+   MIL_INT        RequestId;
+   MIL_DOUBLE     GrabTime;
+   MIL_DOUBLE     SubmitTime;
+   };
+
+// Inspection of the frames of the line rate stress, with a pipeline planned for
+// each degradation level of the recipe.
+struct SLineStressInspection
+   {
+   S3DApiContext*          pContext;
+   MIL_INT                 RecipeIdx;
+   const SDegradationStep* pSteps;
+   CInspectionPipeline*    pPipelines[DEADLINE_MAX_LEVELS];
+   CDeadlineScheduler*     pScheduler;
+   CTelemetryPublisher*    pTelemetry;
+   MIL_UINT64              NextScanIdx;
+   MIL_ID                  MilCorrectedWorkDepthMap;
+   MIL_ID                  MilCorrectedWorkColorMap;
+   };
+
+//*****************************************************************************
+// Example prototypes.
+//*****************************************************************************
+void ParticleBoardInspectionExample(MIL_ID MilSystem, MIL_ID MilDisplay, MIL_ID MilDigitizer, MIL_ID MilGrabImage, SRecipeCache* pRecipeCache);
+void SandPaperInspectionExample(MIL_ID MilSystem, MIL_ID MilDisplay, MIL_ID MilDigitizer, MIL_ID MilGrabImage, SRecipeCache* pRecipeCache);
+void PipelineInspectionExample(MIL_ID MilSystem, MIL_ID MilDisplay, MIL_ID MilDigitizer, MIL_ID MilGrabImage, SRecipeCache* pRecipeCache);
+const S3DApiRecipe& GetInspection3DApiRecipe(const SRecipeCache* pRecipeCache, MIL_INT RecipeIdx);
+MIL_INT GetNb3DQueued(SRecipeCache* pRecipeCache);
+bool RegressionBenchmarkExample(MIL_ID MilSystem, MIL_ID MilDigitizer, MIL_ID MilGrabImage, SRecipeCache* pRecipeCache);
+void KernelMicrobenchmarkExample(MIL_ID MilSystem, SRecipeCache* pRecipeCache);
+void LineRateStressExample(MIL_ID MilSystem, MIL_ID MilDigitizer, MIL_ID MilGrabImage, SRecipeCache* pRecipeCache);
+void ScanShardingExample(MIL_ID MilSystem, MIL_ID MilDigitizer, MIL_ID MilGrabImage, SRecipeCache* pRecipeCache);
+int ScanShardWorker(MIL_ID MilSystem, MIL_INT WorkerIdx);
+
+//*****************************************************************************
+// General function prototypes.
+//*****************************************************************************
+// 3D API functions.
+bool AccessDll(HINSTANCE* phDll, I3DApi** pp3DApi, config3DApi **ppConfig, MIL_CONST_TEXT_PTR DllName, char* FactoryProcName, char* ConfigFile);
+void FreeDll(HINSTANCE* phDll, I3DApi** pp3DApi);
+bool Initialize3DApi(I3DApi* p3DApi,
+                     config3DApi *pConfig,
+                     MIL_ID MilSystem,
+                     MIL_ID* pMilSrcImages,
+                     MIL_INT NbSrcImage,
+                     MIL_ID* pMilDisparityImage,
+                     MIL_ID* pMilRectifiedImage,
+                     MIL_INT* pWorkSizeX,
+                     MIL_INT* pWorkSizeY);
+
+// Recipe cache functions.
+bool InitRecipeCache(SRecipeCache* pRecipeCache, MIL_ID MilSystem, MIL_ID MilGrabImage, char* ConfigFile, const SThreadRoleConfig* pThreadRoles);
+void InitCalibratedRecipeCache(SRecipeCache* pRecipeCache, MIL_ID MilSystem, const SCalibratedRecipe* pRecipes, MIL_INT NbRecipes, const SThreadRoleConfig* pThreadRoles);
+S3DApiContext* SelectRecipe(SRecipeCache* pRecipeCache, const S3DApiRecipe& Recipe);
+void FreeRecipeCache(SRecipeCache* pRecipeCache);
+void Free3DApiContext(S3DApiContext* pContext);
+
+// Depth map processing functions.
+void FillHolesAndSmooth(MIL_ID MilDisplay, MIL_ID MilDepthMap, MIL_ID MilFilledHolesDepthMap, MIL_INT FilterSize);
+void FillHolesPushPull(CPushPullHoleFiller* pHoleFiller, MIL_ID MilDepthMap, MIL_ID MilFilledHolesDepthMap, MIL_INT SmoothingLevels, MIL_INT MaxFillDistance);
+void CorrectHorizontalCurve(MIL_ID MilDepthMap, MIL_INT ChildOffsetY, MIL_INT ChildSizeY);
+bool SubtractReferenceSurface(CReferenceSurface* pReferenceSurface, MIL_ID MilDepthMap, MIL_ID MilCorrectedDepthMap, MIL_INT OffsetX,
+                              MIL_DOUBLE OutlierFactor, bool Learn, SReferenceSurfaceFit* pFit);
+MIL_UINT32 HashBytes(MIL_UINT32 Hash, const void* pData, size_t Size);
+MIL_UINT32 GetRecipeId(const char* ConfigFile, const S3DApiRecipe& Recipe);
+void InitReferenceSurface(S3DApiContext* pContext);
+MIL_INT FindValidPeaks(MIL_ID MilSubsampledDepthMap, const SDepthCalibration& Calibration, MIL_DOUBLE MinPeakHeight, CPipelineThreadPool* pThreadPool, MIL_INT* pValidCoordX, MIL_INT* pValidCoordY);
+MIL_DOUBLE CalculateLocalDensity(MIL_ID MilPeakImage, MIL_ID MilLocalDensityImage, MIL_DOUBLE LocalPixelSize, MIL_INT KernelSize);
+bool FindValidRegion(MIL_ID MilDepthMap, MIL_INT Margin, SValidRegion* pRegion, MIL_INT* pRowStartX, MIL_INT* pRowEndX);
+bool RunLineRateStress(CLineSourceSimulator* pLineSource, const SLineSourceParams& Params, MIL_ID MilSourceImage, const MIL_ID* pMilFrameImages,
+                       SLineStressInspection* pInspection, SLineSourceStatistics* pStatistics);
+void PublishLostScan(SLineStressInspection* pInspection);
+void PrintLineRateStressRow(const SLineSourceParams& Params, const SLineSourceStatistics& Statistics, MIL_INT NbDegradedScans, bool Sustained);
+void InspectScanShard(SRecipeCache* pRecipeCache, CInspectionPipeline** pPipelines, MIL_ID MilDepthMap, MIL_INT RecipeIdx, SScanShardResult* pResult);
+MIL_INT MergeScanShardResults(CScanShardDispatcher* pDispatcher, CTelemetryPublisher* pTelemetry);
+MIL_INT WriteScanResult(CScanResultRing* pResultRing, CScanResultRecord* pResultRecord);
+void InitDepthMapArchive(SDepthMapArchive* pArchive, CPipelineThreadPool* pThreadPool);
+MIL_INT ArchiveDepthMap(SDepthMapArchive* pArchive, MIL_ID MilDepthMap, const char* ArchiveFilePath);
+void FreeDepthMapArchive(SDepthMapArchive* pArchive);
+bool IsPackedColor(MIL_ID MilImage);
+void CopyColorCrop(MIL_ID MilSrcImage, MIL_INT OffsetX, MIL_ID MilDstImage);
+
+// Pipeline stage functions.
+void FillStage(SPipelineStage* pStage, void* pUserData);
+void PushPullStage(SPipelineStage* pStage, void* pUserData);
+void CalibrateStage(SPipelineStage* pStage, void* pUserData);
+void PlaneStage(SPipelineStage* pStage, void* pUserData);
+void CurveStage(SPipelineStage* pStage, void* pUserData);
+void ReferenceStage(SPipelineStage* pStage, void* pUserData);
+void HysteresisStage(SPipelineStage* pStage, void* pUserData);
+void ResizeStage(SPipelineStage* pStage, void* pUserData);
+void PeaksStage(SPipelineStage* pStage, void* pUserData);
+void DensityStage(SPipelineStage* pStage, void* pUserData);
+
+// Utility functions.
+void GrabImage(I3DApi* p3DApi,
+               MIL_ID* pMilDisplays,
+               MIL_ID* pMilDigitizers,
+               MIL_ID* pMilGrabImages,
+               MIL_INT NbCamera);
+
+void Calculate3D(CAsync3DCalculator* pCalculator,
+                 MIL_ID* pMilDisplays,
+                 MIL_ID* pMilSrcImages,
+                 MIL_INT NbSrcImage,
+                 MIL_ID MilDisparityImage,
+                 MIL_ID MilrectifiedImage,
+                 MIL_ID MilCorrectedWorkDepthMap,
+                 MIL_ID MilCorrectedWorkColorMap);
+void GrabScan(MIL_ID MilDigitizer, MIL_ID MilGrabImage);
+MIL_INT Submit3D(CAsync3DCalculator* pCalculator,
+                 MIL_ID* pMilSrcImages,
+                 MIL_INT NbSrcImage,
+                 MIL_ID MilDisparityImage,
+                 MIL_ID MilRectifiedImage);
+bool Complete3D(CAsync3DCalculator* pCalculator,
+                MIL_INT RequestId,
+                MIL_ID MilDisparityImage,
+                MIL_ID MilRectifiedImage,
+                MIL_ID MilCorrectedWorkDepthMap,
+                MIL_ID MilCorrectedWorkColorMap);
+bool Compute3D(CAsync3DCalculator* pCalculator,
+               MIL_ID* pMilSrcImages,
+               MIL_INT NbSrcImage,
+               MIL_ID MilDisparityImage,
+               MIL_ID MilRectifiedImage,
+               MIL_ID MilCorrectedWorkDepthMap,
+               MIL_ID MilCorrectedWorkColorMap);
+void AllocPipelinedScan(SRecipeCache* pRecipeCache, SPipelinedScan* pScan);
+void StartPipelinedScan(SRecipeCache* pRecipeCache, MIL_ID MilDigitizer, const S3DApiRecipe& Recipe, SPipelinedScan* pScan);
+void FreePipelinedScan(SPipelinedScan* pScan);
+void GetExampleFilePath(char* FilePath, const char* FileName);
+MIL_INT GenAverageCircleKernel(MIL_ID MilAverageKernel);
+void GetDepthCalibration(I3DApi* p3DApi, const config3DApi* pConfig, SDepthCalibration* pCalibration);
+MIL_DOUBLE CalibrateDepthMap(MIL_ID MilDepthMap, const SDepthCalibration& Calibration, MIL_DOUBLE XYMultFactor, MIL_DOUBLE ZMultFactor);
+void ExportDepthMapMesh(MIL_ID MilDepthMap, MIL_DOUBLE PixelSize, MIL_DOUBLE ZMultFactor, MIL_DOUBLE MaxError, const char* FilePath);
+void ShowImage(MIL_ID MilDisplay, MIL_ID MilImage, bool Autoscale);
+MIL_UINT32 MFTYPE StartScan(void *UserDataPtr);
+
+bool CheckForRequiredMILFile(MIL_CONST_TEXT_PTR  FileName);
+
+//*****************************************************************************
+// Useful defines.
+//*****************************************************************************
+static const MIL_INT BORDER_SIZE_X = 64;
+
+// The color maps are packed BGRA, like the grab and rectified images, so that
+// the color path is never converted to planar.
+static const MIL_INT64 COLOR_MAP_ATTRIBUTE = M_IMAGE + M_PROC + M_DISP + M_BGR32 + M_PACKED;
+static const MIL_DOUBLE DISPLAY_ZOOM_FACTOR = 0.125;
+static const MIL_INT WINDOWS_OFFSET_X = 15;
+
+//*****************************************************************************
+// 3D API recipes. The default recipe is the one of the config file.
+//*****************************************************************************
+static const int           SAND_PAPER_3DAPI_DSTART       = -20;
+static const int           SAND_PAPER_3DAPI_DEND         = 10;
+static const int           SAND_PAPER_3DAPI_WINDOW_TYPE  = 0; // 27x27
+static const double        SAND_PAPER_3DAPI_MIN_STD_DEV  = 0.5; 
+static const int           SAND_PAPER_3DAPI_MIN_GRAY     = 10;
+static const MIL_DOUBLE    SAND_PAPER_3DAPI_MIN_KKF      = 0.5;
+static const bool          SAND_PAPER_3DAPI_PYRAMIDAL    = true;
+
+static const S3DApiRecipe  SAND_PAPER_3DAPI_RECIPE = {SAND_PAPER_3DAPI_DSTART,
+                                                      SAND_PAPER_3DAPI_DEND,
+                                                      SAND_PAPER_3DAPI_WINDOW_TYPE,
+                                                      SAND_PAPER_3DAPI_MIN_STD_DEV,
+                                                      SAND_PAPER_3DAPI_MIN_GRAY,
+                                                      SAND_PAPER_3DAPI_MIN_KKF,
+                                                      SAND_PAPER_3DAPI_PYRAMIDAL};
+
+//*****************************************************************************
+// Main.
+//*****************************************************************************
+int MosMain(void)
+   {
+   // Allocate the MIL objects.
+   int ExitCode = 0;
+   MIL_ID MilApplication = MappAlloc(M_NULL, M_DEFAULT, M_NULL);
+   PlaceCurrentThread(THREAD_ROLES[THREAD_ROLE_HOST], 0);
+   MIL_ID MilSystem      = MsysAlloc(M_DEFAULT, SYSTEM_DESCRIPTOR[SYSTEM_TO_USE], M_DEFAULT, M_DEFAULT, M_NULL);  
+
+   // A worker process of the scan sharding only inspects the scans of the ring.
+   MIL_INT ScanShardWorkerIdx = CScanShardWorker::GetCommandLineWorkerIdx();
+   if(ScanShardWorkerIdx >= 0)
+      {
+      ExitCode = ScanShardWorker(MilSystem, ScanShardWorkerIdx);
+      MsysFree(MilSystem);
+      MappFree(MilApplication);
+      return ExitCode;
+      }
+
+   MIL_ID pMilDisplay[2];
+   MdispAlloc(MilSystem, M_DEFAULT, MIL_TEXT("M_DEFAULT"), M_WINDOWED, &pMilDisplay[0]);
+   MdispAlloc(MilSystem, M_DEFAULT, MIL_TEXT("M_DEFAULT"), M_WINDOWED, &pMilDisplay[1]);
+   MdispZoom(pMilDisplay[0], DISPLAY_ZOOM_FACTOR, DISPLAY_ZOOM_FACTOR);
+   MdispZoom(pMilDisplay[1], DISPLAY_ZOOM_FACTOR, DISPLAY_ZOOM_FACTOR);
+
+   // Print Header.
+   if(!RUN_REGRESSION_BENCHMARK && !RUN_KERNEL_MICROBENCHMARK && !RUN_LINE_RATE_STRESS && !RUN_SCAN_SHARDING)
+      PrintHeader();
+
+   // If the DCF file hasn't been specified.
+   if(SYSTEM_TO_USE != 0 && COMPACT_DATA_FORMAT[SYSTEM_TO_USE] == NULL)
+      {
+      MosPrintf(MIL_TEXT("Please set a valid DCF path to run the example with a digitizer.\n")
+                MIL_TEXT("The required Matrox board-specific DCF files for the Chromasens 3DPIXA\n") 
+                MIL_TEXT("are available from the Interfacing Cameras section under the\n") 
+                MIL_TEXT("Support section of www.matrox.com/imaging\n\n")
+                MIL_TEXT("Press <Enter> to end.\n\n"));
+      MosGetch();
+      }
+   else
+      {
+      // Check if the footage is available when using emulated grab on host system.
+      if(SYSTEM_TO_USE != 0 || CheckForRequiredMILFile(COMPACT_DATA_FORMAT[SYSTEM_TO_USE]))
+         {
+         // Allocate the digitizer and image for the compact Chromasens camera.
+         MIL_ID pMilDigitizer[2];
+         MdigAlloc(MilSystem, M_DEFAULT, COMPACT_DATA_FORMAT[SYSTEM_TO_USE], M_DEFAULT, &pMilDigitizer[0]);
+         MIL_INT GrabImageSizeX = MdigInquire(pMilDigitizer[0], M_SIZE_X, M_NULL);
+         MIL_INT GrabImageSizeY = MdigInquire(pMilDigitizer[0], M_SIZE_Y, M_NULL);
+         MIL_ID pMilGrabImage[2];
+         MbufAllocColor(MilSystem, 3, GrabImageSizeX, GrabImageSizeY, 8+M_UNSIGNED, M_IMAGE + M_PROC + M_DISP + M_BGR32 + M_GRAB, &pMilGrabImage[0]);
+
+         // Get the path to the config file.
+         char CompactConfigFilePath[MAX_PATH];
+         GetExampleFilePath(CompactConfigFilePath, COMPACT_CONFIG_FILE);
+
+         // Allocate the Chromasens 3DAPI recipe cache for the compact Chromasens camera.
+         // All the recipes are initialized up front so that switching product is immediate.
+         SRecipeCache RecipeCache;
+         if(InitRecipeCache(&RecipeCache, MilSystem, pMilGrabImage[0], CompactConfigFilePath, THREAD_ROLES) &&
+            SelectRecipe(&RecipeCache, SAND_PAPER_3DAPI_RECIPE))
+            {
+            if(RUN_REGRESSION_BENCHMARK)
+               {
+               // Run the regression benchmark only.
+               if(!RegressionBenchmarkExample(MilSystem, pMilDigitizer[0], pMilGrabImage[0], &RecipeCache))
+                  ExitCode = 1;
+               }
+            else if(RUN_KERNEL_MICROBENCHMARK)
+               {
+               // Run the kernel microbenchmark only.
+               KernelMicrobenchmarkExample(MilSystem, &RecipeCache);
+               }
+            else if(RUN_LINE_RATE_STRESS)
+               {
+               // Run the line rate stress only.
+               LineRateStressExample(MilSystem, pMilDigitizer[0], pMilGrabImage[0], &RecipeCache);
+               }
+            else if(RUN_SCAN_SHARDING)
+               {
+               // Run the scan sharding only.
+               ScanShardingExample(MilSystem, pMilDigitizer[0], pMilGrabImage[0], &RecipeCache);
+               }
+            else
+               {
+               // Run the particle board example
+               ParticleBoardInspectionExample(MilSystem, pMilDisplay[0], pMilDigitizer[0], pMilGrabImage[0], &RecipeCache);
+
+               // Run the sand paper example.
+               SandPaperInspectionExample(MilSystem, pMilDisplay[0], pMilDigitizer[0], pMilGrabImage[0], &RecipeCache);
+
+               // Run both inspections from their pipeline description.
+               PipelineInspectionExample(MilSystem, pMilDisplay[0], pMilDigitizer[0], pMilGrabImage[0], &RecipeCache);
+               }
+            }
+
+         // Free the Chromasens 3dAPI contexts.
+         FreeRecipeCache(&RecipeCache);
+
+         // Free the grab image.
+         MbufFree(pMilGrabImage[0]);
+
+         // Free the digitizers.
+         MdigFree(pMilDigitizer[0]);
+         }
+      }
+
+   // Free MIL objects.
+   MdispFree(pMilDisplay[0]);
+   MdispFree(pMilDisplay[1]);
+   MsysFree(MilSystem);
+   MappFree(MilApplication);
+   return ExitCode;
+   }
+
+//*****************************************************************************
+// Particle board inspection example parameters.
+//*****************************************************************************
+static const MIL_INT D3D_DISPLAY_SIZE_X = 640;
+static const MIL_INT D3D_DISPLAY_SIZE_Y = 480;
+static const MIL_DOUBLE D3D_DISPLAY_SUBSAMPLING = 0.25;
+
+// Adaptive mesh of the depth map written for a remote viewer, with its largest
+// error in mm.
+static const MIL_DOUBLE PARTICLE_BOARD_MESH_MAX_ERROR = 0.01;
+static const char*      PARTICLE_BOARD_MESH_FILE      = "Chromasens_3DPIXA_M10PP3_ParticleBoard.mesh";
+
+static const MIL_DOUBLE PLANE_OUTLIER_DISTANCE_RANGE_FACTOR = 0.1;
+
+static const MIL_INT HORIZONTAL_CURVE_CORRECTION_CHILD_OFFSET_Y = 0;
+static const MIL_INT HORIZONTAL_CURVE_CORRECTION_CHILD_SIZE_Y = 1000;
+
+static const MIL_DOUBLE DEFECT_THRESHOLD_HIGH = 0.096; // in mm
+static const MIL_DOUBLE DEFECT_THRESHOLD_LOW = 0.048; // in mm
+
+static const MIL_INT PARTICLEBOARD_KERNEL_SIZE = 51;
+
+static const MIL_DOUBLE PARTICLEBOARD_Z_MULT_FACTOR = 8.333333;
+//*****************************************************************************
+// ParticleBoardInspectionExample.  
+//*****************************************************************************
+void ParticleBoardInspectionExample(MIL_ID MilSystem, MIL_ID MilDisplay, MIL_ID MilDigitizer, MIL_ID MilGrabImage, SRecipeCache* pRecipeCache)
+   {
+   MosPrintf(MIL_TEXT("[PARTICLE BOARD FLATNESS INSPECTION]\n\n")
+             MIL_TEXT("In this example, a textured particle board is scanned to generate a depth map.\n")
+             MIL_TEXT("The depth map is analyzed to detect depressions on the surface of the \n")
+             MIL_TEXT("particle board.\n\n")
+             MIL_TEXT("Press <Enter> to start.\n\n"));
+   MosGetch();
+
+   // Select the Chromasens 3D API context of the config file recipe.
+   S3DApiContext* pContext = SelectRecipe(pRecipeCache, pRecipeCache->DefaultRecipe);
+   if(pContext)
+      {
+      I3DApi* p3DApi = pContext->p3DApi;
+      config3DApi* pConfig = pContext->pConfig;
+      MIL_ID MilDisparityImage = pContext->MilDisparityImage;
+      MIL_ID MilRectifiedImage = pContext->MilRectifiedImage;
+      MIL_INT WorkSizeX = pContext->WorkSizeX;
+      MIL_INT WorkSizeY = pContext->WorkSizeY;
+
+      // Allocate the work images. The depth map is corrected in place.
+      MIL_ID MilCorrectedWorkDepthMap  = MbufAlloc2d(MilSystem, WorkSizeX, WorkSizeY, 16+M_UNSIGNED, M_IMAGE + M_PROC + M_DISP, M_NULL);
+      MIL_ID MilCorrectedDepthMap  = MilCorrectedWorkDepthMap;
+      MIL_ID MilCorrectedWorkColorMap  = MbufAllocColor(MilSystem, 3, WorkSizeX, WorkSizeY, 8+M_UNSIGNED, COLOR_MAP_ATTRIBUTE, M_NULL);
+      MIL_ID MilDefectImage        = MbufAlloc2d(MilSystem, WorkSizeX, WorkSizeY, 8+M_UNSIGNED, M_IMAGE + M_PROC + M_DISP, M_NULL);
+      MIL_ID MilPseudoColoredMap   = MbufAllocColor(MilSystem, 3, WorkSizeX, WorkSizeY, 8+M_UNSIGNED, COLOR_MAP_ATTRIBUTE, M_NULL);
+
+      // Allocate the images for the 3D display.
+      MIL_INT Display3DSizeX = (MIL_INT)(WorkSizeX * D3D_DISPLAY_SUBSAMPLING);
+      MIL_INT Display3DSizeY = (MIL_INT)(WorkSizeY * D3D_DISPLAY_SUBSAMPLING);
+      MIL_ID Mil3DDisplayDepthMap  = MbufAlloc2d(MilSystem, Display3DSizeX, Display3DSizeY, 16+M_UNSIGNED, M_IMAGE + M_PROC + M_DISP, M_NULL);
+      MIL_ID Mil3DDisplayColorMap  = MbufAllocColor(MilSystem, 3, Display3DSizeX, Display3DSizeY, 8+M_UNSIGNED, COLOR_MAP_ATTRIBUTE, M_NULL);
+         
+      // Allocate the jet color LUT.
+      MIL_ID MilColorLut = MbufAllocColor(MilSystem, 3, MIL_UINT16_MAX, 1, 8+M_UNSIGNED, M_LUT, M_NULL);
+         
+      // Allocate blob objects.
+      MIL_ID MilBlobResult;
+      MIL_ID MilBlobContext;
+
+      MblobAlloc(MilSystem, M_DEFAULT, M_DEFAULT, &MilBlobContext);
+      MblobAllocResult(MilSystem, M_DEFAULT, M_DEFAULT, &MilBlobResult);
+      MblobControl(MilBlobContext, M_MIN_PIXEL, M_ENABLE);
+
+      //Allocate graphics context
+      MIL_ID BlobGraphicsContext;
+
+      MgraAlloc(MilSystem, &BlobGraphicsContext);
+      MgraColor(BlobGraphicsContext, 0);
+
+      // Grab and calculate 3D.
+      GrabImage(p3DApi, &MilDisplay, &MilDigitizer, &MilGrabImage, 1);
+      Calculate3D(pContext->pCalculator, &MilDisplay, &MilGrabImage, 1, MilDisparityImage, MilRectifiedImage, MilCorrectedWorkDepthMap, MilCorrectedWorkColorMap);
+         
+      // Fill the holes of the depth map in place.
+      FillHolesAndSmooth(MilDisplay, MilCorrectedWorkDepthMap, MilCorrectedDepthMap, PARTICLEBOARD_KERNEL_SIZE); 
+         
+      // Calibrate the depth map.
+      CalibrateDepthMap(MilCorrectedDepthMap, pContext->Calibration, 1, PARTICLEBOARD_Z_MULT_FACTOR);
+
+      // Fit the position of the board and subtract it, with the reference surface,
+      // from the depth map.
+      SReferenceSurfaceFit Fit;
+      SubtractReferenceSurface(pContext->pReferenceSurface, MilCorrectedDepthMap, MilCorrectedDepthMap, 0, PLANE_OUTLIER_DISTANCE_RANGE_FACTOR, true, &Fit);
+
+      // Show the depth map relative to the reference surface.
+      MosPrintf(MIL_TEXT("The reference surface, a running average of the flat scans (%d learned),\n")
+                  MIL_TEXT("and the plane of the board, fitted on a grid of samples, were subtracted\n")
+                  MIL_TEXT("from the depth map in one pass. The horizontal lens distortion is part of\n")
+                  MIL_TEXT("the reference surface; only the offset and the tilts of the board are\n")
+                  MIL_TEXT("fitted for each scan. The depth map now represents the heights relative\n")
+                  MIL_TEXT("to the reference surface.\n\n")
+                  MIL_TEXT("Press <Enter> to continue.\n\n"),
+                  (int)pContext->pReferenceSurface->GetNbScans());
+      ShowImage(MilDisplay, MilCorrectedDepthMap, true); 
+
+      // Show the depth map in a 3d display.
+      MIL_DISP_D3D_HANDLE DispHandle;
+      MimResize(MilCorrectedDepthMap, Mil3DDisplayDepthMap, D3D_DISPLAY_SUBSAMPLING, D3D_DISPLAY_SUBSAMPLING, M_AVERAGE);
+      MimResize(MilCorrectedWorkColorMap, Mil3DDisplayColorMap, D3D_DISPLAY_SUBSAMPLING, D3D_DISPLAY_SUBSAMPLING, M_AVERAGE);
+      CalibrateDepthMap(Mil3DDisplayDepthMap, pContext->Calibration, 1.0 / D3D_DISPLAY_SUBSAMPLING, PARTICLEBOARD_Z_MULT_FACTOR);
+      DispHandle = MdepthD3DAlloc(Mil3DDisplayDepthMap, Mil3DDisplayColorMap,
+                                    D3D_DISPLAY_SIZE_X,
+                                    D3D_DISPLAY_SIZE_Y,
+                                    M_DEFAULT,
+                                    M_DEFAULT,
+                                    M_DEFAULT,
+                                    M_DEFAULT,
+                                    M_DEFAULT,
+                                    M_DEFAULT,
+                                    0);
+
+      if (DispHandle != NULL)
+         {
+         MdispD3DShow(DispHandle);
+         MdispD3DPrintHelp(DispHandle);
+         }
+         
+      MosPrintf(MIL_TEXT("A 3D display of the particle board surface after rectification is shown.\n")
+                  MIL_TEXT("For display purposes, the surface heights have been magnified by %.2f.\n\n")
+                  MIL_TEXT("Press <Enter> to continue.\n\n"),
+                  PARTICLEBOARD_Z_MULT_FACTOR);
+      MosGetch();
+
+      // Write the adaptive mesh of the depth map for a remote viewer.
+      ExportDepthMapMesh(MilCorrectedDepthMap, pConfig->resolutionX, PARTICLEBOARD_Z_MULT_FACTOR, PARTICLE_BOARD_MESH_MAX_ERROR, PARTICLE_BOARD_MESH_FILE);
+
+      // Get the gray value at 0 height.
+      MIL_DOUBLE FinalWorldPosZ;
+      MIL_DOUBLE FinalGrayLevelSizeZ;
+      McalInquire(MilCorrectedDepthMap, M_WORLD_POS_Z, &FinalWorldPosZ);
+      McalInquire(MilCorrectedDepthMap, M_GRAY_LEVEL_SIZE_Z, &FinalGrayLevelSizeZ);
+      MIL_DOUBLE DefectThresholdLowGray  = (DEFECT_THRESHOLD_LOW * PARTICLEBOARD_Z_MULT_FACTOR - FinalWorldPosZ) / FinalGrayLevelSizeZ;
+      MIL_DOUBLE DefectThresholdHighGray = (DEFECT_THRESHOLD_HIGH * PARTICLEBOARD_Z_MULT_FACTOR- FinalWorldPosZ) / FinalGrayLevelSizeZ;
+
+      // Get the possible defects.
+      MimBinarize(MilCorrectedDepthMap, MilDefectImage, M_FIXED + M_LESS, DefectThresholdLowGray, M_NULL);
+         
+      // Perform seed recontruction using blob. 
+      MblobCalculate(MilBlobContext, MilDefectImage, MilCorrectedDepthMap, MilBlobResult);
+      MblobSelect(MilBlobResult, M_INCLUDE_ONLY, M_MIN_PIXEL, M_LESS, DefectThresholdHighGray, M_NULL);
+
+      MIL_INT NbDefects;
+      MblobGetResult(MilBlobResult, M_GENERAL, M_NUMBER + M_TYPE_MIL_INT, &NbDefects);
+      if(NbDefects>0)
+         {
+         MblobDraw(BlobGraphicsContext, MilBlobResult, MilDefectImage, M_DRAW_BLOBS, M_EXCLUDED_BLOBS, M_DEFAULT);
+            
+         // Color the defect blob with a color lut in the color map.
+         MIL_ID MilColorLutChild = MbufChild1d(MilColorLut, (MIL_INT)DefectThresholdHighGray, (MIL_INT)DefectThresholdLowGray - (MIL_INT)DefectThresholdHighGray + 1, M_NULL);
+         MbufClear(MilColorLut, M_RGB888(0,0,128));
+         MgenLutFunction(MilColorLutChild, M_COLORMAP_JET, M_DEFAULT, M_DEFAULT, M_DEFAULT, M_DEFAULT, M_DEFAULT, M_DEFAULT);
+         MimLutMap(MilCorrectedDepthMap, MilPseudoColoredMap, MilColorLut);
+         MbufCopyCond(MilPseudoColoredMap, MilCorrectedWorkColorMap, MilDefectImage, M_EQUAL, 255);  
+         MbufFree(MilColorLutChild);
+         }
+         
+      // Show the defect in overlay of the displayed depth image.
+      MIL_ID MilOverlay = MdispInquire(MilDisplay, M_OVERLAY_ID, M_NULL);
+      MbufCopyCond(MilPseudoColoredMap, MilOverlay, MilDefectImage, M_EQUAL, 255);
+
+      // Show the defect in the 3D display.
+      if (DispHandle != NULL)
+         {
+         MimResize(MilCorrectedWorkColorMap, Mil3DDisplayColorMap, D3D_DISPLAY_SUBSAMPLING, D3D_DISPLAY_SUBSAMPLING, M_AVERAGE);
+         MdepthD3DSetImages(DispHandle, Mil3DDisplayDepthMap, Mil3DDisplayColorMap);
+         }
+      MosPrintf(MIL_TEXT("The defects were extracted using an hysteresis threshold defined in world\n")
+                  MIL_TEXT("units. A first low height threshold(set to %.2f um) identifies groups of\n")
+                  MIL_TEXT("pixels that could be defects. To be considered defects, the group of \n")
+                  MIL_TEXT("pixels must have a least one height value greater than a second higher\n")
+                  MIL_TEXT("threshold (set to %.2f um).\n\n")
+                  MIL_TEXT("Press <Enter> to continue.\n\n"),
+                  DEFECT_THRESHOLD_LOW * 1000,
+                  DEFECT_THRESHOLD_HIGH* 1000);
+      ShowImage(MilDisplay, MilCorrectedDepthMap, true);  
+
+      // Clear the overlay and deselect the image.
+      MdispControl(MilDisplay, M_OVERLAY_CLEAR, M_DEFAULT);
+
+      // Free the 3D display.
+      if(DispHandle)
+         MdispD3DFree(DispHandle);
+
+      // Free blob.
+      MblobFree(MilBlobContext);
+      MblobFree(MilBlobResult);
+
+      // Free the color lut.
+      MbufFree(MilColorLut);
+
+      // Free the work images.
+      MbufFree(Mil3DDisplayColorMap);
+      MbufFree(Mil3DDisplayDepthMap);
+      MbufFree(MilPseudoColoredMap);
+      MbufFree(MilDefectImage);
+      MbufFree(MilCorrectedWorkColorMap);
+      MbufFree(MilCorrectedWorkDepthMap);
+
+      //Free graphics context
+      MgraFree(BlobGraphicsContext);
+      }
+   }
+
+//*****************************************************************************
+// Sand paper inspection example parameters.
+//*****************************************************************************
+static const MIL_INT    RESIZE_DOWN_NEIGHBORHOOD = 10;
+static const MIL_DOUBLE RESIZE_DOWN_FACTOR       = 1.0/RESIZE_DOWN_NEIGHBORHOOD; 
+
+static const MIL_INT LOCAL_DENSITY_KERNEL_SIZE = 45;
+
+static const MIL_DOUBLE MIN_PEAK_HEIGHT = 0.25; // in mm
+
+static const MIL_INT SAND_PAPER_KERNEL_SIZE = 51;
+
+static const MIL_DOUBLE SAND_PAPER_Z_MULT_FACTOR = 4;
+
+static const MIL_DOUBLE SAND_PAPER_MESH_MAX_ERROR = 0.05; // in mm
+static const char*      SAND_PAPER_MESH_FILE      = "Chromasens_3DPIXA_M10PP3_SandPaper.mesh";
+//*****************************************************************************
+// SandPaperInspectionExample.  
+//*****************************************************************************
+void SandPaperInspectionExample(MIL_ID MilSystem, MIL_ID MilDisplay, MIL_ID MilDigitizer, MIL_ID MilGrabImage, SRecipeCache* pRecipeCache)
+   {
+   MosPrintf(MIL_TEXT("[SAND PAPER DENSITY INSPECTION]\n\n")
+             MIL_TEXT("In this example, a piece of sand paper is scanned to generate a depth map.\n")
+             MIL_TEXT("The depth map is analyzed to generate a local density map of the peaks.\n\n")
+             MIL_TEXT("Press <Enter> to start.\n\n"));
+   MosGetch();
+
+   // Allocate the graphic list.
+   MIL_ID MilGraList = MgraAllocList(MilSystem, M_DEFAULT, M_NULL);
+
+   // Switch to the pre-initialized Chromasens 3D API context of the sand paper recipe.
+   MIL_DOUBLE SwitchStartTime;
+   MIL_DOUBLE SwitchEndTime;
+   MappTimer(M_DEFAULT, M_TIMER_READ, &SwitchStartTime);
+   S3DApiContext* pContext = SelectRecipe(pRecipeCache, SAND_PAPER_3DAPI_RECIPE);
+   MappTimer(M_DEFAULT, M_TIMER_READ, &SwitchEndTime);
+   if(pContext)
+      {
+      MosPrintf(MIL_TEXT("CS3D: Switched to the sand paper recipe in %.3f ms.\n\n"), (SwitchEndTime - SwitchStartTime) * 1000.0);
+
+      I3DApi* p3DApi = pContext->p3DApi;
+      config3DApi* pConfig = pContext->pConfig;
+      MIL_ID MilDisparityImage = pContext->MilDisparityImage;
+      MIL_ID MilRectifiedImage = pContext->MilRectifiedImage;
+      MIL_INT WorkSizeX = pContext->WorkSizeX;
+      MIL_INT WorkSizeY = pContext->WorkSizeY;
+
+      // Calculate the subsampled image size.
+      MIL_INT SubsampledSizeX = (MIL_INT)(WorkSizeX * RESIZE_DOWN_FACTOR);
+      MIL_INT SubsampledSizeY = (MIL_INT)(WorkSizeY * RESIZE_DOWN_FACTOR);
+
+      // Allocate the work images. The depth map is corrected in place.
+      MIL_ID MilCorrectedWorkDepthMap  = MbufAlloc2d(MilSystem, WorkSizeX, WorkSizeY, 16+M_UNSIGNED, M_IMAGE + M_PROC + M_DISP, M_NULL);
+      MIL_ID MilCorrectedDepthMap  = MilCorrectedWorkDepthMap;
+      MIL_ID MilCorrectedWorkColorMap  = MbufAllocColor(MilSystem, 3, WorkSizeX, WorkSizeY, 8+M_UNSIGNED, COLOR_MAP_ATTRIBUTE, M_NULL);
+      MIL_ID MilSubsampledDepthMap = MbufAlloc2d(MilSystem, SubsampledSizeX, SubsampledSizeY, 16+M_UNSIGNED, M_IMAGE + M_PROC + M_DISP, M_NULL); 
+      MIL_ID MilPeakImage = MbufAlloc2d(MilSystem, SubsampledSizeX, SubsampledSizeY, 8+M_UNSIGNED, M_IMAGE + M_PROC + M_DISP, M_NULL);
+
+      // Allocate the images for the 3D display.
+      MIL_INT Display3DSizeX = (MIL_INT)(WorkSizeX * D3D_DISPLAY_SUBSAMPLING);
+      MIL_INT Display3DSizeY = (MIL_INT)(WorkSizeY * D3D_DISPLAY_SUBSAMPLING);
+      MIL_ID Mil3DDisplayDepthMap  = MbufAlloc2d(MilSystem, Display3DSizeX, Display3DSizeY, 16+M_UNSIGNED, M_IMAGE + M_PROC + M_DISP, M_NULL);
+      MIL_ID Mil3DDisplayColorMap  = MbufAllocColor(MilSystem, 3, Display3DSizeX, Display3DSizeY, 8+M_UNSIGNED, COLOR_MAP_ATTRIBUTE, M_NULL);
+
+      // Allocate the image to compute the local density.
+      MIL_DOUBLE LocalPixelSize = pConfig->resolutionX / (RESIZE_DOWN_FACTOR);
+      MIL_ID MilLocalDensityImage = MbufAlloc2d(MilSystem, SubsampledSizeX, SubsampledSizeY, 8+M_UNSIGNED, M_IMAGE+M_PROC, M_NULL);
+      MIL_ID MilLocalDensityFullSizeImage = MbufAlloc2d(MilSystem, WorkSizeX, WorkSizeY, 8+M_UNSIGNED, M_IMAGE+M_PROC+M_DISP, M_NULL);
+
+      // Allocate the valid peak arrays.
+      MIL_INT MaxNbEvents = SubsampledSizeX * SubsampledSizeY / 9;
+      MIL_INT* pValidCoordX = new MIL_INT[MaxNbEvents];
+      MIL_INT* pValidCoordY = new MIL_INT[MaxNbEvents];
+
+      // Grab and calculate 3D.
+      GrabImage(p3DApi, &MilDisplay, &MilDigitizer, &MilGrabImage, 1);
+      Calculate3D(pContext->pCalculator, &MilDisplay, &MilGrabImage, 1, MilDisparityImage, MilRectifiedImage, MilCorrectedWorkDepthMap, MilCorrectedWorkColorMap);         
+
+      // Fill the holes of the depth map in place.
+      FillHolesAndSmooth(MilDisplay, MilCorrectedWorkDepthMap, MilCorrectedDepthMap, SAND_PAPER_KERNEL_SIZE); 
+         
+      // Calibrate the depth map.
+      CalibrateDepthMap(MilCorrectedDepthMap, pContext->Calibration, 1, SAND_PAPER_Z_MULT_FACTOR);
+         
+      // Subsample the depth map.
+      MimResize(MilCorrectedDepthMap, MilSubsampledDepthMap, RESIZE_DOWN_FACTOR, RESIZE_DOWN_FACTOR, M_AVERAGE);
+
+      // Locate the peaks and keep only the ones with enough contrast.
+      MIL_INT NbValidPeak = FindValidPeaks(MilSubsampledDepthMap, pContext->Calibration, MIN_PEAK_HEIGHT, pRecipeCache->pThreadPool, pValidCoordX, pValidCoordY);
+      if(NbValidPeak >= 0)
+         {
+         // Draw the valid peaks over the original image.
+         MgraColor(M_DEFAULT, M_COLOR_GREEN);   
+         for(MIL_INT PeakIdx = 0; PeakIdx < NbValidPeak; PeakIdx++)
+            MgraArcFill(M_DEFAULT, MilGraList, pValidCoordX[PeakIdx], pValidCoordY[PeakIdx], 0.5, 0.5, 0, 360);
+         MgraControlList(MilGraList, M_ALL, M_DEFAULT, M_DRAW_ZOOM_X, RESIZE_DOWN_NEIGHBORHOOD);
+         MgraControlList(MilGraList, M_ALL, M_DEFAULT, M_DRAW_ZOOM_Y, RESIZE_DOWN_NEIGHBORHOOD);
+            
+         // Draw the peaks in the rectified color image.
+         MgraDraw(MilGraList, MilCorrectedWorkColorMap, M_DEFAULT);
+         
+         // Associate the graphic list to the display.
+         MdispControl(MilDisplay, M_ASSOCIATED_GRAPHIC_LIST_ID, MilGraList);
+
+         // Show the depth map in a 3D display.
+         MIL_DISP_D3D_HANDLE DispHandle;
+         MimResize(MilCorrectedDepthMap, Mil3DDisplayDepthMap, D3D_DISPLAY_SUBSAMPLING, D3D_DISPLAY_SUBSAMPLING, M_AVERAGE);
+         MimResize(MilCorrectedWorkColorMap, Mil3DDisplayColorMap, D3D_DISPLAY_SUBSAMPLING, D3D_DISPLAY_SUBSAMPLING, M_AVERAGE);
+         CalibrateDepthMap(Mil3DDisplayDepthMap, pContext->Calibration, 1.0 / D3D_DISPLAY_SUBSAMPLING, SAND_PAPER_Z_MULT_FACTOR);
+         DispHandle = MdepthD3DAlloc(Mil3DDisplayDepthMap, Mil3DDisplayColorMap,
+                                       D3D_DISPLAY_SIZE_X,
+                                       D3D_DISPLAY_SIZE_Y,
+                                       M_DEFAULT,
+                                       M_DEFAULT,
+                                       M_DEFAULT,
+                                       M_DEFAULT,
+                                       M_DEFAULT,
+                                       M_DEFAULT,
+                                       0);
+
+         if (DispHandle != NULL)
+            {
+            MdispD3DShow(DispHandle);
+            MdispD3DPrintHelp(DispHandle);
+            }
+            
+         MosPrintf(MIL_TEXT("A 3D display of the sand paper is shown.\n")
+                     MIL_TEXT("For display purposes, the surface heights have been magnified by %.2f.\n")
+                     MIL_TEXT("The peaks have been detected and are identified in green.\n\n")
+                     MIL_TEXT("Press <Enter> to continue.\n\n"),
+                     SAND_PAPER_Z_MULT_FACTOR);
+         ShowImage(MilDisplay, MilCorrectedDepthMap, true); 
+
+         // Write the adaptive mesh of the depth map for a remote viewer.
+         ExportDepthMapMesh(MilCorrectedDepthMap, pConfig->resolutionX, SAND_PAPER_Z_MULT_FACTOR, SAND_PAPER_MESH_MAX_ERROR, SAND_PAPER_MESH_FILE);
+            
+         // Calculate the global peak density in peak/cm^2.
+         MIL_DOUBLE GlobalPeakDensity = 100 * (MIL_DOUBLE)NbValidPeak / (WorkSizeX * WorkSizeY* pConfig->resolutionX * pConfig->resolutionX);
+
+         // Generate an image indicating the local peak density. 
+         MbufClear(MilPeakImage, 0);
+         MgraColor(M_DEFAULT, 1);
+         MgraDots(M_DEFAULT, MilPeakImage, NbValidPeak, pValidCoordX, pValidCoordY, M_DEFAULT);
+         MIL_DOUBLE MaxDensity = CalculateLocalDensity(MilPeakImage, MilLocalDensityImage, LocalPixelSize, LOCAL_DENSITY_KERNEL_SIZE);
+
+         // Resize to fit in the full image.
+         MimResize(MilLocalDensityImage, MilLocalDensityFullSizeImage, (MIL_DOUBLE)RESIZE_DOWN_NEIGHBORHOOD, (MIL_DOUBLE)RESIZE_DOWN_NEIGHBORHOOD, M_INTERPOLATE);
+            
+         // Show the peak density. 
+         if (DispHandle != NULL)
+            {
+            MimResize(MilLocalDensityFullSizeImage, Mil3DDisplayColorMap, D3D_DISPLAY_SUBSAMPLING, D3D_DISPLAY_SUBSAMPLING, M_AVERAGE);
+            MdepthD3DSetImages(DispHandle, Mil3DDisplayDepthMap, Mil3DDisplayColorMap);
+            }
+         MosPrintf(MIL_TEXT("The 3D display now shows the local density of peaks.\n")
+                     MIL_TEXT("The global average density is %.2f peaks/cm^2.\n")
+                     MIL_TEXT("The maximum local density (in white) is %.2f peak/cm^2.\n\n")
+                     MIL_TEXT("Press <Enter> to continue.\n\n"),
+                     GlobalPeakDensity,
+                     MaxDensity);
+         ShowImage(MilDisplay, MilLocalDensityFullSizeImage, false);
+
+         // Free the 3D display.
+         if(DispHandle)
+            MdispD3DFree(DispHandle);
+         }
+      else
+         MosPrintf(MIL_TEXT("The number of possible peaks should be equal to nb of zone of influence.\n\n"));
+         
+      // Free the allocated arrays.
+      delete [] pValidCoordY;
+      delete [] pValidCoordX;
+
+      // Free the work images.
+      MbufFree(Mil3DDisplayColorMap);
+      MbufFree(Mil3DDisplayDepthMap);
+      MbufFree(MilLocalDensityFullSizeImage);
+      MbufFree(MilLocalDensityImage);
+      MbufFree(MilPeakImage);
+      MbufFree(MilSubsampledDepthMap);
+      MbufFree(MilCorrectedWorkColorMap);
+      MbufFree(MilCorrectedWorkDepthMap);
+      }
+
+   // Free the graphic list
+   MgraFree(MilGraList);
+   }
+
+//*****************************************************************************
+// Pipeline inspection example parameters.
+//*****************************************************************************
+static const SPipelineStageType PIPELINE_STAGE_TYPES[] =
+   {
+   // Name          Inputs  Output format             Function          In place  Scratch bytes/pixel
+   {"fill",         1,      PIPELINE_OUTPUT_SAME,     FillStage,        true,     8},
+   {"pushpull",     1,      PIPELINE_OUTPUT_SAME,     PushPullStage,    true,     13},
+   {"calibrate",    1,      PIPELINE_OUTPUT_SAME,     CalibrateStage,   true,     0},
+   {"plane",        1,      PIPELINE_OUTPUT_SAME,     PlaneStage,       true,     0},
+   {"curve",        1,      PIPELINE_OUTPUT_SAME,     CurveStage,       true,     2},
+   {"reference",    1,      PIPELINE_OUTPUT_SAME,     ReferenceStage,   true,     0},
+   {"hysteresis",   1,      PIPELINE_OUTPUT_MASK,     HysteresisStage,  false,    0},
+   {"resize",       1,      PIPELINE_OUTPUT_RESIZED,  ResizeStage,      false,    0},
+   {"peaks",        1,      PIPELINE_OUTPUT_MASK,     PeaksStage,       false,    3},
+   {"density",      1,      PIPELINE_OUTPUT_SAME,     DensityStage,     true,     0}
+   };
+static const MIL_INT NB_PIPELINE_STAGE_TYPES = sizeof(PIPELINE_STAGE_TYPES) / sizeof(PIPELINE_STAGE_TYPES[0]);
+
+// Built-in descriptions, used when the description file is not found.
+static const char* PARTICLE_BOARD_PIPELINE =
+   "# Particle board flatness inspection.\n"
+   "input      depth\n"
+   "fill       filled   = depth     size=51\n"
+   "calibrate  world    = filled    zmult=8.333333\n"
+   "reference  surface  = world     outlier=0.1\n"
+   "hysteresis defects  = surface   low=0.048 high=0.096 zmult=8.333333\n"
+   "resize     preview  = surface   factor=0.25\n"
+   "output     surface defects preview\n";
+
+static const char* SAND_PAPER_PIPELINE =
+   "# Sand paper peak density inspection.\n"
+   "input      depth\n"
+   "fill       filled   = depth     size=51\n"
+   "calibrate  world    = filled    zmult=4\n"
+   "resize     coarse   = world     factor=0.1\n"
+   "peaks      peaks    = coarse    height=0.25\n"
+   "density    density  = peaks     subsampling=0.1 kernel=45\n"
+   "resize     preview  = world     factor=0.25\n"
+   "output     world density preview\n";
+
+// Degradation policies, applied in order when a scan would end past its
+// deadline. Level 0 runs the pipeline of the recipe; each later level is
+// cumulative with the previous ones.
+static const char* PARTICLE_BOARD_NO_PREVIEW_PIPELINE =
+   "# Particle board flatness inspection, without the preview.\n"
+   "input      depth\n"
+   "fill       filled   = depth     size=51\n"
+   "calibrate  world    = filled    zmult=8.333333\n"
+   "reference  surface  = world     outlier=0.1\n"
+   "hysteresis defects  = surface   low=0.048 high=0.096 zmult=8.333333\n"
+   "output     surface defects\n";
+
+static const char* PARTICLE_BOARD_SMALL_FILL_PIPELINE =
+   "# Particle board flatness inspection, without the preview, with a smaller fill.\n"
+   "input      depth\n"
+   "fill       filled   = depth     size=25\n"
+   "calibrate  world    = filled    zmult=8.333333\n"
+   "reference  surface  = world     outlier=0.1\n"
+   "hysteresis defects  = surface   low=0.048 high=0.096 zmult=8.333333\n"
+   "output     surface defects\n";
+
+// The push-pull fill does not depend on the size of the holes; its reach and
+// smoothing are close to the ones of the kernel fill of 51.
+static const char* PARTICLE_BOARD_PUSH_PULL_PIPELINE =
+   "# Particle board flatness inspection, without the preview, with the push-pull fill.\n"
+   "input      depth\n"
+   "pushpull   filled   = depth     smoothing=1 maxdistance=25\n"
+   "calibrate  world    = filled    zmult=8.333333\n"
+   "reference  surface  = world     outlier=0.1\n"
+   "hysteresis defects  = surface   low=0.048 high=0.096 zmult=8.333333\n"
+   "output     surface defects\n";
+
+static const SDegradationStep PARTICLE_BOARD_DEGRADATION[] =
+   {
+   // Name                           Pipeline                              ROI fraction
+   {"full quality",                  NULL,                                 1.0},
+   {"no visualization",              PARTICLE_BOARD_NO_PREVIEW_PIPELINE,   1.0},
+   {"fill kernel of 25",             PARTICLE_BOARD_SMALL_FILL_PIPELINE,   1.0},
+   {"push-pull fill",                PARTICLE_BOARD_PUSH_PULL_PIPELINE,    1.0},
+   {"center of the valid region",    NULL,                                 0.5}
+   };
+
+static const char* SAND_PAPER_NO_PREVIEW_PIPELINE =
+   "# Sand paper peak density inspection, without the preview.\n"
+   "input      depth\n"
+   "fill       filled   = depth     size=51\n"
+   "calibrate  world    = filled    zmult=4\n"
+   "resize     coarse   = world     factor=0.1\n"
+   "peaks      peaks    = coarse    height=0.25\n"
+   "density    density  = peaks     subsampling=0.1 kernel=45\n"
+   "output     world density\n";
+
+// The holes are filled on the 0.25 pyramid level, subsampled without mixing the
+// invalid pixels, with a kernel of the same reach as the full resolution one.
+static const char* SAND_PAPER_PYRAMID_PIPELINE =
+   "# Sand paper peak density inspection, from the 0.25 pyramid level.\n"
+   "input      depth\n"
+   "resize     pyramid  = depth     factor=0.25 nearest=1\n"
+   "fill       filled   = pyramid   size=13\n"
+   "calibrate  world    = filled    zmult=4 xymult=4\n"
+   "resize     coarse   = world     factor=0.4\n"
+   "peaks      peaks    = coarse    height=0.25\n"
+   "density    density  = peaks     subsampling=0.1 kernel=45\n"
+   "output     world density\n";
+
+static const char* SAND_PAPER_SMALL_FILL_PIPELINE =
+   "# Sand paper peak density inspection, from the 0.25 pyramid level, with a smaller fill.\n"
+   "input      depth\n"
+   "resize     pyramid  = depth     factor=0.25 nearest=1\n"
+   "fill       filled   = pyramid   size=7\n"
+   "calibrate  world    = filled    zmult=4 xymult=4\n"
+   "resize     coarse   = world     factor=0.4\n"
+   "peaks      peaks    = coarse    height=0.25\n"
+   "density    density  = peaks     subsampling=0.1 kernel=45\n"
+   "output     world density\n";
+
+static const char* SAND_PAPER_PUSH_PULL_PIPELINE =
+   "# Sand paper peak density inspection, from the 0.25 pyramid level, with the push-pull fill.\n"
+   "input      depth\n"
+   "resize     pyramid  = depth     factor=0.25 nearest=1\n"
+   "pushpull   filled   = pyramid   smoothing=1 maxdistance=6\n"
+   "calibrate  world    = filled    zmult=4 xymult=4\n"
+   "resize     coarse   = world     factor=0.4\n"
+   "peaks      peaks    = coarse    height=0.25\n"
+   "density    density  = peaks     subsampling=0.1 kernel=45\n"
+   "output     world density\n";
+
+static const SDegradationStep SAND_PAPER_DEGRADATION[] =
+   {
+   // Name                           Pipeline                              ROI fraction
+   {"full quality",                  NULL,                                 1.0},
+   {"no visualization",              SAND_PAPER_NO_PREVIEW_PIPELINE,       1.0},
+   {"density from the 0.25 pyramid", SAND_PAPER_PYRAMID_PIPELINE,          1.0},
+   {"fill kernel of 7",              SAND_PAPER_SMALL_FILL_PIPELINE,       1.0},
+   {"push-pull fill",                SAND_PAPER_PUSH_PULL_PIPELINE,        1.0},
+   {"center of the valid region",    NULL,                                 0.5}
+   };
+
+// Inspection recipe, made of a 3D API recipe, a pipeline description and a
+// degradation policy.
+struct SInspectionRecipe
+   {
+   MIL_CONST_TEXT_PTR      Name;
+   const S3DApiRecipe*     p3DApiRecipe;   // M_NULL for the recipe of the config file.
+   const char*             PipelineFileName;
+   const char*             DefaultPipeline;
+   const char*             ResultNames[4];
+   const SDegradationStep* pDegradationSteps;
+   MIL_INT                 NbDegradationSteps;
+   };
+
+static const SInspectionRecipe INSPECTION_RECIPES[] =
+   {
+   {MIL_TEXT("Particle board"), M_NULL,                   "ParticleBoard.pipeline", PARTICLE_BOARD_PIPELINE, {"defects.count", M_NULL, M_NULL, M_NULL},
+    PARTICLE_BOARD_DEGRADATION, sizeof(PARTICLE_BOARD_DEGRADATION) / sizeof(PARTICLE_BOARD_DEGRADATION[0])},
+   {MIL_TEXT("Sand paper"),     &SAND_PAPER_3DAPI_RECIPE, "SandPaper.pipeline",     SAND_PAPER_PIPELINE,     {"peaks.count", "density.global", "density.max", M_NULL},
+    SAND_PAPER_DEGRADATION,     sizeof(SAND_PAPER_DEGRADATION) / sizeof(SAND_PAPER_DEGRADATION[0])}
+   };
+static const MIL_INT NB_INSPECTION_RECIPES = sizeof(INSPECTION_RECIPES) / sizeof(INSPECTION_RECIPES[0]);
+
+// Margin added around the valid region so that the fill kernel sees the same neighborhood.
+static const MIL_INT VALID_REGION_MARGIN = PARTICLEBOARD_KERNEL_SIZE / 2;
+
+// Thresholds of the scan quality gate.
+static const SQualityGateThresholds QUALITY_GATE_THRESHOLDS =
+   {
+   8,       // Sample step, in pixels.
+   650,     // Maximum consistent disparity step, about 1% of the range.
+   0.02,    // Skip coverage.
+   0.20,    // Skip confidence.
+   0.30,    // Flag coverage.
+   0.10,    // Flag clipped fraction.
+   0.60     // Downgrade confidence.
+   };
+
+// Ring of the binary scan results, in a file of the working directory or in a
+// named shared memory.
+static const bool    SCAN_RESULT_USE_SHARED_MEMORY = false;
+static const char*   SCAN_RESULT_RING_FILE         = "Chromasens_3DPIXA_M10PP3_Results.ring";
+static const char*   SCAN_RESULT_SHARED_MEMORY     = "Local\\Chromasens_3DPIXA_M10PP3_Results";
+static const MIL_INT SCAN_RESULT_RING_CAPACITY     = 4 * 1024 * 1024;
+
+// Archive of the depth maps, compressed without loss in files of the working directory.
+static const bool    ARCHIVE_DEPTH_MAPS            = true;
+static const char*   DEPTH_MAP_ARCHIVE_FILE_FORMAT = "Chromasens_3DPIXA_M10PP3_Scan%llu.cdm";
+static const MIL_INT DEPTH_MAP_ARCHIVE_VERIFY_PERIOD = 16;   // Restore and compare every Nth scan, 0 for none.
+
+// Number of scans with their own buffers in the pipeline inspection: the 3D of
+// a scan is calculated while the previous one is post-processed.
+static const MIL_INT NB_PIPELINED_SCANS            = 2;
+
+// Live telemetry, published after every scan in a named shared memory read by
+// TelemetryReader.
+static const bool    PUBLISH_TELEMETRY             = true;
+
+//*****************************************************************************
+// PipelineInspectionExample. Runs the inspections from their description.
+//*****************************************************************************
+void PipelineInspectionExample(MIL_ID MilSystem, MIL_ID MilDisplay, MIL_ID MilDigitizer, MIL_ID MilGrabImage, SRecipeCache* pRecipeCache)
+   {
+   MosPrintf(MIL_TEXT("[RECIPE-DRIVEN INSPECTION PIPELINE]\n\n")
+             MIL_TEXT("In this example, both inspections are described by a pipeline recipe.\n")
+             MIL_TEXT("The lifetime of the intermediate buffers is analyzed so that buffers\n")
+             MIL_TEXT("that are never alive at the same time share the same memory, and the\n")
+             MIL_TEXT("independent stages are run concurrently. The pipeline only processes\n")
+             MIL_TEXT("the region of the scan that holds valid 3D data, and scans whose 3D\n")
+             MIL_TEXT("quality is too poor are rejected before any processing.\n\n")
+             MIL_TEXT("Press <Enter> to start.\n\n"));
+   MosGetch();
+
+   // Open the ring of the binary scan results.
+   CScanResultRing ResultRing;
+   CScanResultRecord ResultRecord;
+   bool ResultRingOpened = SCAN_RESULT_USE_SHARED_MEMORY ? ResultRing.OpenSharedMemory(SCAN_RESULT_SHARED_MEMORY, SCAN_RESULT_RING_CAPACITY)
+                                                         : ResultRing.OpenFile(SCAN_RESULT_RING_FILE, SCAN_RESULT_RING_CAPACITY);
+   if(!ResultRingOpened)
+      MosPrintf(MIL_TEXT("Unable to open the scan result ring, the results are only printed.\n\n"));
+   MIL_UINT64 ScanIdx = ResultRing.GetNbRecords();
+   SDepthMapArchive DepthMapArchive;
+   InitDepthMapArchive(&DepthMapArchive, pRecipeCache->pThreadPool);
+
+   // Open the live telemetry.
+   CTelemetryPublisher Telemetry;
+   if(PUBLISH_TELEMETRY && !Telemetry.Open(TELEMETRY_SHARED_MEMORY))
+      MosPrintf(MIL_TEXT("Unable to open the telemetry shared memory, no telemetry is published.\n\n"));
+
+   pRecipeCache->pThreadPool->ResetStatistics();
+
+   // Allocate the buffers of the scans in flight and start the first scan.
+   SPipelinedScan Scans[NB_PIPELINED_SCANS];
+   for(MIL_INT SlotIdx = 0; SlotIdx < NB_PIPELINED_SCANS; SlotIdx++)
+      AllocPipelinedScan(pRecipeCache, &Scans[SlotIdx]);
+   StartPipelinedScan(pRecipeCache, MilDigitizer, GetInspection3DApiRecipe(pRecipeCache, 0), &Scans[0]);
+
+   for(MIL_INT RecipeIdx = 0; RecipeIdx < NB_INSPECTION_RECIPES; RecipeIdx++)
+      {
+      const SInspectionRecipe& InspectionRecipe = INSPECTION_RECIPES[RecipeIdx];
+
+      // Get the scan submitted with the pre-initialized 3D API context of the recipe.
+      SPipelinedScan& Scan = Scans[RecipeIdx % NB_PIPELINED_SCANS];
+      S3DApiContext* pContext = Scan.pContext;
+      if(!pContext)
+         {
+         if(RecipeIdx + 1 < NB_INSPECTION_RECIPES)
+            StartPipelinedScan(pRecipeCache, MilDigitizer, GetInspection3DApiRecipe(pRecipeCache, RecipeIdx + 1), &Scans[(RecipeIdx + 1) % NB_PIPELINED_SCANS]);
+         continue;
+         }
+
+      // Allocate the work images.
+      MIL_ID MilCorrectedWorkDepthMap = MbufAlloc2d(MilSystem, pContext->WorkSizeX, pContext->WorkSizeY, 16+M_UNSIGNED, M_IMAGE + M_PROC + M_DISP, M_NULL);
+      MIL_ID MilCorrectedWorkColorMap = MbufAllocColor(MilSystem, 3, pContext->WorkSizeX, pContext->WorkSizeY, 8+M_UNSIGNED, COLOR_MAP_ATTRIBUTE, M_NULL);
+
+      MIL_DOUBLE SubmitTime = Scan.SubmitTime;
+      MIL_DOUBLE PreparedTime;
+      MIL_DOUBLE CompletedTime;
+      Telemetry.BeginScan(ScanIdx, RecipeIdx, Scan.GrabTime);
+
+      // The depth of the 3D queue is sampled at each stage boundary of the scan,
+      // and the one of the post-processing queue at each task submitted in it.
+      Telemetry.SetQueueDepth("3d", (MIL_DOUBLE)GetNb3DQueued(pRecipeCache));
+      pRecipeCache->pThreadPool->TakeMeanQueued(THREAD_ROLE_POST_PROCESSING);
+
+      // While the 3D is calculated, load the pipeline description and plan its buffers.
+      CInspectionPipeline Pipeline(PIPELINE_STAGE_TYPES, NB_PIPELINE_STAGE_TYPES);
+      Pipeline.SetThreadPool(pRecipeCache->pThreadPool, THREAD_ROLE_POST_PROCESSING);
+      char PipelineFilePath[MAX_PATH];
+      GetExampleFilePath(PipelineFilePath, InspectionRecipe.PipelineFileName);
+      bool Loaded = Pipeline.LoadFile(PipelineFilePath) || Pipeline.Load(InspectionRecipe.DefaultPipeline);
+      bool Planned = Loaded && Pipeline.Plan(MilSystem, &MilCorrectedWorkDepthMap, 1);
+      MappTimer(M_DEFAULT, M_TIMER_READ, &PreparedTime);
+
+      // Wait for the 3D data.
+      Complete3D(pContext->pCalculator, Scan.RequestId, Scan.MilDisparityImage, Scan.MilRectifiedImage, MilCorrectedWorkDepthMap, MilCorrectedWorkColorMap);
+      Scan.pContext = NULL;
+      MappTimer(M_DEFAULT, M_TIMER_READ, &CompletedTime);
+      Telemetry.SetStageLatency("3d", CompletedTime - SubmitTime);
+      Telemetry.SetQueueDepth("3d", (MIL_DOUBLE)GetNb3DQueued(pRecipeCache));
+      if(!Loaded)
+         MosPrintf(MIL_TEXT("Unable to load the %s pipeline.\n\n"), InspectionRecipe.Name);
+
+      if(Planned)
+         {
+         MosPrintf(MIL_TEXT("%s inspection:\n"), InspectionRecipe.Name);
+         Pipeline.PrintPlan();
+         Pipeline.PrintMemoryReport();
+         MosPrintf(MIL_TEXT("The pipeline was prepared in %.1f ms while the 3D was calculated; the 3D was ready %.1f ms later.\n"),
+                   (PreparedTime - SubmitTime) * 1000.0, (CompletedTime - PreparedTime) * 1000.0);
+
+#if USE_CPU_STEREO && !USE_CS3D_API
+         // Print the time of the CPU rectification.
+         MosPrintf(MIL_TEXT("The views were rectified on the CPU in %.1f ms, with remap tables built %d time(s).\n"),
+                   pContext->p3DApi->getCpuStereoMatcher()->GetRectifyTime() * 1000.0, (int)pContext->p3DApi->getCpuStereoMatcher()->GetNbRectifyBuilds());
+
+         // Print the disparity range searched by the CPU calculation.
+         int SearchStart;
+         int SearchEnd;
+         pContext->p3DApi->getCpuStereoMatcher()->GetSearchRange(&SearchStart, &SearchEnd);
+         MosPrintf(MIL_TEXT("The disparity was searched from %d to %d, %.0f%% of the recipe range.\n"),
+                   SearchStart, SearchEnd, 100.0 * (SearchEnd - SearchStart + 1) / (pContext->pConfig->dEnd - pContext->pConfig->dStart + 1));
+
+         // Compare the coarse-to-fine disparity with the brute-force one.
+         SCpuStereoAccuracy Accuracy;
+         if(pContext->p3DApi->getCpuStereoMatcher()->CompareWithBruteForce(&Accuracy))
+            {
+            MosPrintf(MIL_TEXT("Coarse-to-fine disparity: %.1f ms, brute force: %.1f ms.\n"), Accuracy.PyramidalTime * 1000.0, Accuracy.BruteForceTime * 1000.0);
+            MosPrintf(MIL_TEXT("   %d pixels valid in both, %d only coarse-to-fine, %d only brute force.\n"),
+                      (int)Accuracy.NbValidBoth, (int)Accuracy.NbValidOnlyPyramidal, (int)Accuracy.NbValidOnlyBruteForce);
+            MosPrintf(MIL_TEXT("   Mean difference %.3f disparity steps, %.2f%% differ by more than a step.\n"),
+                      Accuracy.MeanAbsDifference, Accuracy.OutlierFraction * 100.0);
+            }
+#endif
+         }
+
+      // Keep the next scan in the 3D stage while this one is post-processed.
+      if(RecipeIdx + 1 < NB_INSPECTION_RECIPES)
+         StartPipelinedScan(pRecipeCache, MilDigitizer, GetInspection3DApiRecipe(pRecipeCache, RecipeIdx + 1), &Scans[(RecipeIdx + 1) % NB_PIPELINED_SCANS]);
+      Telemetry.SetQueueDepth("3d", (MIL_DOUBLE)GetNb3DQueued(pRecipeCache));
+
+      if(Planned)
+         {
+         // Evaluate the quality of the scan.
+         MIL_DOUBLE StartTime;
+         MIL_DOUBLE EndTime;
+         SScanQuality ScanQuality;
+         CScanQualityGate QualityGate(QUALITY_GATE_THRESHOLDS);
+         MappTimer(M_DEFAULT, M_TIMER_READ, &StartTime);
+         EQualityDecision QualityDecision = QualityGate.Evaluate(MilCorrectedWorkDepthMap, &ScanQuality);
+         MappTimer(M_DEFAULT, M_TIMER_READ, &EndTime);
+         CScanQualityGate::PrintReport(ScanQuality);
+         MosPrintf(MIL_TEXT("The quality gate ran in %.2f ms.\n"), (EndTime - StartTime) * 1000.0);
+         Telemetry.SetStageLatency("gate", EndTime - StartTime);
+         Telemetry.SetValidCoverage(ScanQuality.Coverage);
+         Telemetry.SetQueueDepth("3d", (MIL_DOUBLE)GetNb3DQueued(pRecipeCache));
+
+         // Archive the depth map.
+         char ArchiveFilePath[MAX_PATH];
+         sprintf_s(ArchiveFilePath, MAX_PATH, DEPTH_MAP_ARCHIVE_FILE_FORMAT, (unsigned long long)ScanIdx);
+         ArchiveDepthMap(&DepthMapArchive, MilCorrectedWorkDepthMap, ARCHIVE_DEPTH_MAPS ? ArchiveFilePath : NULL);
+
+         ResultRecord.Reset(ScanIdx++, RecipeIdx);
+         ResultRecord.SetQuality(ScanQuality.Decision, ScanQuality.Reasons);
+         if(QualityDecision == QUALITY_SKIP)
+            {
+            WriteScanResult(&ResultRing, &ResultRecord);
+            Telemetry.Publish(QualityDecision, true, false);
+            MosPrintf(MIL_TEXT("The inspection is skipped.\n\nPress <Enter> to continue.\n\n"));
+            Telemetry.Pause();
+            MosGetch();
+            Telemetry.Resume();
+            MbufFree(MilCorrectedWorkColorMap);
+            MbufFree(MilCorrectedWorkDepthMap);
+            continue;
+            }
+
+         // Find the region of the scan that holds valid data.
+         SValidRegion ValidRegion;
+         MappTimer(M_DEFAULT, M_TIMER_READ, &StartTime);
+         bool HasValidData = FindValidRegion(MilCorrectedWorkDepthMap, VALID_REGION_MARGIN, &ValidRegion, M_NULL, M_NULL);
+         MappTimer(M_DEFAULT, M_TIMER_READ, &EndTime);
+         if(!HasValidData)
+            {
+            WriteScanResult(&ResultRing, &ResultRecord);
+            Telemetry.Publish(QualityDecision, true, false);
+            MosPrintf(MIL_TEXT("The scan holds no valid 3D data, the inspection is skipped.\n\n"));
+            MbufFree(MilCorrectedWorkColorMap);
+            MbufFree(MilCorrectedWorkDepthMap);
+            continue;
+            }
+         MosPrintf(MIL_TEXT("The valid region (%d x %d at %d, %d) covers %.1f%% of the scan and was found in %.2f ms.\n"),
+                   (int)ValidRegion.SizeX, (int)ValidRegion.SizeY, (int)ValidRegion.OffsetX, (int)ValidRegion.OffsetY,
+                   100.0 * ValidRegion.SizeX * ValidRegion.SizeY / (pContext->WorkSizeX * pContext->WorkSizeY),
+                   (EndTime - StartTime) * 1000.0);
+
+         // Run the pipeline on the valid region.
+         MIL_ID MilValidRegionDepthMap = MbufChild2d(MilCorrectedWorkDepthMap, ValidRegion.OffsetX, ValidRegion.OffsetY, ValidRegion.SizeX, ValidRegion.SizeY, M_NULL);
+         ResultRecord.SetOffset(ValidRegion.OffsetX, ValidRegion.OffsetY);
+         pContext->pScanResultRecord = &ResultRecord;
+         pContext->RegionOffsetX = ValidRegion.OffsetX;
+         MappTimer(M_DEFAULT, M_TIMER_READ, &StartTime);
+         bool Succeeded = Pipeline.Run(&MilValidRegionDepthMap, 1, pContext);
+         MappTimer(M_DEFAULT, M_TIMER_READ, &EndTime);
+         pContext->pScanResultRecord = NULL;
+         Telemetry.SetQueueDepth("3d", (MIL_DOUBLE)GetNb3DQueued(pRecipeCache));
+         Telemetry.SetQueueDepth("post-processing", pRecipeCache->pThreadPool->TakeMeanQueued(THREAD_ROLE_POST_PROCESSING));
+
+         // Add the peak statistics and write the result record.
+         MIL_DOUBLE NbPeaks;
+         MIL_DOUBLE GlobalDensity;
+         MIL_DOUBLE MaxLocalDensity;
+         if(Succeeded && Pipeline.GetResult("peaks.count", &NbPeaks) && Pipeline.GetResult("density.global", &GlobalDensity) && Pipeline.GetResult("density.max", &MaxLocalDensity))
+            ResultRecord.SetPeaks((MIL_INT)NbPeaks, GlobalDensity, MaxLocalDensity);
+         MIL_DOUBLE WriteStartTime;
+         MIL_DOUBLE WriteEndTime;
+         MappTimer(M_DEFAULT, M_TIMER_READ, &WriteStartTime);
+         MIL_INT RecordSize = WriteScanResult(&ResultRing, &ResultRecord);
+         MappTimer(M_DEFAULT, M_TIMER_READ, &WriteEndTime);
+
+         // Publish the telemetry of the scan.
+         MIL_DOUBLE NbDefects;
+         for(MIL_INT StageIdx = 0; StageIdx < Pipeline.GetNbStages(); StageIdx++)
+            Telemetry.SetStageLatency(Pipeline.GetStageName(StageIdx), Pipeline.GetStageTime(StageIdx));
+         Telemetry.SetMemory(Pipeline.GetHighWaterMark());
+         if(Succeeded && Pipeline.GetResult("defects.count", &NbDefects))
+            Telemetry.SetNbDefects((MIL_INT)NbDefects);
+         if(Succeeded && Pipeline.GetResult("peaks.count", &NbPeaks))
+            Telemetry.SetNbPeaks((MIL_INT)NbPeaks);
+         Telemetry.Publish(QualityDecision, !Succeeded, QualityDecision == QUALITY_FLAG || QualityDecision == QUALITY_DOWNGRADE);
+
+         // Print the results.
+         if(Succeeded)
+            {
+            MosPrintf(MIL_TEXT("The pipeline ran in %.1f ms.\n"), (EndTime - StartTime) * 1000.0);
+            if(RecordSize > 0)
+               MosPrintf(MIL_TEXT("The %d byte result record was written in %.1f us.\n"), (int)RecordSize, (WriteEndTime - WriteStartTime) * 1000000.0);
+            for(MIL_INT ResultIdx = 0; ResultIdx < 4 && InspectionRecipe.ResultNames[ResultIdx]; ResultIdx++)
+               {
+               MIL_DOUBLE ResultValue;
+               if(Pipeline.GetResult(InspectionRecipe.ResultNames[ResultIdx], &ResultValue))
+                  MosPrintf(MIL_TEXT("   %-16hs %.2f\n"), InspectionRecipe.ResultNames[ResultIdx], ResultValue);
+               }
+            if(QualityDecision == QUALITY_FLAG)
+               MosPrintf(MIL_TEXT("The scan is flagged for review.\n"));
+            else if(QualityDecision == QUALITY_DOWNGRADE)
+               MosPrintf(MIL_TEXT("The results are downgraded because of the scan quality.\n"));
+            MosPrintf(MIL_TEXT("\nPress <Enter> to continue.\n\n"));
+            Telemetry.Pause();
+            ShowImage(MilDisplay, Pipeline.GetBuffer("preview"), true);
+            Telemetry.Resume();
+            }
+         MbufFree(MilValidRegionDepthMap);
+         }
+      else
+         {
+         // Publish the scan as failed, without inspection.
+         ResultRecord.Reset(ScanIdx++, RecipeIdx);
+         ResultRecord.SetQuality(QUALITY_SKIP, QUALITY_REASON_NONE);
+         WriteScanResult(&ResultRing, &ResultRecord);
+         Telemetry.Publish(QUALITY_SKIP, true, false);
+         MosPrintf(MIL_TEXT("The %s pipeline could not be prepared, the inspection is skipped.\n\n"), InspectionRecipe.Name);
+         }
+
+      MbufFree(MilCorrectedWorkColorMap);
+      MbufFree(MilCorrectedWorkDepthMap);
+      }
+
+   for(MIL_INT SlotIdx = 0; SlotIdx < NB_PIPELINED_SCANS; SlotIdx++)
+      FreePipelinedScan(&Scans[SlotIdx]);
+   FreeDepthMapArchive(&DepthMapArchive);
+
+   if(ResultRingOpened)
+      MosPrintf(MIL_TEXT("%d scan result records are in the ring.\n\n"), (int)ResultRing.GetNbRecords());
+   pRecipeCache->pThreadPool->PrintStatistics();
+   }
+
+//*****************************************************************************
+// GetInspection3DApiRecipe. Returns the 3D API recipe of an inspection recipe.
+//*****************************************************************************
+const S3DApiRecipe& GetInspection3DApiRecipe(const SRecipeCache* pRecipeCache, MIL_INT RecipeIdx)
+   {
+   const S3DApiRecipe* p3DApiRecipe = INSPECTION_RECIPES[RecipeIdx].p3DApiRecipe;
+   return p3DApiRecipe ? *p3DApiRecipe : pRecipeCache->DefaultRecipe;
+   }
+
+//*****************************************************************************
+// GetNb3DQueued. Returns the number of scans waiting for or in the 3D
+//                calculation, in all the contexts.
+//*****************************************************************************
+MIL_INT GetNb3DQueued(SRecipeCache* pRecipeCache)
+   {
+   MIL_INT NbQueued = 0;
+   for(MIL_INT ContextIdx = 0; ContextIdx < pRecipeCache->NbContexts; ContextIdx++)
+      {
+      if(pRecipeCache->Contexts[ContextIdx].pCalculator)
+         NbQueued += pRecipeCache->Contexts[ContextIdx].pCalculator->GetNbQueued();
+      }
+   return NbQueued;
+   }
+
+//*****************************************************************************
+// Regression benchmark. The golden values and depth maps are in files of the
+// working directory; set BENCHMARK_RECORD_GOLDEN to true to record new ones.
+//*****************************************************************************
+static const bool    BENCHMARK_RECORD_GOLDEN           = false;
+static const MIL_INT BENCHMARK_NB_RUNS                 = 5;
+static const char*   BENCHMARK_GOLDEN_FILE             = "Chromasens_3DPIXA_M10PP3_Golden.txt";
+static const char*   BENCHMARK_GOLDEN_DEPTH_MAP_FORMAT = "Chromasens_3DPIXA_M10PP3_Golden_%s.cdm";
+
+static const SBenchmarkThresholds BENCHMARK_THRESHOLDS =
+   {
+   0.01,    // Result tolerance, 1%.
+   1.0,     // Depth tolerance, in gray levels.
+   0.001,   // Depth map differing pixels, 0.1%.
+   0.25,    // Time tolerance, 25% slower.
+   0.002,   // Time difference ignored, 2 ms.
+   0.05     // Memory tolerance, 5% larger.
+   };
+
+//*****************************************************************************
+// RegressionBenchmarkExample. Runs both inspection pipelines on the recorded
+//                             data and compares their results, depth maps,
+//                             stage durations and memory with the golden ones.
+//                             Returns false if a regression is found.
+//*****************************************************************************
+bool RegressionBenchmarkExample(MIL_ID MilSystem, MIL_ID MilDigitizer, MIL_ID MilGrabImage, SRecipeCache* pRecipeCache)
+   {
+   MosPrintf(MIL_TEXT("[REGRESSION BENCHMARK]\n\n")
+             MIL_TEXT("Both inspection pipelines are run on the recorded data. Their results,\n")
+             MIL_TEXT("depth maps, stage durations and memory are compared with the golden\n")
+             MIL_TEXT("ones of a previous run.\n\n"));
+
+   CRegressionBenchmark Benchmark(BENCHMARK_THRESHOLDS, BENCHMARK_RECORD_GOLDEN);
+   char GoldenFilePath[MAX_PATH];
+   GetExampleFilePath(GoldenFilePath, BENCHMARK_GOLDEN_FILE);
+   if(BENCHMARK_RECORD_GOLDEN)
+      MosPrintf(MIL_TEXT("This run records the golden values (see BENCHMARK_RECORD_GOLDEN).\n\n"));
+   else if(!Benchmark.LoadGolden(GoldenFilePath))
+      MosPrintf(MIL_TEXT("No golden values were found in %hs, every value fails. Set\n")
+                MIL_TEXT("BENCHMARK_RECORD_GOLDEN to true to record them.\n\n"), GoldenFilePath);
+
+   for(MIL_INT RecipeIdx = 0; RecipeIdx < NB_INSPECTION_RECIPES; RecipeIdx++)
+      {
+      const SInspectionRecipe& InspectionRecipe = INSPECTION_RECIPES[RecipeIdx];
+      S3DApiContext* pContext = SelectRecipe(pRecipeCache, InspectionRecipe.p3DApiRecipe ? *InspectionRecipe.p3DApiRecipe : pRecipeCache->DefaultRecipe);
+      if(!pContext)
+         continue;
+
+      // The values of the inspection are named after its pipeline file.
+      char InspectionName[BENCHMARK_MAX_KEY_LENGTH / 2];
+      strncpy(InspectionName, InspectionRecipe.PipelineFileName, sizeof(InspectionName) - 1);
+      InspectionName[sizeof(InspectionName) - 1] = 0;
+      char* pExtension = strchr(InspectionName, '.');
+      if(pExtension)
+         *pExtension = 0;
+      char Key[BENCHMARK_MAX_KEY_LENGTH];
+
+      // Calculate the 3D data of the recorded scan and compare the depth map.
+      MIL_ID MilCorrectedWorkDepthMap = MbufAlloc2d(MilSystem, pContext->WorkSizeX, pContext->WorkSizeY, 16+M_UNSIGNED, M_IMAGE + M_PROC + M_DISP, M_NULL);
+      MIL_ID MilCorrectedWorkColorMap = MbufAllocColor(MilSystem, 3, pContext->WorkSizeX, pContext->WorkSizeY, 8+M_UNSIGNED, COLOR_MAP_ATTRIBUTE, M_NULL);
+      MIL_DOUBLE StartTime;
+      MIL_DOUBLE EndTime;
+      GrabScan(MilDigitizer, MilGrabImage);
+      MappTimer(M_DEFAULT, M_TIMER_READ, &StartTime);
+      Compute3D(pContext->pCalculator, &MilGrabImage, 1, pContext->MilDisparityImage, pContext->MilRectifiedImage, MilCorrectedWorkDepthMap, MilCorrectedWorkColorMap);
+      MappTimer(M_DEFAULT, M_TIMER_READ, &EndTime);
+      sprintf_s(Key, sizeof(Key), "%s.time.3d", InspectionName);
+      Benchmark.AddValue(Key, EndTime - StartTime, BENCHMARK_TIME);
+      char GoldenDepthMapFileName[MAX_PATH];
+      sprintf_s(GoldenDepthMapFileName, MAX_PATH, BENCHMARK_GOLDEN_DEPTH_MAP_FORMAT, InspectionName);
+      char GoldenDepthMapPath[MAX_PATH];
+      GetExampleFilePath(GoldenDepthMapPath, GoldenDepthMapFileName);
+      sprintf_s(Key, sizeof(Key), "%s.depth", InspectionName);
+      Benchmark.AddDepthMap(Key, MilCorrectedWorkDepthMap, GoldenDepthMapPath);
+
+      // Load and plan the pipeline.
+      CInspectionPipeline Pipeline(PIPELINE_STAGE_TYPES, NB_PIPELINE_STAGE_TYPES);
+      Pipeline.SetThreadPool(pRecipeCache->pThreadPool, THREAD_ROLE_POST_PROCESSING);
+      char PipelineFilePath[MAX_PATH];
+      GetExampleFilePath(PipelineFilePath, InspectionRecipe.PipelineFileName);
+      bool Loaded = Pipeline.LoadFile(PipelineFilePath) || Pipeline.Load(InspectionRecipe.DefaultPipeline);
+      if(Loaded && Pipeline.Plan(MilSystem, &MilCorrectedWorkDepthMap, 1))
+         {
+         sprintf_s(Key, sizeof(Key), "%s.memory", InspectionName);
+         Benchmark.AddValue(Key, (MIL_DOUBLE)Pipeline.GetHighWaterMark(), BENCHMARK_MEMORY);
+
+         // Run the pipeline on the valid region several times and keep the fastest
+         // duration of each stage.
+         SValidRegion ValidRegion;
+         if(!FindValidRegion(MilCorrectedWorkDepthMap, VALID_REGION_MARGIN, &ValidRegion, M_NULL, M_NULL))
+            {
+            ValidRegion.OffsetX = 0;
+            ValidRegion.OffsetY = 0;
+            ValidRegion.SizeX = pContext->WorkSizeX;
+            ValidRegion.SizeY = pContext->WorkSizeY;
+            }
+         MIL_ID MilValidRegionDepthMap = MbufChild2d(MilCorrectedWorkDepthMap, ValidRegion.OffsetX, ValidRegion.OffsetY, ValidRegion.SizeX, ValidRegion.SizeY, M_NULL);
+         MIL_DOUBLE StageTimes[PIPELINE_MAX_STAGES];
+         MIL_DOUBLE PipelineTime = 0.0;
+         bool Succeeded = true;
+
+         // Each run starts from an empty reference surface, so that the results do
+         // not depend on the scans learned before.
+         CReferenceSurface* pReferenceSurface = pContext->pReferenceSurface;
+         CReferenceSurface BenchmarkReferenceSurface;
+         pContext->pReferenceSurface = &BenchmarkReferenceSurface;
+         pContext->RegionOffsetX = ValidRegion.OffsetX;
+         for(MIL_INT RunIdx = 0; RunIdx < BENCHMARK_NB_RUNS && Succeeded; RunIdx++)
+            {
+            BenchmarkReferenceSurface.Reset(pContext->WorkSizeX);
+            MappTimer(M_DEFAULT, M_TIMER_READ, &StartTime);
+            Succeeded = Pipeline.Run(&MilValidRegionDepthMap, 1, pContext);
+            MappTimer(M_DEFAULT, M_TIMER_READ, &EndTime);
+            if(RunIdx == 0 || EndTime - StartTime < PipelineTime)
+               PipelineTime = EndTime - StartTime;
+            for(MIL_INT StageIdx = 0; StageIdx < Pipeline.GetNbStages(); StageIdx++)
+               {
+               if(RunIdx == 0 || Pipeline.GetStageTime(StageIdx) < StageTimes[StageIdx])
+                  StageTimes[StageIdx] = Pipeline.GetStageTime(StageIdx);
+               }
+            }
+         pContext->pReferenceSurface = pReferenceSurface;
+
+         // Add the results and the durations.
+         if(Succeeded)
+            {
+            for(MIL_INT ResultIdx = 0; ResultIdx < 4 && InspectionRecipe.ResultNames[ResultIdx]; ResultIdx++)
+               {
+               MIL_DOUBLE ResultValue;
+               sprintf_s(Key, sizeof(Key), "%s.%s", InspectionName, InspectionRecipe.ResultNames[ResultIdx]);
+               if(Pipeline.GetResult(InspectionRecipe.ResultNames[ResultIdx], &ResultValue))
+                  Benchmark.AddValue(Key, ResultValue, BENCHMARK_RESULT);
+               }
+            for(MIL_INT StageIdx = 0; StageIdx < Pipeline.GetNbStages(); StageIdx++)
+               {
+               sprintf_s(Key, sizeof(Key), "%s.time.%s", InspectionName, Pipeline.GetStageName(StageIdx));
+               Benchmark.AddValue(Key, StageTimes[StageIdx], BENCHMARK_TIME);
+               }
+            sprintf_s(Key, sizeof(Key), "%s.time.pipeline", InspectionName);
+            Benchmark.AddValue(Key, PipelineTime, BENCHMARK_TIME);
+            }
+         else
+            MosPrintf(MIL_TEXT("Unable to run the %s pipeline.\n"), InspectionRecipe.Name);
+         MbufFree(MilValidRegionDepthMap);
+         }
+      else
+         MosPrintf(MIL_TEXT("Unable to load the %s pipeline.\n"), InspectionRecipe.Name);
+
+      MbufFree(MilCorrectedWorkColorMap);
+      MbufFree(MilCorrectedWorkDepthMap);
+      }
+
+   // Print the report and record the golden values if requested.
+   Benchmark.PrintReport();
+   if(Benchmark.IsRecording())
+      {
+      if(Benchmark.SaveGolden(GoldenFilePath))
+         MosPrintf(MIL_TEXT("\nThe golden values are recorded in %hs.\n\n"), GoldenFilePath);
+      else
+         MosPrintf(MIL_TEXT("\nUnable to record the golden values in %hs.\n\n"), GoldenFilePath);
+      return true;
+      }
+   MIL_INT NbFailures = Benchmark.GetNbFailures();
+   if(NbFailures)
+      MosPrintf(MIL_TEXT("\n%d values regressed.\n\n"), (int)NbFailures);
+   else
+      MosPrintf(MIL_TEXT("\nNo regression.\n\n"));
+   return NbFailures == 0;
+   }
+
+//*****************************************************************************
+// Kernel microbenchmark. The synthetic frames are sand-paper-like scenes with
+// depressions; the kernels are run as the pipeline stages run them.
+//*****************************************************************************
+static const MIL_INT KERNEL_BENCHMARK_FRAME_SIZES[][2] = {{2968 - 2 * BORDER_SIZE_X, 2048},
+                                                          {8192, 4096},
+                                                          {16384, 4096}};
+static const MIL_INT KERNEL_BENCHMARK_NB_FRAME_SIZES = sizeof(KERNEL_BENCHMARK_FRAME_SIZES) / sizeof(KERNEL_BENCHMARK_FRAME_SIZES[0]);
+static const MIL_INT KERNEL_BENCHMARK_MAX_THREAD_COUNTS = 8;
+static const MIL_INT KERNEL_BENCHMARK_NB_RUNS = 3;
+
+static const SSyntheticSceneParams KERNEL_BENCHMARK_SCENE =
+   {
+   0, 0,       // Size, set for each frame.
+   32768.0,    // Base level.
+   0.5,        // Tilt in X, per pixel.
+   0.2,        // Tilt in Y, per pixel.
+   2000.0,     // Horizontal curve at the borders.
+   50.0,       // Noise amplitude.
+   0.05,       // Hole fraction.
+   12.0,       // Hole radius.
+   20,         // Number of depressions.
+   3000.0,     // Depression depth.
+   60.0,       // Depression radius.
+   2000.0,     // Peaks per megapixel.
+   1500.0,     // Peak height.
+   6.0,        // Peak radius.
+   1234        // Seed.
+   };
+
+// Kernel of the microbenchmark, a pipeline stage run on one of the frame buffers.
+struct SKernelBenchmark
+   {
+   const char* StageType;
+   const char* ParamName;    // M_NULL if the stage is run with its default parameters.
+   MIL_DOUBLE  ParamValue;
+   MIL_INT     InputIdx;
+   MIL_INT     OutputIdx;
+   };
+
+// Buffers of a microbenchmark frame.
+enum EKernelBenchmarkBuffer
+   {
+   KERNEL_BUFFER_DISPARITY,   // Synthetic disparity.
+   KERNEL_BUFFER_WORLD,       // Filled and calibrated.
+   KERNEL_BUFFER_SURFACE,     // Curve or reference surface corrected.
+   KERNEL_BUFFER_DEFECTS,     // Hysteresis mask.
+   KERNEL_BUFFER_COARSE,      // Resized world.
+   KERNEL_BUFFER_PEAKS,       // Peak mask.
+   KERNEL_BUFFER_DENSITY,     // Local density.
+   KERNEL_NB_BUFFERS
+   };
+
+static const SKernelBenchmark KERNEL_BENCHMARKS[] =
+   {
+   {"pushpull",   M_NULL,   0.0,                                     KERNEL_BUFFER_DISPARITY, KERNEL_BUFFER_WORLD},
+   {"fill",       "size",   (MIL_DOUBLE)PARTICLEBOARD_KERNEL_SIZE,   KERNEL_BUFFER_DISPARITY, KERNEL_BUFFER_WORLD},
+   {"curve",      M_NULL,   0.0,                                     KERNEL_BUFFER_WORLD,     KERNEL_BUFFER_SURFACE},
+   {"reference",  "learn",  0.0,                                     KERNEL_BUFFER_WORLD,     KERNEL_BUFFER_SURFACE},
+   {"hysteresis", "zmult",  PARTICLEBOARD_Z_MULT_FACTOR,             KERNEL_BUFFER_SURFACE,   KERNEL_BUFFER_DEFECTS},
+   {"resize",     "factor", RESIZE_DOWN_FACTOR,                      KERNEL_BUFFER_WORLD,     KERNEL_BUFFER_COARSE},
+   {"peaks",      "height", MIN_PEAK_HEIGHT,                         KERNEL_BUFFER_COARSE,    KERNEL_BUFFER_PEAKS},
+   {"density",    "kernel", (MIL_DOUBLE)LOCAL_DENSITY_KERNEL_SIZE,   KERNEL_BUFFER_PEAKS,     KERNEL_BUFFER_DENSITY}
+   };
+static const MIL_INT NB_KERNEL_BENCHMARKS = sizeof(KERNEL_BENCHMARKS) / sizeof(KERNEL_BENCHMARKS[0]);
+
+//*****************************************************************************
+// KernelMicrobenchmarkExample. Runs the post-processing kernels on synthetic
+//                              frames of increasing size, with an increasing
+//                              number of processing cores, and prints their
+//                              durations and speedups.
+//*****************************************************************************
+void KernelMicrobenchmarkExample(MIL_ID MilSystem, SRecipeCache* pRecipeCache)
+   {
+   MosPrintf(MIL_TEXT("[KERNEL MICROBENCHMARK]\n\n")
+             MIL_TEXT("The post-processing kernels are run on synthetic frames larger than\n")
+             MIL_TEXT("the ones of the camera, limiting MIL to an increasing number of cores.\n\n"));
+
+   // The kernels use the calibration and the 3D API of the default recipe.
+   S3DApiContext* pContext = SelectRecipe(pRecipeCache, pRecipeCache->DefaultRecipe);
+   if(!pContext)
+      return;
+
+   // Get the thread counts to sweep, in powers of two up to the number of cores.
+   MIL_INT NbCores = MappInquireMp(M_DEFAULT, M_CORE_NUM, M_DEFAULT, M_DEFAULT, M_NULL);
+   MIL_INT ThreadCounts[KERNEL_BENCHMARK_MAX_THREAD_COUNTS];
+   MIL_INT NbThreadCounts = 0;
+   for(MIL_INT NbThreads = 1; NbThreads < NbCores && NbThreadCounts < KERNEL_BENCHMARK_MAX_THREAD_COUNTS - 1; NbThreads *= 2)
+      ThreadCounts[NbThreadCounts++] = NbThreads;
+   ThreadCounts[NbThreadCounts++] = NbCores > 1 ? NbCores : 1;
+
+   // The reference kernel learns the synthetic frames in its own reference
+   // surface, until it is ready, then only fits and subtracts it.
+   CReferenceSurface* pReferenceSurface = pContext->pReferenceSurface;
+   CReferenceSurface KernelReferenceSurface;
+   pContext->pReferenceSurface = &KernelReferenceSurface;
+   pContext->RegionOffsetX = 0;
+
+   for(MIL_INT FrameSizeIdx = 0; FrameSizeIdx < KERNEL_BENCHMARK_NB_FRAME_SIZES; FrameSizeIdx++)
+      {
+      MIL_INT SizeX = KERNEL_BENCHMARK_FRAME_SIZES[FrameSizeIdx][0];
+      MIL_INT SizeY = KERNEL_BENCHMARK_FRAME_SIZES[FrameSizeIdx][1];
+      MIL_INT CoarseSizeX = (MIL_INT)(SizeX * RESIZE_DOWN_FACTOR);
+      MIL_INT CoarseSizeY = (MIL_INT)(SizeY * RESIZE_DOWN_FACTOR);
+
+      // Allocate the buffers of the frame.
+      MIL_ID MilBuffers[KERNEL_NB_BUFFERS];
+      MilBuffers[KERNEL_BUFFER_DISPARITY] = MbufAlloc2d(MilSystem, SizeX, SizeY, 16+M_UNSIGNED, M_IMAGE + M_PROC, M_NULL);
+      MilBuffers[KERNEL_BUFFER_WORLD]     = MbufAlloc2d(MilSystem, SizeX, SizeY, 16+M_UNSIGNED, M_IMAGE + M_PROC, M_NULL);
+      MilBuffers[KERNEL_BUFFER_SURFACE]   = MbufAlloc2d(MilSystem, SizeX, SizeY, 16+M_UNSIGNED, M_IMAGE + M_PROC, M_NULL);
+      MilBuffers[KERNEL_BUFFER_DEFECTS]   = MbufAlloc2d(MilSystem, SizeX, SizeY, 8+M_UNSIGNED, M_IMAGE + M_PROC, M_NULL);
+      MilBuffers[KERNEL_BUFFER_COARSE]    = MbufAlloc2d(MilSystem, CoarseSizeX, CoarseSizeY, 16+M_UNSIGNED, M_IMAGE + M_PROC, M_NULL);
+      MilBuffers[KERNEL_BUFFER_PEAKS]     = MbufAlloc2d(MilSystem, CoarseSizeX, CoarseSizeY, 8+M_UNSIGNED, M_IMAGE + M_PROC, M_NULL);
+      MilBuffers[KERNEL_BUFFER_DENSITY]   = MbufAlloc2d(MilSystem, CoarseSizeX, CoarseSizeY, 8+M_UNSIGNED, M_IMAGE + M_PROC, M_NULL);
+      MIL_ID MilColorImage = MbufAllocColor(MilSystem, 3, SizeX, SizeY, 8+M_UNSIGNED, COLOR_MAP_ATTRIBUTE, M_NULL);
+      KernelReferenceSurface.Reset(SizeX);
+
+      // Generate the synthetic scene.
+      MIL_DOUBLE StartTime;
+      MIL_DOUBLE EndTime;
+      SSyntheticSceneParams SceneParams = KERNEL_BENCHMARK_SCENE;
+      SceneParams.SizeX = SizeX;
+      SceneParams.SizeY = SizeY;
+      CSyntheticSceneGenerator SceneGenerator(SceneParams);
+      MappTimer(M_DEFAULT, M_TIMER_READ, &StartTime);
+      SceneGenerator.Generate(MilBuffers[KERNEL_BUFFER_DISPARITY], MilColorImage);
+      MappTimer(M_DEFAULT, M_TIMER_READ, &EndTime);
+      MosPrintf(MIL_TEXT("Frame of %d x %d pixels (%.1f Mpixel), %.1f%% of holes, generated in %.0f ms.\n"),
+                (int)SizeX, (int)SizeY, SizeX * SizeY / 1000000.0, SceneGenerator.GetHoleFraction() * 100.0, (EndTime - StartTime) * 1000.0);
+
+      // Print the header of the table.
+      MosPrintf(MIL_TEXT("   Kernel    "));
+      for(MIL_INT CountIdx = 0; CountIdx < NbThreadCounts; CountIdx++)
+         MosPrintf(MIL_TEXT(" %3d core%s "), (int)ThreadCounts[CountIdx], ThreadCounts[CountIdx] > 1 ? MIL_TEXT("s") : MIL_TEXT(" "));
+      MosPrintf(MIL_TEXT(" Speedup  Mpixel/s\n"));
+
+      for(MIL_INT KernelIdx = 0; KernelIdx < NB_KERNEL_BENCHMARKS; KernelIdx++)
+         {
+         const SKernelBenchmark& Kernel = KERNEL_BENCHMARKS[KernelIdx];
+
+         // Set up the stage of the kernel.
+         SPipelineStage Stage;
+         memset(&Stage, 0, sizeof(Stage));
+         for(MIL_INT TypeIdx = 0; TypeIdx < NB_PIPELINE_STAGE_TYPES; TypeIdx++)
+            {
+            if(strcmp(PIPELINE_STAGE_TYPES[TypeIdx].Name, Kernel.StageType) == 0)
+               Stage.pType = &PIPELINE_STAGE_TYPES[TypeIdx];
+            }
+         if(Kernel.ParamName)
+            {
+            strncpy(Stage.ParamNames[0], Kernel.ParamName, PIPELINE_MAX_NAME_LENGTH - 1);
+            Stage.ParamValues[0] = Kernel.ParamValue;
+            Stage.NbParams = 1;
+            }
+         Stage.NbInputs = 1;
+         Stage.MilInputs[0] = MilBuffers[Kernel.InputIdx];
+         Stage.MilOutput = MilBuffers[Kernel.OutputIdx];
+         Stage.pUserData = pContext;
+
+         // Run it with each thread count and keep its fastest duration.
+         MIL_DOUBLE KernelTimes[KERNEL_BENCHMARK_MAX_THREAD_COUNTS];
+         MosPrintf(MIL_TEXT("   %-10hs"), Kernel.StageType);
+         for(MIL_INT CountIdx = 0; CountIdx < NbThreadCounts; CountIdx++)
+            {
+            MappControlMp(M_DEFAULT, M_CORE_MAX, M_DEFAULT, ThreadCounts[CountIdx], M_NULL);
+            for(MIL_INT RunIdx = 0; RunIdx < KERNEL_BENCHMARK_NB_RUNS; RunIdx++)
+               {
+               PipelineStageThread(&Stage);
+               if(RunIdx == 0 || Stage.RunTime < KernelTimes[CountIdx])
+                  KernelTimes[CountIdx] = Stage.RunTime;
+               }
+            MosPrintf(MIL_TEXT(" %8.1f ms"), KernelTimes[CountIdx] * 1000.0);
+            }
+         MosPrintf(MIL_TEXT(" %7.2f  %8.0f\n"), KernelTimes[0] / KernelTimes[NbThreadCounts - 1],
+                   SizeX * SizeY / KernelTimes[NbThreadCounts - 1] / 1000000.0);
+
+         // The world depth map is calibrated once filled, like by the calibrate stage.
+         if(Kernel.OutputIdx == KERNEL_BUFFER_WORLD)
+            CalibrateDepthMap(MilBuffers[KERNEL_BUFFER_WORLD], pContext->Calibration, 1, PARTICLEBOARD_Z_MULT_FACTOR);
+         }
+      MosPrintf(MIL_TEXT("\n"));
+
+      MbufFree(MilColorImage);
+      for(MIL_INT BufferIdx = 0; BufferIdx < KERNEL_NB_BUFFERS; BufferIdx++)
+         MbufFree(MilBuffers[BufferIdx]);
+      }
+   pContext->pReferenceSurface = pReferenceSurface;
+
+   // Let MIL use all the cores again.
+   MappControlMp(M_DEFAULT, M_CORE_MAX, M_DEFAULT, M_DEFAULT, M_NULL);
+   }
+
+//*****************************************************************************
+// Line rate stress. The line source replays the grabbed frame, or a synthetic
+// depth map of the size of the work area when the 3D calculation is not to be
+// stressed, at the pace of a simulated encoder.
+//*****************************************************************************
+static const bool       LINE_STRESS_USE_SYNTHETIC_SCENE = false;
+static const MIL_INT    LINE_STRESS_NB_FRAME_BUFFERS    = 4;       // One filled, one processed and the others queued.
+static const MIL_INT    LINE_STRESS_NB_SEARCH_STEPS     = 6;
+static const MIL_DOUBLE LINE_STRESS_MAX_MISSED_FRACTION = 0.05;   // Of the frames, for a line rate to be sustained.
+
+// Latency budget of a scan, as a fraction of the frame period. With the deadline
+// scheduler, a scan that would end past its budget is processed at the first
+// degradation level of its recipe expected to fit, and is flagged in the
+// telemetry.
+static const bool       LINE_STRESS_USE_DEADLINE_SCHEDULER = true;
+static const MIL_DOUBLE LINE_STRESS_BUDGET_FRACTION        = 1.0;
+
+static const SLineSourceParams LINE_STRESS_PARAMS =
+   {
+   10000.0,    // Nominal line rate, in lines/s.
+   64,         // Lines per block.
+   0.2,        // Jitter, of the block period.
+   0.002,      // Stall probability, per block.
+   0.020,      // Stall duration, in s.
+   0.002,      // Burst probability, per block.
+   512,        // Burst length, in lines.
+   1.5,        // Burst line rate factor.
+   20,         // Number of frames.
+   QUEUE_DROP_OLDEST,   // Full policy of the ready frames.
+   4321        // Seed.
+   };
+static const MIL_INT LINE_STRESS_NB_SEARCH_FRAMES = 10;
+
+//*****************************************************************************
+// LineRateStressExample. Runs each inspection on frames delivered by a
+//                        simulated line source at the nominal line rate, then
+//                        searches the maximum line rate it sustains.
+//*****************************************************************************
+void LineRateStressExample(MIL_ID MilSystem, MIL_ID MilDigitizer, MIL_ID MilGrabImage, SRecipeCache* pRecipeCache)
+   {
+   MosPrintf(MIL_TEXT("[LINE RATE STRESS]\n\n")
+             MIL_TEXT("The inspections are run on frames delivered line by line by a simulated\n")
+             MIL_TEXT("encoder, with jitter, stalls and bursts. The completed frames wait in a\n")
+             MIL_TEXT("bounded queue; when it is full, the source blocks or a frame is dropped, as\n")
+             MIL_TEXT("set by its full policy, and the consumer counts the frames missing in the\n")
+             MIL_TEXT("sequence. A frame misses its deadline when it is released after the next\n")
+             MIL_TEXT("frame would be completed.\n")
+             MIL_TEXT("With the deadline scheduler, a scan expected to end past its budget is\n")
+             MIL_TEXT("processed at a degraded quality level instead of being held back.\n\n"));
+
+   // Grab the frame to replay.
+   GrabScan(MilDigitizer, MilGrabImage);
+   MIL_INT GrabSizeX = MbufInquire(MilGrabImage, M_SIZE_X, M_NULL);
+   MIL_INT GrabSizeY = MbufInquire(MilGrabImage, M_SIZE_Y, M_NULL);
+
+   // Open the live telemetry, in which the degraded scans are flagged.
+   CTelemetryPublisher Telemetry;
+   if(PUBLISH_TELEMETRY && !Telemetry.Open(TELEMETRY_SHARED_MEMORY))
+      MosPrintf(MIL_TEXT("Unable to open the telemetry shared memory, no telemetry is published.\n\n"));
+
+   CLineSourceSimulator LineSource;
+   for(MIL_INT RecipeIdx = 0; RecipeIdx < NB_INSPECTION_RECIPES; RecipeIdx++)
+      {
+      const SInspectionRecipe& InspectionRecipe = INSPECTION_RECIPES[RecipeIdx];
+      S3DApiContext* pContext = SelectRecipe(pRecipeCache, InspectionRecipe.p3DApiRecipe ? *InspectionRecipe.p3DApiRecipe : pRecipeCache->DefaultRecipe);
+      if(!pContext)
+         continue;
+
+      // Allocate the work images and the frame buffers of the source.
+      MIL_ID MilCorrectedWorkDepthMap = MbufAlloc2d(MilSystem, pContext->WorkSizeX, pContext->WorkSizeY, 16+M_UNSIGNED, M_IMAGE + M_PROC + M_DISP, M_NULL);
+      MIL_ID MilCorrectedWorkColorMap = MbufAllocColor(MilSystem, 3, pContext->WorkSizeX, pContext->WorkSizeY, 8+M_UNSIGNED, COLOR_MAP_ATTRIBUTE, M_NULL);
+      MIL_ID MilSourceImage = MilGrabImage;
+      MIL_ID MilFrameImages[LINE_STRESS_NB_FRAME_BUFFERS];
+      for(MIL_INT FrameIdx = 0; FrameIdx < LINE_STRESS_NB_FRAME_BUFFERS; FrameIdx++)
+         {
+         if(LINE_STRESS_USE_SYNTHETIC_SCENE)
+            MilFrameImages[FrameIdx] = MbufAlloc2d(MilSystem, pContext->WorkSizeX, pContext->WorkSizeY, 16+M_UNSIGNED, M_IMAGE + M_PROC, M_NULL);
+         else
+            MilFrameImages[FrameIdx] = MbufAllocColor(MilSystem, 3, GrabSizeX, GrabSizeY, 8+M_UNSIGNED, M_IMAGE + M_PROC + M_BGR32 + M_PACKED, M_NULL);
+         }
+      if(LINE_STRESS_USE_SYNTHETIC_SCENE)
+         {
+         SSyntheticSceneParams SceneParams = KERNEL_BENCHMARK_SCENE;
+         SceneParams.SizeX = pContext->WorkSizeX;
+         SceneParams.SizeY = pContext->WorkSizeY;
+         MilSourceImage = MbufAlloc2d(MilSystem, pContext->WorkSizeX, pContext->WorkSizeY, 16+M_UNSIGNED, M_IMAGE + M_PROC, M_NULL);
+         CSyntheticSceneGenerator SceneGenerator(SceneParams);
+         SceneGenerator.Generate(MilSourceImage, M_NULL);
+         }
+
+      // Load and plan the pipeline of every degradation level. A level that keeps
+      // the description of the previous level shares its pipeline.
+      SLineStressInspection Inspection;
+      memset(&Inspection, 0, sizeof(Inspection));
+      Inspection.pContext = pContext;
+      Inspection.RecipeIdx = RecipeIdx;
+      Inspection.pSteps = InspectionRecipe.pDegradationSteps;
+      Inspection.pTelemetry = &Telemetry;
+      Inspection.MilCorrectedWorkDepthMap = MilCorrectedWorkDepthMap;
+      Inspection.MilCorrectedWorkColorMap = MilCorrectedWorkColorMap;
+      MIL_INT NbLevels = LINE_STRESS_USE_DEADLINE_SCHEDULER ? InspectionRecipe.NbDegradationSteps : 1;
+      CInspectionPipeline* pOwnedPipelines[DEADLINE_MAX_LEVELS];
+      MIL_INT NbOwnedPipelines = 0;
+      bool Planned = true;
+      for(MIL_INT Level = 0; Level < NbLevels && Planned; Level++)
+         {
+         const char* Description = InspectionRecipe.pDegradationSteps[Level].Pipeline;
+         if(Level > 0 && !Description)
+            {
+            Inspection.pPipelines[Level] = Inspection.pPipelines[Level - 1];
+            continue;
+            }
+         CInspectionPipeline* pPipeline = new CInspectionPipeline(PIPELINE_STAGE_TYPES, NB_PIPELINE_STAGE_TYPES);
+         pOwnedPipelines[NbOwnedPipelines++] = pPipeline;
+         pPipeline->SetThreadPool(pRecipeCache->pThreadPool, THREAD_ROLE_POST_PROCESSING);
+         bool Loaded;
+         if(Description)
+            Loaded = pPipeline->Load(Description);
+         else
+            {
+            char PipelineFilePath[MAX_PATH];
+            GetExampleFilePath(PipelineFilePath, InspectionRecipe.PipelineFileName);
+            Loaded = pPipeline->LoadFile(PipelineFilePath) || pPipeline->Load(InspectionRecipe.DefaultPipeline);
+            }
+         Planned = Loaded && pPipeline->Plan(MilSystem, &MilCorrectedWorkDepthMap, 1);
+         Inspection.pPipelines[Level] = pPipeline;
+         }
+      CDeadlineScheduler Scheduler(NbLevels, 0.0);
+      Inspection.pScheduler = &Scheduler;
+
+      if(Planned)
+         {
+         MIL_INT FrameSizeY = MbufInquire(MilFrameImages[0], M_SIZE_Y, M_NULL);
+         MosPrintf(MIL_TEXT("%s inspection, %d lines per frame from a %hs source, %d degradation level(s):\n"), InspectionRecipe.Name, (int)FrameSizeY,
+                   LINE_STRESS_USE_SYNTHETIC_SCENE ? "synthetic depth map" : "recorded grab", (int)(NbLevels - 1));
+         MosPrintf(MIL_TEXT("   Lines/s  Frames  Dropped  Missed  Degraded  Max queue  Mean queue  Growth (/s)  Latency mean/max (ms)  Stalls  Bursts  Late (ms)\n"));
+
+         // Run at the nominal line rate, then print the scans processed at each
+         // degradation level.
+         SLineSourceParams Params = LINE_STRESS_PARAMS;
+         SLineSourceStatistics Statistics;
+         bool Sustained = RunLineRateStress(&LineSource, Params, MilSourceImage, MilFrameImages, &Inspection, &Statistics);
+         PrintLineRateStressRow(Params, Statistics, Scheduler.GetNbDegradedScans(), Sustained);
+         MosPrintf(MIL_TEXT("\n"));
+         LineSource.GetReadyQueue().PrintStatistics();
+         MosPrintf(MIL_TEXT("   %d frames dropped by the queue, %d missing in the sequence taken.\n\n"),
+                   (int)Statistics.NbDroppedFrames, (int)Statistics.NbLostFrames);
+         if(NbLevels > 1)
+            {
+            Scheduler.PrintStatistics(InspectionRecipe.pDegradationSteps);
+            MosPrintf(MIL_TEXT("\n"));
+            }
+
+         // Search the maximum sustained line rate by bisection, around the line
+         // rate at which the processing alone would keep up.
+         MIL_DOUBLE ServiceLineRate = Statistics.MeanServiceTime > 0 ? FrameSizeY / Statistics.MeanServiceTime : Params.LineRate;
+         MIL_DOUBLE LowLineRate = 0.25 * ServiceLineRate;
+         MIL_DOUBLE HighLineRate = 1.25 * ServiceLineRate;
+         MIL_DOUBLE MaxSustainedLineRate = Sustained ? Params.LineRate : 0.0;
+         Params.NbFrames = LINE_STRESS_NB_SEARCH_FRAMES;
+         for(MIL_INT StepIdx = 0; StepIdx < LINE_STRESS_NB_SEARCH_STEPS; StepIdx++)
+            {
+            Params.LineRate = 0.5 * (LowLineRate + HighLineRate);
+            Sustained = RunLineRateStress(&LineSource, Params, MilSourceImage, MilFrameImages, &Inspection, &Statistics);
+            PrintLineRateStressRow(Params, Statistics, Scheduler.GetNbDegradedScans(), Sustained);
+            if(Sustained)
+               {
+               LowLineRate = Params.LineRate;
+               if(Params.LineRate > MaxSustainedLineRate)
+                  MaxSustainedLineRate = Params.LineRate;
+               }
+            else
+               HighLineRate = Params.LineRate;
+            }
+
+         // The conveyor speed is the line rate times the line pitch of the camera.
+         if(MaxSustainedLineRate > 0)
+            MosPrintf(MIL_TEXT("Maximum sustained line rate: %.0f lines/s, a conveyor speed of %.1f m/min.\n\n"),
+                      MaxSustainedLineRate, MaxSustainedLineRate * pContext->pConfig->resolutionY * 60.0 / 1000.0);
+         else
+            MosPrintf(MIL_TEXT("No line rate down to %.0f lines/s was sustained.\n\n"), HighLineRate);
+         }
+      else
+         MosPrintf(MIL_TEXT("Unable to load the %s pipelines.\n\n"), InspectionRecipe.Name);
+
+      for(MIL_INT PipelineIdx = 0; PipelineIdx < NbOwnedPipelines; PipelineIdx++)
+         delete pOwnedPipelines[PipelineIdx];
+      if(MilSourceImage != MilGrabImage)
+         MbufFree(MilSourceImage);
+      for(MIL_INT FrameIdx = 0; FrameIdx < LINE_STRESS_NB_FRAME_BUFFERS; FrameIdx++)
+         MbufFree(MilFrameImages[FrameIdx]);
+      MbufFree(MilCorrectedWorkColorMap);
+      MbufFree(MilCorrectedWorkDepthMap);
+      }
+   }
+
+//*****************************************************************************
+// RunLineRateStress. Runs the inspection on the frames of the line source until
+//                    it ends. Returns true if the line rate was sustained: no
+//                    frame dropped, few deadlines missed and a queue that did
+//                    not grow by a frame over the run.
+//*****************************************************************************
+bool RunLineRateStress(CLineSourceSimulator* pLineSource, const SLineSourceParams& Params, MIL_ID MilSourceImage, const MIL_ID* pMilFrameImages,
+                       SLineStressInspection* pInspection, SLineSourceStatistics* pStatistics)
+   {
+   S3DApiContext* pContext = pInspection->pContext;
+   CDeadlineScheduler* pScheduler = pInspection->pScheduler;
+   CTelemetryPublisher* pTelemetry = pInspection->pTelemetry;
+
+   // The budget of a scan is a fraction of the frame period at this line rate.
+   MIL_INT FrameSizeY = MbufInquire(pMilFrameImages[0], M_SIZE_Y, M_NULL);
+   pScheduler->SetBudget(LINE_STRESS_BUDGET_FRACTION * FrameSizeY / Params.LineRate);
+   pScheduler->ResetStatistics();
+   if(!pLineSource->Start(MilSourceImage, pMilFrameImages, LINE_STRESS_NB_FRAME_BUFFERS, Params, &THREAD_ROLES[THREAD_ROLE_ACQUISITION]))
+      {
+      memset(pStatistics, 0, sizeof(*pStatistics));
+      return false;
+      }
+
+   MIL_INT FrameIdx;
+   MIL_INT64 NextSequence = 0;
+   while((FrameIdx = pLineSource->TakeFrame()) >= 0)
+      {
+      // Publish the frames missing in the sequence as dropped scans.
+      MIL_INT64 Sequence = pLineSource->GetFrameSequence(FrameIdx);
+      for(; NextSequence < Sequence; NextSequence++)
+         PublishLostScan(pInspection);
+      NextSequence = Sequence + 1;
+
+      MIL_DOUBLE CompletionTime = pLineSource->GetFrameCompletionTime(FrameIdx);
+      MIL_DOUBLE Deadline = pScheduler->GetDeadline(CompletionTime);
+      pTelemetry->BeginScan(pInspection->NextScanIdx++, pInspection->RecipeIdx, CompletionTime);
+      pTelemetry->SetQueueDepth("ready", pLineSource->GetNbReadyFrames());
+
+      // Calculate the 3D data of a grabbed frame; a synthetic frame is already a depth map.
+      MIL_DOUBLE StartTime, EndTime;
+      MIL_ID MilFrameImage = pLineSource->GetFrameImage(FrameIdx);
+      MIL_ID MilDepthMap = MilFrameImage;
+      if(!LINE_STRESS_USE_SYNTHETIC_SCENE)
+         {
+         MappTimer(M_DEFAULT, M_TIMER_READ, &StartTime);
+         Compute3D(pContext->pCalculator, &MilFrameImage, 1, pContext->MilDisparityImage, pContext->MilRectifiedImage,
+                   pInspection->MilCorrectedWorkDepthMap, pInspection->MilCorrectedWorkColorMap);
+         MappTimer(M_DEFAULT, M_TIMER_READ, &EndTime);
+         pTelemetry->SetStageLatency("3d", EndTime - StartTime);
+         MilDepthMap = pInspection->MilCorrectedWorkDepthMap;
+         }
+
+      // Select the degradation level from the time left before the deadline, and
+      // run its pipeline on its part of the valid region.
+      MIL_INT Level = pScheduler->SelectLevel(Deadline);
+      const SDegradationStep& Step = pInspection->pSteps[Level];
+      CInspectionPipeline* pPipeline = pInspection->pPipelines[Level];
+      SValidRegion ValidRegion;
+      bool Succeeded = false;
+      MappTimer(M_DEFAULT, M_TIMER_READ, &StartTime);
+      if(FindValidRegion(MilDepthMap, VALID_REGION_MARGIN, &ValidRegion, M_NULL, M_NULL))
+         {
+         if(Step.RoiFraction < 1.0)
+            {
+            MIL_INT RoiSizeX = (MIL_INT)(Step.RoiFraction * ValidRegion.SizeX);
+            MIL_INT RoiSizeY = (MIL_INT)(Step.RoiFraction * ValidRegion.SizeY);
+            ValidRegion.OffsetX += (ValidRegion.SizeX - RoiSizeX) / 2;
+            ValidRegion.OffsetY += (ValidRegion.SizeY - RoiSizeY) / 2;
+            ValidRegion.SizeX = RoiSizeX > 0 ? RoiSizeX : 1;
+            ValidRegion.SizeY = RoiSizeY > 0 ? RoiSizeY : 1;
+            }
+         MIL_ID MilValidRegionDepthMap = MbufChild2d(MilDepthMap, ValidRegion.OffsetX, ValidRegion.OffsetY, ValidRegion.SizeX, ValidRegion.SizeY, M_NULL);
+         pContext->RegionOffsetX = ValidRegion.OffsetX;
+         Succeeded = pPipeline->Run(&MilValidRegionDepthMap, 1, pContext);
+         MbufFree(MilValidRegionDepthMap);
+         }
+      MappTimer(M_DEFAULT, M_TIMER_READ, &EndTime);
+      pScheduler->Complete(Level, EndTime - StartTime, Deadline, EndTime);
+
+      // Publish the scan; a scan processed below the full quality is flagged.
+      for(MIL_INT StageIdx = 0; Succeeded && StageIdx < pPipeline->GetNbStages(); StageIdx++)
+         pTelemetry->SetStageLatency(pPipeline->GetStageName(StageIdx), pPipeline->GetStageTime(StageIdx));
+      pTelemetry->SetMemory(pPipeline->GetHighWaterMark());
+      pTelemetry->Publish(Level > 0 ? QUALITY_DOWNGRADE : QUALITY_PASS, !Succeeded, Level > 0);
+      pLineSource->ReleaseFrame(FrameIdx);
+      }
+   pLineSource->Stop();
+   pLineSource->GetStatistics(pStatistics);
+   for(; NextSequence < Params.NbFrames; NextSequence++)
+      PublishLostScan(pInspection);
+
+   return pStatistics->NbFrames > 0 &&
+          pStatistics->NbDroppedFrames == 0 &&
+          pStatistics->ReadyQueue.NbBlockedPushes == 0 &&
+          pStatistics->NbMissedDeadlines <= LINE_STRESS_MAX_MISSED_FRACTION * pStatistics->NbFrames &&
+          pStatistics->QueueGrowth * pStatistics->Duration < 1.0;
+   }
+
+//*****************************************************************************
+// PublishLostScan. Publishes a frame of the line source that never reached the
+//                  inspection as a dropped scan.
+//*****************************************************************************
+void PublishLostScan(SLineStressInspection* pInspection)
+   {
+   MIL_DOUBLE CurrentTime;
+   MappTimer(M_DEFAULT, M_TIMER_READ, &CurrentTime);
+   pInspection->pTelemetry->BeginScan(pInspection->NextScanIdx++, pInspection->RecipeIdx, CurrentTime);
+   pInspection->pTelemetry->Publish(QUALITY_SKIP, true, false);
+   }
+
+//*****************************************************************************
+// PrintLineRateStressRow. Prints the statistics of a line rate stress run.
+//*****************************************************************************
+void PrintLineRateStressRow(const SLineSourceParams& Params, const SLineSourceStatistics& Statistics, MIL_INT NbDegradedScans, bool Sustained)
+   {
+   MosPrintf(MIL_TEXT("   %7.0f  %6d  %7d  %6d  %8d  %9d  %10.2f  %11.2f  %10.1f / %-10.1f  %6d  %6d  %9.2f  %hs\n"),
+             Params.LineRate, (int)Statistics.NbFrames, (int)Statistics.NbDroppedFrames, (int)Statistics.NbMissedDeadlines, (int)NbDegradedScans,
+             (int)Statistics.MaxQueueDepth, Statistics.MeanQueueDepth, Statistics.QueueGrowth,
+             Statistics.MeanLatency * 1000.0, Statistics.MaxLatency * 1000.0,
+             (int)Statistics.NbStalls, (int)Statistics.NbBursts, Statistics.MaxLateness * 1000.0,
+             Sustained ? "sustained" : "not sustained");
+   }
+
+//*****************************************************************************
+// Scan sharding. The acquisition process replays the grabbed scan of each
+// recipe in turn; the recipes alternate from one scan to the next.
+//*****************************************************************************
+static const MIL_INT    SCAN_SHARD_NB_WORKERS  = 4;
+static const MIL_INT    SCAN_SHARD_NB_SLOTS    = 8;       // At least one per worker, and some written ahead.
+static const MIL_INT    SCAN_SHARD_NB_SCANS    = 64;
+static const MIL_DOUBLE SCAN_SHARD_SCAN_TIMEOUT = 10.0;   // In s, after which a worker holding a scan is restarted.
+static const MIL_INT    SCAN_SHARD_READY_TIMEOUT = 60000; // In ms, for the workers to initialize their pipelines.
+static const DWORD      SCAN_SHARD_WAIT_PERIOD = 100;     // In ms, between the checks of the workers.
+
+// Fault injection: when enabled, the worker of the scan of sequence number
+// SCAN_SHARD_FAILED_SCAN terminates itself, to show that only this scan is lost.
+static const bool       SCAN_SHARD_INJECT_FAILURE = false;
+static const MIL_INT64  SCAN_SHARD_FAILED_SCAN = 5;
+
+//*****************************************************************************
+// ScanShardingExample. Writes the scans in the ring of the scan sharding,
+//                      inspected by the worker processes, and takes their
+//                      results in sequence order.
+//*****************************************************************************
+void ScanShardingExample(MIL_ID MilSystem, MIL_ID MilDigitizer, MIL_ID MilGrabImage, SRecipeCache* pRecipeCache)
+   {
+   MosPrintf(MIL_TEXT("[SCAN SHARDING]\n\n")
+             MIL_TEXT("The inspections are run by worker processes. This process writes the\n")
+             MIL_TEXT("depth map of each scan in a ring of a shared memory, the workers\n")
+             MIL_TEXT("claim the scans and write their results in the ring, and the results\n")
+             MIL_TEXT("are taken in sequence order. A worker that ends, or holds a scan past\n")
+             MIL_TEXT("its timeout, is restarted and only its scan in flight is lost.\n\n"));
+
+   // Grab the scan to replay and calculate its 3D data with each recipe. The
+   // workers get the calibration of each recipe in the ring, so they do not
+   // initialize the 3D API. The inspections only use the depth maps, so the
+   // color maps are not written in the ring.
+   GrabScan(MilDigitizer, MilGrabImage);
+   MIL_ID MilDepthMaps[NB_INSPECTION_RECIPES];
+   SCalibratedRecipe CalibratedRecipes[NB_INSPECTION_RECIPES];
+   memset(CalibratedRecipes, 0, sizeof(CalibratedRecipes));
+   MIL_INT FrameSizeX = 0;
+   MIL_INT FrameSizeY = 0;
+   for(MIL_INT RecipeIdx = 0; RecipeIdx < NB_INSPECTION_RECIPES; RecipeIdx++)
+      {
+      const SInspectionRecipe& InspectionRecipe = INSPECTION_RECIPES[RecipeIdx];
+      S3DApiContext* pContext = SelectRecipe(pRecipeCache, InspectionRecipe.p3DApiRecipe ? *InspectionRecipe.p3DApiRecipe : pRecipeCache->DefaultRecipe);
+      MilDepthMaps[RecipeIdx] = M_NULL;
+      if(!pContext)
+         continue;
+      CalibratedRecipes[RecipeIdx].Recipe = pContext->Recipe;
+      CalibratedRecipes[RecipeIdx].Calibration = pContext->Calibration;
+      CalibratedRecipes[RecipeIdx].WorkSizeX = (MIL_INT32)pContext->WorkSizeX;
+      CalibratedRecipes[RecipeIdx].WorkSizeY = (MIL_INT32)pContext->WorkSizeY;
+      CalibratedRecipes[RecipeIdx].RecipeId = pContext->RecipeId;
+      MilDepthMaps[RecipeIdx] = MbufAlloc2d(MilSystem, pContext->WorkSizeX, pContext->WorkSizeY, 16+M_UNSIGNED, M_IMAGE + M_PROC, M_NULL);
+      MIL_ID MilColorMap = MbufAllocColor(MilSystem, 3, pContext->WorkSizeX, pContext->WorkSizeY, 8+M_UNSIGNED, COLOR_MAP_ATTRIBUTE, M_NULL);
+      Compute3D(pContext->pCalculator, &MilGrabImage, 1, pContext->MilDisparityImage, pContext->MilRectifiedImage, MilDepthMaps[RecipeIdx], MilColorMap);
+      MbufFree(MilColorMap);
+      if(pContext->WorkSizeX > FrameSizeX)
+         FrameSizeX = pContext->WorkSizeX;
+      if(pContext->WorkSizeY > FrameSizeY)
+         FrameSizeY = pContext->WorkSizeY;
+      }
+
+   // Open the live telemetry, published in sequence order.
+   CTelemetryPublisher Telemetry;
+   if(PUBLISH_TELEMETRY && !Telemetry.Open(TELEMETRY_SHARED_MEMORY))
+      MosPrintf(MIL_TEXT("Unable to open the telemetry shared memory, no telemetry is published.\n\n"));
+
+   // Create the ring and start the workers.
+   CScanShardDispatcher Dispatcher;
+   MIL_INT NbStartedWorkers = 0;
+   if(Dispatcher.Open(SCAN_SHARD_SHARED_MEMORY, SCAN_SHARD_NB_SLOTS, FrameSizeX, FrameSizeY, CalibratedRecipes, sizeof(CalibratedRecipes)))
+      NbStartedWorkers = Dispatcher.StartWorkers(SCAN_SHARD_NB_WORKERS, SCAN_SHARD_SCAN_TIMEOUT);
+   if(NbStartedWorkers > 0)
+      {
+      MosPrintf(MIL_TEXT("Waiting for the worker processes to initialize...\n"));
+      MIL_INT NbReadyWorkers = Dispatcher.WaitForWorkers(SCAN_SHARD_READY_TIMEOUT);
+      MosPrintf(MIL_TEXT("%d of %d worker processes are ready.\n\n"), (int)NbReadyWorkers, (int)SCAN_SHARD_NB_WORKERS);
+
+      // Write each scan once its slot is free, taking the results meanwhile.
+      MIL_DOUBLE StartTime, EndTime;
+      MappTimer(M_DEFAULT, M_TIMER_READ, &StartTime);
+      MIL_INT NbScans = 0;
+      for(MIL_INT ScanIdx = 0; ScanIdx < SCAN_SHARD_NB_SCANS; ScanIdx++)
+         {
+         MIL_INT RecipeIdx = ScanIdx % NB_INSPECTION_RECIPES;
+         if(!MilDepthMaps[RecipeIdx])
+            continue;
+         while(Dispatcher.IsFull())
+            {
+            MergeScanShardResults(&Dispatcher, &Telemetry);
+            Dispatcher.Wait(SCAN_SHARD_WAIT_PERIOD);
+            }
+         Dispatcher.Write(RecipeIdx,
+                          (const void*)MbufInquire(MilDepthMaps[RecipeIdx], M_HOST_ADDRESS, M_NULL), MbufInquire(MilDepthMaps[RecipeIdx], M_PITCH_BYTE, M_NULL),
+                          MbufInquire(MilDepthMaps[RecipeIdx], M_SIZE_X, M_NULL), MbufInquire(MilDepthMaps[RecipeIdx], M_SIZE_Y, M_NULL));
+         NbScans++;
+         MergeScanShardResults(&Dispatcher, &Telemetry);
+         }
+      while(Dispatcher.GetNbPending() > 0)
+         {
+         MergeScanShardResults(&Dispatcher, &Telemetry);
+         if(Dispatcher.GetNbPending() > 0)
+            Dispatcher.Wait(SCAN_SHARD_WAIT_PERIOD);
+         }
+      MappTimer(M_DEFAULT, M_TIMER_READ, &EndTime);
+
+      // The mean time of a scan in a worker times the scan rate is the number of
+      // scans inspected at the same time.
+      MIL_DOUBLE ScanRate = EndTime > StartTime ? NbScans / (EndTime - StartTime) : 0.0;
+      MosPrintf(MIL_TEXT("\n%d scans were inspected in %.2f s, %.1f scans/s; %d were lost.\n"),
+                (int)NbScans, EndTime - StartTime, ScanRate, (int)Dispatcher.GetNbLostScans());
+      Dispatcher.PrintStatistics();
+      MosPrintf(MIL_TEXT("A scan takes %.1f ms in a worker, so %.1f scans were inspected at a time.\n\n"),
+                Dispatcher.GetMeanProcessTime() * 1000.0, Dispatcher.GetMeanProcessTime() * ScanRate);
+      }
+   else
+      MosPrintf(MIL_TEXT("Unable to create the scan shard ring or to start its workers.\n\n"));
+   Dispatcher.Close();
+
+   for(MIL_INT RecipeIdx = 0; RecipeIdx < NB_INSPECTION_RECIPES; RecipeIdx++)
+      if(MilDepthMaps[RecipeIdx])
+         MbufFree(MilDepthMaps[RecipeIdx]);
+   }
+
+//*****************************************************************************
+// MergeScanShardResults. Takes the results of the scan sharding available in
+//                        sequence order and publishes them. Returns the number
+//                        of results taken.
+//*****************************************************************************
+MIL_INT MergeScanShardResults(CScanShardDispatcher* pDispatcher, CTelemetryPublisher* pTelemetry)
+   {
+   MIL_INT NbResults = 0;
+   SScanShardResult Result;
+   while(pDispatcher->TakeResult(&Result))
+      {
+      pTelemetry->BeginScan((MIL_UINT64)Result.Sequence, Result.RecipeIdx, Result.WriteTime);
+      if(Result.Lost)
+         {
+         MosPrintf(MIL_TEXT("Scan %d was lost by worker %d.\n"), (int)Result.Sequence, (int)Result.WorkerIdx);
+         pTelemetry->Publish(QUALITY_SKIP, true, false);
+         }
+      else
+         {
+         pTelemetry->SetStageLatency("worker", Result.ProcessTime);
+         pTelemetry->SetValidCoverage(Result.ValidCoverage);
+         pTelemetry->SetNbDefects(Result.NbDefects);
+         pTelemetry->SetNbPeaks(Result.NbPeaks);
+         pTelemetry->Publish(Result.Decision, !Result.Succeeded, Result.Decision == QUALITY_FLAG || Result.Decision == QUALITY_DOWNGRADE);
+         }
+      NbResults++;
+      }
+   return NbResults;
+   }
+
+//*****************************************************************************
+// ScanShardWorker. Inspects the scans claimed in the ring of the scan sharding
+//                  until the acquisition process stops. Runs instead of the
+//                  examples in a worker process. Returns the exit code.
+//*****************************************************************************
+int ScanShardWorker(MIL_ID MilSystem, MIL_INT WorkerIdx)
+   {
+   CScanShardWorker Worker;
+   if(!Worker.Attach(SCAN_SHARD_SHARED_MEMORY, WorkerIdx))
+      {
+      MosPrintf(MIL_TEXT("Worker %d: unable to open the scan shard ring.\n"), (int)WorkerIdx);
+      return 1;
+      }
+
+   // Give the post-processing workers of this process its share of the cores.
+   SThreadRoleConfig ThreadRoles[NB_THREAD_ROLES];
+   memcpy(ThreadRoles, THREAD_ROLES, sizeof(ThreadRoles));
+   SThreadRoleConfig& PostProcessingRole = ThreadRoles[THREAD_ROLE_POST_PROCESSING];
+   MIL_INT NbCores = GetNbProcessors() - PostProcessingRole.FirstCore;
+   if(NbCores > 0)
+      {
+      MIL_INT NbWorkerCores = NbCores / Worker.GetNbWorkers() > 0 ? NbCores / Worker.GetNbWorkers() : 1;
+      PostProcessingRole.FirstCore += (WorkerIdx * NbWorkerCores) % NbCores;
+      PostProcessingRole.NbCores = NbWorkerCores;
+      }
+
+   // Create the contexts of the recipes from their calibration in the ring,
+   // without the 3D API. Each worker learns its own reference surfaces, which
+   // are not saved.
+   if(Worker.GetUserDataSize() != (MIL_INT)(NB_INSPECTION_RECIPES * sizeof(SCalibratedRecipe)))
+      {
+      MosPrintf(MIL_TEXT("Worker %d: the scan shard ring does not hold the calibration of the recipes.\n"), (int)WorkerIdx);
+      return 1;
+      }
+   SRecipeCache RecipeCache;
+   InitCalibratedRecipeCache(&RecipeCache, MilSystem, (const SCalibratedRecipe*)Worker.GetUserData(), NB_INSPECTION_RECIPES, ThreadRoles);
+
+   // The depth maps are inspected in place in the slots.
+   MIL_ID MilSlotDepthMaps[SCAN_SHARD_MAX_SLOTS];
+   for(MIL_INT SlotIdx = 0; SlotIdx < Worker.GetNbSlots(); SlotIdx++)
+      {
+      MilSlotDepthMaps[SlotIdx] = MbufCreate2d(MilSystem, Worker.GetFrameSizeX(), Worker.GetFrameSizeY(), 16+M_UNSIGNED, M_IMAGE + M_PROC,
+                                               M_HOST_ADDRESS + M_PITCH, Worker.GetPitch(), (void*)Worker.GetDepthMap(SlotIdx), M_NULL);
+      }
+
+   CInspectionPipeline* pPipelines[NB_INSPECTION_RECIPES];
+   memset(pPipelines, 0, sizeof(pPipelines));
+   Worker.SetReady();
+   while(!Worker.IsStopped())
+      {
+      MIL_INT SlotIdx = Worker.Claim(SCAN_SHARD_WAIT_PERIOD);
+      if(SlotIdx < 0)
+         continue;
+      if(SCAN_SHARD_INJECT_FAILURE && Worker.GetSequence(SlotIdx) == SCAN_SHARD_FAILED_SCAN)
+         TerminateProcess(GetCurrentProcess(), 1);
+
+      SScanShardResult Result;
+      MIL_INT RecipeIdx = Worker.GetRecipeIdx(SlotIdx);
+      MIL_ID MilDepthMap = MbufChild2d(MilSlotDepthMaps[SlotIdx], 0, 0, Worker.GetSizeX(SlotIdx), Worker.GetSizeY(SlotIdx), M_NULL);
+      if(RecipeIdx < NB_INSPECTION_RECIPES)
+         InspectScanShard(&RecipeCache, pPipelines, MilDepthMap, RecipeIdx, &Result);
+      else
+         memset(&Result, 0, sizeof(Result));
+      MbufFree(MilDepthMap);
+      Worker.Complete(SlotIdx, Result);
+      }
+
+   for(MIL_INT RecipeIdx = 0; RecipeIdx < NB_INSPECTION_RECIPES; RecipeIdx++)
+      delete pPipelines[RecipeIdx];
+   for(MIL_INT SlotIdx = 0; SlotIdx < Worker.GetNbSlots(); SlotIdx++)
+      MbufFree(MilSlotDepthMaps[SlotIdx]);
+   FreeRecipeCache(&RecipeCache);
+   return 0;
+   }
+
+//*****************************************************************************
+// InspectScanShard. Inspects a scan of the scan sharding like the pipeline
+//                   example: the quality gate, then the pipeline of the recipe
+//                   on the valid region. The contexts of the recipe cache are
+//                   in the order of the inspection recipes. The pipeline of a
+//                   recipe is loaded and planned at its first scan.
+//*****************************************************************************
+void InspectScanShard(SRecipeCache* pRecipeCache, CInspectionPipeline** pPipelines, MIL_ID MilDepthMap, MIL_INT RecipeIdx, SScanShardResult* pResult)
+   {
+   MIL_DOUBLE StartTime, EndTime;
+   MappTimer(M_DEFAULT, M_TIMER_READ, &StartTime);
+   memset(pResult, 0, sizeof(*pResult));
+   const SInspectionRecipe& InspectionRecipe = INSPECTION_RECIPES[RecipeIdx];
+   S3DApiContext* pContext = RecipeIdx < pRecipeCache->NbContexts && pRecipeCache->Contexts[RecipeIdx].WorkSizeX > 0 ? &pRecipeCache->Contexts[RecipeIdx] : NULL;
+   if(pContext && !pPipelines[RecipeIdx])
+      {
+      CInspectionPipeline* pPipeline = new CInspectionPipeline(PIPELINE_STAGE_TYPES, NB_PIPELINE_STAGE_TYPES);
+      pPipeline->SetThreadPool(pRecipeCache->pThreadPool, THREAD_ROLE_POST_PROCESSING);
+      char PipelineFilePath[MAX_PATH];
+      GetExampleFilePath(PipelineFilePath, InspectionRecipe.PipelineFileName);
+      if((pPipeline->LoadFile(PipelineFilePath) || pPipeline->Load(InspectionRecipe.DefaultPipeline)) &&
+         pPipeline->Plan(pRecipeCache->MilSystem, &MilDepthMap, 1))
+         pPipelines[RecipeIdx] = pPipeline;
+      else
+         delete pPipeline;
+      }
+
+   // Evaluate the quality of the scan, then run the pipeline on its valid region.
+   SScanQuality ScanQuality;
+   CScanQualityGate QualityGate(QUALITY_GATE_THRESHOLDS);
+   pResult->Decision = (MIL_UINT32)QualityGate.Evaluate(MilDepthMap, &ScanQuality);
+   pResult->ValidCoverage = ScanQuality.Coverage;
+   SValidRegion ValidRegion;
+   CInspectionPipeline* pPipeline = pPipelines[RecipeIdx];
+   if(pContext && pPipeline && pResult->Decision != QUALITY_SKIP && FindValidRegion(MilDepthMap, VALID_REGION_MARGIN, &ValidRegion, M_NULL, M_NULL))
+      {
+      MIL_ID MilValidRegionDepthMap = MbufChild2d(MilDepthMap, ValidRegion.OffsetX, ValidRegion.OffsetY, ValidRegion.SizeX, ValidRegion.SizeY, M_NULL);
+      pContext->RegionOffsetX = ValidRegion.OffsetX;
+      pResult->Succeeded = pPipeline->Run(&MilValidRegionDepthMap, 1, pContext) ? 1 : 0;
+      MbufFree(MilValidRegionDepthMap);
+
+      MIL_DOUBLE ResultValue;
+      if(pResult->Succeeded && pPipeline->GetResult("defects.count", &ResultValue))
+         pResult->NbDefects = (MIL_UINT32)ResultValue;
+      if(pResult->Succeeded && pPipeline->GetResult("peaks.count", &ResultValue))
+         pResult->NbPeaks = (MIL_UINT32)ResultValue;
+      }
+   MappTimer(M_DEFAULT, M_TIMER_READ, &EndTime);
+   pResult->ProcessTime = EndTime - StartTime;
+   }
+
+//*****************************************************************************
+// WriteScanResult. Finishes the result record of a scan and appends it to the
+//                  ring. Returns the size of the record, 0 if it was not written.
+//*****************************************************************************
+MIL_INT WriteScanResult(CScanResultRing* pResultRing, CScanResultRecord* pResultRecord)
+   {
+   MIL_INT RecordSize;
+   const MIL_UINT8* pRecord = pResultRecord->Finish(&RecordSize);
+   return pResultRing->Write(pRecord, RecordSize) ? RecordSize : 0;
+   }
+
+//*****************************************************************************
+// InitDepthMapArchive. Initializes the archive without buffers; they are
+//                      allocated at the first scan and kept for the next ones.
+//                      The tiles are coded by the post-processing workers.
+//*****************************************************************************
+void InitDepthMapArchive(SDepthMapArchive* pArchive, CPipelineThreadPool* pThreadPool)
+   {
+   pArchive->Codec.SetThreadPool(pThreadPool, THREAD_ROLE_POST_PROCESSING);
+   pArchive->pStream = NULL;
+   pArchive->StreamCapacity = 0;
+   pArchive->pDecodedData = NULL;
+   pArchive->DecodedCapacity = 0;
+   pArchive->NbArchived = 0;
+   }
+
+//*****************************************************************************
+// ArchiveDepthMap. Compresses the depth map without loss and writes it to the
+//                  archive file, if any. Every DEPTH_MAP_ARCHIVE_VERIFY_PERIOD
+//                  scans, starting with the first, the map is also restored and
+//                  compared with the original; it is not archived if it differs.
+//                  Returns the size of the compressed map, 0 on failure.
+//*****************************************************************************
+MIL_INT ArchiveDepthMap(SDepthMapArchive* pArchive, MIL_ID MilDepthMap, const char* ArchiveFilePath)
+   {
+   MIL_INT SizeX = MbufInquire(MilDepthMap, M_SIZE_X, M_NULL);
+   MIL_INT SizeY = MbufInquire(MilDepthMap, M_SIZE_Y, M_NULL);
+   MIL_INT Pitch = MbufInquire(MilDepthMap, M_PITCH, M_NULL);
+   const MIL_UINT16* pData = (const MIL_UINT16*)MbufInquire(MilDepthMap, M_HOST_ADDRESS, M_NULL);
+   MIL_INT MaxStreamSize = CDepthMapCodec::GetMaxEncodedSize(SizeX, SizeY);
+   if(pArchive->StreamCapacity < MaxStreamSize)
+      {
+      delete [] pArchive->pStream;
+      pArchive->pStream = new MIL_UINT8[MaxStreamSize];
+      pArchive->StreamCapacity = MaxStreamSize;
+      }
+   bool Verify = DEPTH_MAP_ARCHIVE_VERIFY_PERIOD > 0 && pArchive->NbArchived % DEPTH_MAP_ARCHIVE_VERIFY_PERIOD == 0;
+   pArchive->NbArchived++;
+
+   // Compress the depth map.
+   MIL_DOUBLE StartTime;
+   MIL_DOUBLE EncodedTime;
+   MIL_DOUBLE DecodedTime;
+   MappTimer(M_DEFAULT, M_TIMER_READ, &StartTime);
+   MIL_INT StreamSize = pArchive->Codec.Encode(pData, SizeX, SizeY, Pitch, pArchive->pStream, MaxStreamSize);
+   MappTimer(M_DEFAULT, M_TIMER_READ, &EncodedTime);
+   DecodedTime = EncodedTime;
+
+   // Decompress it and compare it with the original, if the scan is verified.
+   bool Identical = StreamSize > 0;
+   if(Identical && Verify)
+      {
+      if(pArchive->DecodedCapacity < SizeX * SizeY)
+         {
+         delete [] pArchive->pDecodedData;
+         pArchive->pDecodedData = new MIL_UINT16[SizeX * SizeY];
+         pArchive->DecodedCapacity = SizeX * SizeY;
+         }
+      Identical = pArchive->Codec.Decode(pArchive->pStream, StreamSize, pArchive->pDecodedData, SizeX);
+      MappTimer(M_DEFAULT, M_TIMER_READ, &DecodedTime);
+      for(MIL_INT y = 0; y < SizeY && Identical; y++)
+         Identical = memcmp(pData + y * Pitch, pArchive->pDecodedData + y * SizeX, SizeX * sizeof(MIL_UINT16)) == 0;
+      }
+
+   MIL_DOUBLE RawSize = (MIL_DOUBLE)(SizeX * SizeY * sizeof(MIL_UINT16));
+   if(Identical)
+      {
+      MosPrintf(MIL_TEXT("The depth map was compressed %.2f:1 in %.1f ms (%.2f GB/s)"),
+                RawSize / StreamSize, (EncodedTime - StartTime) * 1000.0, RawSize / (EncodedTime - StartTime) / 1e9);
+      if(Verify)
+         MosPrintf(MIL_TEXT(" and restored exactly in %.1f ms (%.2f GB/s)"), (DecodedTime - EncodedTime) * 1000.0, RawSize / (DecodedTime - EncodedTime) / 1e9);
+      MosPrintf(MIL_TEXT(".\n"));
+
+      // Write the archive file.
+      FILE* pFile = NULL;
+      if(ArchiveFilePath && fopen_s(&pFile, ArchiveFilePath, "wb") == 0 && pFile != NULL)
+         {
+         if(fwrite(pArchive->pStream, 1, StreamSize, pFile) == (size_t)StreamSize)
+            MosPrintf(MIL_TEXT("It is archived in %hs.\n"), ArchiveFilePath);
+         fclose(pFile);
+         }
+      else if(ArchiveFilePath)
+         MosPrintf(MIL_TEXT("Unable to write the archive file %hs.\n"), ArchiveFilePath);
+      }
+   else
+      {
+      MosPrintf(MIL_TEXT("The depth map is not restored exactly by its compression, it is not archived.\n"));
+      StreamSize = 0;
+      }
+   return StreamSize;
+   }
+
+//*****************************************************************************
+// FreeDepthMapArchive. Frees the buffers of the archive.
+//*****************************************************************************
+void FreeDepthMapArchive(SDepthMapArchive* pArchive)
+   {
+   delete [] pArchive->pDecodedData;
+   delete [] pArchive->pStream;
+   InitDepthMapArchive(pArchive, NULL);
+   }
+
+//*****************************************************************************
+// FillStage. Pipeline stage that fills the holes of the depth map.
+//    size: Size of the fill kernel.
+//*****************************************************************************
+void FillStage(SPipelineStage* pStage, void* pUserData)
+   {
+   FillHolesAndSmooth(M_NULL, pStage->MilInputs[0], pStage->MilOutput, (MIL_INT)GetStageParam(pStage, "size", 51));
+   }
+
+//*****************************************************************************
+// PushPullStage. Pipeline stage that fills the holes of any size of the depth
+//                map by push-pull interpolation, in the pyramid of the context.
+//    smoothing:   Number of pyramid levels replaced by their interpolation.
+//    maxdistance: Maximum fill distance in pixels, 0 to fill every hole.
+//*****************************************************************************
+void PushPullStage(SPipelineStage* pStage, void* pUserData)
+   {
+   S3DApiContext* pContext = (S3DApiContext*)pUserData;
+   FillHolesPushPull(&pContext->HoleFiller, pStage->MilInputs[0], pStage->MilOutput, (MIL_INT)GetStageParam(pStage, "smoothing", 0), (MIL_INT)GetStageParam(pStage, "maxdistance", 0));
+   }
+
+//*****************************************************************************
+// CalibrateStage. Pipeline stage that calibrates the depth map.
+//    zmult:  Z multiplication factor.
+//    xymult: Pixel size multiplication factor, for a map resized from the scan.
+//*****************************************************************************
+void CalibrateStage(SPipelineStage* pStage, void* pUserData)
+   {
+   S3DApiContext* pContext = (S3DApiContext*)pUserData;
+   if(pStage->MilInputs[0] != pStage->MilOutput)
+      MbufCopy(pStage->MilInputs[0], pStage->MilOutput);
+   MIL_DOUBLE ZRange = CalibrateDepthMap(pStage->MilOutput, pContext->Calibration, GetStageParam(pStage, "xymult", 1.0), GetStageParam(pStage, "zmult", 1.0));
+   SetStageResult(pStage, "zrange", ZRange);
+   }
+
+//*****************************************************************************
+// PlaneStage. Pipeline stage that fits a plane and subtracts it.
+//    outlier: Outlier distance, as a factor of the Z range.
+//*****************************************************************************
+void PlaneStage(SPipelineStage* pStage, void* pUserData)
+   {
+   MIL_ID MilSystem = MbufInquire(pStage->MilInputs[0], M_OWNER_SYSTEM, M_NULL);
+   MIL_ID MilPlaneFit = M3dmapAlloc(MilSystem, M_GEOMETRY, M_DEFAULT, M_NULL);
+
+   // Calculate a plane on the data. 
+   MIL_DOUBLE GrayLevelSizeZ;
+   McalInquire(pStage->MilInputs[0], M_GRAY_LEVEL_SIZE_Z, &GrayLevelSizeZ);
+   MIL_DOUBLE ZRange = GrayLevelSizeZ * 65535;
+   if(ZRange < 0)
+      ZRange = -ZRange;
+   M3dmapSetGeometry(MilPlaneFit, M_PLANE, M_FIT, (MIL_DOUBLE)pStage->MilInputs[0], M_NULL, ZRange * GetStageParam(pStage, "outlier", 0.1), M_DEFAULT, M_DEFAULT); 
+
+   // Remove the plane from the depth map.
+   if(pStage->MilInputs[0] != pStage->MilOutput)
+      McalAssociate(pStage->MilInputs[0], pStage->MilOutput, M_DEFAULT);
+   M3dmapArith(pStage->MilInputs[0], MilPlaneFit, pStage->MilOutput, M_NULL, M_SUB, M_SET_WORLD_OFFSET_Z);
+
+   M3dmapFree(MilPlaneFit);
+   }
+
+//*****************************************************************************
+// CurveStage. Pipeline stage that corrects the horizontal curve.
+//    offsety, sizey: Rows used to estimate the curve.
+//*****************************************************************************
+void CurveStage(SPipelineStage* pStage, void* pUserData)
+   {
+   if(pStage->MilInputs[0] != pStage->MilOutput)
+      {
+      MbufCopy(pStage->MilInputs[0], pStage->MilOutput);
+      McalAssociate(pStage->MilInputs[0], pStage->MilOutput, M_DEFAULT);
+      }
+
+   // Clip the estimation rows to the image, which can be a region of the scan.
+   MIL_INT SizeY = MbufInquire(pStage->MilOutput, M_SIZE_Y, M_NULL);
+   MIL_INT ChildOffsetY = (MIL_INT)GetStageParam(pStage, "offsety", (MIL_DOUBLE)HORIZONTAL_CURVE_CORRECTION_CHILD_OFFSET_Y);
+   MIL_INT ChildSizeY = (MIL_INT)GetStageParam(pStage, "sizey", (MIL_DOUBLE)HORIZONTAL_CURVE_CORRECTION_CHILD_SIZE_Y);
+   if(ChildOffsetY > SizeY - 1)
+      ChildOffsetY = SizeY - 1;
+   if(ChildOffsetY + ChildSizeY > SizeY)
+      ChildSizeY = SizeY - ChildOffsetY;
+   CorrectHorizontalCurve(pStage->MilOutput, ChildOffsetY, ChildSizeY);
+   }
+
+//*****************************************************************************
+// ReferenceStage. Pipeline stage that subtracts the reference surface and the
+//                 fitted plane of the scan, in place of the plane and curve
+//                 stages.
+//    outlier: Outlier distance, as a factor of the Z range.
+//    learn:   1 to learn the flat scans in the reference surface.
+//*****************************************************************************
+void ReferenceStage(SPipelineStage* pStage, void* pUserData)
+   {
+   S3DApiContext* pContext = (S3DApiContext*)pUserData;
+   SReferenceSurfaceFit Fit;
+   if(!SubtractReferenceSurface(pContext->pReferenceSurface, pStage->MilInputs[0], pStage->MilOutput, pContext->RegionOffsetX,
+                                GetStageParam(pStage, "outlier", 0.1), GetStageParam(pStage, "learn", 1) != 0, &Fit))
+      {
+      MosPrintf(MIL_TEXT("The region is out of the reference surface, the scan fails.\n"));
+      FailStage(pStage);
+      return;
+      }
+   SetStageResult(pStage, "offset", Fit.Offset);
+   SetStageResult(pStage, "tiltx", Fit.TiltX);
+   SetStageResult(pStage, "tilty", Fit.TiltY);
+   SetStageResult(pStage, "outliers", Fit.OutlierFraction);
+   SetStageResult(pStage, "scans", (MIL_DOUBLE)pContext->pReferenceSurface->GetNbScans());
+   }
+
+//*****************************************************************************
+// HysteresisStage. Pipeline stage that extracts the depressions with an
+//                  hysteresis threshold defined in world units. The output
+//                  mask is 255 on the defects.
+//    low, high: Thresholds in mm.
+//    zmult:     Z multiplication factor of the calibration.
+//*****************************************************************************
+void HysteresisStage(SPipelineStage* pStage, void* pUserData)
+   {
+   S3DApiContext* pContext = (S3DApiContext*)pUserData;
+   MIL_ID MilSystem = MbufInquire(pStage->MilInputs[0], M_OWNER_SYSTEM, M_NULL);
+   MIL_DOUBLE ZMultFactor = GetStageParam(pStage, "zmult", 1.0);
+
+   // Get the gray value of the thresholds.
+   MIL_DOUBLE WorldPosZ;
+   MIL_DOUBLE GrayLevelSizeZ;
+   McalInquire(pStage->MilInputs[0], M_WORLD_POS_Z, &WorldPosZ);
+   McalInquire(pStage->MilInputs[0], M_GRAY_LEVEL_SIZE_Z, &GrayLevelSizeZ);
+   MIL_DOUBLE ThresholdLowGray  = (GetStageParam(pStage, "low", DEFECT_THRESHOLD_LOW) * ZMultFactor - WorldPosZ) / GrayLevelSizeZ;
+   MIL_DOUBLE ThresholdHighGray = (GetStageParam(pStage, "high", DEFECT_THRESHOLD_HIGH) * ZMultFactor - WorldPosZ) / GrayLevelSizeZ;
+
+   // Allocate blob objects.
+   MIL_ID MilBlobResult;
+   MIL_ID MilBlobContext;
+   MblobAlloc(MilSystem, M_DEFAULT, M_DEFAULT, &MilBlobContext);
+   MblobAllocResult(MilSystem, M_DEFAULT, M_DEFAULT, &MilBlobResult);
+   MblobControl(MilBlobContext, M_MIN_PIXEL, M_ENABLE);
+   if(pContext->pScanResultRecord)
+      MblobControl(MilBlobContext, M_BOX, M_ENABLE);
+
+   // Get the possible defects and perform seed reconstruction using blob.
+   MimBinarize(pStage->MilInputs[0], pStage->MilOutput, M_FIXED + M_LESS, ThresholdLowGray, M_NULL);
+   MblobCalculate(MilBlobContext, pStage->MilOutput, pStage->MilInputs[0], MilBlobResult);
+   MblobSelect(MilBlobResult, M_INCLUDE_ONLY, M_MIN_PIXEL, M_LESS, ThresholdHighGray, M_NULL);
+
+   // Keep every defect in the result record of the scan.
+   if(pContext->pScanResultRecord)
+      pContext->pScanResultRecord->SetDefects(MilBlobResult, WorldPosZ, GrayLevelSizeZ, ZMultFactor);
+
+   // Remove the excluded blobs from the mask.
+   MIL_INT NbDefects;
+   MblobGetResult(MilBlobResult, M_GENERAL, M_NUMBER + M_TYPE_MIL_INT, &NbDefects);
+   MIL_ID MilGraphicsContext = MgraAlloc(MilSystem, M_NULL);
+   MgraColor(MilGraphicsContext, 0);
+   MblobDraw(MilGraphicsContext, MilBlobResult, pStage->MilOutput, M_DRAW_BLOBS, M_EXCLUDED_BLOBS, M_DEFAULT);
+   SetStageResult(pStage, "count", (MIL_DOUBLE)NbDefects);
+
+   MgraFree(MilGraphicsContext);
+   MblobFree(MilBlobContext);
+   MblobFree(MilBlobResult);
+   }
+
+//*****************************************************************************
+// ResizeStage. Pipeline stage that subsamples an image.
+//    factor:  Resize factor.
+//    nearest: 1 to subsample without averaging, which keeps the invalid pixels
+//             of a depth map invalid.
+//*****************************************************************************
+void ResizeStage(SPipelineStage* pStage, void* pUserData)
+   {
+   MIL_DOUBLE Factor = GetStageParam(pStage, "factor", 1.0);
+   MimResize(pStage->MilInputs[0], pStage->MilOutput, Factor, Factor, GetStageParam(pStage, "nearest", 0) != 0 ? M_NEAREST_NEIGHBOR : M_AVERAGE);
+   }
+
+//*****************************************************************************
+// PeaksStage. Pipeline stage that locates the valid peaks of a subsampled
+//             depth map. The output mask is 1 on the peaks.
+//    height: Minimum peak height in mm.
+//*****************************************************************************
+void PeaksStage(SPipelineStage* pStage, void* pUserData)
+   {
+   S3DApiContext* pContext = (S3DApiContext*)pUserData;
+   MIL_INT SizeX = MbufInquire(pStage->MilInputs[0], M_SIZE_X, M_NULL);
+   MIL_INT SizeY = MbufInquire(pStage->MilInputs[0], M_SIZE_Y, M_NULL);
+   MIL_INT MaxNbEvents = SizeX * SizeY / 9;
+   MIL_INT* pValidCoordX = new MIL_INT[MaxNbEvents];
+   MIL_INT* pValidCoordY = new MIL_INT[MaxNbEvents];
+
+   // The stage runs beside the other stages of its level, so the zones of
+   // influence are reduced serially.
+   MIL_INT NbValidPeak = FindValidPeaks(pStage->MilInputs[0], pContext->Calibration, GetStageParam(pStage, "height", MIN_PEAK_HEIGHT), NULL, pValidCoordX, pValidCoordY);
+   MbufClear(pStage->MilOutput, 0);
+   if(NbValidPeak > 0)
+      {
+      MgraColor(M_DEFAULT, 1);
+      MgraDots(M_DEFAULT, pStage->MilOutput, NbValidPeak, pValidCoordX, pValidCoordY, M_DEFAULT);
+      }
+   SetStageResult(pStage, "count", (MIL_DOUBLE)(NbValidPeak > 0 ? NbValidPeak : 0));
+
+   delete [] pValidCoordY;
+   delete [] pValidCoordX;
+   }
+
+//*****************************************************************************
+// DensityStage. Pipeline stage that calculates the local peak density from
+//               the peak mask.
+//    subsampling: Subsampling factor of the peak mask.
+//    kernel:      Size of the local density kernel.
+//*****************************************************************************
+void DensityStage(SPipelineStage* pStage, void* pUserData)
+   {
+   S3DApiContext* pContext = (S3DApiContext*)pUserData;
+   MIL_ID MilSystem = MbufInquire(pStage->MilInputs[0], M_OWNER_SYSTEM, M_NULL);
+   MIL_INT SizeX = MbufInquire(pStage->MilInputs[0], M_SIZE_X, M_NULL);
+   MIL_INT SizeY = MbufInquire(pStage->MilInputs[0], M_SIZE_Y, M_NULL);
+   MIL_DOUBLE LocalPixelSize = pContext->Calibration.PixelSizeX / GetStageParam(pStage, "subsampling", RESIZE_DOWN_FACTOR);
+
+   // Count the peaks.
+   MIL_ID MilStatContext = MimAlloc(MilSystem, M_STATISTICS_CONTEXT, M_DEFAULT, M_NULL);
+   MimControl(MilStatContext, M_STAT_SUM, M_ENABLE);
+   MIL_ID MilStatResult = MimAllocResult(MilSystem, M_DEFAULT, M_STATISTICS_RESULT, M_NULL);
+   MimStatCalculate(MilStatContext, pStage->MilInputs[0], MilStatResult, M_DEFAULT);
+   MIL_DOUBLE NbPeaks;
+   MimGetResult(MilStatResult, M_STAT_SUM, &NbPeaks);
+   MimFree(MilStatResult);
+   MimFree(MilStatContext);
+
+   // Calculate the global peak density in peak/cm^2 and the local density.
+   SetStageResult(pStage, "global", 100 * NbPeaks / (SizeX * SizeY * LocalPixelSize * LocalPixelSize));
+   SetStageResult(pStage, "max", CalculateLocalDensity(pStage->MilInputs[0], pStage->MilOutput, LocalPixelSize, (MIL_INT)GetStageParam(pStage, "kernel", (MIL_DOUBLE)LOCAL_DENSITY_KERNEL_SIZE)));
+   }
+
+//*****************************************************************************
+// GrabImage. Grabs the image from the 3DPIXA.
+//*****************************************************************************
+void GrabImage(I3DApi* p3DApi, MIL_ID* pMilDisplays, MIL_ID* pMilDigitizers, MIL_ID* pMilGrabImages, MIL_INT NbCamera)
+   {
+   MIL_CONST_TEXT_PTR ImageText = NbCamera == 1 ? MIL_TEXT("An image") : MIL_TEXT("Two images");
+   if(SYSTEM_TO_USE == 0)
+      {
+      MosPrintf(MIL_TEXT("%s, grabbed with the the 3DPIXA camera, will be loaded.\n\n")
+                MIL_TEXT("Press <Enter> to grab.\n\n"),
+                ImageText);
+      }
+   else
+      {
+      MosPrintf(MIL_TEXT("%s will be grabbed with the the 3DPIXA camera.\n\n")
+                MIL_TEXT("Press <Enter> to grab.\n\n"),
+                ImageText);
+      }   
+   MosGetch();
+
+   // Start thread to generate movement of the object and send the trigger to the frame grabber.
+   MIL_ID MilSystem = MdigInquire(pMilDigitizers[0], M_OWNER_SYSTEM, M_NULL);
+   MIL_ID MilStartScanThread = MthrAlloc(MilSystem, M_THREAD, M_DEFAULT, StartScan, (void*)&THREAD_ROLES[THREAD_ROLE_ACQUISITION], M_NULL);
+
+   // Set the second digitizer to be asynchronous and start the grab.
+   if(NbCamera == 2)
+      {
+      if(SYSTEM_TO_USE != 0)
+         MdigControl(pMilDigitizers[1], M_GRAB_MODE, M_ASYNCHRONOUS);
+      MdigGrab(pMilDigitizers[1], pMilGrabImages[1]);
+      }
+   MdigGrab(pMilDigitizers[0], pMilGrabImages[0]);
+
+   // Free the thread.
+   MthrFree(MilStartScanThread);
+
+   // Show the grabbed image.
+   MosPrintf(MIL_TEXT("The displayed image was grabbed with the 3DPIXA camera.\n\n")
+             MIL_TEXT("Press <Enter> to continue.\n\n"));
+   ShowImage(pMilDisplays[0], pMilGrabImages[0], false);
+   if(NbCamera == 2)
+      {
+      MosPrintf(MIL_TEXT("The displayed image was grabbed with the 3DPIXA camera.\n\n")
+                MIL_TEXT("Press <Enter> to continue.\n\n"));
+      ShowImage(pMilDisplays[1], pMilGrabImages[1], false);
+      }
+   }
+
+//*****************************************************************************
+// Calculate3D. Calculates the 3D data with the CS3D API.
+//*****************************************************************************
+void Calculate3D(CAsync3DCalculator* pCalculator, MIL_ID* pMilDisplays, MIL_ID* pMilSrcImages, MIL_INT NbSrcImage, MIL_ID MilDisparityImage, MIL_ID MilRectifiedImage, MIL_ID MilCorrectedWorkDepthMap, MIL_ID MilCorrectedWorkColorMap)
+      {
+   // Calculate the 3D data and get the resulting images.
+   MosPrintf(MIL_TEXT("CS3D: Loading the images in the CS3D API and calculating the depth map..."));
+   if(Compute3D(pCalculator, pMilSrcImages, NbSrcImage, MilDisparityImage, MilRectifiedImage, MilCorrectedWorkDepthMap, MilCorrectedWorkColorMap))
+      MosPrintf(MIL_TEXT("Done\n\n"));
+   else
+      MosPrintf(MIL_TEXT("Image info not acceptable for calculation.\n\n"));
+
+   // Show the disparity image.
+   MosPrintf(MIL_TEXT("The depth map is displayed.\n\n")
+             MIL_TEXT("Press <Enter> to continue.\n\n"));
+   if(NbSrcImage == 2)
+      MdispSelect(pMilDisplays[1], M_NULL);
+   ShowImage(pMilDisplays[0], MilCorrectedWorkDepthMap, true);
+   }
+
+//*****************************************************************************
+// GrabScan. Grabs the image from the 3DPIXA without user interaction.
+//*****************************************************************************
+void GrabScan(MIL_ID MilDigitizer, MIL_ID MilGrabImage)
+   {
+   // Start thread to generate movement of the object and send the trigger to the frame grabber.
+   MIL_ID MilSystem = MdigInquire(MilDigitizer, M_OWNER_SYSTEM, M_NULL);
+   MIL_ID MilStartScanThread = MthrAlloc(MilSystem, M_THREAD, M_DEFAULT, StartScan, (void*)&THREAD_ROLES[THREAD_ROLE_ACQUISITION], M_NULL);
+   MdigGrab(MilDigitizer, MilGrabImage);
+   MthrFree(MilStartScanThread);
+   }
+
+//*****************************************************************************
+// Submit3D. Submits the source images to the asynchronous 3D calculation of the
+//           CS3D API. The outputs are written in the disparity and rectified
+//           images. Returns the identifier of the request.
+//*****************************************************************************
+MIL_INT Submit3D(CAsync3DCalculator* pCalculator, MIL_ID* pMilSrcImages, MIL_INT NbSrcImage, MIL_ID MilDisparityImage, MIL_ID MilRectifiedImage)
+   {
+   SAsync3DRequest Request;
+   Request.NbSrc = NbSrcImage;
+   for(MIL_INT SrcIdx = 0; SrcIdx < NbSrcImage; SrcIdx++)
+      Request.pSrcData[SrcIdx] = (char*)MbufInquire(pMilSrcImages[SrcIdx], M_HOST_ADDRESS, M_NULL);
+
+   Request.pDisparityData = (void*)MbufInquire(MilDisparityImage, M_HOST_ADDRESS, M_NULL);
+   Request.DisparityPitchByte = (int)MbufInquire(MilDisparityImage, M_PITCH_BYTE, M_NULL);
+   Request.pRectifiedData = NULL;
+   Request.RectifiedPitchByte = 0;
+   Request.RectifiedType = IMG_OUT_BGRA;
+   if(MilRectifiedImage)
+      {
+      Request.pRectifiedData = (void*)MbufInquire(MilRectifiedImage, M_HOST_ADDRESS, M_NULL);
+      Request.RectifiedPitchByte = (int)MbufInquire(MilRectifiedImage, M_PITCH_BYTE, M_NULL);
+      Request.RectifiedType = MbufInquire(MilRectifiedImage, M_SIZE_BAND, M_NULL) == 1 ? IMG_OUT_GRAY : IMG_OUT_BGRA;
+      }
+   Request.Callback = NULL;
+   Request.pUserData = NULL;
+   return pCalculator->Submit(Request);
+   }
+
+//*****************************************************************************
+// Complete3D. Waits for a submitted 3D calculation and copies the workable
+//             area of the outputs in the work images. Returns false if a source
+//             image was not accepted by the API.
+//*****************************************************************************
+bool Complete3D(CAsync3DCalculator* pCalculator, MIL_INT RequestId, MIL_ID MilDisparityImage, MIL_ID MilRectifiedImage, MIL_ID MilCorrectedWorkDepthMap, MIL_ID MilCorrectedWorkColorMap)
+   {
+   bool SrcImagesAccepted = pCalculator->Wait(RequestId);
+
+   // Get only the workable area of the disparity map.
+   MIL_INT WorkSizeX = MbufInquire(MilCorrectedWorkDepthMap, M_SIZE_X, M_NULL);
+   MIL_INT WorkSizeY = MbufInquire(MilCorrectedWorkDepthMap, M_SIZE_Y, M_NULL);
+   MbufCopyColor2d(MilDisparityImage, MilCorrectedWorkDepthMap, 0, BORDER_SIZE_X, 0, 0, 0, 0, WorkSizeX, WorkSizeY);
+   MIL_ID MilSourceRectifiedImage = MilRectifiedImage == 0 ? MilDisparityImage : MilRectifiedImage;
+   CopyColorCrop(MilSourceRectifiedImage, BORDER_SIZE_X, MilCorrectedWorkColorMap);
+
+   return SrcImagesAccepted;
+   }
+
+//*****************************************************************************
+// IsPackedColor. Returns true if the image is an 8-bit packed BGRA image.
+//*****************************************************************************
+bool IsPackedColor(MIL_ID MilImage)
+   {
+   return MbufInquire(MilImage, M_SIZE_BAND, M_NULL) == 3 &&
+          MbufInquire(MilImage, M_SIZE_BIT, M_NULL) == 8 &&
+          (MbufInquire(MilImage, M_DATA_FORMAT, M_NULL) & M_BGR32) == M_BGR32;
+   }
+
+//*****************************************************************************
+// CopyColorCrop. Copies the region of the source image starting at column
+//                OffsetX, of the size of the destination color map. Packed BGRA
+//                and gray images are copied or expanded in a single pass, and a
+//                packed BGRA image is split in a single pass in a planar map.
+//*****************************************************************************
+void CopyColorCrop(MIL_ID MilSrcImage, MIL_INT OffsetX, MIL_ID MilDstImage)
+   {
+   MIL_INT SizeX = MbufInquire(MilDstImage, M_SIZE_X, M_NULL);
+   MIL_INT SizeY = MbufInquire(MilDstImage, M_SIZE_Y, M_NULL);
+   MIL_INT SrcPitchByte = MbufInquire(MilSrcImage, M_PITCH_BYTE, M_NULL);
+   const MIL_UINT8* pSrcData = (const MIL_UINT8*)MbufInquire(MilSrcImage, M_HOST_ADDRESS, M_NULL);
+   bool IsSrcPacked = IsPackedColor(MilSrcImage);
+   bool IsSrcGray = MbufInquire(MilSrcImage, M_SIZE_BAND, M_NULL) == 1 && MbufInquire(MilSrcImage, M_SIZE_BIT, M_NULL) == 8;
+
+   if(pSrcData && IsPackedColor(MilDstImage) && (IsSrcPacked || IsSrcGray))
+      {
+      MIL_UINT8* pDstData = (MIL_UINT8*)MbufInquire(MilDstImage, M_HOST_ADDRESS, M_NULL);
+      MIL_INT DstPitchByte = MbufInquire(MilDstImage, M_PITCH_BYTE, M_NULL);
+      if(IsSrcPacked)
+         CopyPackedColorCrop(pSrcData, SrcPitchByte, OffsetX, pDstData, DstPitchByte, SizeX, SizeY);
+      else
+         ExpandGrayCrop(pSrcData, SrcPitchByte, OffsetX, pDstData, DstPitchByte, SizeX, SizeY);
+      }
+   else if(pSrcData && IsSrcPacked && MbufInquire(MilDstImage, M_SIZE_BAND, M_NULL) == 3 && MbufInquire(MilDstImage, M_SIZE_BIT, M_NULL) == 8)
+      {
+      MIL_ID MilRedBand = MbufChildColor(MilDstImage, M_RED, M_NULL);
+      MIL_ID MilGreenBand = MbufChildColor(MilDstImage, M_GREEN, M_NULL);
+      MIL_ID MilBlueBand = MbufChildColor(MilDstImage, M_BLUE, M_NULL);
+      DeinterleaveColorCrop(pSrcData, SrcPitchByte, OffsetX,
+                            (MIL_UINT8*)MbufInquire(MilRedBand, M_HOST_ADDRESS, M_NULL),
+                            (MIL_UINT8*)MbufInquire(MilGreenBand, M_HOST_ADDRESS, M_NULL),
+                            (MIL_UINT8*)MbufInquire(MilBlueBand, M_HOST_ADDRESS, M_NULL),
+                            MbufInquire(MilRedBand, M_PITCH_BYTE, M_NULL), SizeX, SizeY);
+      MbufFree(MilBlueBand);
+      MbufFree(MilGreenBand);
+      MbufFree(MilRedBand);
+      }
+   else
+      MbufCopyColor2d(MilSrcImage, MilDstImage, M_ALL_BANDS, OffsetX, 0, M_ALL_BANDS, 0, 0, SizeX, SizeY);
+   }
+
+//*****************************************************************************
+// Compute3D. Calculates the 3D data with the CS3D API and copies the workable
+//            area of the outputs in the work images. Returns false if a source
+//            image was not accepted by the API.
+//*****************************************************************************
+bool Compute3D(CAsync3DCalculator* pCalculator, MIL_ID* pMilSrcImages, MIL_INT NbSrcImage, MIL_ID MilDisparityImage, MIL_ID MilRectifiedImage, MIL_ID MilCorrectedWorkDepthMap, MIL_ID MilCorrectedWorkColorMap)
+   {
+   MIL_INT RequestId = Submit3D(pCalculator, pMilSrcImages, NbSrcImage, MilDisparityImage, MilRectifiedImage);
+   return Complete3D(pCalculator, RequestId, MilDisparityImage, MilRectifiedImage, MilCorrectedWorkDepthMap, MilCorrectedWorkColorMap);
+   }
+
+//*****************************************************************************
+// AllocPipelinedScan. Allocates the grab and output buffers of a scan in flight
+//                     like the ones of the default context. All the contexts
+//                     are initialized from the same grab image and geometry, so
+//                     their outputs have the same format.
+//*****************************************************************************
+void AllocPipelinedScan(SRecipeCache* pRecipeCache, SPipelinedScan* pScan)
+   {
+   const S3DApiContext& DefaultContext = pRecipeCache->Contexts[0];
+   pScan->pContext = NULL;
+   pScan->RequestId = -1;
+   pScan->GrabTime = 0;
+   pScan->SubmitTime = 0;
+   MbufClone(pRecipeCache->MilGrabImage, M_DEFAULT, M_DEFAULT, M_DEFAULT, M_DEFAULT, M_DEFAULT, M_DEFAULT, &pScan->MilGrabImage);
+   MbufClone(DefaultContext.MilDisparityImage, M_DEFAULT, M_DEFAULT, M_DEFAULT, M_DEFAULT, M_DEFAULT, M_DEFAULT, &pScan->MilDisparityImage);
+   pScan->MilRectifiedImage = M_NULL;
+   if(DefaultContext.MilRectifiedImage)
+      MbufClone(DefaultContext.MilRectifiedImage, M_DEFAULT, M_DEFAULT, M_DEFAULT, M_DEFAULT, M_DEFAULT, M_DEFAULT, &pScan->MilRectifiedImage);
+   }
+
+//*****************************************************************************
+// StartPipelinedScan. Selects the context of the recipe, grabs a scan in the
+//                     buffers of the slot and submits its 3D calculation. The
+//                     context of the slot is NULL if the recipe is unavailable.
+//*****************************************************************************
+void StartPipelinedScan(SRecipeCache* pRecipeCache, MIL_ID MilDigitizer, const S3DApiRecipe& Recipe, SPipelinedScan* pScan)
+   {
+   pScan->pContext = SelectRecipe(pRecipeCache, Recipe);
+   if(!pScan->pContext)
+      return;
+   MappTimer(M_DEFAULT, M_TIMER_READ, &pScan->GrabTime);
+   GrabScan(MilDigitizer, pScan->MilGrabImage);
+   MappTimer(M_DEFAULT, M_TIMER_READ, &pScan->SubmitTime);
+   pScan->RequestId = Submit3D(pScan->pContext->pCalculator, &pScan->MilGrabImage, 1, pScan->MilDisparityImage, pScan->MilRectifiedImage);
+   }
+
+//*****************************************************************************
+// FreePipelinedScan. Waits for the scan of a slot, if any, and frees its buffers.
+//*****************************************************************************
+void FreePipelinedScan(SPipelinedScan* pScan)
+   {
+   if(pScan->pContext)
+      pScan->pContext->pCalculator->Wait(pScan->RequestId);
+   pScan->pContext = NULL;
+   if(pScan->MilRectifiedImage)
+      MbufFree(pScan->MilRectifiedImage);
+   MbufFree(pScan->MilDisparityImage);
+   MbufFree(pScan->MilGrabImage);
+   }
+
+//*****************************************************************************
+// FillHolesAndSmooth. Smooths the depth map and fills its hole. Invalid pixels
+//                     whose neighborhood contains at least 10% of valid pixels
+//                     are replaced by the average of the valid neighbors. The
+//                     result is shown only if a display is given. The depth
+//                     map can be filled in place.
+//*****************************************************************************
+void FillHolesAndSmooth(MIL_ID MilDisplay, MIL_ID MilDepthMap, MIL_ID MilFilledHolesDepthMap, MIL_INT FilterSize)
+   {
+   MIL_ID MilSystem = MbufInquire(MilDepthMap, M_OWNER_SYSTEM, M_NULL);
+   MIL_INT ImageSizeX = MbufInquire(MilDepthMap, M_SIZE_X, M_NULL);
+   MIL_INT ImageSizeY = MbufInquire(MilDepthMap, M_SIZE_Y, M_NULL);
+
+   // Allocate the work images.
+   MIL_ID MilValidImage = MbufAlloc2d(MilSystem, ImageSizeX, ImageSizeY, 16+M_UNSIGNED, M_IMAGE+M_PROC, M_NULL);
+   MIL_ID MilNormImage = MbufAlloc2d(MilSystem, ImageSizeX, ImageSizeY, 16+M_UNSIGNED, M_IMAGE+M_PROC, M_NULL);
+   MIL_ID MilTempFilledHolesDepthMap32 = MbufAlloc2d(MilSystem, ImageSizeX, ImageSizeY, 32 + M_UNSIGNED, M_IMAGE + M_PROC, M_NULL);
+
+   // Create the valid image.
+   MimBinarize(MilDepthMap, MilValidImage, M_FIXED + M_GREATER, 0, M_NULL);
+
+   MIL_ID MilUniformKernel = MbufAlloc2d(MilSystem, FilterSize, FilterSize, 8+M_UNSIGNED, M_KERNEL, M_NULL);
+   MbufClear(MilUniformKernel, 1);
+   MbufControl(MilUniformKernel, M_NORMALIZATION_FACTOR, FilterSize*FilterSize);
+   MimConvolve(MilValidImage, MilNormImage, MilUniformKernel);
+   MimConvolve(MilDepthMap, MilFilledHolesDepthMap, MilUniformKernel);
+   
+   // Normalize the values.
+   MimShift(MilFilledHolesDepthMap, MilTempFilledHolesDepthMap32, 16);
+   MimArith(MilTempFilledHolesDepthMap32, MilNormImage, MilFilledHolesDepthMap, M_DIV);
+
+   // Invalidate the data of values that do not have enough valid values in their neighborhood.
+   MimBinarize(MilNormImage, MilValidImage, M_GREATER, 0.1 * MIL_UINT16_MAX, M_NULL);
+   MbufClearCond(MilFilledHolesDepthMap, MIL_UINT16_MAX, M_NULL, M_NULL, MilValidImage, M_EQUAL, 0);
+
+   // Show the depth map without the holes.
+   if(MilDisplay)
+      {
+      MosPrintf(MIL_TEXT("The depth map was smoothed and its holes were filled.\n\n")
+                MIL_TEXT("Press <Enter> to continue.\n\n"));
+      ShowImage(MilDisplay, MilFilledHolesDepthMap, true);
+      }
+
+   MbufFree(MilUniformKernel);
+   MbufFree(MilTempFilledHolesDepthMap32);
+   MbufFree(MilNormImage);
+   MbufFree(MilValidImage);
+   }
+
+//*****************************************************************************
+// FillHolesPushPull. Fills the holes of the depth map whatever their size, in a
+//                    time proportional to its number of pixels. The valid pixels
+//                    are kept unless smoothing levels are given, and the pixels
+//                    farther than the maximum fill distance from a valid pixel
+//                    are invalid. The depth map can be filled in place. The
+//                    pyramid of the hole filler is only reallocated when the
+//                    size of the depth map changes.
+//*****************************************************************************
+void FillHolesPushPull(CPushPullHoleFiller* pHoleFiller, MIL_ID MilDepthMap, MIL_ID MilFilledHolesDepthMap, MIL_INT SmoothingLevels, MIL_INT MaxFillDistance)
+   {
+   MIL_INT SizeX = MbufInquire(MilDepthMap, M_SIZE_X, M_NULL);
+   MIL_INT SizeY = MbufInquire(MilDepthMap, M_SIZE_Y, M_NULL);
+   MIL_INT SrcPitch = MbufInquire(MilDepthMap, M_PITCH, M_NULL);
+   MIL_INT DstPitch = MbufInquire(MilFilledHolesDepthMap, M_PITCH, M_NULL);
+   const MIL_UINT16* pSrcData = (const MIL_UINT16*)MbufInquire(MilDepthMap, M_HOST_ADDRESS, M_NULL);
+   MIL_UINT16* pDstData = (MIL_UINT16*)MbufInquire(MilFilledHolesDepthMap, M_HOST_ADDRESS, M_NULL);
+
+   pHoleFiller->Fill(pSrcData, SrcPitch, pDstData, DstPitch, SizeX, SizeY, SmoothingLevels, MaxFillDistance);
+   }
+
+//*****************************************************************************
+// CorrectHorizontalCurve. Corrects the horizontal curve of the depth map, 
+//                         assuming that it should be flat.
+//*****************************************************************************
+void CorrectHorizontalCurve(MIL_ID MilDepthMap, MIL_INT ChildOffsetY, MIL_INT ChildSizeY)
+   {
+   MIL_ID MilSystem = MbufInquire(MilDepthMap, M_OWNER_SYSTEM, M_NULL);
+   MIL_INT ImageSizeX = MbufInquire(MilDepthMap, M_SIZE_X, M_NULL);
+   MIL_INT ImageSizeY = MbufInquire(MilDepthMap, M_SIZE_Y, M_NULL);
+   
+   // Allocate the temporary images and get the child.
+   MIL_ID MilCorrectionSourceChild = MbufChild2d(MilDepthMap, 0, ChildOffsetY, ImageSizeX, ChildSizeY, M_NULL);
+   MIL_ID MilAverageColumn = MbufAlloc2d(MilSystem, ImageSizeX, 1, 16+M_UNSIGNED, M_IMAGE+M_PROC, M_NULL);
+   MIL_ID MilAverageImage = MbufAlloc2d(MilSystem, ImageSizeX, ImageSizeY, 16+M_UNSIGNED, M_IMAGE+M_PROC, M_NULL);
+   
+   // Get the average of each column to get an estimation of the horizontal curve.
+   MimResize(MilCorrectionSourceChild, MilAverageColumn, M_FILL_DESTINATION, M_FILL_DESTINATION, M_AVERAGE);
+   MimResize(MilAverageColumn, MilAverageImage, M_FILL_DESTINATION, M_FILL_DESTINATION, M_NEAREST_NEIGHBOR);
+   
+   // Remove the curve.
+   McalAssociate(MilDepthMap, MilAverageImage, M_DEFAULT);
+   M3dmapArith(MilDepthMap, MilAverageImage, MilDepthMap, M_NULL, M_SUB, M_SET_WORLD_OFFSET_Z);
+
+   // Free the allocations.
+   MbufFree(MilAverageImage);
+   MbufFree(MilAverageColumn);
+   MbufFree(MilCorrectionSourceChild);
+   }
+
+//*****************************************************************************
+// SubtractReferenceSurface. Subtracts the reference surface and the fitted
+//                           plane from a calibrated depth map, whose first
+//                           column is column OffsetX of the scan. The
+//                           corrected depth map is calibrated to represent
+//                           the heights relative to the reference surface.
+//                           Returns false if the depth map does not fit in
+//                           the columns of the reference surface.
+//*****************************************************************************
+bool SubtractReferenceSurface(CReferenceSurface* pReferenceSurface, MIL_ID MilDepthMap, MIL_ID MilCorrectedDepthMap, MIL_INT OffsetX,
+                              MIL_DOUBLE OutlierFactor, bool Learn, SReferenceSurfaceFit* pFit)
+   {
+   MIL_DOUBLE GrayLevelSizeZ;
+   McalInquire(MilDepthMap, M_GRAY_LEVEL_SIZE_Z, &GrayLevelSizeZ);
+   if(MilDepthMap != MilCorrectedDepthMap)
+      McalAssociate(MilDepthMap, MilCorrectedDepthMap, M_DEFAULT);
+
+   if(!pReferenceSurface->Correct((const MIL_UINT16*)MbufInquire(MilDepthMap, M_HOST_ADDRESS, M_NULL), MbufInquire(MilDepthMap, M_PITCH, M_NULL),
+                                  (MIL_UINT16*)MbufInquire(MilCorrectedDepthMap, M_HOST_ADDRESS, M_NULL), MbufInquire(MilCorrectedDepthMap, M_PITCH, M_NULL),
+                                  MbufInquire(MilDepthMap, M_SIZE_X, M_NULL), MbufInquire(MilDepthMap, M_SIZE_Y, M_NULL),
+                                  OffsetX, OutlierFactor * MIL_UINT16_MAX, Learn, pFit))
+      return false;
+
+   // The bias of the corrected gray levels is a height of 0.
+   McalControl(MilCorrectedDepthMap, M_WORLD_POS_Z, -REFERENCE_SURFACE_BIAS * GrayLevelSizeZ);
+   return true;
+   }
+
+//*****************************************************************************
+// HashBytes. Adds bytes to a FNV-1a hash.
+//*****************************************************************************
+MIL_UINT32 HashBytes(MIL_UINT32 Hash, const void* pData, size_t Size)
+   {
+   const MIL_UINT8* pBytes = (const MIL_UINT8*)pData;
+   for(size_t i = 0; i < Size; i++)
+      Hash = (Hash ^ pBytes[i]) * 16777619u;
+   return Hash;
+   }
+
+//*****************************************************************************
+// GetRecipeId. Returns the FNV-1a hash of the config file content and of the
+//              recipe, so that a reference surface is only reloaded for the
+//              same calibration and recipe.
+//*****************************************************************************
+MIL_UINT32 GetRecipeId(const char* ConfigFile, const S3DApiRecipe& Recipe)
+   {
+   MIL_UINT32 Hash = 2166136261u;
+
+   // Hash the config file, which holds the calibration.
+   FILE* pFile = NULL;
+   if(ConfigFile && fopen_s(&pFile, ConfigFile, "rb") == 0 && pFile != NULL)
+      {
+      MIL_UINT8 Buffer[4096];
+      size_t NbRead;
+      while((NbRead = fread(Buffer, 1, sizeof(Buffer), pFile)) > 0)
+         Hash = HashBytes(Hash, Buffer, NbRead);
+      fclose(pFile);
+      }
+
+   // Hash the recipe field by field, to skip the padding of the structure.
+   Hash = HashBytes(Hash, &Recipe.dStart, sizeof(Recipe.dStart));
+   Hash = HashBytes(Hash, &Recipe.dEnd, sizeof(Recipe.dEnd));
+   Hash = HashBytes(Hash, &Recipe.windowType, sizeof(Recipe.windowType));
+   Hash = HashBytes(Hash, &Recipe.minStdDevA, sizeof(Recipe.minStdDevA));
+   Hash = HashBytes(Hash, &Recipe.mingw, sizeof(Recipe.mingw));
+   Hash = HashBytes(Hash, &Recipe.minKkf, sizeof(Recipe.minKkf));
+   Hash = HashBytes(Hash, &Recipe.Pyramidal, sizeof(Recipe.Pyramidal));
+   return Hash;
+   }
+
+//*****************************************************************************
+// InitReferenceSurface. Creates the reference surface of a context, from the
+//                       file of its recipe id if it was saved for the same
+//                       depth map width.
+//*****************************************************************************
+void InitReferenceSurface(S3DApiContext* pContext)
+   {
+   char FilePath[MAX_PATH];
+   sprintf_s(FilePath, MAX_PATH, REFERENCE_SURFACE_FILE_FORMAT, (unsigned int)pContext->RecipeId);
+   pContext->pReferenceSurface = new CReferenceSurface();
+   pContext->RegionOffsetX = 0;
+   pContext->pReferenceSurface->Load(FilePath, pContext->WorkSizeX);
+   }
+
+//*****************************************************************************
+// FindValidPeaks. Locates the peaks of the subsampled depth map and keeps the
+//                 ones whose height, relative to the minimum of their zone of
+//                 influence, is above the minimum peak height. The coordinate
+//                 arrays must hold SizeX*SizeY/9 peaks. The zones are reduced
+//                 on the post-processing workers of the pool, if given.
+//                 Returns the number of valid peaks or -1 if the zones of
+//                 influence are inconsistent.
+//*****************************************************************************
+MIL_INT FindValidPeaks(MIL_ID MilSubsampledDepthMap, const SDepthCalibration& Calibration, MIL_DOUBLE MinPeakHeight, CPipelineThreadPool* pThreadPool, MIL_INT* pValidCoordX, MIL_INT* pValidCoordY)
+   {
+   MIL_ID MilSystem = MbufInquire(MilSubsampledDepthMap, M_OWNER_SYSTEM, M_NULL);
+   MIL_INT SubsampledSizeX = MbufInquire(MilSubsampledDepthMap, M_SIZE_X, M_NULL);
+   MIL_INT SubsampledSizeY = MbufInquire(MilSubsampledDepthMap, M_SIZE_Y, M_NULL);
+
+   // Allocate the peak and zone of influence images.
+   MIL_ID MilPeakImage = MbufAlloc2d(MilSystem, SubsampledSizeX, SubsampledSizeY, 8+M_UNSIGNED, M_IMAGE + M_PROC, M_NULL);
+   MIL_ID MilZoneOfInfluenceImage = MbufAlloc2d(MilSystem, SubsampledSizeX, SubsampledSizeY, 16+M_UNSIGNED, M_IMAGE + M_PROC, M_NULL);
+
+   // Allocate the peak list.
+   MIL_INT MaxNbEvents = SubsampledSizeX * SubsampledSizeY / 9;
+   MIL_ID MilPeakList = MimAllocResult(MilSystem, MaxNbEvents, M_EVENT_LIST, M_NULL);
+
+   // Locate the possible peaks.
+   MimLocateEvent(MilSubsampledDepthMap, MilPeakList,  M_ALL+M_LOCAL_MAX_STRICT_MEDIUM, M_NULL, M_NULL);
+   MIL_INT NbEvent;
+   MimGetResult(MilPeakList, M_NB_EVENT + M_TYPE_MIL_INT, &NbEvent);
+   MIL_INT* pCoordX = new MIL_INT[MaxNbEvents];
+   MIL_INT* pCoordY = new MIL_INT[MaxNbEvents];
+   MimGetResult(MilPeakList, M_POSITION_X + M_TYPE_MIL_INT, pCoordX);
+   MimGetResult(MilPeakList, M_POSITION_Y + M_TYPE_MIL_INT, pCoordY);
+
+   // Create a peak image an get their zone of influence.
+   MgraColor(M_DEFAULT, 255);
+   MbufClear(MilPeakImage, 0);
+   MgraDots(M_DEFAULT, MilPeakImage, NbEvent, pCoordX, pCoordY, M_DEFAULT);
+   MimZoneOfInfluence(MilPeakImage, MilZoneOfInfluenceImage, M_CHAMFER_3_4);
+
+   // Filter the peaks based on their contrast.
+   MIL_INT NbValidPeak = -1;
+
+   // Get the data pointer and the pitch of the subsampled and zone of influence image to access values directly.
+   MIL_UINT16* pZoneOfInfluenceData = (MIL_UINT16*)MbufInquire(MilZoneOfInfluenceImage, M_HOST_ADDRESS, M_NULL);
+   MIL_INT ZonePitch = MbufInquire(MilZoneOfInfluenceImage, M_PITCH, M_NULL);
+   MIL_UINT16* pSubsampledImageData = (MIL_UINT16*)MbufInquire(MilSubsampledDepthMap, M_HOST_ADDRESS, M_NULL);
+   MIL_INT SubsampledPitch = MbufInquire(MilSubsampledDepthMap, M_PITCH, M_NULL);
+
+   // Get the minimum value in the zone of influence of each peak, labeled from 1.
+   CLabelStatistics ZoneStatistics;
+   ZoneStatistics.SetThreadPool(pThreadPool, THREAD_ROLE_POST_PROCESSING);
+   MIL_INT NbZones = ZoneStatistics.Calculate(pZoneOfInfluenceData, ZonePitch, pSubsampledImageData, SubsampledPitch,
+                                              SubsampledSizeX, SubsampledSizeY, NbEvent);
+
+   // Each peak should have its own zone.
+   if(NbZones == NbEvent && ZoneStatistics.GetNbOutOfRangePixels() == 0)
+      {
+      NbValidPeak = 0;
+      for(MIL_INT PeakIdx = 0; PeakIdx < NbEvent; PeakIdx++)
+         {
+         // Get the gray value at the peak.
+         MIL_INT PeakValue = pSubsampledImageData[pCoordX[PeakIdx] + SubsampledPitch*pCoordY[PeakIdx]];
+            
+         // Get the minimum value in the zone of influence associated to the peak.
+         MIL_INT PeakLabel = pZoneOfInfluenceData[pCoordX[PeakIdx] + ZonePitch*pCoordY[PeakIdx]];
+
+         // Calculate the height associated to the gray value contrast.
+         MIL_INT PeakContrast =  PeakValue - ZoneStatistics.Get(PeakLabel).Min;
+         MIL_DOUBLE PeakHeight = (Calibration.FirstGrayZ - Calibration.LastGrayZ) * (PeakContrast - 1) / (65535 - 1);
+            
+         // If the peak height is above the threshold, keep the peak.
+         if(PeakHeight >= MinPeakHeight)
+            {
+            pValidCoordX[NbValidPeak] = pCoordX[PeakIdx];
+            pValidCoordY[NbValidPeak] = pCoordY[PeakIdx];
+            NbValidPeak++;
+            }
+         }
+      }
+
+   // Free the allocations.
+   delete [] pCoordY;
+   delete [] pCoordX;
+   MimFree(MilPeakList);
+   MbufFree(MilZoneOfInfluenceImage);
+   MbufFree(MilPeakImage);
+
+   return NbValidPeak;
+   }
+
+//*****************************************************************************
+// CalculateLocalDensity. Calculates the local density of the peaks, set to 1 in
+//                        the peak image, with a circular average kernel. The
+//                        density image is scaled so that the maximum local
+//                        density is 255. Returns the maximum in peak/cm^2.
+//*****************************************************************************
+MIL_DOUBLE CalculateLocalDensity(MIL_ID MilPeakImage, MIL_ID MilLocalDensityImage, MIL_DOUBLE LocalPixelSize, MIL_INT KernelSize)
+   {
+   MIL_ID MilSystem = MbufInquire(MilPeakImage, M_OWNER_SYSTEM, M_NULL);
+
+   // Allocate the average kernel.
+   MIL_DOUBLE KernelSizeInMm = LocalPixelSize * KernelSize;
+   MIL_DOUBLE KernelSizeInMmSquare = KernelSizeInMm * KernelSizeInMm;
+   MIL_DOUBLE KernelSizeInPixelSquare = (MIL_DOUBLE)(KernelSize * KernelSize);
+   MIL_ID MilAverageKernel = MbufAlloc2d(MilSystem, KernelSize, KernelSize, 8+M_UNSIGNED, M_KERNEL, M_NULL);
+   MIL_INT KernelArea = GenAverageCircleKernel(MilAverageKernel);
+   MIL_DOUBLE CircleKernelSizeInMmSquare = ((MIL_DOUBLE)KernelArea/KernelSizeInPixelSquare) * KernelSizeInMmSquare;
+
+   // Allocate the stat context and result.
+   MIL_ID MilStatContext = MimAlloc(MilSystem, M_STATISTICS_CONTEXT, M_DEFAULT, M_NULL);
+   MimControl(MilStatContext, M_STAT_MAX, M_ENABLE);
+   MIL_ID MilStatResult = MimAllocResult(MilSystem, M_DEFAULT, M_STATISTICS_RESULT, M_NULL);
+
+   // Generate an image indicating the local peak density per KernelSizeInMmSquare. 
+   MimConvolve(MilPeakImage, MilLocalDensityImage, MilAverageKernel);
+      
+   // Put the density per cm^2.
+   MimArith(MilLocalDensityImage, 100.0/CircleKernelSizeInMmSquare, MilLocalDensityImage, M_MULT_CONST+M_FLOAT_PROC+M_SATURATION);
+
+   // Increase contrast.
+   MIL_DOUBLE MaxDensity;
+   MimStatCalculate(MilStatContext, MilLocalDensityImage, MilStatResult, M_DEFAULT);
+
+   MimGetResult(MilStatResult, M_STAT_MAX, &MaxDensity);
+   if(MaxDensity > 0)
+      MimArith(MilLocalDensityImage, 255.0/MaxDensity, MilLocalDensityImage, M_MULT_CONST + M_SATURATION + M_FLOAT_PROC);
+
+   // Free the allocations.
+   MimFree(MilStatResult);
+   MimFree(MilStatContext);
+   MbufFree(MilAverageKernel);
+
+   return MaxDensity;
+   }
+
+//*****************************************************************************
+// FindValidRegion. Finds the bounding box of the valid, non zero, pixels of the
+//                  depth map, grown by a margin and clipped to the image. Each
+//                  row is scanned from both ends up to its first valid pixel
+//                  so only the invalid borders are read. The first and last
+//                  valid columns of each row are returned in the optional
+//                  extent arrays, -1 for the rows without valid pixels.
+//                  Returns false if the depth map has no valid pixels.
+//*****************************************************************************
+bool FindValidRegion(MIL_ID MilDepthMap, MIL_INT Margin, SValidRegion* pRegion, MIL_INT* pRowStartX, MIL_INT* pRowEndX)
+   {
+   MIL_INT SizeX = MbufInquire(MilDepthMap, M_SIZE_X, M_NULL);
+   MIL_INT SizeY = MbufInquire(MilDepthMap, M_SIZE_Y, M_NULL);
+   MIL_INT Pitch = MbufInquire(MilDepthMap, M_PITCH, M_NULL);
+   const MIL_UINT16* pData = (const MIL_UINT16*)MbufInquire(MilDepthMap, M_HOST_ADDRESS, M_NULL);
+
+   MIL_INT MinX = SizeX;
+   MIL_INT MaxX = -1;
+   MIL_INT MinY = SizeY;
+   MIL_INT MaxY = -1;
+   pRegion->NbValidRows = 0;
+   for(MIL_INT y = 0; y < SizeY; y++)
+      {
+      const MIL_UINT16* pRow = pData + y * Pitch;
+
+      // Find the first valid pixel of the row.
+      MIL_INT StartX = 0;
+      while(StartX < SizeX && pRow[StartX] == 0)
+         StartX++;
+
+      // Find the last valid pixel of the row.
+      MIL_INT EndX = -1;
+      if(StartX < SizeX)
+         {
+         EndX = SizeX - 1;
+         while(pRow[EndX] == 0)
+            EndX--;
+
+         if(StartX < MinX)
+            MinX = StartX;
+         if(EndX > MaxX)
+            MaxX = EndX;
+         if(MinY == SizeY)
+            MinY = y;
+         MaxY = y;
+         pRegion->NbValidRows++;
+         }
+      else
+         StartX = -1;
+
+      if(pRowStartX)
+         pRowStartX[y] = StartX;
+      if(pRowEndX)
+         pRowEndX[y] = EndX;
+      }
+
+   if(MaxY < 0)
+      {
+      pRegion->OffsetX = 0;
+      pRegion->OffsetY = 0;
+      pRegion->SizeX = 0;
+      pRegion->SizeY = 0;
+      return false;
+      }
+
+   // Grow the region by the margin.
+   MinX = MinX > Margin ? MinX - Margin : 0;
+   MinY = MinY > Margin ? MinY - Margin : 0;
+   MaxX = MaxX + Margin < SizeX ? MaxX + Margin : SizeX - 1;
+   MaxY = MaxY + Margin < SizeY ? MaxY + Margin : SizeY - 1;
+   pRegion->OffsetX = MinX;
+   pRegion->OffsetY = MinY;
+   pRegion->SizeX = MaxX - MinX + 1;
+   pRegion->SizeY = MaxY - MinY + 1;
+   return true;
+   }
+
+//*****************************************************************************
+// GetDepthCalibration. Gets the calibration of the depth maps from the
+//                      configuration of the 3DPIXA.
+//*****************************************************************************
+void GetDepthCalibration(I3DApi* p3DApi, const config3DApi* pConfig, SDepthCalibration* pCalibration)
+   {
+   float FirstGrayZ;
+   p3DApi->grayToMm(FirstGrayZ, (unsigned short)1);
+   float LastGrayZ;
+   p3DApi->grayToMm(LastGrayZ, (unsigned short)65535);
+   pCalibration->PixelSizeX = pConfig->resolutionX;
+   pCalibration->PixelSizeY = pConfig->resolutionY;
+   pCalibration->FirstGrayZ = FirstGrayZ;
+   pCalibration->LastGrayZ = LastGrayZ;
+   }
+
+//*****************************************************************************
+// CalibrateDepthMap. Calibrates the depth map based on the calibration of the
+//                    3DPIXA. Returns the Z-range.
+//*****************************************************************************
+MIL_DOUBLE CalibrateDepthMap(MIL_ID MilDepthMap, const SDepthCalibration& Calibration, MIL_DOUBLE XYMultFactor, MIL_DOUBLE ZMultFactor)
+   {
+   MIL_DOUBLE PixelSize = Calibration.PixelSizeX * XYMultFactor;
+   McalUniform(MilDepthMap, 0, 0, PixelSize, PixelSize, 0.0, M_DEFAULT);
+   MIL_DOUBLE MinZ = Calibration.LastGrayZ * ZMultFactor;
+   MIL_DOUBLE MaxZ = Calibration.FirstGrayZ * ZMultFactor;
+   McalControl(MilDepthMap, M_WORLD_POS_Z, MaxZ);
+   McalControl(MilDepthMap, M_GRAY_LEVEL_SIZE_Z, (MinZ - MaxZ) / 65535);
+   return MaxZ - MinZ;
+   }
+
+//*****************************************************************************
+// ExportDepthMapMesh. Builds the adaptive mesh of a calibrated depth map, within
+//                     the maximum error in mm, writes it and compares it with
+//                     the regular grids of the 3D display and of the full
+//                     resolution.
+//*****************************************************************************
+void ExportDepthMapMesh(MIL_ID MilDepthMap, MIL_DOUBLE PixelSize, MIL_DOUBLE ZMultFactor, MIL_DOUBLE MaxError, const char* FilePath)
+   {
+   MIL_INT SizeX = MbufInquire(MilDepthMap, M_SIZE_X, M_NULL);
+   MIL_INT SizeY = MbufInquire(MilDepthMap, M_SIZE_Y, M_NULL);
+   MIL_INT Pitch = MbufInquire(MilDepthMap, M_PITCH, M_NULL);
+   const MIL_UINT16* pDepth = (const MIL_UINT16*)MbufInquire(MilDepthMap, M_HOST_ADDRESS, M_NULL);
+   MIL_DOUBLE WorldPosZ;
+   MIL_DOUBLE GrayLevelSizeZ;
+   McalInquire(MilDepthMap, M_WORLD_POS_Z, &WorldPosZ);
+   McalInquire(MilDepthMap, M_GRAY_LEVEL_SIZE_Z, &GrayLevelSizeZ);
+   MIL_DOUBLE MmPerGray = (GrayLevelSizeZ < 0 ? -GrayLevelSizeZ : GrayLevelSizeZ) / ZMultFactor;
+
+   // Build the mesh.
+   MIL_DOUBLE StartTime;
+   MIL_DOUBLE EndTime;
+   CDepthMapMesh Mesh;
+   MappTimer(M_DEFAULT, M_TIMER_READ, &StartTime);
+   bool Built = Mesh.Build(pDepth, Pitch, SizeX, SizeY, MaxError / MmPerGray);
+   MappTimer(M_DEFAULT, M_TIMER_READ, &EndTime);
+   if(!Built)
+      {
+      MosPrintf(MIL_TEXT("Unable to allocate the mesh of the depth map.\n\n"));
+      return;
+      }
+
+   // Measure the regular grid of the 3D display.
+   MIL_INT GridStep = (MIL_INT)(1.0 / D3D_DISPLAY_SUBSAMPLING + 0.5);
+   MIL_INT NbGridTriangles = 2 * ((SizeX - 1) / GridStep) * ((SizeY - 1) / GridStep);
+   MIL_DOUBLE GridError = CDepthMapMesh::MeasureGridError(pDepth, Pitch, SizeX, SizeY, GridStep) * MmPerGray;
+
+   MosPrintf(MIL_TEXT("An adaptive mesh of the depth map, within %.3f mm of every valid pixel, was\n")
+             MIL_TEXT("built in %.1f ms: %d triangles on %d vertices. The regular grid of the 3D\n")
+             MIL_TEXT("display has %d triangles, with errors up to %.3f mm, and the grid of the full\n")
+             MIL_TEXT("resolution %d triangles.\n"),
+             MaxError, (EndTime - StartTime) * 1000.0, (int)Mesh.GetNbTriangles(), (int)Mesh.GetNbVertices(),
+             (int)NbGridTriangles, GridError, (int)(2 * (SizeX - 1) * (SizeY - 1)));
+
+   // Write it in the world units, without the exaggeration of the display.
+   if(Mesh.Write(FilePath, PixelSize, PixelSize, WorldPosZ / ZMultFactor, GrayLevelSizeZ / ZMultFactor))
+      MosPrintf(MIL_TEXT("The mesh was written to %hs (%d KB) for a remote viewer.\n\n"), FilePath, (int)(Mesh.GetFileSize() / 1024));
+   else
+      MosPrintf(MIL_TEXT("Unable to write the mesh to %hs.\n\n"), FilePath);
+   }
+
+//*****************************************************************************
+// GenAverageCircleKernel. Generates an average circle kernel and returns the
+//                         circle's area.
+//*****************************************************************************
+MIL_INT GenAverageCircleKernel(MIL_ID MilAverageKernel)
+   {
+   // Get the kernel information.
+   MIL_ID MilSystem = MbufInquire(MilAverageKernel, M_OWNER_SYSTEM, M_NULL);
+   MIL_ID KernelSize = MbufInquire(MilAverageKernel, M_SIZE_X, M_NULL);
+   MIL_INT KernelPitch = MbufInquire(MilAverageKernel, M_PITCH, M_NULL);
+
+   // Allocate the stat context.
+   MIL_ID MilStatContext = MimAlloc(MilSystem, M_STATISTICS_CONTEXT, M_DEFAULT, M_NULL);
+
+   // Enable statistics to use.
+   MimControl(MilStatContext, M_STAT_NUMBER,    M_ENABLE);
+   MimControl(MilStatContext, M_CONDITION, M_EQUAL);
+   MimControl(MilStatContext, M_COND_LOW,  1);
+
+   // Allocate a stat result.
+   MIL_ID MilStatResult = MimAllocResult(MilSystem, M_DEFAULT, M_STATISTICS_RESULT, M_NULL);
+
+   // Create an image on top of the kernel.
+   MIL_ID MilAverageKernelImage = MbufCreate2d(MilSystem, M_DEFAULT, M_DEFAULT, M_DEFAULT, M_IMAGE+M_PROC, M_MIL_ID+M_PITCH, KernelPitch, (void*)MilAverageKernel, M_NULL); 
+
+   // Clear the kernel.
+   MbufClear(MilAverageKernel, 0);
+     
+   // Draw a circle in the middle of the kernel.
+   MgraColor(M_DEFAULT, 1);
+   MIL_INT CircleRadius = (KernelSize-1)/2;
+   MgraArcFill(M_DEFAULT, MilAverageKernelImage, CircleRadius, CircleRadius, CircleRadius, CircleRadius, 0, 360);
+   
+   // Get the area of the circle.
+   MimStatCalculate(MilStatContext, MilAverageKernelImage, MilStatResult, M_DEFAULT);
+
+   MIL_INT CircleArea;
+   MimGetResult(MilStatResult, M_STAT_NUMBER + M_TYPE_MIL_INT, &CircleArea);
+
+   // Free the image created on the kernel.
+   MbufFree(MilAverageKernelImage);
+
+   // Free the stat result.
+   MimFree(MilStatResult);
+
+   // Free the stat context.
+   MimFree(MilStatContext);
+
+   return CircleArea;
+   }
+
+//*****************************************************************************
+// ShowImage. Shows an image and waits for the user to press a key.
+//*****************************************************************************
+void ShowImage(MIL_ID MilDisplay, MIL_ID MilImage, bool AutoScale)
+   {
+   // Set the scale mode.
+   MdispControl(MilDisplay, M_VIEW_MODE, AutoScale ? M_AUTO_SCALE : M_DEFAULT);
+
+   // Select the image.
+   MdispSelect(MilDisplay, MilImage);
+
+   // Enable the display updates.
+   MdispControl(MilDisplay, M_UPDATE, M_ENABLE);
+   
+   // Wait for the user to press a key.
+   MosGetch();
+
+   // Disable the display updates.
+   MdispControl(MilDisplay, M_UPDATE, M_DISABLE);
+   }
+
+//*****************************************************************************
+// StartScan Thread used to start the scanning of the object.
+//*****************************************************************************
+MIL_UINT32 MFTYPE StartScan(void *UserDataPtr)
+   {
+   // Place the thread on the cores of the acquisition.
+   if(UserDataPtr)
+      PlaceCurrentThread(*(const SThreadRoleConfig*)UserDataPtr, 0);
+
+   // Open the communication with the scanner.
+
+   // Send a command to start the scanner script.
+   // By using a scanner with a controller, the command 
+   // starts a program that initiates the movement
+   // and sends the trigger to the frame grabber to start
+   // grabbing.
+
+   // Close the communication with the scanner.
+
+   return 0;
+   }
+
+//*****************************************************************************
+// AccessDll. Create the 3DAPI object.
+//*****************************************************************************
+typedef int (*newFunc)(void*, void*);
+bool AccessDll(HINSTANCE* phDll, I3DApi** pp3DApi, config3DApi **ppConfig, MIL_CONST_TEXT_PTR DllName, char* FactoryProcName, char* ConfigFile)
+   {
+#if USE_CS3D_API
+
+   MIL_TEXT_CHAR DllPath[MAX_PATH];
+   MosSprintf(DllPath, MAX_PATH, MIL_TEXT("%s\\%s"), CS3D_DLL_PATH, DllName);
+
+   // Load the DLL.
+   *phDll = LoadLibrary(DllPath);
+   if(*phDll == 0)
+      {
+      DWORD LastError = GetLastError();
+      MosPrintf(MIL_TEXT("Error loading dll %s\n"), DllName);
+      MosPrintf(MIL_TEXT("Error code: %d\n"), LastError);
+      *pp3DApi = 0;
+      return false;
+      }
+
+   // Get address of the factory function.
+   newFunc CreateFuncAddr  = (newFunc)GetProcAddress(*phDll, FactoryProcName);
+
+   if(CreateFuncAddr == 0)
+      {
+      MosPrintf(MIL_TEXT("Error: Cannot find function %s\n"), FactoryProcName);
+      *phDll = 0;
+      *pp3DApi = 0;
+      return false;
+      }
+
+   // Use create-function with parameter.
+   if(CreateFuncAddr(pp3DApi, ConfigFile) < 0)
+      {
+      MosPrintf(MIL_TEXT("Error: unable to create dll object\n"));
+      *phDll = 0;
+      *pp3DApi = 0;
+      return false;
+      }
+
+   // Get the 3DPIXA configuration.
+   *ppConfig = (*pp3DApi)->getConfig();
+   if(!*ppConfig)
+      {
+      MosPrintf(MIL_TEXT("Error: unable to get 3d API configuration.\n"));
+      return false;
+      }
+
+   return true;
+
+# else
+
+   // Allocate the stub I3DApi and get the pointer to the config.
+#if USE_CPU_STEREO
+   *pp3DApi = new I3DApi();
+#else
+   *pp3DApi = new I3DApi(COMPACT_STANDALONE_OUTPUT_IMAGE_PATH);
+#endif
+   *ppConfig = (*pp3DApi)->getConfig();
+   return true;
+
+#endif
+   }
+
+//*****************************************************************************
+// Initialize3DApi. Initialize the 3DAPI object.
+//*****************************************************************************
+bool Initialize3DApi(I3DApi* p3DApi,
+                     config3DApi *pConfig,
+                     MIL_ID MilSystem,
+                     MIL_ID* pMilSrcImages,
+                     MIL_INT NbSrcImages,
+                     MIL_ID* pMilDisparityImage,
+                     MIL_ID* pMilRectifiedImage,
+                     MIL_INT* pWorkSizeX,
+                     MIL_INT* pWorkSizeY)
+   {
+   // Initialize the API.
+   if(p3DApi->initialize(pConfig) >= 0)
+      {
+      // Set the source image information.
+      for(int SrcIdx = 0; SrcIdx < NbSrcImages; SrcIdx++)
+         {
+         int ImageSizeX = (int)MbufInquire(pMilSrcImages[SrcIdx], M_SIZE_X, M_NULL);
+         int ImageSizeY = (int)MbufInquire(pMilSrcImages[SrcIdx], M_SIZE_Y, M_NULL);
+         char* pImageData = (char*)MbufInquire(pMilSrcImages[SrcIdx], M_HOST_ADDRESS, M_NULL);
+         int ImagePitchByte = (int)MbufInquire(pMilSrcImages[SrcIdx], M_PITCH_BYTE, M_NULL);
+         MIL_INT NbBands = MbufInquire(pMilSrcImages[SrcIdx], M_SIZE_BAND, M_NULL);
+         if(NbBands == 3)
+            {
+            p3DApi->setSrcImgChannelOrder(SrcIdx, CO_BGRA);
+            p3DApi->setSrcImgInfo(SrcIdx, ImageSizeX, ImageSizeY, 3, 32, ImagePitchByte, ImageSizeX*ImageSizeY*4);
+            }
+         else
+            {
+            p3DApi->setSrcImgChannelOrder(SrcIdx, CO_GRAY);
+            p3DApi->setSrcImgInfo(SrcIdx, ImageSizeX, ImageSizeY, 1, 8, ImagePitchByte, ImageSizeX*ImageSizeY);
+            }
+         if(p3DApi->setSrcImgPtr(SrcIdx, pImageData) < 0)
+            {
+            MosPrintf(MIL_TEXT("Image %i info not acceptable for calculation.\n"), SrcIdx);
+            return false;
+            }
+         }
+
+      // Allocate MIL disparity output images.
+      int DestSizeX;
+      int DestSizeY;
+      int DestChannel;
+      unsigned long long DestSizeByte;
+      p3DApi->getDestImgInfo(IMG_OUT_DISP, DestSizeX, DestSizeY, DestChannel, DestSizeByte);
+      if(DestSizeX != -1)
+         MbufAlloc2d(MilSystem, DestSizeX, DestSizeY, 16+M_UNSIGNED, M_IMAGE + M_PROC + M_DISP, pMilDisparityImage);
+      else
+         {
+         MosPrintf(MIL_TEXT("Unable to get the output disparity image.\n"));
+         return false;
+         }
+      
+      // Allocate the color or gray image.
+      MIL_INT ColorAttribute = M_BGR32;
+      outImgType DestImageType = IMG_OUT_BGRA;
+      if(pConfig->numChannelsUsedForCalculation == 1)
+         {
+         ColorAttribute = M_NULL;
+         DestImageType = IMG_OUT_GRAY;
+         }
+      p3DApi->getDestImgInfo(DestImageType, DestSizeX, DestSizeY, DestChannel, DestSizeByte);
+      if(DestSizeX != -1)
+         MbufAllocColor(MilSystem, pConfig->numChannelsUsedForCalculation, DestSizeX, DestSizeY, 8+M_UNSIGNED, M_IMAGE + M_PROC + M_DISP + ColorAttribute, pMilRectifiedImage);
+      else
+         MosPrintf(MIL_TEXT("Unable to get the output color or grayscale rectified image.\n"));
+      
+      // Calculate the work size.
+      *pWorkSizeX = DestSizeX - 2 * BORDER_SIZE_X;
+      *pWorkSizeY = DestSizeY;
+
+      // Start the calculation.
+      MosPrintf(MIL_TEXT("CS3D: Starting the CS3D api..."));
+      if(p3DApi->start() < 0)
+         {
+         MosPrintf(MIL_TEXT("Unable to start CS3D api.\n"));
+         return false;
+         }
+      else
+         {
+         MosPrintf(MIL_TEXT("Done.\n\n"));
+         }
+      }
+   else
+      {
+      MosPrintf(MIL_TEXT("Unable to initialize the CS3D api."));
+      return false;
+      }
+
+   return true;
+   }
+
+//*****************************************************************************
+// InitRecipeCache. Initializes the recipe cache with the context of the
+//                  recipe defined in the config file.
+//*****************************************************************************
+bool InitRecipeCache(SRecipeCache* pRecipeCache, MIL_ID MilSystem, MIL_ID MilGrabImage, char* ConfigFile, const SThreadRoleConfig* pThreadRoles)
+   {
+   pRecipeCache->MilSystem = MilSystem;
+   pRecipeCache->MilGrabImage = MilGrabImage;
+   pRecipeCache->ConfigFile = ConfigFile;
+   pRecipeCache->NbContexts = 0;
+
+   // Start the pinned workers of the post-processing stages.
+   pRecipeCache->pThreadPool = new CPipelineThreadPool(pThreadRoles, NB_THREAD_ROLES);
+   pRecipeCache->SaveReferenceSurfaces = true;
+
+   // Allocate the first context to read the default recipe from the config file.
+   S3DApiContext* pContext = &pRecipeCache->Contexts[0];
+   pContext->MilDisparityImage = M_NULL;
+   pContext->MilRectifiedImage = M_NULL;
+   pContext->p3DApi = NULL;
+   pContext->pCalculator = NULL;
+   pContext->pScanResultRecord = NULL;
+   pContext->pReferenceSurface = NULL;
+   pContext->hDll = 0;
+   pRecipeCache->NbContexts = 1;
+   if(!AccessDll(&pContext->hDll, &pContext->p3DApi, &pContext->pConfig, MIL_TEXT("CS3DApi64.dll"), "CS3DApiCreate", ConfigFile))
+      return false;
+
+   // Set the image height according to the digitizer.
+   MIL_INT GrabImageSizeY = MbufInquire(MilGrabImage, M_SIZE_Y, M_NULL);
+   pContext->pConfig->imgHeight = (int)GrabImageSizeY;
+   pContext->pConfig->oriImgHeight = (int)GrabImageSizeY;
+
+   // Keep the recipe of the config file.
+   config3DApi* pConfig = pContext->pConfig;
+   S3DApiRecipe DefaultRecipe = {pConfig->dStart, pConfig->dEnd, pConfig->windowType, pConfig->minStdDevA, pConfig->mingw, pConfig->minKkf, false};
+   pRecipeCache->DefaultRecipe = DefaultRecipe;
+   pContext->Recipe = DefaultRecipe;
+
+   if(!Initialize3DApi(pContext->p3DApi, pConfig, MilSystem, &MilGrabImage, 1,
+                       &pContext->MilDisparityImage, &pContext->MilRectifiedImage,
+                       &pContext->WorkSizeX, &pContext->WorkSizeY))
+      return false;
+
+   // Start the asynchronous calculation.
+   pContext->pCalculator = new CAsync3DCalculator(MilSystem, pContext->p3DApi, &THREAD_ROLES[THREAD_ROLE_3D]);
+#if USE_CPU_STEREO && !USE_CS3D_API
+   pContext->p3DApi->getCpuStereoMatcher()->SetThreadPool(pRecipeCache->pThreadPool, THREAD_ROLE_POST_PROCESSING);
+#endif
+   GetDepthCalibration(pContext->p3DApi, pConfig, &pContext->Calibration);
+   pContext->RecipeId = GetRecipeId(ConfigFile, DefaultRecipe);
+   InitReferenceSurface(pContext);
+   return true;
+   }
+
+//*****************************************************************************
+// InitCalibratedRecipeCache. Creates a context for each recipe from its
+//                            calibration, without the 3D API: the contexts
+//                            only post-process the depth maps calculated by
+//                            another process, and are never selected.
+//*****************************************************************************
+void InitCalibratedRecipeCache(SRecipeCache* pRecipeCache, MIL_ID MilSystem, const SCalibratedRecipe* pRecipes, MIL_INT NbRecipes, const SThreadRoleConfig* pThreadRoles)
+   {
+   pRecipeCache->MilSystem = MilSystem;
+   pRecipeCache->MilGrabImage = M_NULL;
+   pRecipeCache->ConfigFile = NULL;
+   pRecipeCache->NbContexts = 0;
+   pRecipeCache->pThreadPool = new CPipelineThreadPool(pThreadRoles, NB_THREAD_ROLES);
+   pRecipeCache->SaveReferenceSurfaces = false;
+   for(MIL_INT RecipeIdx = 0; RecipeIdx < NbRecipes && RecipeIdx < MAX_NB_RECIPES; RecipeIdx++)
+      {
+      S3DApiContext* pContext = &pRecipeCache->Contexts[RecipeIdx];
+      pContext->Recipe = pRecipes[RecipeIdx].Recipe;
+      pContext->hDll = 0;
+      pContext->p3DApi = NULL;
+      pContext->pConfig = NULL;
+      pContext->pCalculator = NULL;
+      pContext->pScanResultRecord = NULL;
+      pContext->MilDisparityImage = M_NULL;
+      pContext->MilRectifiedImage = M_NULL;
+      pContext->WorkSizeX = pRecipes[RecipeIdx].WorkSizeX;
+      pContext->WorkSizeY = pRecipes[RecipeIdx].WorkSizeY;
+      pContext->Calibration = pRecipes[RecipeIdx].Calibration;
+      pContext->RegionOffsetX = 0;
+      pContext->RecipeId = pRecipes[RecipeIdx].RecipeId;
+      InitReferenceSurface(pContext);
+      pRecipeCache->NbContexts++;
+      }
+   pRecipeCache->DefaultRecipe = pRecipeCache->Contexts[0].Recipe;
+   }
+
+//*****************************************************************************
+// SelectRecipe. Returns the context of the recipe. The context is created and
+//               initialized only the first time the recipe is selected.
+//*****************************************************************************
+S3DApiContext* SelectRecipe(SRecipeCache* pRecipeCache, const S3DApiRecipe& Recipe)
+   {
+   // Look for an already initialized context.
+   for(MIL_INT ContextIdx = 0; ContextIdx < pRecipeCache->NbContexts; ContextIdx++)
+      {
+      const S3DApiRecipe& CachedRecipe = pRecipeCache->Contexts[ContextIdx].Recipe;
+      if(CachedRecipe.dStart     == Recipe.dStart     &&
+         CachedRecipe.dEnd       == Recipe.dEnd       &&
+         CachedRecipe.windowType == Recipe.windowType &&
+         CachedRecipe.minStdDevA == Recipe.minStdDevA &&
+         CachedRecipe.mingw      == Recipe.mingw      &&
+         CachedRecipe.minKkf     == Recipe.minKkf     &&
+         CachedRecipe.Pyramidal  == Recipe.Pyramidal)
+         return &pRecipeCache->Contexts[ContextIdx];
+      }
+
+   if(pRecipeCache->NbContexts == MAX_NB_RECIPES)
+      {
+      MosPrintf(MIL_TEXT("The maximum number of recipes is reached.\n"));
+      return NULL;
+      }
+
+   // Create a new context from the default one.
+   S3DApiContext* pDefaultContext = &pRecipeCache->Contexts[0];
+   S3DApiContext* pContext = &pRecipeCache->Contexts[pRecipeCache->NbContexts];
+   pContext->Recipe = Recipe;
+   pContext->MilDisparityImage = M_NULL;
+   pContext->MilRectifiedImage = M_NULL;
+   pContext->p3DApi = NULL;
+   pContext->pCalculator = NULL;
+   pContext->pScanResultRecord = NULL;
+   pContext->pReferenceSurface = NULL;
+   pContext->hDll = 0;
+
+   // The context is only added to the cache once it is initialized.
+#if USE_CS3D_API
+   if(!AccessDll(&pContext->hDll, &pContext->p3DApi, &pContext->pConfig, MIL_TEXT("CS3DApi64.dll"), "CS3DApiCreate", pRecipeCache->ConfigFile))
+      {
+      Free3DApiContext(pContext);
+      return NULL;
+      }
+   *pContext->pConfig = *pDefaultContext->pConfig;
+#else
+   // The standalone contexts share the recorded outputs to stay in sequence with the grab.
+   pContext->p3DApi = new I3DApi(*pDefaultContext->p3DApi);
+   pContext->pConfig = pContext->p3DApi->getConfig();
+#endif
+
+   // Set the configuration parameters of Chromasens 3D API.
+   pContext->pConfig->dStart     = Recipe.dStart;
+   pContext->pConfig->dEnd       = Recipe.dEnd;
+   pContext->pConfig->windowType = Recipe.windowType;
+   pContext->pConfig->minStdDevA = Recipe.minStdDevA;
+   pContext->pConfig->mingw      = Recipe.mingw;
+   pContext->pConfig->minKkf     = Recipe.minKkf;
+#if USE_CPU_STEREO && !USE_CS3D_API
+   pContext->p3DApi->getCpuStereoMatcher()->SetPyramidal(Recipe.Pyramidal);
+#endif
+
+   if(!Initialize3DApi(pContext->p3DApi, pContext->pConfig, pRecipeCache->MilSystem, &pRecipeCache->MilGrabImage, 1,
+                       &pContext->MilDisparityImage, &pContext->MilRectifiedImage,
+                       &pContext->WorkSizeX, &pContext->WorkSizeY))
+      {
+      Free3DApiContext(pContext);
+      return NULL;
+      }
+   pContext->pCalculator = new CAsync3DCalculator(pRecipeCache->MilSystem, pContext->p3DApi, &THREAD_ROLES[THREAD_ROLE_3D]);
+#if USE_CPU_STEREO && !USE_CS3D_API
+   pContext->p3DApi->getCpuStereoMatcher()->SetThreadPool(pRecipeCache->pThreadPool, THREAD_ROLE_POST_PROCESSING);
+#endif
+   GetDepthCalibration(pContext->p3DApi, pContext->pConfig, &pContext->Calibration);
+   pContext->RecipeId = GetRecipeId(pRecipeCache->ConfigFile, Recipe);
+   InitReferenceSurface(pContext);
+   pRecipeCache->NbContexts++;
+
+   return pContext;
+   }
+
+//*****************************************************************************
+// FreeRecipeCache. Stops and frees all the contexts of the recipe cache.
+//*****************************************************************************
+void FreeRecipeCache(SRecipeCache* pRecipeCache)
+   {
+   for(MIL_INT ContextIdx = pRecipeCache->NbContexts - 1; ContextIdx >= 0; ContextIdx--)
+      {
+      S3DApiContext* pContext = &pRecipeCache->Contexts[ContextIdx];
+
+      // Stop the calculation, after the submitted requests.
+      delete pContext->pCalculator;
+      pContext->pCalculator = NULL;
+
+      // Save the reference surface for the next run.
+      if(pContext->pReferenceSurface)
+         {
+         char FilePath[MAX_PATH];
+         sprintf_s(FilePath, MAX_PATH, REFERENCE_SURFACE_FILE_FORMAT, (unsigned int)pContext->RecipeId);
+         if(pRecipeCache->SaveReferenceSurfaces && pContext->pReferenceSurface->GetNbScans() > 0 && !pContext->pReferenceSurface->Save(FilePath))
+            MosPrintf(MIL_TEXT("Unable to save the reference surface to %hs.\n"), FilePath);
+         delete pContext->pReferenceSurface;
+         pContext->pReferenceSurface = NULL;
+         }
+      Free3DApiContext(pContext);
+      }
+   pRecipeCache->NbContexts = 0;
+
+   // Stop the workers.
+   delete pRecipeCache->pThreadPool;
+   pRecipeCache->pThreadPool = NULL;
+   }
+
+//*****************************************************************************
+// Free3DApiContext. Stops the 3D API of a context and frees its output
+//                   images and its 3D API, whichever were allocated.
+//*****************************************************************************
+void Free3DApiContext(S3DApiContext* pContext)
+   {
+   if(pContext->MilDisparityImage)
+      pContext->p3DApi->stopBlocking();
+
+   // Free output images.
+   if(pContext->MilRectifiedImage)
+      MbufFree(pContext->MilRectifiedImage);
+   if(pContext->MilDisparityImage)
+      MbufFree(pContext->MilDisparityImage);
+   pContext->MilRectifiedImage = M_NULL;
+   pContext->MilDisparityImage = M_NULL;
+
+   // Free the Chromasens 3dAPI.
+   FreeDll(&pContext->hDll, &pContext->p3DApi);
+   }
+
+//*****************************************************************************
+// FreeDll. Free the 3DAPI object.
+//*****************************************************************************
+void FreeDll(HINSTANCE* phDll, I3DApi** pp3DApi)
+   {
+   if(*pp3DApi)
+      {
+      delete *pp3DApi;
+      *pp3DApi = 0;
+      }
+#if USE_CS3D_API
+   if(*phDll)
+      {
+      FreeLibrary(*phDll);
+      *phDll = 0;
+      }
+#endif
+   }
+
+//*******************************************************************************
+// GetExampleFilePath. Gets the path of a file of the example image directory.
+//*******************************************************************************
+void GetExampleFilePath(char* FilePath, const char* FileName)
+   {
+   char* MilPath;
+   size_t Len;
+   _dupenv_s(&MilPath, &Len, "MIL_PATH");
+   sprintf_s(FilePath, MAX_PATH, "%s\\..\\..\\Images\\Chromasens_3DPIXA_M10PP3\\%s", MilPath, FileName);
+   free(MilPath);
+   }
+
+//*******************************************************************************
+// CheckForRequiredMILFile. Checks that required avi is present to run the example.
+//                          Generates an error if it's not present.
+//*******************************************************************************
+bool CheckForRequiredMILFile(MIL_CONST_TEXT_PTR  FileName)
+   {
+   MIL_INT FilePresent;
+   MappFileOperation(M_DEFAULT, FileName, M_NULL, M_NULL, M_FILE_EXISTS, M_DEFAULT, &FilePresent);
+   if (FilePresent == M_NO)
+      {
+      MosPrintf(MIL_TEXT("The footage needed to run this example is missing. You need \n")
+                MIL_TEXT("to obtain and apply a separate specific update to have it.\n\n"));
+
+      MosPrintf(MIL_TEXT("Press <Enter> to end.\n\n"));
+      MosGetch();
+      }
+   return FilePresent == M_YES;
+   }
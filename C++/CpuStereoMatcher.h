@@ -0,0 +1,1254 @@
+﻿//***************************************************************************************/
+//
+// File name: CpuStereoMatcher.h
+//
+// Synopsis:  Contains a CPU implementation of the disparity calculation of the
+//            CS3D API, used by the standalone I3DApi when no GPU is available.
+//            The disparity is found by a windowed zero-mean normalized cross
+//            correlation (ZNCC) between the two views of the 3DPIXA. The window
+//            sums are updated incrementally so that the cost does not depend on
+//            the window size, the products are accumulated with SSE2 and the
+//            rows are split in bands processed by the workers of the pinned
+//            thread pool, or by concurrent threads when no pool is set.
+//
+//            In the coarse-to-fine mode, the whole range is searched on views
+//            decimated by 2, then each tile of the full resolution views is only
+//            searched around the disparities found in it.
+//
+//            The search can be restricted to the disparities observed in the
+//            recent scans. The range widens again, and the scan is recalculated,
+//            when too many pixels hit its limits.
+//
+//            The raw views are first rectified on the CPU with the remap tables of
+//            the calibration geometry, which resample them to imgWidth and shift
+//            the right view by the fractional vertical offset dY. A single source
+//            image holds the left view in its left half and the right view in its
+//            right half. With identity tables, the views are extracted straight
+//            from the source images.
+//
+// Copyright © 1992-2024 Zebra Technologies Corp. and/or its affiliates
+// All Rights Reserved
+
+#include <emmintrin.h>
+#include <math.h>
+#include <string.h>
+#include "EpipolarRectifier.h"
+
+// Sizes of the correlation window for each window type. Type 0 is the
+// largest window, 27x27.
+static const MIL_INT CPU_STEREO_WINDOW_SIZES[] = {27, 23, 19, 15, 11, 9, 7, 5};
+static const MIL_INT CPU_STEREO_NB_WINDOW_TYPES = sizeof(CPU_STEREO_WINDOW_SIZES) / sizeof(CPU_STEREO_WINDOW_SIZES[0]);
+static const MIL_INT CPU_STEREO_MAX_THREADS = 32;
+static const float   CPU_STEREO_INVALID_SCORE = -2.0f;
+static const float   CPU_STEREO_INVALID_DISP  = -1.0e9f;
+
+// Parameters of the coarse-to-fine search.
+static const MIL_INT CPU_STEREO_TILE_SIZE_X       = 128;
+static const MIL_INT CPU_STEREO_TILE_SIZE_Y       = 64;
+static const MIL_INT CPU_STEREO_PYRAMID_MARGIN    = 2;   // Margin around the coarse disparities, in full resolution steps.
+static const MIL_INT CPU_STEREO_MIN_COARSE_RADIUS = 2;
+
+// Parameters of the adaptive disparity range.
+static const bool       CPU_STEREO_ADAPTIVE_RANGE        = true;
+static const MIL_INT    DISPARITY_RANGE_MAX_STEPS        = 256;
+static const MIL_INT    DISPARITY_RANGE_HISTORY          = 8;     // Number of scans in the histogram.
+static const MIL_INT    DISPARITY_RANGE_MARGIN           = 2;     // Safety margin, in disparity steps.
+static const MIL_DOUBLE DISPARITY_RANGE_OUTLIER_FRACTION = 0.001; // Fraction of the pixels ignored at each end.
+static const MIL_DOUBLE DISPARITY_RANGE_MAX_AT_LIMIT     = 0.02;  // Fraction of the pixels at a limit that widens it.
+static const MIL_DOUBLE DISPARITY_RANGE_MIN_VALID_DROP   = 0.5;   // Drop of the valid ratio that widens the range.
+
+//////////////////////////////////////////////////////////////////////////
+// Class that tracks the disparity histogram of the recent scans and
+// narrows the active search range to the observed span plus a margin.
+//////////////////////////////////////////////////////////////////////////
+class CDisparityRangeTracker
+   {
+   public:
+      // Constructor.
+      CDisparityRangeTracker()
+         : m_FullStart(0), m_FullEnd(0), m_ActiveStart(0), m_ActiveEnd(0), m_NbScans(0), m_NextScan(0), m_ValidRatio(0)
+         {
+         }
+
+      // Function that sets the full range and makes it active.
+      void Reset(MIL_INT FullStart, MIL_INT FullEnd)
+         {
+         m_FullStart = FullStart;
+         m_FullEnd = FullEnd;
+         m_ActiveStart = FullStart;
+         m_ActiveEnd = FullEnd;
+         m_NbScans = 0;
+         m_NextScan = 0;
+         m_ValidRatio = 0;
+         }
+
+      MIL_INT GetActiveStart() const {return m_ActiveStart;}
+      MIL_INT GetActiveEnd() const {return m_ActiveEnd;}
+
+      // Function that adds the disparity histogram of a scan, indexed from the start
+      // of the full range, and updates the active range. The candidates are the
+      // pixels with enough texture to be matched. Returns true if a limit was hit
+      // by too many pixels or if the valid pixels dropped, as when the heights jump
+      // out of the range: the range is then widened and the scan must be recalculated.
+      bool AddScan(const MIL_INT* pHistogram, MIL_INT NbCandidates, MIL_INT NbAtLowLimit, MIL_INT NbAtHighLimit)
+         {
+         MIL_INT NbSteps = m_FullEnd - m_FullStart + 1;
+         if(NbSteps > DISPARITY_RANGE_MAX_STEPS || NbCandidates == 0)
+            return false;
+         MIL_INT NbValid = 0;
+         for(MIL_INT StepIdx = 0; StepIdx < NbSteps; StepIdx++)
+            NbValid += pHistogram[StepIdx];
+         MIL_DOUBLE ValidRatio = (MIL_DOUBLE)NbValid / NbCandidates;
+
+         // Widen the whole range if the valid pixels dropped.
+         bool Widen = false;
+         bool IsNarrowed = m_ActiveStart > m_FullStart || m_ActiveEnd < m_FullEnd;
+         if(IsNarrowed && ValidRatio < DISPARITY_RANGE_MIN_VALID_DROP * m_ValidRatio)
+            {
+            m_ActiveStart = m_FullStart;
+            m_ActiveEnd = m_FullEnd;
+            Widen = true;
+            }
+
+         // Widen the range on the sides whose limit is hit.
+         if(m_ActiveStart > m_FullStart && NbAtLowLimit > DISPARITY_RANGE_MAX_AT_LIMIT * NbValid)
+            {
+            m_ActiveStart = m_FullStart;
+            Widen = true;
+            }
+         if(m_ActiveEnd < m_FullEnd && NbAtHighLimit > DISPARITY_RANGE_MAX_AT_LIMIT * NbValid)
+            {
+            m_ActiveEnd = m_FullEnd;
+            Widen = true;
+            }
+         if(Widen)
+            {
+            // The heights changed, forget the history.
+            m_NbScans = 0;
+            m_NextScan = 0;
+            return true;
+            }
+         if(NbValid == 0)
+            return false;
+         m_ValidRatio = ValidRatio;
+
+         // Add the scan to the history.
+         memcpy(m_Histograms[m_NextScan], pHistogram, NbSteps * sizeof(MIL_INT));
+         m_NextScan = (m_NextScan + 1) % DISPARITY_RANGE_HISTORY;
+         if(m_NbScans < DISPARITY_RANGE_HISTORY)
+            m_NbScans++;
+
+         // Find the span of the history, without the outliers.
+         MIL_INT Histogram[DISPARITY_RANGE_MAX_STEPS];
+         MIL_INT Total = 0;
+         for(MIL_INT StepIdx = 0; StepIdx < NbSteps; StepIdx++)
+            {
+            Histogram[StepIdx] = 0;
+            for(MIL_INT ScanIdx = 0; ScanIdx < m_NbScans; ScanIdx++)
+               Histogram[StepIdx] += m_Histograms[ScanIdx][StepIdx];
+            Total += Histogram[StepIdx];
+            }
+         MIL_INT NbOutliers = (MIL_INT)(DISPARITY_RANGE_OUTLIER_FRACTION * Total);
+         MIL_INT LowStep = 0;
+         for(MIL_INT Sum = Histogram[0]; Sum <= NbOutliers && LowStep < NbSteps - 1; Sum += Histogram[++LowStep]);
+         MIL_INT HighStep = NbSteps - 1;
+         for(MIL_INT Sum = Histogram[HighStep]; Sum <= NbOutliers && HighStep > LowStep; Sum += Histogram[--HighStep]);
+
+         // Set the active range to the span plus the margin.
+         m_ActiveStart = m_FullStart + LowStep - DISPARITY_RANGE_MARGIN;
+         m_ActiveEnd = m_FullStart + HighStep + DISPARITY_RANGE_MARGIN;
+         if(m_ActiveStart < m_FullStart)
+            m_ActiveStart = m_FullStart;
+         if(m_ActiveEnd > m_FullEnd)
+            m_ActiveEnd = m_FullEnd;
+         return false;
+         }
+
+   private:
+      MIL_INT m_FullStart;
+      MIL_INT m_FullEnd;
+      MIL_INT m_ActiveStart;
+      MIL_INT m_ActiveEnd;
+      MIL_INT m_Histograms[DISPARITY_RANGE_HISTORY][DISPARITY_RANGE_MAX_STEPS];
+      MIL_INT m_NbScans;
+      MIL_INT m_NextScan;
+      MIL_DOUBLE m_ValidRatio;
+   };
+
+class CCpuStereoMatcher;
+
+// Phase of the calculation run by the bands.
+enum ECpuStereoPhase
+   {
+   CPU_STEREO_RECTIFY,        // Rectify the views of the source images.
+   CPU_STEREO_EXTRACT,        // Extract the gray views from the rectified views.
+   CPU_STEREO_DECIMATE,       // Decimate the views for the coarse search.
+   CPU_STEREO_MATCH_COARSE,   // Search the whole range on the decimated views.
+   CPU_STEREO_MATCH           // Search at full resolution.
+   };
+
+// Band of rows processed by a thread, with its work memory.
+struct SCpuStereoBand
+   {
+   CCpuStereoMatcher* pMatcher;
+   MIL_INT            StartY;
+   MIL_INT            EndY;
+   MIL_INT            CoarseStartY;
+   MIL_INT            CoarseEndY;
+   ECpuStereoPhase    Phase;
+
+   MIL_INT32*         pColumnSums;      // Column sums of L, L^2, R and R^2.
+   MIL_INT32*         pColumnSumsLR;    // Column sums of L*R for each disparity.
+   MIL_INT32*         pWindowSums;      // Window sums of L and R.
+   MIL_DOUBLE*        pInvStdDev;       // Inverse of the window deviation of L and R.
+   MIL_DOUBLE*        pStdDevL;         // Standard deviation of the left windows.
+   float*             pScores;          // ZNCC score of each disparity.
+   float*             pRightBestScores; // Best score of each pixel of the right view.
+   MIL_INT*           pRightBestDisp;   // Disparity index of the best right score.
+
+   MIL_INT*           pHistogram;       // Histogram of the valid disparities, from dStart.
+   MIL_INT            NbCandidates;     // Number of pixels with enough texture.
+   MIL_INT            NbAtLowLimit;     // Number of best matches at the limits of the search.
+   MIL_INT            NbAtHighLimit;
+   };
+
+// Views at a resolution level.
+struct SCpuStereoLevel
+   {
+   MIL_INT        SizeX;
+   MIL_INT        SizeY;
+   MIL_INT        Radius;       // Radius of the correlation window.
+   unsigned char* pLeft;
+   unsigned char* pRight;
+   };
+
+// Search of a tile: its pixels and its disparity range.
+struct SCpuStereoTile
+   {
+   MIL_INT StartX;
+   MIL_INT EndX;
+   MIL_INT StartY;
+   MIL_INT EndY;
+   MIL_INT SearchStart;
+   MIL_INT NbSearchDisp;
+   bool    CountLowLimit;    // The low limit of the search is a narrowed limit.
+   bool    CountHighLimit;   // The high limit of the search is a narrowed limit.
+   };
+
+// Comparison of the coarse-to-fine result with the brute-force one.
+struct SCpuStereoAccuracy
+   {
+   MIL_INT    NbValidBoth;
+   MIL_INT    NbValidOnlyPyramidal;
+   MIL_INT    NbValidOnlyBruteForce;
+   MIL_DOUBLE MeanAbsDifference;   // In disparity steps.
+   MIL_DOUBLE OutlierFraction;     // Fraction of the pixels valid in both that differ by more than one step.
+   MIL_DOUBLE PyramidalTime;       // In s.
+   MIL_DOUBLE BruteForceTime;      // In s.
+   };
+
+// Source image given to the matcher.
+struct SCpuStereoSource
+   {
+   MIL_INT              SizeX;
+   MIL_INT              SizeY;
+   MIL_INT              NbChannels;
+   MIL_INT              PitchByte;
+   const unsigned char* pData;
+   };
+
+//////////////////////////////////////////////////////////////////////////
+// Class that calculates the disparity of the 3DPIXA views on the CPU.
+// The public functions follow the I3DApi calls they implement.
+//////////////////////////////////////////////////////////////////////////
+class CCpuStereoMatcher
+   {
+   public:
+      // Constructor.
+      CCpuStereoMatcher()
+         : m_NbSources(0),
+           m_SrcViewSizeX(0),
+           m_NbChannels(0),
+           m_SizeX(0),
+           m_SizeY(0),
+           m_pRectified(NULL),
+           m_pDisparity(NULL),
+           m_pCoarseDisparity(NULL),
+           m_AdaptiveRange(CPU_STEREO_ADAPTIVE_RANGE),
+           m_SearchStart(0),
+           m_NbSearchDisp(0),
+           m_Pyramidal(false),
+           m_MatchTime(0),
+           m_RectifyTime(0),
+           m_pThreadPool(NULL),
+           m_ThreadPoolRole(0),
+           m_NbBands(0)
+         {
+         memset(&m_Config, 0, sizeof(m_Config));
+         memset(m_Sources, 0, sizeof(m_Sources));
+         memset(m_pRectifiedViews, 0, sizeof(m_pRectifiedViews));
+         memset(m_Levels, 0, sizeof(m_Levels));
+         memset(m_Bands, 0, sizeof(m_Bands));
+         }
+
+      // Destructor.
+      virtual ~CCpuStereoMatcher()
+         {
+         Free();
+         }
+
+      // Function that sets the calculation parameters. Returns -1 if they are invalid.
+      int initialize(const config3DApi* pConfig)
+         {
+         if(pConfig->dEnd <= pConfig->dStart || pConfig->windowType < 0 || pConfig->windowType >= CPU_STEREO_NB_WINDOW_TYPES)
+            return -1;
+         m_Config = *pConfig;
+         m_RangeTracker.Reset(m_Config.dStart, m_Config.dEnd);
+         Free();
+         return 0;
+         }
+
+      // Function that sets the format of a source image.
+      int setSrcImgInfo(int camNr, int width, int height, int channelCount, int bpp, int linePitch, long sizeInByte)
+         {
+         if(camNr < 0 || camNr > 1 || (bpp != 8 && bpp != 32))
+            return -1;
+         m_Sources[camNr].SizeX = width;
+         m_Sources[camNr].SizeY = height;
+         m_Sources[camNr].NbChannels = bpp / 8;
+         m_Sources[camNr].PitchByte = linePitch;
+         if(camNr + 1 > m_NbSources)
+            m_NbSources = camNr + 1;
+         Free();
+         return 0;
+         }
+
+      // Function that sets the data of a source image. Its format must be set.
+      int setSrcImgPtr(int camNr, char* pData)
+         {
+         if(camNr < 0 || camNr >= m_NbSources || m_Sources[camNr].SizeX == 0)
+            return -1;
+         m_Sources[camNr].pData = (const unsigned char*)pData;
+         return 0;
+         }
+
+      // Function that calculates the disparity of the current source images.
+      long getNextImgBlocking()
+         {
+         if(!Allocate() || m_Sources[0].pData == NULL || (m_NbSources == 2 && m_Sources[1].pData == NULL))
+            return -1;
+
+         MIL_DOUBLE StartTime;
+         MIL_DOUBLE EndTime;
+         MappTimer(M_DEFAULT, M_TIMER_READ, &StartTime);
+         if(!m_Rectifier.IsIdentity())
+            RunBands(CPU_STEREO_RECTIFY);
+         MappTimer(M_DEFAULT, M_TIMER_READ, &EndTime);
+         m_RectifyTime = EndTime - StartTime;
+
+         RunBands(CPU_STEREO_EXTRACT);
+         if(m_Pyramidal)
+            RunBands(CPU_STEREO_DECIMATE);
+         m_SearchStart = m_AdaptiveRange ? m_RangeTracker.GetActiveStart() : m_Config.dStart;
+         m_NbSearchDisp = (m_AdaptiveRange ? m_RangeTracker.GetActiveEnd() : m_Config.dEnd) - m_SearchStart + 1;
+         m_MatchTime = Match(m_Pyramidal);
+
+         // Update the adaptive range and recalculate the scan if it was too narrow.
+         while(m_AdaptiveRange && AddScanToRangeTracker())
+            {
+            m_SearchStart = m_RangeTracker.GetActiveStart();
+            m_NbSearchDisp = m_RangeTracker.GetActiveEnd() - m_SearchStart + 1;
+            m_MatchTime += Match(m_Pyramidal);
+            }
+         return 0;
+         }
+
+      // Function that sets the pool whose workers process the bands, NULL to
+      // start a thread per band for each phase.
+      void SetThreadPool(CPipelineThreadPool* pThreadPool, MIL_INT Role)
+         {
+         m_pThreadPool = pThreadPool;
+         m_ThreadPoolRole = Role;
+         }
+
+      // Function that enables the adaptive disparity range.
+      void SetAdaptiveRange(bool Enable)
+         {
+         m_AdaptiveRange = Enable;
+         m_RangeTracker.Reset(m_Config.dStart, m_Config.dEnd);
+         }
+
+      // Function that enables the coarse-to-fine search. The whole range is searched
+      // on views decimated by 2, then each tile is searched at full resolution only
+      // around the disparities found in it.
+      void SetPyramidal(bool Enable) {m_Pyramidal = Enable;}
+      bool IsPyramidal() const {return m_Pyramidal;}
+
+      // Function that returns the disparity range searched in the last calculation.
+      void GetSearchRange(int* pStart, int* pEnd) const
+         {
+         *pStart = (int)m_SearchStart;
+         *pEnd = (int)(m_SearchStart + m_NbSearchDisp - 1);
+         }
+
+      // Function that returns the time of the last rectification, in s, and the
+      // number of times the remap tables were built.
+      MIL_DOUBLE GetRectifyTime() const {return m_RectifyTime;}
+      MIL_INT GetNbRectifyBuilds() const {return m_Rectifier.GetNbBuilds();}
+
+      // Function that recalculates the last coarse-to-fine disparity by brute force
+      // and compares both. The coarse-to-fine disparity is kept as the output.
+      bool CompareWithBruteForce(SCpuStereoAccuracy* pAccuracy)
+         {
+         if(!m_Pyramidal || m_pDisparity == NULL)
+            return false;
+
+         // Keep the coarse-to-fine disparity and calculate the brute-force one.
+         MIL_INT NbPixels = m_SizeX * m_SizeY;
+         MIL_UINT16* pPyramidalDisparity = new MIL_UINT16[NbPixels];
+         memcpy(pPyramidalDisparity, m_pDisparity, NbPixels * sizeof(MIL_UINT16));
+         pAccuracy->PyramidalTime = m_MatchTime;
+         pAccuracy->BruteForceTime = Match(false);
+
+         // Compare the disparities, in disparity steps.
+         MIL_DOUBLE GrayPerStep = 65534.0 / (m_Config.dEnd - m_Config.dStart);
+         MIL_DOUBLE SumAbsDifference = 0;
+         MIL_INT NbOutliers = 0;
+         pAccuracy->NbValidBoth = 0;
+         pAccuracy->NbValidOnlyPyramidal = 0;
+         pAccuracy->NbValidOnlyBruteForce = 0;
+         for(MIL_INT PixelIdx = 0; PixelIdx < NbPixels; PixelIdx++)
+            {
+            MIL_INT PyramidalValue = pPyramidalDisparity[PixelIdx];
+            MIL_INT BruteForceValue = m_pDisparity[PixelIdx];
+            if(PyramidalValue != 0 && BruteForceValue != 0)
+               {
+               MIL_DOUBLE AbsDifference = fabs((MIL_DOUBLE)(PyramidalValue - BruteForceValue)) / GrayPerStep;
+               SumAbsDifference += AbsDifference;
+               if(AbsDifference > 1.0)
+                  NbOutliers++;
+               pAccuracy->NbValidBoth++;
+               }
+            else if(PyramidalValue != 0)
+               pAccuracy->NbValidOnlyPyramidal++;
+            else if(BruteForceValue != 0)
+               pAccuracy->NbValidOnlyBruteForce++;
+            }
+         pAccuracy->MeanAbsDifference = pAccuracy->NbValidBoth > 0 ? SumAbsDifference / pAccuracy->NbValidBoth : 0.0;
+         pAccuracy->OutlierFraction = pAccuracy->NbValidBoth > 0 ? (MIL_DOUBLE)NbOutliers / pAccuracy->NbValidBoth : 0.0;
+
+         // Restore the coarse-to-fine disparity.
+         memcpy(m_pDisparity, pPyramidalDisparity, NbPixels * sizeof(MIL_UINT16));
+         delete [] pPyramidalDisparity;
+         return true;
+         }
+
+      // Function that returns the format of an output image.
+      void getDestImgInfo(outImgType imgType, int &width, int &height, int &channelCount, unsigned long long &sizeInByte)
+         {
+         if(!GetViewSize(&m_SizeX, &m_SizeY))
+            {
+            width = -1;
+            height = -1;
+            channelCount = 0;
+            sizeInByte = 0;
+            return;
+            }
+         width = (int)m_SizeX;
+         height = (int)m_SizeY;
+         switch(imgType)
+            {
+         case IMG_OUT_BGRA:
+            channelCount = 3;
+            sizeInByte = (unsigned long long)m_SizeX * m_SizeY * 4;
+            break;
+         case IMG_OUT_GRAY:
+            channelCount = 1;
+            sizeInByte = (unsigned long long)m_SizeX * m_SizeY;
+            break;
+         case IMG_OUT_DISP:
+         default:
+            channelCount = 1;
+            sizeInByte = (unsigned long long)m_SizeX * m_SizeY * 2;
+            break;
+            }
+         }
+
+      // Function that copies the last output image to the given data pointer.
+      int getLastImage(void** imgPtr, int linePitch, outImgType type)
+         {
+         if(m_pDisparity == NULL)
+            return -1;
+
+         const unsigned char* pSrc;
+         MIL_INT RowSizeByte;
+         switch(type)
+            {
+         case IMG_OUT_BGRA:
+            pSrc = m_pRectified;
+            RowSizeByte = m_SizeX * 4;
+            break;
+         case IMG_OUT_GRAY:
+            pSrc = m_Levels[0].pLeft;
+            RowSizeByte = m_SizeX;
+            break;
+         case IMG_OUT_DISP:
+         default:
+            pSrc = (const unsigned char*)m_pDisparity;
+            RowSizeByte = m_SizeX * 2;
+            break;
+            }
+         unsigned char* pDst = (unsigned char*)*imgPtr;
+         for(MIL_INT y = 0; y < m_SizeY; y++)
+            memcpy(pDst + y * linePitch, pSrc + y * RowSizeByte, RowSizeByte);
+         return 0;
+         }
+
+      // Thread function that processes a band of rows.
+      static MIL_UINT32 MFTYPE BandThread(void* pBandPtr)
+         {
+         SCpuStereoBand* pBand = (SCpuStereoBand*)pBandPtr;
+         switch(pBand->Phase)
+            {
+         case CPU_STEREO_RECTIFY:
+            pBand->pMatcher->RectifyViews(pBand);
+            break;
+         case CPU_STEREO_EXTRACT:
+            pBand->pMatcher->ExtractViews(pBand);
+            break;
+         case CPU_STEREO_DECIMATE:
+            pBand->pMatcher->DecimateViews(pBand);
+            break;
+         case CPU_STEREO_MATCH_COARSE:
+            pBand->pMatcher->MatchCoarseBand(pBand);
+            break;
+         case CPU_STEREO_MATCH:
+         default:
+            pBand->pMatcher->MatchBand(pBand);
+            break;
+            }
+         return 0;
+         }
+
+      // Task that processes a band of rows.
+      static void BandTask(void* pBandPtr)
+         {
+         BandThread(pBandPtr);
+         }
+
+   private:
+      // Disallow copy.
+      CCpuStereoMatcher(const CCpuStereoMatcher&);
+      CCpuStereoMatcher& operator=(const CCpuStereoMatcher&);
+
+      // Function that returns the width of the raw views in the source images.
+      MIL_INT GetSrcViewSizeX() const
+         {
+         return m_NbSources == 2 ? m_Sources[0].SizeX : m_Sources[0].SizeX / 2;
+         }
+
+      // Function that returns the size of the rectified views from the source images.
+      bool GetViewSize(MIL_INT* pSizeX, MIL_INT* pSizeY) const
+         {
+         if(m_NbSources == 0 || m_Sources[0].SizeX == 0)
+            return false;
+         *pSizeX = CEpipolarRectifier::GetRectifiedSizeX(m_Config, GetSrcViewSizeX());
+         *pSizeY = m_Sources[0].SizeY;
+         return true;
+         }
+
+      // Function that allocates the views, the outputs and the work memory of the bands.
+      bool Allocate()
+         {
+         if(m_pDisparity != NULL)
+            return true;
+         if(!GetViewSize(&m_SizeX, &m_SizeY) || m_SizeX <= 0 || m_SizeY <= 0)
+            return false;
+         if(m_NbSources == 2 && (m_Sources[1].NbChannels != m_Sources[0].NbChannels ||
+                                 m_Sources[1].SizeX != m_Sources[0].SizeX ||
+                                 m_Sources[1].SizeY != m_Sources[0].SizeY))
+            return false;
+
+         // Build the remap tables, unless the geometry did not change.
+         m_SrcViewSizeX = GetSrcViewSizeX();
+         if(!m_Rectifier.Build(m_Config, m_SrcViewSizeX))
+            return false;
+
+         // Allocate the rectified views, unless the views are read from the sources.
+         // The color output is the left rectified view, or its expansion for gray
+         // sources.
+         m_NbChannels = m_Sources[0].NbChannels;
+         if(!m_Rectifier.IsIdentity())
+            {
+            for(MIL_INT View = 0; View < 2; View++)
+               m_pRectifiedViews[View] = new unsigned char[m_SizeX * m_SizeY * m_NbChannels];
+            }
+         m_pRectified = m_pRectifiedViews[0] != NULL && m_NbChannels == 4 ? m_pRectifiedViews[0] : new unsigned char[m_SizeX * m_SizeY * 4];
+
+         // Allocate the full resolution and the decimated views.
+         MIL_INT Radius = CPU_STEREO_WINDOW_SIZES[m_Config.windowType] / 2;
+         MIL_INT NbDisp = m_Config.dEnd - m_Config.dStart + 1;
+         for(MIL_INT LevelIdx = 0; LevelIdx < 2; LevelIdx++)
+            {
+            SCpuStereoLevel& Level = m_Levels[LevelIdx];
+            Level.SizeX = m_SizeX >> LevelIdx;
+            Level.SizeY = m_SizeY >> LevelIdx;
+            Level.Radius = LevelIdx == 0 ? Radius : Radius / 2;
+            if(Level.Radius < CPU_STEREO_MIN_COARSE_RADIUS)
+               Level.Radius = CPU_STEREO_MIN_COARSE_RADIUS;
+            Level.pLeft = new unsigned char[Level.SizeX * Level.SizeY];
+            Level.pRight = new unsigned char[Level.SizeX * Level.SizeY];
+            }
+         m_pDisparity = new MIL_UINT16[m_SizeX * m_SizeY];
+         m_pCoarseDisparity = new float[m_Levels[1].SizeX * m_Levels[1].SizeY];
+
+         m_NbBands = GetNbProcessors();
+         if(m_NbBands < 1)
+            m_NbBands = 1;
+         if(m_NbBands > CPU_STEREO_MAX_THREADS)
+            m_NbBands = CPU_STEREO_MAX_THREADS;
+         if(m_NbBands > m_Levels[1].SizeY)
+            m_NbBands = m_Levels[1].SizeY > 0 ? m_Levels[1].SizeY : 1;
+         for(MIL_INT BandIdx = 0; BandIdx < m_NbBands; BandIdx++)
+            {
+            SCpuStereoBand& Band = m_Bands[BandIdx];
+            Band.pMatcher = this;
+            Band.StartY = m_SizeY * BandIdx / m_NbBands;
+            Band.EndY = m_SizeY * (BandIdx + 1) / m_NbBands;
+            Band.CoarseStartY = m_Levels[1].SizeY * BandIdx / m_NbBands;
+            Band.CoarseEndY = m_Levels[1].SizeY * (BandIdx + 1) / m_NbBands;
+            Band.pColumnSums = new MIL_INT32[4 * m_SizeX];
+            Band.pColumnSumsLR = new MIL_INT32[NbDisp * m_SizeX];
+            Band.pWindowSums = new MIL_INT32[2 * m_SizeX];
+            Band.pInvStdDev = new MIL_DOUBLE[2 * m_SizeX];
+            Band.pStdDevL = new MIL_DOUBLE[m_SizeX];
+            Band.pScores = new float[NbDisp * m_SizeX];
+            Band.pRightBestScores = new float[m_SizeX];
+            Band.pRightBestDisp = new MIL_INT[m_SizeX];
+            Band.pHistogram = new MIL_INT[NbDisp];
+            }
+         return true;
+         }
+
+      // Function that frees the allocations. They are redone at the next calculation.
+      void Free()
+         {
+         for(MIL_INT BandIdx = 0; BandIdx < m_NbBands; BandIdx++)
+            {
+            SCpuStereoBand& Band = m_Bands[BandIdx];
+            delete [] Band.pHistogram;
+            delete [] Band.pRightBestDisp;
+            delete [] Band.pRightBestScores;
+            delete [] Band.pScores;
+            delete [] Band.pStdDevL;
+            delete [] Band.pInvStdDev;
+            delete [] Band.pWindowSums;
+            delete [] Band.pColumnSumsLR;
+            delete [] Band.pColumnSums;
+            }
+         memset(m_Bands, 0, sizeof(m_Bands));
+         m_NbBands = 0;
+         for(MIL_INT LevelIdx = 0; LevelIdx < 2; LevelIdx++)
+            {
+            delete [] m_Levels[LevelIdx].pRight;
+            delete [] m_Levels[LevelIdx].pLeft;
+            }
+         memset(m_Levels, 0, sizeof(m_Levels));
+         delete [] m_pCoarseDisparity;
+         delete [] m_pDisparity;
+         if(m_pRectified != m_pRectifiedViews[0])
+            delete [] m_pRectified;
+         for(MIL_INT View = 0; View < 2; View++)
+            {
+            delete [] m_pRectifiedViews[View];
+            m_pRectifiedViews[View] = NULL;
+            }
+         m_pCoarseDisparity = NULL;
+         m_pDisparity = NULL;
+         m_pRectified = NULL;
+         }
+
+      // Function that runs a phase of the calculation on all the bands concurrently,
+      // the first one in the calling thread. The other bands are queued in the
+      // pool, or run in threads started for the phase when no pool is set.
+      void RunBands(ECpuStereoPhase Phase)
+         {
+         for(MIL_INT BandIdx = 0; BandIdx < m_NbBands; BandIdx++)
+            m_Bands[BandIdx].Phase = Phase;
+         if(m_pThreadPool && m_pThreadPool->GetNbWorkers(m_ThreadPoolRole) > 0 && !m_pThreadPool->IsWorkerThread())
+            {
+            CThreadPoolBatch Batch;
+            for(MIL_INT BandIdx = 1; BandIdx < m_NbBands; BandIdx++)
+               m_pThreadPool->Submit(m_ThreadPoolRole, BandTask, &m_Bands[BandIdx], &Batch);
+            BandThread(&m_Bands[0]);
+            Batch.Wait();
+            return;
+            }
+
+         MIL_ID MilThreads[CPU_STEREO_MAX_THREADS];
+         for(MIL_INT BandIdx = 1; BandIdx < m_NbBands; BandIdx++)
+            MilThreads[BandIdx] = MthrAlloc(M_DEFAULT_HOST, M_THREAD, M_DEFAULT, BandThread, &m_Bands[BandIdx], M_NULL);
+         BandThread(&m_Bands[0]);
+         for(MIL_INT BandIdx = 1; BandIdx < m_NbBands; BandIdx++)
+            {
+            MthrWait(MilThreads[BandIdx], M_THREAD_END_WAIT, M_NULL);
+            MthrFree(MilThreads[BandIdx]);
+            }
+         }
+
+      // Function that calculates the disparity of the extracted views in the
+      // current search range. Returns the calculation time in s.
+      MIL_DOUBLE Match(bool Pyramidal)
+         {
+         MIL_DOUBLE StartTime;
+         MIL_DOUBLE EndTime;
+         MappTimer(M_DEFAULT, M_TIMER_READ, &StartTime);
+         bool PreviousPyramidal = m_Pyramidal;
+         m_Pyramidal = Pyramidal;
+         if(Pyramidal)
+            RunBands(CPU_STEREO_MATCH_COARSE);
+         RunBands(CPU_STEREO_MATCH);
+         m_Pyramidal = PreviousPyramidal;
+         MappTimer(M_DEFAULT, M_TIMER_READ, &EndTime);
+         return EndTime - StartTime;
+         }
+
+      // Function that adds the statistics of the bands to the range tracker.
+      // Returns true if the scan must be recalculated with a wider range.
+      bool AddScanToRangeTracker()
+         {
+         MIL_INT NbDisp = m_Config.dEnd - m_Config.dStart + 1;
+         MIL_INT Histogram[DISPARITY_RANGE_MAX_STEPS];
+         MIL_INT NbCandidates = 0;
+         MIL_INT NbAtLowLimit = 0;
+         MIL_INT NbAtHighLimit = 0;
+         if(NbDisp > DISPARITY_RANGE_MAX_STEPS)
+            return false;
+         for(MIL_INT DispIdx = 0; DispIdx < NbDisp; DispIdx++)
+            Histogram[DispIdx] = 0;
+         for(MIL_INT BandIdx = 0; BandIdx < m_NbBands; BandIdx++)
+            {
+            for(MIL_INT DispIdx = 0; DispIdx < NbDisp; DispIdx++)
+               Histogram[DispIdx] += m_Bands[BandIdx].pHistogram[DispIdx];
+            NbCandidates += m_Bands[BandIdx].NbCandidates;
+            NbAtLowLimit += m_Bands[BandIdx].NbAtLowLimit;
+            NbAtHighLimit += m_Bands[BandIdx].NbAtHighLimit;
+            }
+         return m_RangeTracker.AddScan(Histogram, NbCandidates, NbAtLowLimit, NbAtHighLimit);
+         }
+
+      // Function that returns the gray value of a source pixel.
+      unsigned char GetGray(const unsigned char* pPixel, MIL_INT NbChannels) const
+         {
+         if(NbChannels == 1)
+            return pPixel[0];
+         if(m_Config.numChannelsUsedForCalculation >= 3)
+            return (unsigned char)((pPixel[0] + pPixel[1] + pPixel[2]) / 3);
+         MIL_INT Channel = m_Config.intensityChannelUsed;
+         return pPixel[Channel < 0 ? 0 : (Channel > 2 ? 2 : Channel)];
+         }
+
+      // Function that returns a row of a view in the source images.
+      const unsigned char* GetSourceRow(MIL_INT View, MIL_INT y) const
+         {
+         const SCpuStereoSource& Source = m_Sources[m_NbSources == 2 ? View : 0];
+         MIL_INT OffsetX = m_NbSources == 2 ? 0 : View * m_SrcViewSizeX;
+         return Source.pData + y * Source.PitchByte + OffsetX * m_NbChannels;
+         }
+
+      // Function that rectifies the rows of a band of the left and right views.
+      void RectifyViews(const SCpuStereoBand* pBand)
+         {
+         for(MIL_INT View = 0; View < 2; View++)
+            {
+            const SCpuStereoSource& Source = m_Sources[m_NbSources == 2 ? View : 0];
+            m_Rectifier.Rectify(View, GetSourceRow(View, 0), Source.SizeY, Source.PitchByte, m_NbChannels,
+                                m_pRectifiedViews[View], m_SizeX * m_NbChannels, pBand->StartY, pBand->EndY);
+            }
+         }
+
+      // Function that extracts the gray left and right views of the rows of a
+      // band from the rectified views, or from the sources with identity tables,
+      // and the color image.
+      void ExtractViews(const SCpuStereoBand* pBand)
+         {
+         bool IsIdentity = m_Rectifier.IsIdentity();
+         for(MIL_INT y = pBand->StartY; y < pBand->EndY; y++)
+            {
+            const unsigned char* pLeftRow = IsIdentity ? GetSourceRow(0, y) : m_pRectifiedViews[0] + y * m_SizeX * m_NbChannels;
+            const unsigned char* pRightRow = IsIdentity ? GetSourceRow(1, y) : m_pRectifiedViews[1] + y * m_SizeX * m_NbChannels;
+            unsigned char* pLeft = m_Levels[0].pLeft + y * m_SizeX;
+            unsigned char* pRight = m_Levels[0].pRight + y * m_SizeX;
+            for(MIL_INT x = 0; x < m_SizeX; x++)
+               {
+               pLeft[x] = GetGray(pLeftRow + x * m_NbChannels, m_NbChannels);
+               pRight[x] = GetGray(pRightRow + x * m_NbChannels, m_NbChannels);
+               }
+
+            // Copy the color left view, or expand the gray one, to the color image.
+            if(m_NbChannels == 4 && IsIdentity)
+               memcpy(m_pRectified + y * m_SizeX * 4, pLeftRow, m_SizeX * 4);
+            else if(m_NbChannels == 1)
+               {
+               unsigned char* pRectified = m_pRectified + y * m_SizeX * 4;
+               for(MIL_INT x = 0; x < m_SizeX; x++)
+                  {
+                  pRectified[4 * x] = pRectified[4 * x + 1] = pRectified[4 * x + 2] = pLeftRow[x];
+                  pRectified[4 * x + 3] = 255;
+                  }
+               }
+            }
+         }
+
+      // Function that decimates the views by 2, averaging 2x2 pixels, for the
+      // coarse rows of a band.
+      void DecimateViews(const SCpuStereoBand* pBand)
+         {
+         const SCpuStereoLevel& Full = m_Levels[0];
+         const SCpuStereoLevel& Coarse = m_Levels[1];
+         for(MIL_INT y = pBand->CoarseStartY; y < pBand->CoarseEndY; y++)
+            {
+            for(MIL_INT View = 0; View < 2; View++)
+               {
+               const unsigned char* pSrc = (View == 0 ? Full.pLeft : Full.pRight) + 2 * y * Full.SizeX;
+               unsigned char* pDst = (View == 0 ? Coarse.pLeft : Coarse.pRight) + y * Coarse.SizeX;
+               for(MIL_INT x = 0; x < Coarse.SizeX; x++)
+                  pDst[x] = (unsigned char)((pSrc[2 * x] + pSrc[2 * x + 1] + pSrc[Full.SizeX + 2 * x] + pSrc[Full.SizeX + 2 * x + 1] + 2) >> 2);
+               }
+            }
+         }
+
+      // Function that searches the whole range on the decimated views for the
+      // coarse rows of a band.
+      void MatchCoarseBand(SCpuStereoBand* pBand)
+         {
+         const SCpuStereoLevel& Coarse = m_Levels[1];
+         for(MIL_INT PixelIdx = pBand->CoarseStartY * Coarse.SizeX; PixelIdx < pBand->CoarseEndY * Coarse.SizeX; PixelIdx++)
+            m_pCoarseDisparity[PixelIdx] = CPU_STEREO_INVALID_DISP;
+
+         SCpuStereoTile Tile;
+         Tile.StartX = 0;
+         Tile.EndX = Coarse.SizeX;
+         Tile.StartY = pBand->CoarseStartY;
+         Tile.EndY = pBand->CoarseEndY;
+         Tile.SearchStart = (MIL_INT)floor(m_SearchStart / 2.0);
+         Tile.NbSearchDisp = (MIL_INT)ceil((m_SearchStart + m_NbSearchDisp - 1) / 2.0) - Tile.SearchStart + 1;
+         Tile.CountLowLimit = false;
+         Tile.CountHighLimit = false;
+         MatchTile(pBand, Coarse, Tile, false);
+         }
+
+      // Function that calculates the disparity of the rows of a band at full
+      // resolution, either in the whole range or, in tiles, around the coarse
+      // disparity.
+      void MatchBand(SCpuStereoBand* pBand)
+         {
+         // Clear the statistics and the output of the band.
+         memset(pBand->pHistogram, 0, (m_Config.dEnd - m_Config.dStart + 1) * sizeof(MIL_INT));
+         pBand->NbCandidates = 0;
+         pBand->NbAtLowLimit = 0;
+         pBand->NbAtHighLimit = 0;
+         memset(m_pDisparity + pBand->StartY * m_SizeX, 0, (pBand->EndY - pBand->StartY) * m_SizeX * sizeof(MIL_UINT16));
+
+         SCpuStereoTile Tile;
+         Tile.SearchStart = m_SearchStart;
+         Tile.NbSearchDisp = m_NbSearchDisp;
+         Tile.CountLowLimit = m_SearchStart > m_Config.dStart;
+         Tile.CountHighLimit = m_SearchStart + m_NbSearchDisp - 1 < m_Config.dEnd;
+         if(!m_Pyramidal)
+            {
+            Tile.StartX = 0;
+            Tile.EndX = m_SizeX;
+            Tile.StartY = pBand->StartY;
+            Tile.EndY = pBand->EndY;
+            MatchTile(pBand, m_Levels[0], Tile, true);
+            return;
+            }
+
+         for(Tile.StartY = pBand->StartY; Tile.StartY < pBand->EndY; Tile.StartY += CPU_STEREO_TILE_SIZE_Y)
+            {
+            Tile.EndY = Tile.StartY + CPU_STEREO_TILE_SIZE_Y < pBand->EndY ? Tile.StartY + CPU_STEREO_TILE_SIZE_Y : pBand->EndY;
+            for(Tile.StartX = 0; Tile.StartX < m_SizeX; Tile.StartX += CPU_STEREO_TILE_SIZE_X)
+               {
+               Tile.EndX = Tile.StartX + CPU_STEREO_TILE_SIZE_X < m_SizeX ? Tile.StartX + CPU_STEREO_TILE_SIZE_X : m_SizeX;
+               SetTileRangeFromCoarse(&Tile);
+               MatchTile(pBand, m_Levels[0], Tile, true);
+               }
+            }
+         }
+
+      // Function that sets the search range of a tile around the disparities of
+      // the coarse pixels that cover it. The tiles without coarse disparity are
+      // searched in the whole range.
+      void SetTileRangeFromCoarse(SCpuStereoTile* pTile) const
+         {
+         const SCpuStereoLevel& Coarse = m_Levels[1];
+         MIL_INT StartX = pTile->StartX / 2 > 0 ? pTile->StartX / 2 - 1 : 0;
+         MIL_INT StartY = pTile->StartY / 2 > 0 ? pTile->StartY / 2 - 1 : 0;
+         MIL_INT EndX = pTile->EndX / 2 + 1 < Coarse.SizeX ? pTile->EndX / 2 + 1 : Coarse.SizeX;
+         MIL_INT EndY = pTile->EndY / 2 + 1 < Coarse.SizeY ? pTile->EndY / 2 + 1 : Coarse.SizeY;
+         float MinDisp = 0;
+         float MaxDisp = 0;
+         bool HasDisp = false;
+         for(MIL_INT y = StartY; y < EndY; y++)
+            {
+            const float* pCoarseDisparity = m_pCoarseDisparity + y * Coarse.SizeX;
+            for(MIL_INT x = StartX; x < EndX; x++)
+               {
+               float Disp = pCoarseDisparity[x];
+               if(Disp == CPU_STEREO_INVALID_DISP)
+                  continue;
+               if(!HasDisp || Disp < MinDisp)
+                  MinDisp = Disp;
+               if(!HasDisp || Disp > MaxDisp)
+                  MaxDisp = Disp;
+               HasDisp = true;
+               }
+            }
+
+         // Scale the coarse span to full resolution and add the margin.
+         MIL_INT ActiveEnd = m_SearchStart + m_NbSearchDisp - 1;
+         MIL_INT SearchStart = m_SearchStart;
+         MIL_INT SearchEnd = ActiveEnd;
+         if(HasDisp)
+            {
+            SearchStart = (MIL_INT)floor(2 * MinDisp) - CPU_STEREO_PYRAMID_MARGIN;
+            SearchEnd = (MIL_INT)ceil(2 * MaxDisp) + CPU_STEREO_PYRAMID_MARGIN;
+            if(SearchStart < m_SearchStart)
+               SearchStart = m_SearchStart;
+            if(SearchEnd > ActiveEnd)
+               SearchEnd = ActiveEnd;
+            if(SearchStart > SearchEnd)
+               {
+               SearchStart = m_SearchStart;
+               SearchEnd = ActiveEnd;
+               }
+            }
+         pTile->SearchStart = SearchStart;
+         pTile->NbSearchDisp = SearchEnd - SearchStart + 1;
+         pTile->CountLowLimit = SearchStart == m_SearchStart && m_SearchStart > m_Config.dStart;
+         pTile->CountHighLimit = SearchEnd == ActiveEnd && ActiveEnd < m_Config.dEnd;
+         }
+
+      // Function that adds the products of a row to the column sums and removes
+      // the ones of another row. SubY is -1 when no row is removed. The view sums
+      // are updated in [StartX, EndX) and the product sums in [StartLR, EndLR).
+      void UpdateColumnSums(SCpuStereoBand* pBand, const SCpuStereoLevel& Level, const SCpuStereoTile& Tile,
+                            MIL_INT AddY, MIL_INT SubY, MIL_INT StartX, MIL_INT EndX, MIL_INT StartLR, MIL_INT EndLR) const
+         {
+         MIL_INT SizeX = Level.SizeX;
+         MIL_INT32* pSumL  = pBand->pColumnSums;
+         MIL_INT32* pSumLL = pSumL + SizeX;
+         MIL_INT32* pSumR  = pSumLL + SizeX;
+         MIL_INT32* pSumRR = pSumR + SizeX;
+         const unsigned char* pLeftAdd = Level.pLeft + AddY * SizeX;
+         const unsigned char* pRightAdd = Level.pRight + AddY * SizeX;
+         const unsigned char* pLeftSub = SubY >= 0 ? Level.pLeft + SubY * SizeX : NULL;
+         const unsigned char* pRightSub = SubY >= 0 ? Level.pRight + SubY * SizeX : NULL;
+
+         // Update the sums of each view.
+         for(MIL_INT x = StartX; x < EndX; x++)
+            {
+            MIL_INT32 LeftValue = pLeftAdd[x];
+            MIL_INT32 RightValue = pRightAdd[x];
+            pSumL[x]  += LeftValue;
+            pSumLL[x] += LeftValue * LeftValue;
+            pSumR[x]  += RightValue;
+            pSumRR[x] += RightValue * RightValue;
+            if(pLeftSub)
+               {
+               LeftValue = pLeftSub[x];
+               RightValue = pRightSub[x];
+               pSumL[x]  -= LeftValue;
+               pSumLL[x] -= LeftValue * LeftValue;
+               pSumR[x]  -= RightValue;
+               pSumRR[x] -= RightValue * RightValue;
+               }
+            }
+
+         // Update the sums of the products for each searched disparity, 8 pixels at a time.
+         const __m128i Zero = _mm_setzero_si128();
+         for(MIL_INT DispIdx = 0; DispIdx < Tile.NbSearchDisp; DispIdx++)
+            {
+            MIL_INT Disp = Tile.SearchStart + DispIdx;
+            MIL_INT DispStartX = Disp < 0 ? -Disp : 0;
+            MIL_INT DispEndX = Disp > 0 ? SizeX - Disp : SizeX;
+            if(DispStartX < StartLR)
+               DispStartX = StartLR;
+            if(DispEndX > EndLR)
+               DispEndX = EndLR;
+            MIL_INT32* pSumLR = pBand->pColumnSumsLR + DispIdx * SizeX;
+            MIL_INT x = DispStartX;
+            for(; x + 8 <= DispEndX; x += 8)
+               {
+               __m128i LeftAdd  = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)(pLeftAdd + x)), Zero);
+               __m128i RightAdd = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)(pRightAdd + x + Disp)), Zero);
+               __m128i Product  = _mm_mullo_epi16(LeftAdd, RightAdd);
+               __m128i ProductLow  = _mm_unpacklo_epi16(Product, Zero);
+               __m128i ProductHigh = _mm_unpackhi_epi16(Product, Zero);
+               if(pLeftSub)
+                  {
+                  __m128i LeftSub  = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)(pLeftSub + x)), Zero);
+                  __m128i RightSub = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)(pRightSub + x + Disp)), Zero);
+                  __m128i SubProduct = _mm_mullo_epi16(LeftSub, RightSub);
+                  ProductLow  = _mm_sub_epi32(ProductLow, _mm_unpacklo_epi16(SubProduct, Zero));
+                  ProductHigh = _mm_sub_epi32(ProductHigh, _mm_unpackhi_epi16(SubProduct, Zero));
+                  }
+               __m128i* pDst = (__m128i*)(pSumLR + x);
+               _mm_storeu_si128(pDst, _mm_add_epi32(_mm_loadu_si128(pDst), ProductLow));
+               _mm_storeu_si128(pDst + 1, _mm_add_epi32(_mm_loadu_si128(pDst + 1), ProductHigh));
+               }
+            for(; x < DispEndX; x++)
+               {
+               pSumLR[x] += (MIL_INT32)pLeftAdd[x] * pRightAdd[x + Disp];
+               if(pLeftSub)
+                  pSumLR[x] -= (MIL_INT32)pLeftSub[x] * pRightSub[x + Disp];
+               }
+            }
+         }
+
+      // Function that calculates the disparity of the pixels of a tile at a level.
+      // The scores are also calculated for the pixels around the tile whose match
+      // can be one of its right pixels, for the consistency check.
+      void MatchTile(SCpuStereoBand* pBand, const SCpuStereoLevel& Level, const SCpuStereoTile& Tile, bool IsFullResolution)
+         {
+         MIL_INT SizeX = Level.SizeX;
+         MIL_INT Radius = Level.Radius;
+         MIL_INT WindowSize = 2 * Radius + 1;
+         MIL_INT64 NbPixels = WindowSize * WindowSize;
+         MIL_INT NbDisp = Tile.NbSearchDisp;
+
+         // Get the output pixels, the rows and columns too close to the border have no disparity.
+         MIL_INT StartY = Tile.StartY > Radius ? Tile.StartY : Radius;
+         MIL_INT EndY = Tile.EndY < Level.SizeY - Radius ? Tile.EndY : Level.SizeY - Radius;
+         MIL_INT OutStartX = Tile.StartX > Radius ? Tile.StartX : Radius;
+         MIL_INT OutEndX = Tile.EndX < SizeX - Radius ? Tile.EndX : SizeX - Radius;
+         if(StartY >= EndY || OutStartX >= OutEndX)
+            return;
+
+         // Get the columns of the scores, of the left windows and of all the windows.
+         MIL_INT ScoreStartX = OutStartX - (NbDisp - 1) > Radius ? OutStartX - (NbDisp - 1) : Radius;
+         MIL_INT ScoreEndX = OutEndX + (NbDisp - 1) < SizeX - Radius ? OutEndX + (NbDisp - 1) : SizeX - Radius;
+         MIL_INT LeftStartX = ScoreStartX - Radius;
+         MIL_INT LeftEndX = ScoreEndX + Radius;
+         MIL_INT MinDisp = Tile.SearchStart;
+         MIL_INT MaxDisp = Tile.SearchStart + NbDisp - 1;
+         MIL_INT ColumnStartX = LeftStartX + (MinDisp < 0 ? MinDisp : 0);
+         MIL_INT ColumnEndX = LeftEndX + (MaxDisp > 0 ? MaxDisp : 0);
+         if(ColumnStartX < 0)
+            ColumnStartX = 0;
+         if(ColumnEndX > SizeX)
+            ColumnEndX = SizeX;
+
+         // Initialize the column sums with the window of the first row.
+         for(MIL_INT Sum = 0; Sum < 4; Sum++)
+            memset(pBand->pColumnSums + Sum * SizeX + ColumnStartX, 0, (ColumnEndX - ColumnStartX) * sizeof(MIL_INT32));
+         for(MIL_INT DispIdx = 0; DispIdx < NbDisp; DispIdx++)
+            memset(pBand->pColumnSumsLR + DispIdx * SizeX + LeftStartX, 0, (LeftEndX - LeftStartX) * sizeof(MIL_INT32));
+         for(MIL_INT y = StartY - Radius; y <= StartY + Radius; y++)
+            UpdateColumnSums(pBand, Level, Tile, y, -1, ColumnStartX, ColumnEndX, LeftStartX, LeftEndX);
+
+         for(MIL_INT y = StartY; y < EndY; y++)
+            {
+            if(y > StartY)
+               UpdateColumnSums(pBand, Level, Tile, y + Radius, y - Radius - 1, ColumnStartX, ColumnEndX, LeftStartX, LeftEndX);
+
+            // Calculate the window sums and deviations of each view.
+            for(MIL_INT View = 0; View < 2; View++)
+               {
+               const MIL_INT32* pSum = pBand->pColumnSums + 2 * View * SizeX;
+               const MIL_INT32* pSquareSum = pSum + SizeX;
+               MIL_INT32* pWindowSum = pBand->pWindowSums + View * SizeX;
+               MIL_DOUBLE* pInvStdDev = pBand->pInvStdDev + View * SizeX;
+               MIL_INT32 Sum = 0;
+               MIL_INT32 SquareSum = 0;
+               for(MIL_INT x = ColumnStartX; x < ColumnStartX + WindowSize - 1; x++)
+                  {
+                  Sum += pSum[x];
+                  SquareSum += pSquareSum[x];
+                  }
+               for(MIL_INT x = ColumnStartX + Radius; x < ColumnEndX - Radius; x++)
+                  {
+                  Sum += pSum[x + Radius];
+                  SquareSum += pSquareSum[x + Radius];
+                  MIL_INT64 Variance = NbPixels * SquareSum - (MIL_INT64)Sum * Sum;
+                  pWindowSum[x] = Sum;
+                  pInvStdDev[x] = Variance > 0 ? 1.0 / sqrt((MIL_DOUBLE)Variance) : 0.0;
+                  if(View == 0)
+                     pBand->pStdDevL[x] = Variance > 0 ? sqrt((MIL_DOUBLE)Variance) / NbPixels : 0.0;
+                  Sum -= pSum[x - Radius];
+                  SquareSum -= pSquareSum[x - Radius];
+                  }
+               }
+
+            // Calculate the ZNCC score of each disparity.
+            for(MIL_INT x = ColumnStartX; x < ColumnEndX; x++)
+               pBand->pRightBestScores[x] = CPU_STEREO_INVALID_SCORE;
+            for(MIL_INT DispIdx = 0; DispIdx < NbDisp; DispIdx++)
+               {
+               MIL_INT Disp = Tile.SearchStart + DispIdx;
+               const MIL_INT32* pSumLR = pBand->pColumnSumsLR + DispIdx * SizeX;
+               float* pScores = pBand->pScores + DispIdx * SizeX;
+               MIL_INT StartX = ScoreStartX > ColumnStartX + Radius - Disp ? ScoreStartX : ColumnStartX + Radius - Disp;
+               MIL_INT EndX = ScoreEndX < ColumnEndX - Radius - Disp ? ScoreEndX : ColumnEndX - Radius - Disp;
+               for(MIL_INT x = ScoreStartX; x < ScoreEndX; x++)
+                  pScores[x] = CPU_STEREO_INVALID_SCORE;
+               if(StartX >= EndX)
+                  continue;
+
+               MIL_INT32 SumLR = 0;
+               for(MIL_INT x = StartX - Radius; x < StartX + Radius; x++)
+                  SumLR += pSumLR[x];
+               for(MIL_INT x = StartX; x < EndX; x++)
+                  {
+                  SumLR += pSumLR[x + Radius];
+                  MIL_INT64 Covariance = NbPixels * SumLR - (MIL_INT64)pBand->pWindowSums[x] * pBand->pWindowSums[SizeX + x + Disp];
+                  float Score = (float)(Covariance * pBand->pInvStdDev[x] * pBand->pInvStdDev[SizeX + x + Disp]);
+                  pScores[x] = Score;
+                  SumLR -= pSumLR[x - Radius];
+
+                  // Keep the best match of the right pixel for the consistency check.
+                  if(Score > pBand->pRightBestScores[x + Disp])
+                     {
+                     pBand->pRightBestScores[x + Disp] = Score;
+                     pBand->pRightBestDisp[x + Disp] = DispIdx;
+                     }
+                  }
+               }
+
+            // Select the best disparity of each pixel.
+            const unsigned char* pLeft = Level.pLeft + y * SizeX;
+            if(IsFullResolution)
+               {
+               MIL_UINT16* pDisparity = m_pDisparity + y * SizeX;
+               for(MIL_INT x = OutStartX; x < OutEndX; x++)
+                  {
+                  MIL_DOUBLE Disp = SelectDisparity(pBand, Tile, SizeX, x, pLeft[x], true);
+                  pDisparity[x] = Disp == CPU_STEREO_INVALID_DISP ? 0 : DisparityToGray(Disp);
+                  }
+               }
+            else
+               {
+               float* pDisparity = m_pCoarseDisparity + y * SizeX;
+               for(MIL_INT x = OutStartX; x < OutEndX; x++)
+                  pDisparity[x] = (float)SelectDisparity(pBand, Tile, SizeX, x, pLeft[x], false);
+               }
+            }
+         }
+
+      // Function that selects the disparity of a pixel from its scores. Returns
+      // CPU_STEREO_INVALID_DISP if it is invalid.
+      MIL_DOUBLE SelectDisparity(SCpuStereoBand* pBand, const SCpuStereoTile& Tile, MIL_INT SizeX, MIL_INT x, unsigned char LeftValue, bool UpdateStatistics) const
+         {
+         // Reject the pixels that are too dark, saturated or without texture.
+         if(LeftValue < m_Config.mingw || LeftValue > m_Config.maxgw || pBand->pStdDevL[x] < m_Config.minStdDevA)
+            return CPU_STEREO_INVALID_DISP;
+         if(UpdateStatistics)
+            pBand->NbCandidates++;
+
+         // Find the best score.
+         MIL_INT NbDisp = Tile.NbSearchDisp;
+         MIL_INT BestIdx = -1;
+         float BestScore = CPU_STEREO_INVALID_SCORE;
+         for(MIL_INT DispIdx = 0; DispIdx < NbDisp; DispIdx++)
+            {
+            float Score = pBand->pScores[DispIdx * SizeX + x];
+            if(Score > BestScore)
+               {
+               BestScore = Score;
+               BestIdx = DispIdx;
+               }
+            }
+         if(BestIdx < 0 || BestScore < m_Config.minKkf)
+            return CPU_STEREO_INVALID_DISP;
+
+         // Count the matches at the limits of a narrowed search range.
+         if(UpdateStatistics && BestIdx == 0 && Tile.CountLowLimit)
+            pBand->NbAtLowLimit++;
+         if(UpdateStatistics && BestIdx == NbDisp - 1 && Tile.CountHighLimit)
+            pBand->NbAtHighLimit++;
+
+         // Reject the ambiguous matches, whose best score is not distinct enough
+         // from the best score away from its neighbors.
+         if(m_Config.dispThreshErr > 0)
+            {
+            float SecondScore = CPU_STEREO_INVALID_SCORE;
+            for(MIL_INT DispIdx = 0; DispIdx < NbDisp; DispIdx++)
+               {
+               float Score = pBand->pScores[DispIdx * SizeX + x];
+               if((DispIdx < BestIdx - 1 || DispIdx > BestIdx + 1) && Score > SecondScore)
+                  SecondScore = Score;
+               }
+            if(BestScore - SecondScore < m_Config.dispThreshErr)
+               return CPU_STEREO_INVALID_DISP;
+            }
+
+         // Reject the matches that are not the best match of the right pixel.
+         if(m_Config.maxConsistent > 0)
+            {
+            MIL_INT RightX = x + Tile.SearchStart + BestIdx;
+            MIL_INT Difference = pBand->pRightBestDisp[RightX] - BestIdx;
+            if(Difference < 0)
+               Difference = -Difference;
+            if(Difference > m_Config.maxConsistent)
+               return CPU_STEREO_INVALID_DISP;
+            }
+
+         // Refine the disparity with a parabola through the neighbor scores.
+         MIL_DOUBLE Disp = (MIL_DOUBLE)(Tile.SearchStart + BestIdx);
+         if(BestIdx > 0 && BestIdx < NbDisp - 1)
+            {
+            float PrevScore = pBand->pScores[(BestIdx - 1) * SizeX + x];
+            float NextScore = pBand->pScores[(BestIdx + 1) * SizeX + x];
+            float Curvature = PrevScore - 2 * BestScore + NextScore;
+            if(PrevScore > CPU_STEREO_INVALID_SCORE && NextScore > CPU_STEREO_INVALID_SCORE && Curvature < 0)
+               Disp += 0.5 * (PrevScore - NextScore) / Curvature;
+            }
+
+         // Add the disparity to the histogram.
+         if(UpdateStatistics)
+            pBand->pHistogram[(MIL_INT)floor(Disp + 0.5) - m_Config.dStart]++;
+         return Disp;
+         }
+
+      // Function that converts a disparity to its gray value, from dStart at 1 to dEnd at 65535.
+      MIL_UINT16 DisparityToGray(MIL_DOUBLE Disp) const
+         {
+         MIL_DOUBLE Gray = 1.0 + (Disp - m_Config.dStart) * 65534.0 / (m_Config.dEnd - m_Config.dStart);
+         if(Gray < 1.0)
+            Gray = 1.0;
+         if(Gray > 65535.0)
+            Gray = 65535.0;
+         return (MIL_UINT16)(Gray + 0.5);
+         }
+
+      config3DApi      m_Config;
+      SCpuStereoSource m_Sources[2];
+      MIL_INT          m_NbSources;
+
+      CEpipolarRectifier m_Rectifier;
+      MIL_INT          m_SrcViewSizeX;
+      MIL_INT          m_NbChannels;
+      unsigned char*   m_pRectifiedViews[2]; // Left and right rectified views, with the channels of the sources.
+
+      MIL_INT          m_SizeX;
+      MIL_INT          m_SizeY;
+      SCpuStereoLevel  m_Levels[2];          // Full resolution and decimated views.
+      unsigned char*   m_pRectified;
+      MIL_UINT16*      m_pDisparity;
+      float*           m_pCoarseDisparity;
+
+      bool                   m_AdaptiveRange;
+      CDisparityRangeTracker m_RangeTracker;
+      MIL_INT                m_SearchStart;
+      MIL_INT                m_NbSearchDisp;
+
+      bool             m_Pyramidal;
+      MIL_DOUBLE       m_MatchTime;
+      MIL_DOUBLE       m_RectifyTime;
+
+      SCpuStereoBand   m_Bands[CPU_STEREO_MAX_THREADS];
+      CPipelineThreadPool* m_pThreadPool;
+      MIL_INT          m_ThreadPoolRole;
+      MIL_INT          m_NbBands;
+   };
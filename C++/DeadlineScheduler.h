@@ -0,0 +1,175 @@
+﻿//***************************************************************************************/
+//
+// File name: DeadlineScheduler.h
+//
+// Synopsis:  Contains the deadline scheduler used by the Chromasens_3DPIXA_M10PP3
+//            example to keep up with the conveyor. Each scan has a latency
+//            budget from the moment its last line is grabbed. Before the
+//            inspection of a scan, the scheduler selects the first level of an
+//            ordered degradation policy whose expected duration fits in the
+//            time left, so a scan is never held back to be processed at full
+//            quality. The levels are degradation steps of the recipe, each
+//            cumulative with the previous ones; level 0 is the full quality.
+//
+//            The expected duration of a level is a running average of its
+//            last runs. A level never run is expected to fit, so it is tried
+//            the first time the previous level does not fit. Since the
+//            expected duration of a level is only updated when it runs, the
+//            level above the selected one is tried again every
+//            DEADLINE_PROBE_PERIOD degraded scans, so that the quality
+//            recovers once the load drops.
+//
+// Copyright © 1992-2024 Zebra Technologies Corp. and/or its affiliates
+// All Rights Reserved
+
+#include <string.h>
+
+static const MIL_INT    DEADLINE_MAX_LEVELS      = 8;
+static const MIL_DOUBLE DEADLINE_SMOOTHING       = 0.3;    // Weight of the last run in the expected duration.
+static const MIL_DOUBLE DEADLINE_SAFETY_MARGIN   = 0.1;    // Of the expected duration.
+static const MIL_INT    DEADLINE_PROBE_PERIOD    = 32;     // Degraded scans between the tries of the level above.
+
+// Step of a degradation policy, applied on top of the previous steps.
+struct SDegradationStep
+   {
+   const char* Name;
+   const char* Pipeline;       // Pipeline description of the step, NULL to keep the previous one.
+   MIL_DOUBLE  RoiFraction;    // Of the width and height of the valid region analyzed, centered.
+   };
+
+// Statistics of a degradation level.
+struct SDeadlineLevelStatistics
+   {
+   MIL_INT    NbScans;
+   MIL_INT    NbLateScans;       // Processed past their deadline.
+   MIL_DOUBLE TotalTime;         // In s.
+   MIL_DOUBLE ExpectedTime;      // In s, 0 if never run.
+   };
+
+//////////////////////////////////////////////////////////////////////////
+// Class that selects the degradation level of each scan from its
+// deadline.
+//////////////////////////////////////////////////////////////////////////
+class CDeadlineScheduler
+   {
+   public:
+      // Constructor. The budget is in seconds.
+      CDeadlineScheduler(MIL_INT NbLevels, MIL_DOUBLE Budget)
+         : m_NbLevels(NbLevels < 1 ? 1 : NbLevels > DEADLINE_MAX_LEVELS ? DEADLINE_MAX_LEVELS : NbLevels),
+           m_Budget(Budget)
+         {
+         Reset();
+         }
+
+      // Destructor.
+      virtual ~CDeadlineScheduler()
+         {
+         }
+
+      // Function that sets the latency budget of a scan, in seconds.
+      void SetBudget(MIL_DOUBLE Budget) {m_Budget = Budget;}
+      MIL_DOUBLE GetBudget() const {return m_Budget;}
+
+      // Function that clears the statistics and the expected durations.
+      void Reset()
+         {
+         memset(m_Levels, 0, sizeof(m_Levels));
+         m_NbScansSinceProbe = 0;
+         }
+
+      // Function that clears the statistics but keeps the expected durations.
+      void ResetStatistics()
+         {
+         for(MIL_INT Level = 0; Level < m_NbLevels; Level++)
+            {
+            m_Levels[Level].NbScans = 0;
+            m_Levels[Level].NbLateScans = 0;
+            m_Levels[Level].TotalTime = 0.0;
+            }
+         }
+
+      // Function that returns the deadline of a scan whose last line was grabbed
+      // at a time of the timer.
+      MIL_DOUBLE GetDeadline(MIL_DOUBLE GrabTime) const {return GrabTime + m_Budget;}
+
+      // Function that returns the first level expected to end before the deadline,
+      // or the last level if none is. Every DEADLINE_PROBE_PERIOD degraded scans,
+      // the level above it is returned instead, to measure it again.
+      MIL_INT SelectLevel(MIL_DOUBLE Deadline)
+         {
+         MIL_DOUBLE CurrentTime;
+         MappTimer(M_DEFAULT, M_TIMER_READ, &CurrentTime);
+         MIL_DOUBLE TimeLeft = Deadline - CurrentTime;
+         MIL_INT SelectedLevel = m_NbLevels - 1;
+         for(MIL_INT Level = 0; Level < m_NbLevels; Level++)
+            {
+            if(m_Levels[Level].ExpectedTime * (1.0 + DEADLINE_SAFETY_MARGIN) <= TimeLeft)
+               {
+               SelectedLevel = Level;
+               break;
+               }
+            }
+
+         if(SelectedLevel == 0)
+            m_NbScansSinceProbe = 0;
+         else if(++m_NbScansSinceProbe >= DEADLINE_PROBE_PERIOD)
+            {
+            m_NbScansSinceProbe = 0;
+            SelectedLevel--;
+            }
+         return SelectedLevel;
+         }
+
+      // Function that records the processing of a scan at a level, ended at a time
+      // of the timer.
+      void Complete(MIL_INT Level, MIL_DOUBLE Duration, MIL_DOUBLE Deadline, MIL_DOUBLE EndTime)
+         {
+         SDeadlineLevelStatistics& Statistics = m_Levels[Level];
+         Statistics.ExpectedTime = Statistics.ExpectedTime == 0.0 ? Duration : (1.0 - DEADLINE_SMOOTHING) * Statistics.ExpectedTime + DEADLINE_SMOOTHING * Duration;
+         Statistics.NbScans++;
+         Statistics.TotalTime += Duration;
+         if(EndTime > Deadline)
+            Statistics.NbLateScans++;
+         }
+
+      // Function that returns the number of levels.
+      MIL_INT GetNbLevels() const {return m_NbLevels;}
+
+      // Function that returns the statistics of a level.
+      const SDeadlineLevelStatistics& GetStatistics(MIL_INT Level) const {return m_Levels[Level];}
+
+      // Function that returns the number of scans processed below the full quality.
+      MIL_INT GetNbDegradedScans() const
+         {
+         MIL_INT NbDegradedScans = 0;
+         for(MIL_INT Level = 1; Level < m_NbLevels; Level++)
+            NbDegradedScans += m_Levels[Level].NbScans;
+         return NbDegradedScans;
+         }
+
+      // Function that prints the scans processed at each level.
+      void PrintStatistics(const SDegradationStep* pSteps) const
+         {
+         MIL_INT NbScans = 0;
+         for(MIL_INT Level = 0; Level < m_NbLevels; Level++)
+            NbScans += m_Levels[Level].NbScans;
+         MosPrintf(MIL_TEXT("   %5hs  %-32hs %13hs  %5hs  %9hs\n"), "Level", "Degradation", "Scans", "Late", "Mean (ms)");
+         for(MIL_INT Level = 0; Level < m_NbLevels; Level++)
+            {
+            const SDeadlineLevelStatistics& Statistics = m_Levels[Level];
+            MosPrintf(MIL_TEXT("   %5d  %-32hs %6d %5.1f%%  %5d  %9.1f\n"), (int)Level, pSteps[Level].Name,
+                      (int)Statistics.NbScans, NbScans > 0 ? 100.0 * Statistics.NbScans / NbScans : 0.0,
+                      (int)Statistics.NbLateScans, Statistics.NbScans > 0 ? Statistics.TotalTime / Statistics.NbScans * 1000.0 : 0.0);
+            }
+         }
+
+   private:
+      // Disallow copy.
+      CDeadlineScheduler(const CDeadlineScheduler&);
+      CDeadlineScheduler& operator=(const CDeadlineScheduler&);
+
+      MIL_INT                  m_NbLevels;
+      MIL_DOUBLE               m_Budget;
+      SDeadlineLevelStatistics m_Levels[DEADLINE_MAX_LEVELS];
+      MIL_INT                  m_NbScansSinceProbe;
+   };
@@ -0,0 +1,679 @@
+﻿//***************************************************************************************/
+//
+// File name: DepthMapCodec.h
+//
+// Synopsis:  Contains the lossless codec used by the Chromasens_3DPIXA_M10PP3 example
+//            to archive the 16-bit disparity and depth maps. The map is cut in
+//            tiles that are coded independently, by the workers of the pinned
+//            thread pool or by concurrent threads, and that can be decoded one
+//            at a time.
+//
+//            Each pixel is predicted from its decoded neighbors, either from
+//            the left pixel (row delta) or from the left, up and up-left pixels
+//            with the median edge detector of LOCO-I (planar). The residuals are
+//            coded with Rice codes whose parameter is chosen for each segment of
+//            32 pixels of a row; a segment of zero residuals, like the invalid
+//            areas of a map, costs 4 bits. A tile that would be larger coded
+//            than raw is stored raw.
+//
+//            Stream layout, all values little endian:
+//               SDepthMapCodecHeader
+//               NbTiles x SDepthMapCodecTile   Offsets are from the start of the stream.
+//               Tile data, in tile order.
+//
+// Copyright © 1992-2024 Zebra Technologies Corp. and/or its affiliates
+// All Rights Reserved
+
+#include <string.h>
+#if defined(_MSC_VER)
+   #include <intrin.h>
+#endif
+
+static const MIL_UINT32 DEPTH_MAP_CODEC_MAGIC        = 0x434D4443;   // "CDMC"
+static const MIL_UINT16 DEPTH_MAP_CODEC_VERSION      = 1;
+static const MIL_INT    DEPTH_MAP_CODEC_TILE_SIZE    = 256;
+static const MIL_INT    DEPTH_MAP_CODEC_SEGMENT_SIZE = 32;
+static const MIL_UINT32 DEPTH_MAP_CODEC_ZERO_SEGMENT = 15;   // Rice parameter of a segment of zero residuals.
+static const MIL_UINT32 DEPTH_MAP_CODEC_MAX_UNARY    = 24;   // Quotients from this one are escaped.
+static const MIL_INT    DEPTH_MAP_CODEC_MAX_THREADS  = 32;
+
+// Prediction of the pixels.
+enum EDepthMapPredictor
+   {
+   DEPTH_MAP_PREDICT_LEFT   = 0,   // Row delta.
+   DEPTH_MAP_PREDICT_PLANAR = 1    // Median edge detector.
+   };
+
+// Coding of a tile.
+enum EDepthMapTileMode
+   {
+   DEPTH_MAP_TILE_CODED = 0,
+   DEPTH_MAP_TILE_RAW   = 1
+   };
+
+// Header of a stream.
+struct SDepthMapCodecHeader
+   {
+   MIL_UINT32 Magic;
+   MIL_UINT16 Version;
+   MIL_UINT16 Predictor;
+   MIL_UINT32 SizeX;
+   MIL_UINT32 SizeY;
+   MIL_UINT32 TileSizeX;
+   MIL_UINT32 TileSizeY;
+   MIL_UINT32 NbTiles;
+   MIL_UINT32 Reserved;
+   };
+
+// Entry of the tile table.
+struct SDepthMapCodecTile
+   {
+   MIL_UINT64 Offset;
+   MIL_UINT32 Size;
+   MIL_UINT32 Mode;
+   };
+
+class CDepthMapCodec;
+
+// Range of tiles processed by a thread, with its work memory.
+struct SDepthMapCodecBand
+   {
+   CDepthMapCodec*      pCodec;
+   MIL_INT              StartTile;
+   MIL_INT              EndTile;
+   bool                 Encode;
+   const MIL_UINT8*     pStream;     // Decoded stream.
+   const MIL_UINT16*    pSrc;        // Encoded map.
+   MIL_UINT16*          pDst;        // Decoded map.
+   MIL_INT              Pitch;       // Of the map, in pixels.
+   MIL_UINT8*           pScratch;    // Coded tiles of the band.
+   MIL_INT              ScratchSize;
+   MIL_INT              UsedSize;
+   };
+
+//////////////////////////////////////////////////////////////////////////
+// Class that writes bits, most significant first.
+//////////////////////////////////////////////////////////////////////////
+class CDepthMapBitWriter
+   {
+   public:
+      // Constructor. Writing stops at the end of the buffer.
+      CDepthMapBitWriter(MIL_UINT8* pData, MIL_INT Size)
+         : m_pData(pData), m_pEnd(pData + Size), m_pCur(pData), m_Acc(0), m_NbBits(0), m_Overflow(false)
+         {
+         }
+
+      // Function that writes the NbBits low bits of Value, NbBits <= 32.
+      void Put(MIL_UINT32 Value, MIL_INT NbBits)
+         {
+         m_Acc = (m_Acc << NbBits) | Value;
+         m_NbBits += NbBits;
+         if(m_NbBits >= 32)
+            {
+            m_NbBits -= 32;
+            if(m_pCur + 4 > m_pEnd)
+               {
+               m_Overflow = true;
+               return;
+               }
+            MIL_UINT32 Word = (MIL_UINT32)(m_Acc >> m_NbBits);
+            m_pCur[0] = (MIL_UINT8)(Word >> 24);
+            m_pCur[1] = (MIL_UINT8)(Word >> 16);
+            m_pCur[2] = (MIL_UINT8)(Word >> 8);
+            m_pCur[3] = (MIL_UINT8)Word;
+            m_pCur += 4;
+            }
+         }
+
+      // Function that writes the remaining bits. Returns the number of bytes
+      // written, -1 if the buffer is too small.
+      MIL_INT Flush()
+         {
+         while(m_NbBits > 0 && !m_Overflow)
+            {
+            if(m_pCur == m_pEnd)
+               m_Overflow = true;
+            else
+               {
+               MIL_INT Shift = m_NbBits >= 8 ? m_NbBits - 8 : 0;
+               MIL_INT NbBits = m_NbBits - Shift;
+               *m_pCur++ = (MIL_UINT8)(((m_Acc >> Shift) & ((1 << NbBits) - 1)) << (8 - NbBits));
+               m_NbBits = Shift;
+               }
+            }
+         return m_Overflow ? -1 : m_pCur - m_pData;
+         }
+
+      bool HasOverflow() const {return m_Overflow;}
+
+   private:
+      MIL_UINT8*       m_pData;
+      const MIL_UINT8* m_pEnd;
+      MIL_UINT8*       m_pCur;
+      MIL_UINT64       m_Acc;
+      MIL_INT          m_NbBits;
+      bool             m_Overflow;
+   };
+
+//////////////////////////////////////////////////////////////////////////
+// Class that reads bits, most significant first. Zeros are read past the
+// end of the data.
+//////////////////////////////////////////////////////////////////////////
+class CDepthMapBitReader
+   {
+   public:
+      // Constructor.
+      CDepthMapBitReader(const MIL_UINT8* pData, MIL_INT Size)
+         : m_pCur(pData), m_pEnd(pData + Size), m_Acc(0), m_NbBits(0)
+         {
+         Refill();
+         }
+
+      // Function that reads NbBits bits, NbBits <= 24.
+      MIL_UINT32 Get(MIL_INT NbBits)
+         {
+         if(NbBits == 0)
+            return 0;
+         if(m_NbBits < NbBits)
+            Refill();
+         m_NbBits -= NbBits;
+         return (MIL_UINT32)(m_Acc >> m_NbBits) & ((1u << NbBits) - 1);
+         }
+
+      // Function that reads a unary code, zeros ended by a one. Returns the number
+      // of zeros, or DEPTH_MAP_CODEC_MAX_UNARY for an escape.
+      MIL_UINT32 GetUnary()
+         {
+         if(m_NbBits < (MIL_INT)DEPTH_MAP_CODEC_MAX_UNARY)
+            Refill();
+         MIL_UINT32 Window = (MIL_UINT32)(m_Acc >> (m_NbBits - DEPTH_MAP_CODEC_MAX_UNARY)) & ((1u << DEPTH_MAP_CODEC_MAX_UNARY) - 1);
+         if(Window == 0)
+            {
+            m_NbBits -= DEPTH_MAP_CODEC_MAX_UNARY;
+            return DEPTH_MAP_CODEC_MAX_UNARY;
+            }
+         MIL_UINT32 NbZeros = DEPTH_MAP_CODEC_MAX_UNARY - 1 - HighestBit(Window);
+         m_NbBits -= NbZeros + 1;
+         return NbZeros;
+         }
+
+   private:
+      // Function that fills the accumulator with whole bytes.
+      void Refill()
+         {
+         while(m_NbBits <= 56)
+            {
+            m_Acc = (m_Acc << 8) | (m_pCur < m_pEnd ? *m_pCur++ : 0);
+            m_NbBits += 8;
+            }
+         }
+
+      // Function that returns the position of the highest set bit of a non-zero value.
+      static MIL_UINT32 HighestBit(MIL_UINT32 Value)
+         {
+#if defined(_MSC_VER)
+         unsigned long Position;
+         _BitScanReverse(&Position, Value);
+         return (MIL_UINT32)Position;
+#else
+         return 31 - (MIL_UINT32)__builtin_clz(Value);
+#endif
+         }
+
+      const MIL_UINT8* m_pCur;
+      const MIL_UINT8* m_pEnd;
+      MIL_UINT64       m_Acc;
+      MIL_INT          m_NbBits;
+   };
+
+//////////////////////////////////////////////////////////////////////////
+// Class that encodes and decodes the 16-bit maps.
+//////////////////////////////////////////////////////////////////////////
+class CDepthMapCodec
+   {
+   public:
+      // Constructor.
+      CDepthMapCodec(EDepthMapPredictor Predictor = DEPTH_MAP_PREDICT_PLANAR, MIL_INT TileSize = DEPTH_MAP_CODEC_TILE_SIZE)
+         : m_Predictor(Predictor),
+           m_TileSize(TileSize),
+           m_SizeX(0),
+           m_SizeY(0),
+           m_pTiles(NULL),
+           m_pThreadPool(NULL),
+           m_ThreadPoolRole(0),
+           m_NbBands(0)
+         {
+         memset(m_Bands, 0, sizeof(m_Bands));
+         }
+
+      // Destructor.
+      virtual ~CDepthMapCodec()
+         {
+         for(MIL_INT BandIdx = 0; BandIdx < DEPTH_MAP_CODEC_MAX_THREADS; BandIdx++)
+            delete [] m_Bands[BandIdx].pScratch;
+         }
+
+      // Function that sets the pool whose workers code the bands, NULL to start
+      // a thread per band for each map.
+      void SetThreadPool(CPipelineThreadPool* pThreadPool, MIL_INT Role)
+         {
+         m_pThreadPool = pThreadPool;
+         m_ThreadPoolRole = Role;
+         }
+
+      // Function that returns the largest stream of a map.
+      static MIL_INT GetMaxEncodedSize(MIL_INT SizeX, MIL_INT SizeY, MIL_INT TileSize = DEPTH_MAP_CODEC_TILE_SIZE)
+         {
+         MIL_INT NbTiles = ((SizeX + TileSize - 1) / TileSize) * ((SizeY + TileSize - 1) / TileSize);
+         return sizeof(SDepthMapCodecHeader) + NbTiles * sizeof(SDepthMapCodecTile) + SizeX * SizeY * sizeof(MIL_UINT16);
+         }
+
+      // Function that encodes a map. Returns the size of the stream, -1 if the
+      // destination is too small.
+      MIL_INT Encode(const MIL_UINT16* pSrc, MIL_INT SizeX, MIL_INT SizeY, MIL_INT Pitch, MIL_UINT8* pDst, MIL_INT DstSize)
+         {
+         if(DstSize < GetMaxEncodedSize(SizeX, SizeY, m_TileSize))
+            return -1;
+
+         // Write the header.
+         SDepthMapCodecHeader Header;
+         SetLayout(SizeX, SizeY, m_TileSize);
+         Header.Magic = DEPTH_MAP_CODEC_MAGIC;
+         Header.Version = DEPTH_MAP_CODEC_VERSION;
+         Header.Predictor = (MIL_UINT16)m_Predictor;
+         Header.SizeX = (MIL_UINT32)SizeX;
+         Header.SizeY = (MIL_UINT32)SizeY;
+         Header.TileSizeX = (MIL_UINT32)m_TileSize;
+         Header.TileSizeY = (MIL_UINT32)m_TileSize;
+         Header.NbTiles = (MIL_UINT32)m_NbTiles;
+         Header.Reserved = 0;
+         memcpy(pDst, &Header, sizeof(Header));
+         m_pTiles = (SDepthMapCodecTile*)(pDst + sizeof(Header));
+
+         // Code the tiles of each band in its scratch memory.
+         for(MIL_INT BandIdx = 0; BandIdx < m_NbBands; BandIdx++)
+            {
+            SDepthMapCodecBand& Band = m_Bands[BandIdx];
+            Band.Encode = true;
+            Band.pSrc = pSrc;
+            Band.Pitch = Pitch;
+            MIL_INT ScratchSize = 0;
+            for(MIL_INT TileIdx = Band.StartTile; TileIdx < Band.EndTile; TileIdx++)
+               ScratchSize += GetTileRawSize(TileIdx);
+            if(ScratchSize > Band.ScratchSize)
+               {
+               delete [] Band.pScratch;
+               Band.pScratch = new MIL_UINT8[ScratchSize];
+               Band.ScratchSize = ScratchSize;
+               }
+            }
+         RunBands();
+
+         // Concatenate the bands and set the offsets of their tiles.
+         MIL_UINT8* pData = pDst + sizeof(Header) + m_NbTiles * sizeof(SDepthMapCodecTile);
+         for(MIL_INT BandIdx = 0; BandIdx < m_NbBands; BandIdx++)
+            {
+            const SDepthMapCodecBand& Band = m_Bands[BandIdx];
+            MIL_UINT64 BandOffset = (MIL_UINT64)(pData - pDst);
+            for(MIL_INT TileIdx = Band.StartTile; TileIdx < Band.EndTile; TileIdx++)
+               m_pTiles[TileIdx].Offset += BandOffset;
+            memcpy(pData, Band.pScratch, Band.UsedSize);
+            pData += Band.UsedSize;
+            }
+         m_pTiles = NULL;
+         return pData - pDst;
+         }
+
+      // Function that returns the header of a stream. Returns false if it is
+      // not a valid stream.
+      static bool GetHeader(const MIL_UINT8* pStream, MIL_INT StreamSize, SDepthMapCodecHeader* pHeader)
+         {
+         if(StreamSize < (MIL_INT)sizeof(SDepthMapCodecHeader))
+            return false;
+         memcpy(pHeader, pStream, sizeof(SDepthMapCodecHeader));
+         if(pHeader->Magic != DEPTH_MAP_CODEC_MAGIC || pHeader->Version != DEPTH_MAP_CODEC_VERSION || pHeader->TileSizeX == 0 || pHeader->TileSizeY == 0)
+            return false;
+         return StreamSize >= (MIL_INT)(sizeof(SDepthMapCodecHeader) + pHeader->NbTiles * sizeof(SDepthMapCodecTile));
+         }
+
+      // Function that decodes a whole map in the destination, of the size of the
+      // stream. Returns false if the stream is not valid.
+      bool Decode(const MIL_UINT8* pStream, MIL_INT StreamSize, MIL_UINT16* pDst, MIL_INT Pitch)
+         {
+         SDepthMapCodecHeader Header;
+         if(!GetHeader(pStream, StreamSize, &Header) || Header.TileSizeX != Header.TileSizeY)
+            return false;
+         SetLayout(Header.SizeX, Header.SizeY, Header.TileSizeX);
+         if(m_NbTiles != (MIL_INT)Header.NbTiles)
+            return false;
+
+         // Check that every tile is inside the stream before the bands read them.
+         const SDepthMapCodecTile* pTiles = (const SDepthMapCodecTile*)(pStream + sizeof(SDepthMapCodecHeader));
+         for(MIL_INT TileIdx = 0; TileIdx < m_NbTiles; TileIdx++)
+            {
+            if(!IsTileValid(pTiles[TileIdx], StreamSize, GetTileRawSize(TileIdx)))
+               return false;
+            }
+
+         EDepthMapPredictor PreviousPredictor = m_Predictor;
+         m_Predictor = (EDepthMapPredictor)Header.Predictor;
+         for(MIL_INT BandIdx = 0; BandIdx < m_NbBands; BandIdx++)
+            {
+            m_Bands[BandIdx].Encode = false;
+            m_Bands[BandIdx].pStream = pStream;
+            m_Bands[BandIdx].pDst = pDst;
+            m_Bands[BandIdx].Pitch = Pitch;
+            }
+         m_pTiles = (SDepthMapCodecTile*)(pStream + sizeof(SDepthMapCodecHeader));
+         RunBands();
+         m_pTiles = NULL;
+         m_Predictor = PreviousPredictor;
+         return true;
+         }
+
+      // Function that decodes a single tile at its position in the destination,
+      // of the size of the stream. Returns false if the stream is not valid.
+      static bool DecodeTile(const MIL_UINT8* pStream, MIL_INT StreamSize, MIL_INT TileIdx, MIL_UINT16* pDst, MIL_INT Pitch)
+         {
+         SDepthMapCodecHeader Header;
+         if(!GetHeader(pStream, StreamSize, &Header) || TileIdx < 0 || TileIdx >= (MIL_INT)Header.NbTiles)
+            return false;
+         const SDepthMapCodecTile* pTile = (const SDepthMapCodecTile*)(pStream + sizeof(SDepthMapCodecHeader)) + TileIdx;
+         MIL_INT NbTilesX = (Header.SizeX + Header.TileSizeX - 1) / Header.TileSizeX;
+         MIL_INT StartX = (TileIdx % NbTilesX) * Header.TileSizeX;
+         MIL_INT StartY = (TileIdx / NbTilesX) * Header.TileSizeY;
+         MIL_INT SizeX = StartX + Header.TileSizeX < Header.SizeX ? Header.TileSizeX : Header.SizeX - StartX;
+         MIL_INT SizeY = StartY + Header.TileSizeY < Header.SizeY ? Header.TileSizeY : Header.SizeY - StartY;
+         if(!IsTileValid(*pTile, StreamSize, SizeX * SizeY * sizeof(MIL_UINT16)))
+            return false;
+         DecodeTileData(pStream + pTile->Offset, pTile->Size, (EDepthMapTileMode)pTile->Mode, (EDepthMapPredictor)Header.Predictor,
+                        pDst + StartY * Pitch + StartX, Pitch, SizeX, SizeY);
+         return true;
+         }
+
+      // Thread function that encodes or decodes the tiles of a band.
+      static MIL_UINT32 MFTYPE BandThread(void* pBandPtr)
+         {
+         SDepthMapCodecBand* pBand = (SDepthMapCodecBand*)pBandPtr;
+         if(pBand->Encode)
+            pBand->pCodec->EncodeBand(pBand);
+         else
+            pBand->pCodec->DecodeBand(pBand);
+         return 0;
+         }
+
+      // Task that encodes or decodes the tiles of a band.
+      static void BandTask(void* pBandPtr)
+         {
+         BandThread(pBandPtr);
+         }
+
+   private:
+      // Disallow copy.
+      CDepthMapCodec(const CDepthMapCodec&);
+      CDepthMapCodec& operator=(const CDepthMapCodec&);
+
+      // Function that sets the tiles of a map size and splits them in bands.
+      void SetLayout(MIL_INT SizeX, MIL_INT SizeY, MIL_INT TileSize)
+         {
+         m_SizeX = SizeX;
+         m_SizeY = SizeY;
+         m_LayoutTileSize = TileSize;
+         m_NbTilesX = (SizeX + TileSize - 1) / TileSize;
+         m_NbTiles = m_NbTilesX * ((SizeY + TileSize - 1) / TileSize);
+         m_NbBands = GetNbProcessors();
+         if(m_NbBands > DEPTH_MAP_CODEC_MAX_THREADS)
+            m_NbBands = DEPTH_MAP_CODEC_MAX_THREADS;
+         if(m_NbBands > m_NbTiles)
+            m_NbBands = m_NbTiles;
+         if(m_NbBands < 1)
+            m_NbBands = 1;
+         for(MIL_INT BandIdx = 0; BandIdx < m_NbBands; BandIdx++)
+            {
+            m_Bands[BandIdx].pCodec = this;
+            m_Bands[BandIdx].StartTile = m_NbTiles * BandIdx / m_NbBands;
+            m_Bands[BandIdx].EndTile = m_NbTiles * (BandIdx + 1) / m_NbBands;
+            }
+         }
+
+      // Function that returns true if the data of a tile entry is inside the
+      // stream and, for a raw tile, holds all its pixels.
+      static bool IsTileValid(const SDepthMapCodecTile& Tile, MIL_INT StreamSize, MIL_INT RawSize)
+         {
+         if(Tile.Offset > (MIL_UINT64)StreamSize || Tile.Size > (MIL_UINT64)StreamSize - Tile.Offset)
+            return false;
+         if(Tile.Mode == DEPTH_MAP_TILE_RAW)
+            return Tile.Size >= (MIL_UINT64)RawSize;
+         return Tile.Mode == DEPTH_MAP_TILE_CODED;
+         }
+
+      // Function that returns the position and the size of a tile.
+      void GetTileRect(MIL_INT TileIdx, MIL_INT* pStartX, MIL_INT* pStartY, MIL_INT* pSizeX, MIL_INT* pSizeY) const
+         {
+         *pStartX = (TileIdx % m_NbTilesX) * m_LayoutTileSize;
+         *pStartY = (TileIdx / m_NbTilesX) * m_LayoutTileSize;
+         *pSizeX = *pStartX + m_LayoutTileSize < m_SizeX ? m_LayoutTileSize : m_SizeX - *pStartX;
+         *pSizeY = *pStartY + m_LayoutTileSize < m_SizeY ? m_LayoutTileSize : m_SizeY - *pStartY;
+         }
+
+      MIL_INT GetTileRawSize(MIL_INT TileIdx) const
+         {
+         MIL_INT StartX, StartY, SizeX, SizeY;
+         GetTileRect(TileIdx, &StartX, &StartY, &SizeX, &SizeY);
+         return SizeX * SizeY * sizeof(MIL_UINT16);
+         }
+
+      // Function that runs the bands concurrently, the first one in the calling
+      // thread. The other bands are queued in the pool, or run in threads started
+      // for the map when no pool is set.
+      void RunBands()
+         {
+         if(m_pThreadPool && m_pThreadPool->GetNbWorkers(m_ThreadPoolRole) > 0 && !m_pThreadPool->IsWorkerThread())
+            {
+            CThreadPoolBatch Batch;
+            for(MIL_INT BandIdx = 1; BandIdx < m_NbBands; BandIdx++)
+               m_pThreadPool->Submit(m_ThreadPoolRole, BandTask, &m_Bands[BandIdx], &Batch);
+            BandThread(&m_Bands[0]);
+            Batch.Wait();
+            return;
+            }
+
+         MIL_ID MilThreads[DEPTH_MAP_CODEC_MAX_THREADS];
+         for(MIL_INT BandIdx = 1; BandIdx < m_NbBands; BandIdx++)
+            MilThreads[BandIdx] = MthrAlloc(M_DEFAULT_HOST, M_THREAD, M_DEFAULT, BandThread, &m_Bands[BandIdx], M_NULL);
+         BandThread(&m_Bands[0]);
+         for(MIL_INT BandIdx = 1; BandIdx < m_NbBands; BandIdx++)
+            {
+            MthrWait(MilThreads[BandIdx], M_THREAD_END_WAIT, M_NULL);
+            MthrFree(MilThreads[BandIdx]);
+            }
+         }
+
+      // Function that codes the tiles of a band one after the other in its
+      // scratch memory. The offsets are relative to the scratch memory.
+      void EncodeBand(SDepthMapCodecBand* pBand)
+         {
+         MIL_UINT8* pData = pBand->pScratch;
+         for(MIL_INT TileIdx = pBand->StartTile; TileIdx < pBand->EndTile; TileIdx++)
+            {
+            MIL_INT StartX, StartY, SizeX, SizeY;
+            GetTileRect(TileIdx, &StartX, &StartY, &SizeX, &SizeY);
+            const MIL_UINT16* pSrc = pBand->pSrc + StartY * pBand->Pitch + StartX;
+            MIL_INT RawSize = SizeX * SizeY * sizeof(MIL_UINT16);
+
+            SDepthMapCodecTile& Tile = m_pTiles[TileIdx];
+            Tile.Offset = (MIL_UINT64)(pData - pBand->pScratch);
+            MIL_INT CodedSize = EncodeTile(pSrc, pBand->Pitch, SizeX, SizeY, pData, RawSize);
+            if(CodedSize >= 0)
+               Tile.Mode = DEPTH_MAP_TILE_CODED;
+            else
+               {
+               // Store the tile raw.
+               Tile.Mode = DEPTH_MAP_TILE_RAW;
+               for(MIL_INT y = 0; y < SizeY; y++)
+                  memcpy(pData + y * SizeX * sizeof(MIL_UINT16), pSrc + y * pBand->Pitch, SizeX * sizeof(MIL_UINT16));
+               CodedSize = RawSize;
+               }
+            Tile.Size = (MIL_UINT32)CodedSize;
+            pData += CodedSize;
+            }
+         pBand->UsedSize = pData - pBand->pScratch;
+         }
+
+      // Function that decodes the tiles of a band.
+      void DecodeBand(SDepthMapCodecBand* pBand)
+         {
+         for(MIL_INT TileIdx = pBand->StartTile; TileIdx < pBand->EndTile; TileIdx++)
+            {
+            MIL_INT StartX, StartY, SizeX, SizeY;
+            GetTileRect(TileIdx, &StartX, &StartY, &SizeX, &SizeY);
+            const SDepthMapCodecTile& Tile = m_pTiles[TileIdx];
+            DecodeTileData(pBand->pStream + Tile.Offset, Tile.Size, (EDepthMapTileMode)Tile.Mode, m_Predictor,
+                           pBand->pDst + StartY * pBand->Pitch + StartX, pBand->Pitch, SizeX, SizeY);
+            }
+         }
+
+      // Function that returns the prediction of a pixel from its decoded neighbors.
+      static MIL_INT Predict(EDepthMapPredictor Predictor, const MIL_UINT16* pPixel, MIL_INT Pitch, MIL_INT x, MIL_INT y)
+         {
+         if(x == 0)
+            return y == 0 ? 0 : pPixel[-Pitch];
+         if(y == 0 || Predictor == DEPTH_MAP_PREDICT_LEFT)
+            return pPixel[-1];
+         return PredictPlanar(pPixel[-1], pPixel[-Pitch], pPixel[-Pitch - 1]);
+         }
+
+      // Function that returns the median edge detector prediction.
+      static MIL_INT PredictPlanar(MIL_INT Left, MIL_INT Up, MIL_INT UpLeft)
+         {
+         MIL_INT Min = Left < Up ? Left : Up;
+         MIL_INT Max = Left < Up ? Up : Left;
+         MIL_INT Gradient = Left + Up - UpLeft;
+         Gradient = UpLeft >= Max ? Min : Gradient;
+         return UpLeft <= Min ? Max : Gradient;
+         }
+
+      // Function that codes a tile. Returns the size of the code, -1 if it is
+      // not smaller than MaxSize.
+      MIL_INT EncodeTile(const MIL_UINT16* pSrc, MIL_INT Pitch, MIL_INT SizeX, MIL_INT SizeY, MIL_UINT8* pDst, MIL_INT MaxSize) const
+         {
+         CDepthMapBitWriter Writer(pDst, MaxSize);
+         MIL_UINT32 Residuals[DEPTH_MAP_CODEC_SEGMENT_SIZE];
+         for(MIL_INT y = 0; y < SizeY && !Writer.HasOverflow(); y++)
+            {
+            const MIL_UINT16* pRow = pSrc + y * Pitch;
+            const MIL_UINT16* pUpRow = pRow - Pitch;
+            bool IsInner = y > 0;
+            for(MIL_INT SegmentX = 0; SegmentX < SizeX; SegmentX += DEPTH_MAP_CODEC_SEGMENT_SIZE)
+               {
+               // Calculate the zigzag residuals of the segment.
+               MIL_INT NbPixels = SegmentX + DEPTH_MAP_CODEC_SEGMENT_SIZE < SizeX ? DEPTH_MAP_CODEC_SEGMENT_SIZE : SizeX - SegmentX;
+               MIL_UINT32 Sum = 0;
+               for(MIL_INT i = 0; i < NbPixels; i++)
+                  {
+                  MIL_INT x = SegmentX + i;
+                  MIL_INT Prediction;
+                  if(!IsInner || x == 0)
+                     Prediction = Predict(m_Predictor, pRow + x, Pitch, x, y);
+                  else if(m_Predictor == DEPTH_MAP_PREDICT_PLANAR)
+                     Prediction = PredictPlanar(pRow[x - 1], pUpRow[x], pUpRow[x - 1]);
+                  else
+                     Prediction = pRow[x - 1];
+                  MIL_UINT32 Residual = (MIL_UINT16)(pRow[x] - Prediction);
+                  Residuals[i] = ((Residual << 1) ^ (0 - (Residual >> 15))) & 0xFFFF;
+                  Sum += Residuals[i];
+                  }
+               if(Sum == 0)
+                  {
+                  Writer.Put(DEPTH_MAP_CODEC_ZERO_SEGMENT, 4);
+                  continue;
+                  }
+
+               // Choose the Rice parameter from the mean residual and code the segment.
+               MIL_UINT32 RiceParam = 0;
+               while(RiceParam < 14 && ((MIL_UINT32)NbPixels << (RiceParam + 1)) <= Sum)
+                  RiceParam++;
+               Writer.Put(RiceParam, 4);
+               for(MIL_INT i = 0; i < NbPixels; i++)
+                  {
+                  MIL_UINT32 Quotient = Residuals[i] >> RiceParam;
+                  if(Quotient < DEPTH_MAP_CODEC_MAX_UNARY && Quotient + 1 + RiceParam <= 32)
+                     Writer.Put((1u << RiceParam) | (Residuals[i] & ((1u << RiceParam) - 1)), Quotient + 1 + RiceParam);
+                  else if(Quotient < DEPTH_MAP_CODEC_MAX_UNARY)
+                     {
+                     Writer.Put(1, Quotient + 1);
+                     Writer.Put(Residuals[i] & ((1u << RiceParam) - 1), RiceParam);
+                     }
+                  else
+                     {
+                     Writer.Put(0, DEPTH_MAP_CODEC_MAX_UNARY);
+                     Writer.Put(Residuals[i], 16);
+                     }
+                  }
+               }
+            }
+         MIL_INT CodedSize = Writer.Flush();
+         return CodedSize >= 0 && CodedSize < MaxSize ? CodedSize : -1;
+         }
+
+      // Function that decodes the data of a tile at its position in the map.
+      static void DecodeTileData(const MIL_UINT8* pData, MIL_INT DataSize, EDepthMapTileMode Mode, EDepthMapPredictor Predictor,
+                                 MIL_UINT16* pDst, MIL_INT Pitch, MIL_INT SizeX, MIL_INT SizeY)
+         {
+         if(Mode == DEPTH_MAP_TILE_RAW)
+            {
+            for(MIL_INT y = 0; y < SizeY; y++)
+               memcpy(pDst + y * Pitch, pData + y * SizeX * sizeof(MIL_UINT16), SizeX * sizeof(MIL_UINT16));
+            return;
+            }
+
+         CDepthMapBitReader Reader(pData, DataSize);
+         for(MIL_INT y = 0; y < SizeY; y++)
+            {
+            MIL_UINT16* pRow = pDst + y * Pitch;
+            const MIL_UINT16* pUpRow = pRow - Pitch;
+            bool IsInner = y > 0;
+            for(MIL_INT SegmentX = 0; SegmentX < SizeX; SegmentX += DEPTH_MAP_CODEC_SEGMENT_SIZE)
+               {
+               MIL_INT EndX = SegmentX + DEPTH_MAP_CODEC_SEGMENT_SIZE < SizeX ? SegmentX + DEPTH_MAP_CODEC_SEGMENT_SIZE : SizeX;
+               MIL_UINT32 RiceParam = Reader.Get(4);
+               for(MIL_INT x = SegmentX; x < EndX; x++)
+                  {
+                  MIL_INT Prediction;
+                  if(!IsInner || x == 0)
+                     Prediction = Predict(Predictor, pRow + x, Pitch, x, y);
+                  else if(Predictor == DEPTH_MAP_PREDICT_PLANAR)
+                     Prediction = PredictPlanar(pRow[x - 1], pUpRow[x], pUpRow[x - 1]);
+                  else
+                     Prediction = pRow[x - 1];
+
+                  MIL_UINT32 Residual = 0;
+                  if(RiceParam != DEPTH_MAP_CODEC_ZERO_SEGMENT)
+                     {
+                     MIL_UINT32 Quotient = Reader.GetUnary();
+                     if(Quotient < DEPTH_MAP_CODEC_MAX_UNARY)
+                        Residual = (Quotient << RiceParam) | Reader.Get(RiceParam);
+                     else
+                        Residual = Reader.Get(16);
+                     }
+                  MIL_INT Difference = (MIL_INT)(Residual >> 1) ^ -(MIL_INT)(Residual & 1);
+                  pRow[x] = (MIL_UINT16)(Prediction + Difference);
+                  }
+               }
+            }
+         }
+
+      EDepthMapPredictor  m_Predictor;
+      MIL_INT             m_TileSize;
+      MIL_INT             m_SizeX;
+      MIL_INT             m_SizeY;
+      MIL_INT             m_LayoutTileSize;
+      MIL_INT             m_NbTilesX;
+      MIL_INT             m_NbTiles;
+      SDepthMapCodecTile* m_pTiles;     // Tile table of the stream being processed.
+
+      CPipelineThreadPool* m_pThreadPool;
+      MIL_INT             m_ThreadPoolRole;
+      SDepthMapCodecBand  m_Bands[DEPTH_MAP_CODEC_MAX_THREADS];
+      MIL_INT             m_NbBands;
+   };
@@ -0,0 +1,586 @@
+﻿//***************************************************************************************/
+//
+// File name: DepthMapMesh.h
+//
+// Synopsis:  Contains the adaptive mesh builder used by the Chromasens_3DPIXA_M10PP3
+//            example to send the calibrated depth maps to a remote viewer. The
+//            map is covered by a quadtree of square blocks; a block is kept
+//            whole when its two triangles are within the error bound of every
+//            pixel it covers, and is split in four otherwise. The flat areas
+//            are covered by a few large triangles while the defects and the
+//            edges keep the full resolution.
+//
+//            A block whose edges hold corners of smaller neighbors is drawn as
+//            a fan around its center through these corners, so the mesh has no
+//            cracks; it is split too if a triangle of the fan is not within
+//            the error bound. The cells with an invalid pixel are left as holes.
+//
+//            File layout, all values little endian:
+//               SDepthMapMeshHeader
+//               NbVertices x SDepthMapMeshVertex    Pixel coordinates and gray level.
+//               NbTriangles x 3 MIL_UINT32          Vertex indices, clockwise in the image.
+//
+// Copyright © 1992-2024 Zebra Technologies Corp. and/or its affiliates
+// All Rights Reserved
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const MIL_UINT32 DEPTH_MAP_MESH_MAGIC          = 0x48534D43;   // "CMSH"
+static const MIL_UINT16 DEPTH_MAP_MESH_VERSION        = 1;
+static const MIL_INT    DEPTH_MAP_MESH_MAX_BLOCK_SIZE = 256;          // Power of 2.
+static const MIL_INT    DEPTH_MAP_MESH_MIN_CAPACITY   = 4096;
+
+// Header of a mesh file. The world position of a vertex is (X * PixelSizeX,
+// Y * PixelSizeY, WorldPosZ + Z * GrayLevelSizeZ).
+struct SDepthMapMeshHeader
+   {
+   MIL_UINT32 Magic;
+   MIL_UINT16 Version;
+   MIL_UINT16 Reserved;
+   MIL_UINT32 SizeX;
+   MIL_UINT32 SizeY;
+   MIL_UINT32 NbVertices;
+   MIL_UINT32 NbTriangles;
+   MIL_DOUBLE PixelSizeX;
+   MIL_DOUBLE PixelSizeY;
+   MIL_DOUBLE WorldPosZ;
+   MIL_DOUBLE GrayLevelSizeZ;
+   };
+
+// Vertex of a mesh.
+struct SDepthMapMeshVertex
+   {
+   MIL_UINT16 X;
+   MIL_UINT16 Y;
+   MIL_UINT16 Z;
+   };
+
+// Slot of the table of the vertices, indexed by a hash of their pixel.
+struct SDepthMapMeshSlot
+   {
+   MIL_INT   Pixel;   // Y * SizeX + X, or -1 if the slot is empty.
+   MIL_INT32 Index;   // Of the vertex, or -1 if the pixel is only marked.
+   };
+
+// Block of the quadtree kept in the mesh.
+struct SDepthMapMeshLeaf
+   {
+   MIL_INT32 X;
+   MIL_INT32 Y;
+   MIL_INT32 Size;
+   };
+
+//////////////////////////////////////////////////////////////////////////
+// Class that builds the adaptive mesh of a 16-bit depth map and writes it.
+//////////////////////////////////////////////////////////////////////////
+class CDepthMapMesh
+   {
+   public:
+      // Constructor.
+      CDepthMapMesh()
+         : m_pDepth(NULL),
+           m_Pitch(0),
+           m_SizeX(0),
+           m_SizeY(0),
+           m_MaxError(0.0),
+           m_pVertexSlots(NULL),
+           m_VertexSlotCapacity(0),
+           m_pLeaves(NULL),
+           m_NbLeaves(0),
+           m_LeafCapacity(0),
+           m_pVertices(NULL),
+           m_NbVertices(0),
+           m_VertexCapacity(0),
+           m_pTriangles(NULL),
+           m_NbTriangles(0),
+           m_TriangleCapacity(0),
+           m_OutOfMemory(false)
+         {
+         }
+
+      // Destructor.
+      virtual ~CDepthMapMesh()
+         {
+         free(m_pTriangles);
+         free(m_pVertices);
+         free(m_pLeaves);
+         free(m_pVertexSlots);
+         }
+
+      // Function that builds the mesh of a depth map, within the maximum error,
+      // in gray levels, of every valid pixel. The pitch is in pixels; 0 and 65535
+      // are invalid. Returns false, with an empty mesh, if its arrays cannot be
+      // allocated.
+      bool Build(const MIL_UINT16* pDepth, MIL_INT Pitch, MIL_INT SizeX, MIL_INT SizeY, MIL_DOUBLE MaxError)
+         {
+         m_pDepth = pDepth;
+         m_Pitch = Pitch;
+         m_SizeX = SizeX;
+         m_SizeY = SizeY;
+         m_MaxError = MaxError;
+         m_NbLeaves = 0;
+         m_NbVertices = 0;
+         m_NbTriangles = 0;
+         m_OutOfMemory = false;
+         if(SizeX < 2 || SizeY < 2)
+            return true;
+
+         // Cover the map with the largest blocks and split them as required.
+         for(MIL_INT y = 0; y < SizeY - 1; y += DEPTH_MAP_MESH_MAX_BLOCK_SIZE)
+            for(MIL_INT x = 0; x < SizeX - 1; x += DEPTH_MAP_MESH_MAX_BLOCK_SIZE)
+               Subdivide(x, y, DEPTH_MAP_MESH_MAX_BLOCK_SIZE);
+
+         // Mark the corners of the blocks and split the blocks whose fan through
+         // the corners on their edges is not within the maximum error, until
+         // no block is split. The blocks of one pixel are never drawn as a fan.
+         bool Split;
+         do
+            {
+            MarkCorners();
+            Split = false;
+            MIL_INT NbLeaves = m_NbLeaves;
+            MIL_INT NbKeptLeaves = 0;
+            for(MIL_INT LeafIdx = 0; LeafIdx < NbLeaves; LeafIdx++)
+               {
+               SDepthMapMeshLeaf Leaf = m_pLeaves[LeafIdx];
+               MIL_INT NbBoundaryVertices = FindBoundaryVertices(Leaf);
+               if(NbBoundaryVertices > 4 && GetFanError(Leaf, NbBoundaryVertices) > m_MaxError)
+                  {
+                  MIL_INT HalfSize = Leaf.Size / 2;
+                  Subdivide(Leaf.X, Leaf.Y, HalfSize);
+                  Subdivide(Leaf.X + HalfSize, Leaf.Y, HalfSize);
+                  Subdivide(Leaf.X, Leaf.Y + HalfSize, HalfSize);
+                  Subdivide(Leaf.X + HalfSize, Leaf.Y + HalfSize, HalfSize);
+                  Split = true;
+                  }
+               else
+                  m_pLeaves[NbKeptLeaves++] = Leaf;
+               }
+
+            // Move the leaves of the split blocks after the kept ones.
+            for(MIL_INT LeafIdx = NbLeaves; LeafIdx < m_NbLeaves; LeafIdx++)
+               m_pLeaves[NbKeptLeaves++] = m_pLeaves[LeafIdx];
+            m_NbLeaves = NbKeptLeaves;
+            }
+         while(Split && !m_OutOfMemory);
+
+         // Triangulate each block through the corners on its edges.
+         for(MIL_INT LeafIdx = 0; LeafIdx < m_NbLeaves && !m_OutOfMemory; LeafIdx++)
+            Triangulate(m_pLeaves[LeafIdx]);
+         if(m_OutOfMemory)
+            {
+            m_NbLeaves = 0;
+            m_NbVertices = 0;
+            m_NbTriangles = 0;
+            return false;
+            }
+         return true;
+         }
+
+      // Function that returns the number of vertices of the mesh.
+      MIL_INT GetNbVertices() const {return m_NbVertices;}
+
+      // Function that returns the number of triangles of the mesh.
+      MIL_INT GetNbTriangles() const {return m_NbTriangles;}
+
+      // Function that returns the size of the mesh file, in bytes.
+      MIL_INT GetFileSize() const
+         {
+         return sizeof(SDepthMapMeshHeader) + m_NbVertices * sizeof(SDepthMapMeshVertex) + m_NbTriangles * 3 * sizeof(MIL_UINT32);
+         }
+
+      // Function that writes the mesh with the calibration of the depth map.
+      bool Write(const char* FilePath, MIL_DOUBLE PixelSizeX, MIL_DOUBLE PixelSizeY, MIL_DOUBLE WorldPosZ, MIL_DOUBLE GrayLevelSizeZ) const
+         {
+         FILE* pFile = NULL;
+         if(fopen_s(&pFile, FilePath, "wb") != 0 || pFile == NULL)
+            return false;
+         SDepthMapMeshHeader Header;
+         memset(&Header, 0, sizeof(Header));
+         Header.Magic = DEPTH_MAP_MESH_MAGIC;
+         Header.Version = DEPTH_MAP_MESH_VERSION;
+         Header.SizeX = (MIL_UINT32)m_SizeX;
+         Header.SizeY = (MIL_UINT32)m_SizeY;
+         Header.NbVertices = (MIL_UINT32)m_NbVertices;
+         Header.NbTriangles = (MIL_UINT32)m_NbTriangles;
+         Header.PixelSizeX = PixelSizeX;
+         Header.PixelSizeY = PixelSizeY;
+         Header.WorldPosZ = WorldPosZ;
+         Header.GrayLevelSizeZ = GrayLevelSizeZ;
+         bool Written = fwrite(&Header, sizeof(Header), 1, pFile) == 1 &&
+                        fwrite(m_pVertices, sizeof(SDepthMapMeshVertex), m_NbVertices, pFile) == (size_t)m_NbVertices &&
+                        fwrite(m_pTriangles, 3 * sizeof(MIL_UINT32), m_NbTriangles, pFile) == (size_t)m_NbTriangles;
+         fclose(pFile);
+         return Written;
+         }
+
+      // Function that returns the largest error, in gray levels, of a regular
+      // grid of cells of Step pixels, each drawn as two triangles, over the cells
+      // whose pixels are all valid.
+      static MIL_DOUBLE MeasureGridError(const MIL_UINT16* pDepth, MIL_INT Pitch, MIL_INT SizeX, MIL_INT SizeY, MIL_INT Step)
+         {
+         MIL_DOUBLE MaxError = 0.0;
+         for(MIL_INT y = 0; y + Step < SizeY; y += Step)
+            {
+            for(MIL_INT x = 0; x + Step < SizeX; x += Step)
+               {
+               MIL_DOUBLE Error = GetBlockError(pDepth, Pitch, x, y, Step, -1.0);
+               if(Error > MaxError)
+                  MaxError = Error;
+               }
+            }
+         return MaxError;
+         }
+
+   private:
+      // Disallow copy.
+      CDepthMapMesh(const CDepthMapMesh&);
+      CDepthMapMesh& operator=(const CDepthMapMesh&);
+
+      static const MIL_INT32 VERTEX_MARKED = -1;
+
+      // Function that returns true if a gray level is valid.
+      static bool IsValid(MIL_UINT16 Value) {return Value != 0 && Value != MIL_UINT16_MAX;}
+
+      // Function that returns the largest error of the two triangles of a block,
+      // split along its main diagonal, over its pixels. Returns -1 if a pixel
+      // is invalid, and stops as soon as the error is above the maximum error,
+      // if it is not negative.
+      static MIL_DOUBLE GetBlockError(const MIL_UINT16* pDepth, MIL_INT Pitch, MIL_INT X, MIL_INT Y, MIL_INT Size, MIL_DOUBLE MaxError)
+         {
+         const MIL_UINT16* pBlock = pDepth + Y * Pitch + X;
+         MIL_DOUBLE Z00 = pBlock[0];
+         MIL_DOUBLE Z10 = pBlock[Size];
+         MIL_DOUBLE Z01 = pBlock[Size * Pitch];
+         MIL_DOUBLE Z11 = pBlock[Size * Pitch + Size];
+         MIL_DOUBLE Scale = 1.0 / Size;
+         MIL_DOUBLE BlockError = 0.0;
+         for(MIL_INT v = 0; v <= Size; v++)
+            {
+            const MIL_UINT16* pRow = pBlock + v * Pitch;
+            for(MIL_INT u = 0; u <= Size; u++)
+               {
+               if(!IsValid(pRow[u]))
+                  return -1.0;
+
+               // Above the diagonal, the triangle is (00, 10, 11); below, (00, 11, 01).
+               MIL_DOUBLE Interpolated = u >= v ? Z00 + (u * (Z10 - Z00) + v * (Z11 - Z10)) * Scale
+                                                : Z00 + (v * (Z01 - Z00) + u * (Z11 - Z01)) * Scale;
+               MIL_DOUBLE Error = pRow[u] - Interpolated;
+               if(Error < 0)
+                  Error = -Error;
+               if(Error > BlockError)
+                  {
+                  BlockError = Error;
+                  if(MaxError >= 0 && BlockError > MaxError)
+                     return BlockError;
+                  }
+               }
+            }
+         return BlockError;
+         }
+
+      // Function that keeps a block or splits it. The blocks that cross the border
+      // of the map are split, and the cells with an invalid pixel are dropped.
+      void Subdivide(MIL_INT X, MIL_INT Y, MIL_INT Size)
+         {
+         if(X >= m_SizeX - 1 || Y >= m_SizeY - 1)
+            return;
+         if(X + Size <= m_SizeX - 1 && Y + Size <= m_SizeY - 1)
+            {
+            MIL_DOUBLE Error = GetBlockError(m_pDepth, m_Pitch, X, Y, Size, m_MaxError);
+            if(Error >= 0 && Error <= m_MaxError)
+               {
+               AddLeaf(X, Y, Size);
+               return;
+               }
+            if(Size == 1)
+               return;
+            }
+         MIL_INT HalfSize = Size / 2;
+         Subdivide(X, Y, HalfSize);
+         Subdivide(X + HalfSize, Y, HalfSize);
+         Subdivide(X, Y + HalfSize, HalfSize);
+         Subdivide(X + HalfSize, Y + HalfSize, HalfSize);
+         }
+
+      // Function that marks the corners of the blocks in an empty vertex table,
+      // with room for them and for the centers of the blocks. The table holds
+      // only these pixels, not the whole map.
+      void MarkCorners()
+         {
+         MIL_INT Capacity = DEPTH_MAP_MESH_MIN_CAPACITY;
+         while(Capacity < 2 * 5 * m_NbLeaves)
+            Capacity *= 2;
+         if(Capacity > m_VertexSlotCapacity)
+            {
+            free(m_pVertexSlots);
+            m_pVertexSlots = (SDepthMapMeshSlot*)malloc(Capacity * sizeof(SDepthMapMeshSlot));
+            m_VertexSlotCapacity = m_pVertexSlots != NULL ? Capacity : 0;
+            }
+         if(m_pVertexSlots == NULL)
+            {
+            m_OutOfMemory = true;
+            return;
+            }
+         for(MIL_INT SlotIdx = 0; SlotIdx < m_VertexSlotCapacity; SlotIdx++)
+            m_pVertexSlots[SlotIdx].Pixel = -1;
+         for(MIL_INT LeafIdx = 0; LeafIdx < m_NbLeaves; LeafIdx++)
+            {
+            const SDepthMapMeshLeaf& Leaf = m_pLeaves[LeafIdx];
+            GetVertexSlot(Leaf.X, Leaf.Y, true);
+            GetVertexSlot(Leaf.X + Leaf.Size, Leaf.Y, true);
+            GetVertexSlot(Leaf.X, Leaf.Y + Leaf.Size, true);
+            GetVertexSlot(Leaf.X + Leaf.Size, Leaf.Y + Leaf.Size, true);
+            }
+         }
+
+      // Function that returns the slot of a pixel in the vertex table. If it is
+      // not in the table, it is added as marked, or NULL is returned.
+      SDepthMapMeshSlot* GetVertexSlot(MIL_INT X, MIL_INT Y, bool Add)
+         {
+         MIL_INT Pixel = Y * m_SizeX + X;
+         MIL_INT Mask = m_VertexSlotCapacity - 1;
+         MIL_INT SlotIdx = (MIL_INT)((((MIL_UINT64)Pixel * 0x9E3779B97F4A7C15ULL) >> 32) & Mask);
+         while(m_pVertexSlots[SlotIdx].Pixel != Pixel)
+            {
+            if(m_pVertexSlots[SlotIdx].Pixel < 0)
+               {
+               if(!Add)
+                  return NULL;
+               m_pVertexSlots[SlotIdx].Pixel = Pixel;
+               m_pVertexSlots[SlotIdx].Index = VERTEX_MARKED;
+               break;
+               }
+            SlotIdx = (SlotIdx + 1) & Mask;
+            }
+         return &m_pVertexSlots[SlotIdx];
+         }
+
+      // Function that adds a block to the mesh.
+      void AddLeaf(MIL_INT X, MIL_INT Y, MIL_INT Size)
+         {
+         if(m_NbLeaves == m_LeafCapacity)
+            {
+            SDepthMapMeshLeaf* pLeaves = (SDepthMapMeshLeaf*)Grow(m_pLeaves, &m_LeafCapacity, sizeof(SDepthMapMeshLeaf));
+            if(pLeaves == NULL)
+               {
+               m_OutOfMemory = true;
+               return;
+               }
+            m_pLeaves = pLeaves;
+            }
+         SDepthMapMeshLeaf& Leaf = m_pLeaves[m_NbLeaves++];
+         Leaf.X = (MIL_INT32)X;
+         Leaf.Y = (MIL_INT32)Y;
+         Leaf.Size = (MIL_INT32)Size;
+         }
+
+      // Function that returns the index of the vertex of a pixel, added on its
+      // first use. Returns 0 if the vertex cannot be added.
+      MIL_UINT32 GetVertex(MIL_INT X, MIL_INT Y)
+         {
+         MIL_INT32& Index = GetVertexSlot(X, Y, true)->Index;
+         if(Index < 0)
+            {
+            if(m_NbVertices == m_VertexCapacity)
+               {
+               SDepthMapMeshVertex* pVertices = (SDepthMapMeshVertex*)Grow(m_pVertices, &m_VertexCapacity, sizeof(SDepthMapMeshVertex));
+               if(pVertices == NULL)
+                  {
+                  m_OutOfMemory = true;
+                  return 0;
+                  }
+               m_pVertices = pVertices;
+               }
+            SDepthMapMeshVertex& Vertex = m_pVertices[m_NbVertices];
+            Vertex.X = (MIL_UINT16)X;
+            Vertex.Y = (MIL_UINT16)Y;
+            Vertex.Z = m_pDepth[Y * m_Pitch + X];
+            Index = (MIL_INT32)m_NbVertices++;
+            }
+         return (MIL_UINT32)Index;
+         }
+
+      // Function that adds a triangle to the mesh.
+      void AddTriangle(MIL_UINT32 Vertex0, MIL_UINT32 Vertex1, MIL_UINT32 Vertex2)
+         {
+         if(m_NbTriangles * 3 + 3 > m_TriangleCapacity)
+            {
+            MIL_UINT32* pTriangles = (MIL_UINT32*)Grow(m_pTriangles, &m_TriangleCapacity, sizeof(MIL_UINT32));
+            if(pTriangles == NULL)
+               {
+               m_OutOfMemory = true;
+               return;
+               }
+            m_pTriangles = pTriangles;
+            }
+         MIL_UINT32* pTriangle = m_pTriangles + m_NbTriangles * 3;
+         pTriangle[0] = Vertex0;
+         pTriangle[1] = Vertex1;
+         pTriangle[2] = Vertex2;
+         m_NbTriangles++;
+         }
+
+      // Function that triangulates a block. Without corners of the neighbors on
+      // its edges, it is drawn as the two triangles whose error was checked;
+      // otherwise, as a fan from its center.
+      void Triangulate(const SDepthMapMeshLeaf& Leaf)
+         {
+         MIL_INT NbBoundaryVertices = FindBoundaryVertices(Leaf);
+         MIL_INT X;
+         MIL_INT Y;
+         for(MIL_INT VertexIdx = 0; VertexIdx < NbBoundaryVertices; VertexIdx++)
+            {
+            GetBoundaryPosition(Leaf, m_BoundaryPositions[VertexIdx], &X, &Y);
+            m_BoundaryVertices[VertexIdx] = GetVertex(X, Y);
+            }
+
+         if(NbBoundaryVertices == 4)
+            {
+            AddTriangle(m_BoundaryVertices[0], m_BoundaryVertices[1], m_BoundaryVertices[2]);
+            AddTriangle(m_BoundaryVertices[0], m_BoundaryVertices[2], m_BoundaryVertices[3]);
+            }
+         else
+            {
+            MIL_UINT32 Center = GetVertex(Leaf.X + Leaf.Size / 2, Leaf.Y + Leaf.Size / 2);
+            for(MIL_INT VertexIdx = 0; VertexIdx < NbBoundaryVertices; VertexIdx++)
+               AddTriangle(Center, m_BoundaryVertices[VertexIdx], m_BoundaryVertices[(VertexIdx + 1) % NbBoundaryVertices]);
+            }
+         }
+
+      // Function that finds the corners of the blocks on the edges of a block,
+      // clockwise in the image from its top left corner. Their positions along
+      // the edges, from 0 to 4 x Size, are kept in the boundary positions.
+      // Returns their number.
+      MIL_INT FindBoundaryVertices(const SDepthMapMeshLeaf& Leaf)
+         {
+         MIL_INT NbBoundaryVertices = 0;
+         MIL_INT X;
+         MIL_INT Y;
+         for(MIL_INT Position = 0; Position < 4 * Leaf.Size; Position++)
+            {
+            GetBoundaryPosition(Leaf, Position, &X, &Y);
+            if(GetVertexSlot(X, Y, false) != NULL)
+               m_BoundaryPositions[NbBoundaryVertices++] = (MIL_INT32)Position;
+            }
+         return NbBoundaryVertices;
+         }
+
+      // Function that returns the pixel at a position along the edges of a block.
+      static void GetBoundaryPosition(const SDepthMapMeshLeaf& Leaf, MIL_INT Position, MIL_INT* pX, MIL_INT* pY)
+         {
+         MIL_INT Edge = Position / Leaf.Size;
+         MIL_INT Offset = Position % Leaf.Size;
+         switch(Edge)
+            {
+            case 0:  *pX = Leaf.X + Offset;             *pY = Leaf.Y;                          break;
+            case 1:  *pX = Leaf.X + Leaf.Size;          *pY = Leaf.Y + Offset;                 break;
+            case 2:  *pX = Leaf.X + Leaf.Size - Offset; *pY = Leaf.Y + Leaf.Size;              break;
+            default: *pX = Leaf.X;                      *pY = Leaf.Y + Leaf.Size - Offset;     break;
+            }
+         }
+
+      // Function that returns the largest error of the fan of a block over its
+      // pixels, from the boundary vertices found. Each pixel is interpolated in
+      // the triangle of the fan whose edges hold the point where the ray from
+      // the center through the pixel leaves the block.
+      MIL_DOUBLE GetFanError(const SDepthMapMeshLeaf& Leaf, MIL_INT NbBoundaryVertices) const
+         {
+         MIL_INT HalfSize = Leaf.Size / 2;
+         MIL_INT CenterX = Leaf.X + HalfSize;
+         MIL_INT CenterY = Leaf.Y + HalfSize;
+         MIL_DOUBLE CenterZ = m_pDepth[CenterY * m_Pitch + CenterX];
+         MIL_DOUBLE FanError = 0.0;
+         for(MIL_INT v = -HalfSize; v <= HalfSize; v++)
+            {
+            const MIL_UINT16* pRow = m_pDepth + (CenterY + v) * m_Pitch + CenterX;
+            for(MIL_INT u = -HalfSize; u <= HalfSize; u++)
+               {
+               if(u == 0 && v == 0)
+                  continue;
+
+               // Position where the ray leaves the block, along its edges.
+               MIL_INT AbsU = u < 0 ? -u : u;
+               MIL_INT AbsV = v < 0 ? -v : v;
+               MIL_DOUBLE Position;
+               if(AbsV >= AbsU)
+                  Position = v < 0 ? HalfSize + (MIL_DOUBLE)u * HalfSize / AbsV
+                                   : 5 * HalfSize - (MIL_DOUBLE)u * HalfSize / AbsV;
+               else
+                  Position = u > 0 ? 3 * HalfSize + (MIL_DOUBLE)v * HalfSize / AbsU
+                                   : 7 * HalfSize - (MIL_DOUBLE)v * HalfSize / AbsU;
+
+               // Find the triangle of the fan.
+               MIL_INT Low = 0;
+               MIL_INT High = NbBoundaryVertices - 1;
+               while(Low < High)
+                  {
+                  MIL_INT Middle = (Low + High + 1) / 2;
+                  if(m_BoundaryPositions[Middle] <= Position)
+                     Low = Middle;
+                  else
+                     High = Middle - 1;
+                  }
+               MIL_INT AX, AY, BX, BY;
+               GetBoundaryPosition(Leaf, m_BoundaryPositions[Low], &AX, &AY);
+               GetBoundaryPosition(Leaf, m_BoundaryPositions[(Low + 1) % NbBoundaryVertices], &BX, &BY);
+
+               // Interpolate the pixel in the triangle.
+               MIL_DOUBLE DAX = (MIL_DOUBLE)(AX - CenterX);
+               MIL_DOUBLE DAY = (MIL_DOUBLE)(AY - CenterY);
+               MIL_DOUBLE DBX = (MIL_DOUBLE)(BX - CenterX);
+               MIL_DOUBLE DBY = (MIL_DOUBLE)(BY - CenterY);
+               MIL_DOUBLE Determinant = DAX * DBY - DAY * DBX;
+               MIL_DOUBLE WeightA = (u * DBY - v * DBX) / Determinant;
+               MIL_DOUBLE WeightB = (DAX * v - DAY * u) / Determinant;
+               MIL_DOUBLE Interpolated = CenterZ + WeightA * (m_pDepth[AY * m_Pitch + AX] - CenterZ)
+                                                 + WeightB * (m_pDepth[BY * m_Pitch + BX] - CenterZ);
+               MIL_DOUBLE Error = pRow[u] - Interpolated;
+               if(Error < 0)
+                  Error = -Error;
+               if(Error > FanError)
+                  {
+                  FanError = Error;
+                  if(FanError > m_MaxError)
+                     return FanError;
+                  }
+               }
+            }
+         return FanError;
+         }
+
+      // Function that doubles the capacity, in elements, of an array. Returns the
+      // reallocated array, or NULL with the array and its capacity unchanged if
+      // it cannot be reallocated.
+      static void* Grow(void* pArray, MIL_INT* pCapacity, MIL_INT ElementSize)
+         {
+         MIL_INT Capacity = *pCapacity > 0 ? *pCapacity * 2 : DEPTH_MAP_MESH_MIN_CAPACITY;
+         void* pGrownArray = realloc(pArray, Capacity * ElementSize);
+         if(pGrownArray != NULL)
+            *pCapacity = Capacity;
+         return pGrownArray;
+         }
+
+      const MIL_UINT16*    m_pDepth;
+      MIL_INT              m_Pitch;
+      MIL_INT              m_SizeX;
+      MIL_INT              m_SizeY;
+      MIL_DOUBLE           m_MaxError;
+      SDepthMapMeshSlot*   m_pVertexSlots;      // Of the corners and centers of the blocks.
+      MIL_INT              m_VertexSlotCapacity;
+      SDepthMapMeshLeaf*   m_pLeaves;
+      MIL_INT              m_NbLeaves;
+      MIL_INT              m_LeafCapacity;
+      SDepthMapMeshVertex* m_pVertices;
+      MIL_INT              m_NbVertices;
+      MIL_INT              m_VertexCapacity;
+      MIL_UINT32*          m_pTriangles;
+      MIL_INT              m_NbTriangles;
+      MIL_INT              m_TriangleCapacity;
+      bool                 m_OutOfMemory;       // An array of the last build could not be allocated.
+      MIL_INT32            m_BoundaryPositions[4 * DEPTH_MAP_MESH_MAX_BLOCK_SIZE];
+      MIL_UINT32           m_BoundaryVertices[4 * DEPTH_MAP_MESH_MAX_BLOCK_SIZE];
+   };
@@ -0,0 +1,287 @@
+﻿//***************************************************************************************/
+//
+// File name: EpipolarRectifier.h
+//
+// Synopsis:  Contains the CPU rectification of the raw 3DPIXA views used by the
+//            Chromasens_3DPIXA_M10PP3 example when no GPU is available, before
+//            the disparity is calculated.
+//
+//            A line scan camera images the same sensor line at every row, so the
+//            remapping of a row does not depend on it. The remap tables hold one
+//            entry per rectified column of each view: the source column, the row
+//            offset and the bilinear weights in 7-bit fixed point. They are built
+//            once per calibration geometry, from the imgWidth, oriImgWidth and dY
+//            of the config3DApi, and applied by tiles to bound the source memory
+//            touched. The color views are sampled with SSE2, a pixel per 32-bit
+//            lane, and the gray views pixel by pixel. When the views keep their
+//            width and dY is 0, as in the COMPACT config, the tables are the
+//            identity and the views are read straight from the source instead.
+//
+// Copyright © 1992-2024 Zebra Technologies Corp. and/or its affiliates
+// All Rights Reserved
+
+#include <emmintrin.h>
+#include <math.h>
+#include <string.h>
+
+static const MIL_INT RECTIFY_FRACTION_BITS = 7;     // Precision of the sampling position, 1/128 pixel.
+static const MIL_INT RECTIFY_FRACTION_ONE  = 1 << RECTIFY_FRACTION_BITS;
+static const MIL_INT RECTIFY_WEIGHT_SHIFT  = 2 * RECTIFY_FRACTION_BITS;
+static const MIL_INT RECTIFY_TILE_SIZE_X   = 256;   // In rectified columns.
+static const MIL_INT RECTIFY_TILE_SIZE_Y   = 32;
+
+// Entry of the remap table of a rectified column. The weights are packed by
+// pairs of neighbor source columns, the left one in the low 16 bits.
+struct SRectifyEntry
+   {
+   MIL_INT32 SrcX;            // Left source column of the sample, in the view.
+   MIL_INT32 OffsetY;         // Offset of the top source row from the rectified row.
+   MIL_INT32 WeightsTop;      // Weights of the top source row.
+   MIL_INT32 WeightsBottom;   // Weights of the bottom source row.
+   };
+
+//////////////////////////////////////////////////////////////////////////
+// Class that rectifies the left and right views of the raw 3DPIXA image
+// with precomputed fixed-point remap tables.
+//////////////////////////////////////////////////////////////////////////
+class CEpipolarRectifier
+   {
+   public:
+      // Constructor.
+      CEpipolarRectifier()
+         : m_SrcSizeX(0),
+           m_SizeX(0),
+           m_OriSizeX(0),
+           m_dY(0),
+           m_IsIdentity(false),
+           m_NbBuilds(0)
+         {
+         memset(m_pTables, 0, sizeof(m_pTables));
+         memset(m_MinOffsetY, 0, sizeof(m_MinOffsetY));
+         memset(m_MaxOffsetY, 0, sizeof(m_MaxOffsetY));
+         }
+
+      // Destructor.
+      virtual ~CEpipolarRectifier()
+         {
+         Free();
+         }
+
+      // Function that returns the width of the rectified views. The views are
+      // resampled to imgWidth only when the source views have the calibrated raw
+      // width, oriImgWidth; other sources, such as footage that is already cropped,
+      // keep their width.
+      static MIL_INT GetRectifiedSizeX(const config3DApi& Config, MIL_INT SrcSizeX)
+         {
+         if(Config.imgWidth > 0 && Config.oriImgWidth == SrcSizeX)
+            return Config.imgWidth;
+         return SrcSizeX;
+         }
+
+      // Function that builds the remap tables of a source view width, unless they
+      // are already built for this geometry. Returns false if the views are too small.
+      bool Build(const config3DApi& Config, MIL_INT SrcSizeX)
+         {
+         MIL_INT SizeX = GetRectifiedSizeX(Config, SrcSizeX);
+         if(SrcSizeX < 2 || SizeX < 1)
+            return false;
+         if(m_pTables[0] != NULL && SrcSizeX == m_SrcSizeX && SizeX == m_SizeX && Config.oriImgWidth == m_OriSizeX && Config.dY == m_dY)
+            return true;
+
+         Free();
+         m_SrcSizeX = SrcSizeX;
+         m_SizeX = SizeX;
+         m_OriSizeX = Config.oriImgWidth;
+         m_dY = Config.dY;
+         m_IsIdentity = SizeX == SrcSizeX && m_dY == 0.0;
+
+         // The right view is shifted down by dY relative to the left view.
+         MIL_DOUBLE ScaleX = (MIL_DOUBLE)SrcSizeX / SizeX;
+         for(MIL_INT View = 0; View < 2; View++)
+            {
+            m_pTables[View] = new SRectifyEntry[SizeX];
+            m_MinOffsetY[View] = 0x7FFFFFFF;
+            m_MaxOffsetY[View] = -0x7FFFFFFF;
+            MIL_DOUBLE ShiftY = View == 0 ? 0.0 : m_dY;
+            for(MIL_INT x = 0; x < SizeX; x++)
+               {
+               MIL_DOUBLE SrcX = (x + 0.5) * ScaleX - 0.5;
+               SetEntry(&m_pTables[View][x], SrcX, ShiftY);
+               if(m_pTables[View][x].OffsetY < m_MinOffsetY[View])
+                  m_MinOffsetY[View] = m_pTables[View][x].OffsetY;
+               if(m_pTables[View][x].OffsetY > m_MaxOffsetY[View])
+                  m_MaxOffsetY[View] = m_pTables[View][x].OffsetY;
+               }
+            }
+         m_NbBuilds++;
+         return true;
+         }
+
+      // Function that returns the width of the rectified views of the built tables.
+      MIL_INT GetSizeX() const {return m_SizeX;}
+
+      // Function that returns true if the built tables sample every pixel of the
+      // views at its own position, so that the rectification can be skipped.
+      bool IsIdentity() const {return m_IsIdentity;}
+
+      // Function that returns the number of times the tables were built.
+      MIL_INT GetNbBuilds() const {return m_NbBuilds;}
+
+      // Function that rectifies the rows StartY to EndY of a view. The source
+      // points to the first pixel of the view and has 1 or 4 channels, as the
+      // destination. The destination rows out of the source are black.
+      void Rectify(MIL_INT View, const unsigned char* pSrc, MIL_INT SrcSizeY, MIL_INT SrcPitchByte, MIL_INT NbChannels,
+                   unsigned char* pDst, MIL_INT DstPitchByte, MIL_INT StartY, MIL_INT EndY) const
+         {
+         const SRectifyEntry* pTable = m_pTables[View];
+         for(MIL_INT TileY = StartY; TileY < EndY; TileY += RECTIFY_TILE_SIZE_Y)
+            {
+            MIL_INT TileEndY = TileY + RECTIFY_TILE_SIZE_Y < EndY ? TileY + RECTIFY_TILE_SIZE_Y : EndY;
+            for(MIL_INT TileX = 0; TileX < m_SizeX; TileX += RECTIFY_TILE_SIZE_X)
+               {
+               MIL_INT TileEndX = TileX + RECTIFY_TILE_SIZE_X < m_SizeX ? TileX + RECTIFY_TILE_SIZE_X : m_SizeX;
+               for(MIL_INT y = TileY; y < TileEndY; y++)
+                  {
+                  unsigned char* pDstRow = pDst + y * DstPitchByte;
+
+                  // The rows whose samples are all inside the source take the fast path.
+                  bool IsInside = y + m_MinOffsetY[View] >= 0 && y + m_MaxOffsetY[View] + 1 < SrcSizeY;
+                  if(IsInside && NbChannels == 4)
+                     RectifyRowBgra(pTable, pSrc, SrcPitchByte, pDstRow, y, TileX, TileEndX);
+                  else
+                     RectifyRowClamped(pTable, pSrc, SrcSizeY, SrcPitchByte, NbChannels, pDstRow, y, TileX, TileEndX);
+                  }
+               }
+            }
+         }
+
+   private:
+      // Disallow copy.
+      CEpipolarRectifier(const CEpipolarRectifier&);
+      CEpipolarRectifier& operator=(const CEpipolarRectifier&);
+
+      // Function that frees the tables.
+      void Free()
+         {
+         for(MIL_INT View = 0; View < 2; View++)
+            {
+            delete [] m_pTables[View];
+            m_pTables[View] = NULL;
+            }
+         }
+
+      // Function that sets the entry of a rectified column from its source
+      // position. The column is clamped to the view.
+      void SetEntry(SRectifyEntry* pEntry, MIL_DOUBLE SrcX, MIL_DOUBLE ShiftY) const
+         {
+         MIL_INT FixedX = (MIL_INT)floor(SrcX * RECTIFY_FRACTION_ONE + 0.5);
+         MIL_INT FixedY = (MIL_INT)floor(ShiftY * RECTIFY_FRACTION_ONE + 0.5);
+         if(FixedX < 0)
+            FixedX = 0;
+         if(FixedX > (m_SrcSizeX - 1) * RECTIFY_FRACTION_ONE)
+            FixedX = (m_SrcSizeX - 1) * RECTIFY_FRACTION_ONE;
+
+         // Keep the right neighbor inside the view at its last column.
+         MIL_INT X = FixedX >> RECTIFY_FRACTION_BITS;
+         MIL_INT FracX = FixedX & (RECTIFY_FRACTION_ONE - 1);
+         if(X == m_SrcSizeX - 1)
+            {
+            X--;
+            FracX = RECTIFY_FRACTION_ONE;
+            }
+         MIL_INT FracY = FixedY & (RECTIFY_FRACTION_ONE - 1);
+         pEntry->SrcX = (MIL_INT32)X;
+         pEntry->OffsetY = (MIL_INT32)(FixedY >> RECTIFY_FRACTION_BITS);
+         pEntry->WeightsTop = PackWeights((RECTIFY_FRACTION_ONE - FracX) * (RECTIFY_FRACTION_ONE - FracY), FracX * (RECTIFY_FRACTION_ONE - FracY));
+         pEntry->WeightsBottom = PackWeights((RECTIFY_FRACTION_ONE - FracX) * FracY, FracX * FracY);
+         }
+
+      // Function that packs the weights of two neighbor source columns.
+      static MIL_INT32 PackWeights(MIL_INT LeftWeight, MIL_INT RightWeight)
+         {
+         return (MIL_INT32)(LeftWeight | (RightWeight << 16));
+         }
+
+      // Function that rectifies columns of a color row whose samples are all
+      // inside the source, 4 pixels at a time. Each pixel is widened with its
+      // right neighbor interleaved so that a multiply-add weights both of them.
+      static void RectifyRowBgra(const SRectifyEntry* pTable, const unsigned char* pSrc, MIL_INT SrcPitchByte,
+                                 unsigned char* pDstRow, MIL_INT y, MIL_INT StartX, MIL_INT EndX)
+         {
+         const __m128i Zero = _mm_setzero_si128();
+         const __m128i Round = _mm_set1_epi32(1 << (RECTIFY_WEIGHT_SHIFT - 1));
+         const __m128i Alpha = _mm_set1_epi32((int)0xFF000000);
+         MIL_INT x = StartX;
+         for(; x + 4 <= EndX; x += 4)
+            {
+            __m128i Sums[4];
+            for(MIL_INT PixelIdx = 0; PixelIdx < 4; PixelIdx++)
+               {
+               const SRectifyEntry& Entry = pTable[x + PixelIdx];
+               const unsigned char* pTop = pSrc + (y + Entry.OffsetY) * SrcPitchByte + Entry.SrcX * 4;
+               __m128i Top = _mm_loadl_epi64((const __m128i*)pTop);
+               __m128i Bottom = _mm_loadl_epi64((const __m128i*)(pTop + SrcPitchByte));
+               Top = _mm_unpacklo_epi8(_mm_unpacklo_epi8(Top, _mm_srli_si128(Top, 4)), Zero);
+               Bottom = _mm_unpacklo_epi8(_mm_unpacklo_epi8(Bottom, _mm_srli_si128(Bottom, 4)), Zero);
+               Sums[PixelIdx] = _mm_add_epi32(_mm_madd_epi16(Top, _mm_set1_epi32(Entry.WeightsTop)),
+                                              _mm_madd_epi16(Bottom, _mm_set1_epi32(Entry.WeightsBottom)));
+               Sums[PixelIdx] = _mm_srli_epi32(_mm_add_epi32(Sums[PixelIdx], Round), (int)RECTIFY_WEIGHT_SHIFT);
+               }
+            __m128i Pixels = _mm_packus_epi16(_mm_packs_epi32(Sums[0], Sums[1]), _mm_packs_epi32(Sums[2], Sums[3]));
+            _mm_storeu_si128((__m128i*)(pDstRow + x * 4), _mm_or_si128(Pixels, Alpha));
+            }
+         for(; x < EndX; x++)
+            SamplePixel(pTable[x], pSrc + (y + pTable[x].OffsetY) * SrcPitchByte, SrcPitchByte, 4, pDstRow + x * 4);
+         }
+
+      // Function that rectifies columns of a row whose samples can be out of the
+      // source. A sample whose top row is out of the source is black and one
+      // whose bottom row is out of it uses the top row only.
+      static void RectifyRowClamped(const SRectifyEntry* pTable, const unsigned char* pSrc, MIL_INT SrcSizeY, MIL_INT SrcPitchByte,
+                                    MIL_INT NbChannels, unsigned char* pDstRow, MIL_INT y, MIL_INT StartX, MIL_INT EndX)
+         {
+         for(MIL_INT x = StartX; x < EndX; x++)
+            {
+            const SRectifyEntry& Entry = pTable[x];
+            unsigned char* pDstPixel = pDstRow + x * NbChannels;
+            MIL_INT TopY = y + Entry.OffsetY;
+            if(TopY < 0 || TopY >= SrcSizeY)
+               {
+               memset(pDstPixel, 0, NbChannels);
+               if(NbChannels == 4)
+                  pDstPixel[3] = 255;
+               }
+            else
+               SamplePixel(Entry, pSrc + TopY * SrcPitchByte, TopY + 1 < SrcSizeY ? SrcPitchByte : 0, NbChannels, pDstPixel);
+            }
+         }
+
+      // Function that samples a pixel with the same fixed-point arithmetic as the SSE2 path.
+      static void SamplePixel(const SRectifyEntry& Entry, const unsigned char* pTopRow, MIL_INT BottomOffset, MIL_INT NbChannels, unsigned char* pDstPixel)
+         {
+         const unsigned char* pTop = pTopRow + Entry.SrcX * NbChannels;
+         const unsigned char* pBottom = pTop + BottomOffset;
+         MIL_INT WeightTopLeft = Entry.WeightsTop & 0xFFFF;
+         MIL_INT WeightTopRight = (Entry.WeightsTop >> 16) & 0xFFFF;
+         MIL_INT WeightBottomLeft = Entry.WeightsBottom & 0xFFFF;
+         MIL_INT WeightBottomRight = (Entry.WeightsBottom >> 16) & 0xFFFF;
+         for(MIL_INT c = 0; c < NbChannels; c++)
+            {
+            MIL_INT Sum = pTop[c] * WeightTopLeft + pTop[NbChannels + c] * WeightTopRight +
+                          pBottom[c] * WeightBottomLeft + pBottom[NbChannels + c] * WeightBottomRight;
+            pDstPixel[c] = (unsigned char)((Sum + (1 << (RECTIFY_WEIGHT_SHIFT - 1))) >> RECTIFY_WEIGHT_SHIFT);
+            }
+         if(NbChannels == 4)
+            pDstPixel[3] = 255;
+         }
+
+      SRectifyEntry* m_pTables[2];      // Left and right views.
+      MIL_INT32      m_MinOffsetY[2];
+      MIL_INT32      m_MaxOffsetY[2];
+      MIL_INT        m_SrcSizeX;
+      MIL_INT        m_SizeX;
+      MIL_INT        m_OriSizeX;
+      MIL_DOUBLE     m_dY;
+      bool           m_IsIdentity;
+      MIL_INT        m_NbBuilds;
+   };
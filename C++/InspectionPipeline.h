@@ -0,0 +1,869 @@
+﻿//***************************************************************************************/
+//
+// File name: InspectionPipeline.h
+//
+// Synopsis:  Contains the declarative inspection pipeline used by the
+//            Chromasens_3DPIXA_M10PP3 example. A pipeline is described by a
+//            text recipe where each line is a processing stage. The executor
+//            plans the lifetime of the intermediate buffers, aliases the ones
+//            that are never alive at the same time and runs the independent
+//            stages concurrently. Stages that support it are run in place
+//            and the memory and the time used by each stage are reported.
+//            The buffers are planned for the largest inputs and each run only
+//            processes the size of its inputs, for example a region of interest.
+//            The concurrent stages are run on the workers of a thread pool role
+//            when a pool is set, or on threads started for each level otherwise.
+//
+// Copyright © 1992-2024 Zebra Technologies Corp. and/or its affiliates
+// All Rights Reserved
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+//////////////////////////////////////////////////////////////////////////
+// Pipeline description syntax.
+//
+//    # Comment.
+//    input  <name> [<name> ...]
+//    <stage type> <output name> = <input name>[,<input name> ...] [<param>=<value> ...]
+//    output <name> [<name> ...]
+//
+// The stages must be listed after the stages that produce their inputs.
+// The buffers named in the output lines are kept until the end of the
+// run, all the other intermediate buffers can be aliased.
+//////////////////////////////////////////////////////////////////////////
+static const MIL_INT PIPELINE_MAX_NAME_LENGTH = 32;
+static const MIL_INT PIPELINE_MAX_STAGES      = 32;
+static const MIL_INT PIPELINE_MAX_BUFFERS     = 48;
+static const MIL_INT PIPELINE_MAX_INPUTS      = 4;
+static const MIL_INT PIPELINE_MAX_PARAMS      = 8;
+static const MIL_INT PIPELINE_MAX_RESULTS     = 4;
+static const MIL_INT PIPELINE_MAX_LINE_LENGTH = 256;
+
+// Format of the output buffer of a stage, relative to its first input.
+enum EPipelineOutputFormat
+   {
+   PIPELINE_OUTPUT_SAME,     // Same size and type as the first input.
+   PIPELINE_OUTPUT_MASK,     // Same size as the first input, 8-bit unsigned.
+   PIPELINE_OUTPUT_RESIZED   // First input resized by the "factor" parameter.
+   };
+
+struct SPipelineStage;
+typedef void (*PIPELINE_STAGE_FUNCTION)(SPipelineStage* pStage, void* pUserData);
+
+// Type of stage that can be used in a pipeline description. A stage that
+// supports in place operation must accept the same buffer as its first input
+// and its output. The scratch size is the number of bytes per pixel of the
+// first input that the stage allocates temporarily.
+struct SPipelineStageType
+   {
+   const char*             Name;
+   MIL_INT                 NbInputs;
+   EPipelineOutputFormat   OutputFormat;
+   PIPELINE_STAGE_FUNCTION Function;
+   bool                    InPlace;
+   MIL_INT                 ScratchBytesPerPixel;
+   };
+
+// Stage of a pipeline.
+struct SPipelineStage
+   {
+   const SPipelineStageType* pType;
+   MIL_INT    NbInputs;
+   MIL_INT    InputBuffers[PIPELINE_MAX_INPUTS];
+   MIL_INT    OutputBuffer;
+   MIL_INT    Level;
+
+   MIL_INT    NbParams;
+   char       ParamNames[PIPELINE_MAX_PARAMS][PIPELINE_MAX_NAME_LENGTH];
+   MIL_DOUBLE ParamValues[PIPELINE_MAX_PARAMS];
+
+   MIL_INT    NbResults;
+   char       ResultNames[PIPELINE_MAX_RESULTS][PIPELINE_MAX_NAME_LENGTH];
+   MIL_DOUBLE ResultValues[PIPELINE_MAX_RESULTS];
+
+   // Buffers resolved by the executor before the stage is called.
+   MIL_ID     MilInputs[PIPELINE_MAX_INPUTS];
+   MIL_ID     MilOutput;
+
+   // Data used by the executor to run the stage in a thread.
+   void*      pUserData;
+   MIL_DOUBLE RunTime;      // Duration of the last run, in seconds.
+   bool       Failed;       // Set by the stage, with FailStage(), to fail the run.
+   };
+
+// Logical buffer of a pipeline.
+struct SPipelineBuffer
+   {
+   char    Name[PIPELINE_MAX_NAME_LENGTH];
+   bool    IsInput;
+   bool    IsOutput;
+   MIL_INT FirstLevel;
+   MIL_INT LastLevel;
+   MIL_INT ProducerStage;
+
+   // Format of the buffer.
+   MIL_INT SizeX;
+   MIL_INT SizeY;
+   MIL_INT SizeBand;
+   MIL_INT Type;
+
+   // Physical buffer that holds the data.
+   MIL_INT PhysicalBuffer;
+
+   // Child of the physical buffer with the size of the last run.
+   MIL_INT RunSizeX;
+   MIL_INT RunSizeY;
+   MIL_ID  MilRunBuffer;
+   };
+
+// Physical buffer allocated by the executor.
+struct SPipelinePhysicalBuffer
+   {
+   MIL_ID  MilBuffer;
+   MIL_INT LastLevel;
+   MIL_INT SizeByte;
+   MIL_INT OwnerStage;
+   };
+
+//*****************************************************************************
+// GetStageParam. Returns the value of a stage parameter or its default value.
+//*****************************************************************************
+inline MIL_DOUBLE GetStageParam(const SPipelineStage* pStage, const char* Name, MIL_DOUBLE DefaultValue)
+   {
+   for(MIL_INT ParamIdx = 0; ParamIdx < pStage->NbParams; ParamIdx++)
+      {
+      if(strcmp(pStage->ParamNames[ParamIdx], Name) == 0)
+         return pStage->ParamValues[ParamIdx];
+      }
+   return DefaultValue;
+   }
+
+//*****************************************************************************
+// SetStageResult. Sets a scalar result of a stage.
+//*****************************************************************************
+inline void SetStageResult(SPipelineStage* pStage, const char* Name, MIL_DOUBLE Value)
+   {
+   for(MIL_INT ResultIdx = 0; ResultIdx < pStage->NbResults; ResultIdx++)
+      {
+      if(strcmp(pStage->ResultNames[ResultIdx], Name) == 0)
+         {
+         pStage->ResultValues[ResultIdx] = Value;
+         return;
+         }
+      }
+   if(pStage->NbResults < PIPELINE_MAX_RESULTS)
+      {
+      strncpy(pStage->ResultNames[pStage->NbResults], Name, PIPELINE_MAX_NAME_LENGTH - 1);
+      pStage->ResultNames[pStage->NbResults][PIPELINE_MAX_NAME_LENGTH - 1] = 0;
+      pStage->ResultValues[pStage->NbResults] = Value;
+      pStage->NbResults++;
+      }
+   }
+
+//*****************************************************************************
+// FailStage. Marks a stage as failed. The run stops after the level of the
+//            stage and returns false.
+//*****************************************************************************
+inline void FailStage(SPipelineStage* pStage)
+   {
+   pStage->Failed = true;
+   }
+
+//*****************************************************************************
+// PipelineStageThread. Thread function that runs a stage.
+//*****************************************************************************
+inline MIL_UINT32 MFTYPE PipelineStageThread(void* pStagePtr)
+   {
+   SPipelineStage* pStage = (SPipelineStage*)pStagePtr;
+   MIL_DOUBLE StartTime;
+   MIL_DOUBLE EndTime;
+   MappTimer(M_DEFAULT, M_TIMER_READ, &StartTime);
+   pStage->pType->Function(pStage, pStage->pUserData);
+   MappTimer(M_DEFAULT, M_TIMER_READ, &EndTime);
+   pStage->RunTime = EndTime - StartTime;
+   return 0;
+   }
+
+//*****************************************************************************
+// PipelineStageTask. Thread pool task that runs a stage.
+//*****************************************************************************
+inline void PipelineStageTask(void* pStagePtr)
+   {
+   PipelineStageThread(pStagePtr);
+   }
+
+//////////////////////////////////////////////////////////////////////////
+// Class that loads, plans and runs a pipeline description.
+//////////////////////////////////////////////////////////////////////////
+class CInspectionPipeline
+   {
+   public:
+      // Constructor. Sets the types of stages that can be used.
+      CInspectionPipeline(const SPipelineStageType* pStageTypes, MIL_INT NbStageTypes)
+         : m_pStageTypes(pStageTypes),
+           m_NbStageTypes(NbStageTypes),
+           m_NbStages(0),
+           m_NbBuffers(0),
+           m_NbPhysicalBuffers(0),
+           m_NbLevels(0),
+           m_pThreadPool(NULL),
+           m_ThreadPoolRole(0)
+         {
+         }
+
+      // Destructor. Frees the physical buffers.
+      virtual ~CInspectionPipeline()
+         {
+         FreeBuffers();
+         }
+
+      // Function that runs the concurrent stages on the workers of a thread pool
+      // role. The pool must outlive the runs.
+      void SetThreadPool(CPipelineThreadPool* pThreadPool, MIL_INT Role)
+         {
+         m_pThreadPool = pThreadPool;
+         m_ThreadPoolRole = Role;
+         }
+
+      // Function that loads a pipeline description file.
+      bool LoadFile(const char* FileName)
+         {
+         FILE* pFile = NULL;
+         if(fopen_s(&pFile, FileName, "r") != 0 || pFile == NULL)
+            return false;
+
+         char* pDescription = new char[PIPELINE_MAX_STAGES * PIPELINE_MAX_LINE_LENGTH];
+         size_t DescriptionLength = fread(pDescription, 1, PIPELINE_MAX_STAGES * PIPELINE_MAX_LINE_LENGTH - 1, pFile);
+         pDescription[DescriptionLength] = 0;
+         fclose(pFile);
+
+         bool Loaded = Load(pDescription);
+         delete [] pDescription;
+         return Loaded;
+         }
+
+      // Function that loads a pipeline description.
+      bool Load(const char* Description)
+         {
+         FreeBuffers();
+         m_NbStages = 0;
+         m_NbBuffers = 0;
+
+         MIL_INT LineNumber = 0;
+         const char* pLine = Description;
+         while(*pLine)
+            {
+            // Extract the line.
+            char Line[PIPELINE_MAX_LINE_LENGTH];
+            MIL_INT LineLength = 0;
+            while(pLine[LineLength] && pLine[LineLength] != '\n')
+               LineLength++;
+            MIL_INT CopyLength = LineLength < PIPELINE_MAX_LINE_LENGTH - 1 ? LineLength : PIPELINE_MAX_LINE_LENGTH - 1;
+            memcpy(Line, pLine, CopyLength);
+            Line[CopyLength] = 0;
+            pLine += pLine[LineLength] ? LineLength + 1 : LineLength;
+            LineNumber++;
+
+            if(!ParseLine(Line))
+               {
+               MosPrintf(MIL_TEXT("Pipeline: error at line %d.\n"), (int)LineNumber);
+               m_NbStages = 0;
+               m_NbBuffers = 0;
+               return false;
+               }
+            }
+         return m_NbStages > 0;
+         }
+
+      // Function that plans the buffer lifetimes and allocates the physical buffers.
+      // The input buffers given are used to get the format of the pipeline inputs.
+      bool Plan(MIL_ID MilSystem, const MIL_ID* pMilInputs, MIL_INT NbInputs)
+         {
+         FreeBuffers();
+
+         // Set the format of the inputs.
+         MIL_INT InputIdx = 0;
+         for(MIL_INT BufferIdx = 0; BufferIdx < m_NbBuffers; BufferIdx++)
+            {
+            SPipelineBuffer& Buffer = m_Buffers[BufferIdx];
+            Buffer.PhysicalBuffer = -1;
+            if(!Buffer.IsInput)
+               continue;
+            if(InputIdx >= NbInputs)
+               {
+               MosPrintf(MIL_TEXT("Pipeline: missing input buffer.\n"));
+               return false;
+               }
+            SetBufferFormat(Buffer, pMilInputs[InputIdx++]);
+            Buffer.FirstLevel = 0;
+            Buffer.LastLevel = 0;
+            }
+
+         // Compute the level of each stage. Stages of the same level are independent.
+         m_NbLevels = 1;
+         for(MIL_INT StageIdx = 0; StageIdx < m_NbStages; StageIdx++)
+            {
+            SPipelineStage& Stage = m_Stages[StageIdx];
+            Stage.Level = 1;
+            for(MIL_INT StageInputIdx = 0; StageInputIdx < Stage.NbInputs; StageInputIdx++)
+               {
+               const SPipelineBuffer& Input = m_Buffers[Stage.InputBuffers[StageInputIdx]];
+               if(Input.FirstLevel + 1 > Stage.Level)
+                  Stage.Level = Input.FirstLevel + 1;
+               }
+
+            // Set the output format.
+            SPipelineBuffer& Output = m_Buffers[Stage.OutputBuffer];
+            const SPipelineBuffer& FirstInput = m_Buffers[Stage.InputBuffers[0]];
+            Output.SizeBand = FirstInput.SizeBand;
+            Output.Type = FirstInput.Type;
+            if(Stage.pType->OutputFormat == PIPELINE_OUTPUT_MASK)
+               {
+               Output.SizeBand = 1;
+               Output.Type = 8+M_UNSIGNED;
+               }
+            GetOutputSize(Stage, FirstInput.SizeX, FirstInput.SizeY, &Output.SizeX, &Output.SizeY);
+            Output.FirstLevel = Stage.Level;
+            Output.LastLevel = Stage.Level;
+            Output.ProducerStage = StageIdx;
+
+            if(Stage.Level + 1 > m_NbLevels)
+               m_NbLevels = Stage.Level + 1;
+            }
+
+         // Extend the lifetime of the buffers up to their last use.
+         for(MIL_INT StageIdx = 0; StageIdx < m_NbStages; StageIdx++)
+            {
+            const SPipelineStage& Stage = m_Stages[StageIdx];
+            for(MIL_INT StageInputIdx = 0; StageInputIdx < Stage.NbInputs; StageInputIdx++)
+               {
+               SPipelineBuffer& Input = m_Buffers[Stage.InputBuffers[StageInputIdx]];
+               if(Stage.Level > Input.LastLevel)
+                  Input.LastLevel = Stage.Level;
+               }
+            }
+         for(MIL_INT BufferIdx = 0; BufferIdx < m_NbBuffers; BufferIdx++)
+            {
+            if(m_Buffers[BufferIdx].IsOutput)
+               m_Buffers[BufferIdx].LastLevel = m_NbLevels;
+            }
+
+         // Assign the physical buffers, in order of first level. A stage that supports it
+         // writes in the buffer of its first input when it is the only reader of that input.
+         // Otherwise, a physical buffer is reused when the format matches and its previous
+         // logical buffer is dead before the first level of the new one.
+         for(MIL_INT Level = 1; Level < m_NbLevels; Level++)
+            {
+            for(MIL_INT BufferIdx = 0; BufferIdx < m_NbBuffers; BufferIdx++)
+               {
+               SPipelineBuffer& Buffer = m_Buffers[BufferIdx];
+               if(Buffer.IsInput || Buffer.FirstLevel != Level)
+                  continue;
+
+               const SPipelineStage& Producer = m_Stages[Buffer.ProducerStage];
+               const SPipelineBuffer& FirstInput = m_Buffers[Producer.InputBuffers[0]];
+               if(Producer.pType->InPlace &&
+                  !FirstInput.IsInput &&
+                  FirstInput.LastLevel == Level &&
+                  GetNbReaders(Producer.InputBuffers[0]) == 1 &&
+                  HasSameFormat(m_PhysicalBuffers[FirstInput.PhysicalBuffer].MilBuffer, Buffer))
+                  {
+                  Buffer.PhysicalBuffer = FirstInput.PhysicalBuffer;
+                  m_PhysicalBuffers[Buffer.PhysicalBuffer].LastLevel = Buffer.LastLevel;
+                  continue;
+                  }
+
+               for(MIL_INT PhysicalIdx = 0; PhysicalIdx < m_NbPhysicalBuffers && Buffer.PhysicalBuffer < 0; PhysicalIdx++)
+                  {
+                  SPipelinePhysicalBuffer& Physical = m_PhysicalBuffers[PhysicalIdx];
+                  if(Physical.LastLevel < Buffer.FirstLevel && HasSameFormat(Physical.MilBuffer, Buffer))
+                     {
+                     Buffer.PhysicalBuffer = PhysicalIdx;
+                     Physical.LastLevel = Buffer.LastLevel;
+                     }
+                  }
+
+               if(Buffer.PhysicalBuffer < 0)
+                  {
+                  if(m_NbPhysicalBuffers == PIPELINE_MAX_BUFFERS)
+                     {
+                     MosPrintf(MIL_TEXT("Pipeline: too many buffers.\n"));
+                     return false;
+                     }
+                  SPipelinePhysicalBuffer& Physical = m_PhysicalBuffers[m_NbPhysicalBuffers];
+                  MbufAllocColor(MilSystem, Buffer.SizeBand, Buffer.SizeX, Buffer.SizeY, Buffer.Type, M_IMAGE + M_PROC + M_DISP, &Physical.MilBuffer);
+                  Physical.LastLevel = Buffer.LastLevel;
+                  Physical.SizeByte = GetBufferBytes(Buffer);
+                  Physical.OwnerStage = Buffer.ProducerStage;
+                  Buffer.PhysicalBuffer = m_NbPhysicalBuffers++;
+                  }
+               }
+            }
+         return true;
+         }
+
+      // Function that runs the pipeline on the inputs. The inputs can be smaller
+      // than the ones used to plan the pipeline. The stages of the same level are
+      // run concurrently. Returns false if a stage failed.
+      bool Run(const MIL_ID* pMilInputs, MIL_INT NbInputs, void* pUserData)
+         {
+         // Allocate the children of the physical buffers with the size of the inputs.
+         FreeRunBuffers();
+         for(MIL_INT BufferIdx = 0; BufferIdx < m_NbBuffers; BufferIdx++)
+            {
+            SPipelineBuffer& Buffer = m_Buffers[BufferIdx];
+            if(Buffer.IsInput)
+               {
+               MIL_ID MilInput = GetMilBuffer(BufferIdx, pMilInputs, NbInputs);
+               if(MilInput == M_NULL)
+                  return false;
+               Buffer.RunSizeX = MbufInquire(MilInput, M_SIZE_X, M_NULL);
+               Buffer.RunSizeY = MbufInquire(MilInput, M_SIZE_Y, M_NULL);
+               continue;
+               }
+            const SPipelineStage& Producer = m_Stages[Buffer.ProducerStage];
+            const SPipelineBuffer& FirstInput = m_Buffers[Producer.InputBuffers[0]];
+            GetOutputSize(Producer, FirstInput.RunSizeX, FirstInput.RunSizeY, &Buffer.RunSizeX, &Buffer.RunSizeY);
+            if(Buffer.PhysicalBuffer < 0 || Buffer.RunSizeX > Buffer.SizeX || Buffer.RunSizeY > Buffer.SizeY || Buffer.RunSizeX < 1 || Buffer.RunSizeY < 1)
+               {
+               MosPrintf(MIL_TEXT("Pipeline: the inputs do not fit in the planned buffers.\n"));
+               FreeRunBuffers();
+               return false;
+               }
+            MbufChild2d(m_PhysicalBuffers[Buffer.PhysicalBuffer].MilBuffer, 0, 0, Buffer.RunSizeX, Buffer.RunSizeY, &Buffer.MilRunBuffer);
+            }
+
+         // Resolve the MIL buffers of the stages.
+         for(MIL_INT StageIdx = 0; StageIdx < m_NbStages; StageIdx++)
+            {
+            SPipelineStage& Stage = m_Stages[StageIdx];
+            for(MIL_INT StageInputIdx = 0; StageInputIdx < Stage.NbInputs; StageInputIdx++)
+               Stage.MilInputs[StageInputIdx] = GetMilBuffer(Stage.InputBuffers[StageInputIdx], pMilInputs, NbInputs);
+            Stage.MilOutput = GetMilBuffer(Stage.OutputBuffer, pMilInputs, NbInputs);
+            Stage.NbResults = 0;
+            Stage.pUserData = pUserData;
+            Stage.RunTime = 0.0;
+            Stage.Failed = false;
+            if(Stage.MilOutput == M_NULL)
+               return false;
+            }
+
+         bool UseThreadPool = m_pThreadPool && m_pThreadPool->GetNbWorkers(m_ThreadPoolRole) > 0;
+         for(MIL_INT Level = 1; Level < m_NbLevels && UseThreadPool && !HasFailedStage(); Level++)
+            {
+            // Queue all the stages of the level in the pool and wait for them.
+            CThreadPoolBatch LevelBatch;
+            for(MIL_INT StageIdx = 0; StageIdx < m_NbStages; StageIdx++)
+               {
+               if(m_Stages[StageIdx].Level == Level)
+                  m_pThreadPool->Submit(m_ThreadPoolRole, PipelineStageTask, &m_Stages[StageIdx], &LevelBatch);
+               }
+            LevelBatch.Wait();
+            }
+         for(MIL_INT Level = 1; Level < m_NbLevels && !UseThreadPool && !HasFailedStage(); Level++)
+            {
+            // Start a thread for all the stages of the level except the last one,
+            // which is run in the calling thread.
+            MIL_ID MilThreads[PIPELINE_MAX_STAGES];
+            MIL_INT NbThreads = 0;
+            SPipelineStage* pLocalStage = NULL;
+            for(MIL_INT StageIdx = 0; StageIdx < m_NbStages; StageIdx++)
+               {
+               SPipelineStage& Stage = m_Stages[StageIdx];
+               if(Stage.Level != Level)
+                  continue;
+               if(pLocalStage)
+                  {
+                  MIL_ID MilSystem = MbufInquire(pLocalStage->MilOutput, M_OWNER_SYSTEM, M_NULL);
+                  MilThreads[NbThreads++] = MthrAlloc(MilSystem, M_THREAD, M_DEFAULT, PipelineStageThread, pLocalStage, M_NULL);
+                  }
+               pLocalStage = &Stage;
+               }
+            if(pLocalStage)
+               PipelineStageThread(pLocalStage);
+
+            // Wait for the other stages of the level.
+            for(MIL_INT ThreadIdx = 0; ThreadIdx < NbThreads; ThreadIdx++)
+               {
+               MthrWait(MilThreads[ThreadIdx], M_THREAD_END_WAIT, M_NULL);
+               MthrFree(MilThreads[ThreadIdx]);
+               }
+            }
+         return !HasFailedStage();
+         }
+
+      // Function that returns the MIL buffer of a named pipeline buffer, with the
+      // size of the last run. Only the outputs are guaranteed to hold their data
+      // after a run.
+      MIL_ID GetBuffer(const char* Name) const
+         {
+         MIL_INT BufferIdx = FindBuffer(Name);
+         if(BufferIdx < 0 || m_Buffers[BufferIdx].IsInput)
+            return M_NULL;
+         return m_Buffers[BufferIdx].MilRunBuffer;
+         }
+
+      // Function that returns a scalar result, named "<stage output name>.<result name>".
+      bool GetResult(const char* Name, MIL_DOUBLE* pValue) const
+         {
+         for(MIL_INT StageIdx = 0; StageIdx < m_NbStages; StageIdx++)
+            {
+            const SPipelineStage& Stage = m_Stages[StageIdx];
+            const char* OutputName = m_Buffers[Stage.OutputBuffer].Name;
+            size_t OutputNameLength = strlen(OutputName);
+            if(strncmp(Name, OutputName, OutputNameLength) != 0 || Name[OutputNameLength] != '.')
+               continue;
+            for(MIL_INT ResultIdx = 0; ResultIdx < Stage.NbResults; ResultIdx++)
+               {
+               if(strcmp(Name + OutputNameLength + 1, Stage.ResultNames[ResultIdx]) == 0)
+                  {
+                  *pValue = Stage.ResultValues[ResultIdx];
+                  return true;
+                  }
+               }
+            }
+         return false;
+         }
+
+      // Function that returns the number of stages.
+      MIL_INT GetNbStages() const {return m_NbStages;}
+
+      // Function that returns the output name of a stage, which identifies it.
+      const char* GetStageName(MIL_INT StageIdx) const {return m_Buffers[m_Stages[StageIdx].OutputBuffer].Name;}
+
+      // Function that returns the duration of a stage in the last run, in seconds.
+      MIL_DOUBLE GetStageTime(MIL_INT StageIdx) const {return m_Stages[StageIdx].RunTime;}
+
+      // Function that prints the buffer plan.
+      void PrintPlan() const
+         {
+         MIL_INT LogicalBytes = 0;
+         MIL_INT PhysicalBytes = 0;
+         MosPrintf(MIL_TEXT("Pipeline: %d stages in %d levels.\n"), (int)m_NbStages, (int)(m_NbLevels - 1));
+         for(MIL_INT BufferIdx = 0; BufferIdx < m_NbBuffers; BufferIdx++)
+            {
+            const SPipelineBuffer& Buffer = m_Buffers[BufferIdx];
+            if(Buffer.IsInput)
+               continue;
+            LogicalBytes += GetBufferBytes(Buffer);
+            MosPrintf(MIL_TEXT("   %-16hs levels %d-%d -> buffer %d\n"), Buffer.Name, (int)Buffer.FirstLevel, (int)Buffer.LastLevel, (int)Buffer.PhysicalBuffer);
+            }
+         for(MIL_INT PhysicalIdx = 0; PhysicalIdx < m_NbPhysicalBuffers; PhysicalIdx++)
+            PhysicalBytes += MbufInquire(m_PhysicalBuffers[PhysicalIdx].MilBuffer, M_SIZE_BYTE, M_NULL);
+         MosPrintf(MIL_TEXT("Pipeline: %.1f MB of intermediate data held in %.1f MB of buffers.\n\n"),
+                   LogicalBytes / 1048576.0, PhysicalBytes / 1048576.0);
+         }
+
+      // Function that returns the memory high-water mark of a run, in bytes. It is
+      // the maximum, over the levels, of the live pipeline buffers and of the scratch
+      // memory of the stages running concurrently. The inputs are not included.
+      MIL_INT GetHighWaterMark() const
+         {
+         MIL_INT HighWaterMark = 0;
+         for(MIL_INT Level = 1; Level < m_NbLevels; Level++)
+            {
+            MIL_INT LevelBytes = GetLiveBytes(Level);
+            for(MIL_INT StageIdx = 0; StageIdx < m_NbStages; StageIdx++)
+               {
+               if(m_Stages[StageIdx].Level == Level)
+                  LevelBytes += GetScratchBytes(StageIdx);
+               }
+            if(LevelBytes > HighWaterMark)
+               HighWaterMark = LevelBytes;
+            }
+         return HighWaterMark;
+         }
+
+      // Function that prints the memory allocated by each stage and the high-water mark.
+      void PrintMemoryReport() const
+         {
+         MosPrintf(MIL_TEXT("   Stage        Output           Buffer (MB)  Scratch (MB)\n"));
+         for(MIL_INT StageIdx = 0; StageIdx < m_NbStages; StageIdx++)
+            {
+            const SPipelineStage& Stage = m_Stages[StageIdx];
+            const SPipelineBuffer& Output = m_Buffers[Stage.OutputBuffer];
+            bool IsInPlace = Output.PhysicalBuffer == m_Buffers[Stage.InputBuffers[0]].PhysicalBuffer;
+            MIL_INT BufferBytes = 0;
+            if(m_PhysicalBuffers[Output.PhysicalBuffer].OwnerStage == StageIdx)
+               BufferBytes = m_PhysicalBuffers[Output.PhysicalBuffer].SizeByte;
+            MosPrintf(MIL_TEXT("   %-12hs %-16hs %8.1f %s  %8.1f\n"),
+                      Stage.pType->Name,
+                      Output.Name,
+                      BufferBytes / 1048576.0,
+                      IsInPlace ? MIL_TEXT("(in place)") : BufferBytes ? MIL_TEXT("          ") : MIL_TEXT("(reused)  "),
+                      GetScratchBytes(StageIdx) / 1048576.0);
+            }
+         MosPrintf(MIL_TEXT("Pipeline: memory high-water mark of %.1f MB per scan.\n\n"), GetHighWaterMark() / 1048576.0);
+         }
+
+   private:
+      // Function that returns the number of stages that read a buffer.
+      MIL_INT GetNbReaders(MIL_INT BufferIdx) const
+         {
+         MIL_INT NbReaders = 0;
+         for(MIL_INT StageIdx = 0; StageIdx < m_NbStages; StageIdx++)
+            {
+            for(MIL_INT StageInputIdx = 0; StageInputIdx < m_Stages[StageIdx].NbInputs; StageInputIdx++)
+               {
+               if(m_Stages[StageIdx].InputBuffers[StageInputIdx] == BufferIdx)
+                  NbReaders++;
+               }
+            }
+         return NbReaders;
+         }
+
+      // Function that returns the bytes of the physical buffers alive at a level.
+      MIL_INT GetLiveBytes(MIL_INT Level) const
+         {
+         MIL_INT LiveBytes = 0;
+         for(MIL_INT PhysicalIdx = 0; PhysicalIdx < m_NbPhysicalBuffers; PhysicalIdx++)
+            {
+            for(MIL_INT BufferIdx = 0; BufferIdx < m_NbBuffers; BufferIdx++)
+               {
+               const SPipelineBuffer& Buffer = m_Buffers[BufferIdx];
+               if(Buffer.PhysicalBuffer == PhysicalIdx && Buffer.FirstLevel <= Level && Level <= Buffer.LastLevel)
+                  {
+                  LiveBytes += m_PhysicalBuffers[PhysicalIdx].SizeByte;
+                  break;
+                  }
+               }
+            }
+         return LiveBytes;
+         }
+
+      // Function that returns the scratch bytes of a stage.
+      MIL_INT GetScratchBytes(MIL_INT StageIdx) const
+         {
+         const SPipelineStage& Stage = m_Stages[StageIdx];
+         const SPipelineBuffer& FirstInput = m_Buffers[Stage.InputBuffers[0]];
+         return FirstInput.SizeX * FirstInput.SizeY * Stage.pType->ScratchBytesPerPixel;
+         }
+
+      // Function that parses a line of the description.
+      bool ParseLine(char* Line)
+         {
+         // Remove the comment and split the line in tokens.
+         char* pComment = strchr(Line, '#');
+         if(pComment)
+            *pComment = 0;
+         char* Tokens[PIPELINE_MAX_PARAMS + 4];
+         MIL_INT NbTokens = 0;
+         for(char* pChar = Line; *pChar && NbTokens < PIPELINE_MAX_PARAMS + 4; )
+            {
+            while(*pChar == ' ' || *pChar == '\t' || *pChar == '\r')
+               *pChar++ = 0;
+            if(!*pChar)
+               break;
+            Tokens[NbTokens++] = pChar;
+            while(*pChar && *pChar != ' ' && *pChar != '\t' && *pChar != '\r')
+               pChar++;
+            }
+         if(NbTokens == 0)
+            return true;
+
+         // Input and output declarations.
+         bool IsInputLine = strcmp(Tokens[0], "input") == 0;
+         if(IsInputLine || strcmp(Tokens[0], "output") == 0)
+            {
+            for(MIL_INT TokenIdx = 1; TokenIdx < NbTokens; TokenIdx++)
+               {
+               MIL_INT BufferIdx = IsInputLine ? AddBuffer(Tokens[TokenIdx]) : FindBuffer(Tokens[TokenIdx]);
+               if(BufferIdx < 0)
+                  return false;
+               if(IsInputLine)
+                  m_Buffers[BufferIdx].IsInput = true;
+               else
+                  m_Buffers[BufferIdx].IsOutput = true;
+               }
+            return true;
+            }
+
+         // Stage declaration.
+         if(NbTokens < 4 || strcmp(Tokens[2], "=") != 0 || m_NbStages == PIPELINE_MAX_STAGES)
+            return false;
+         SPipelineStage& Stage = m_Stages[m_NbStages];
+         Stage.pType = NULL;
+         for(MIL_INT TypeIdx = 0; TypeIdx < m_NbStageTypes; TypeIdx++)
+            {
+            if(strcmp(m_pStageTypes[TypeIdx].Name, Tokens[0]) == 0)
+               Stage.pType = &m_pStageTypes[TypeIdx];
+            }
+         if(!Stage.pType)
+            return false;
+
+         // Inputs, separated by commas.
+         Stage.NbInputs = 0;
+         for(char* pInput = Tokens[3]; pInput; )
+            {
+            char* pNext = strchr(pInput, ',');
+            if(pNext)
+               *pNext++ = 0;
+            MIL_INT BufferIdx = FindBuffer(pInput);
+            if(BufferIdx < 0 || Stage.NbInputs == PIPELINE_MAX_INPUTS)
+               return false;
+            Stage.InputBuffers[Stage.NbInputs++] = BufferIdx;
+            pInput = pNext;
+            }
+         if(Stage.NbInputs != Stage.pType->NbInputs)
+            return false;
+
+         // Parameters.
+         Stage.NbParams = 0;
+         for(MIL_INT TokenIdx = 4; TokenIdx < NbTokens; TokenIdx++)
+            {
+            char* pValue = strchr(Tokens[TokenIdx], '=');
+            if(!pValue || Stage.NbParams == PIPELINE_MAX_PARAMS)
+               return false;
+            *pValue++ = 0;
+            strncpy(Stage.ParamNames[Stage.NbParams], Tokens[TokenIdx], PIPELINE_MAX_NAME_LENGTH - 1);
+            Stage.ParamNames[Stage.NbParams][PIPELINE_MAX_NAME_LENGTH - 1] = 0;
+            Stage.ParamValues[Stage.NbParams] = atof(pValue);
+            Stage.NbParams++;
+            }
+
+         // Output. Each buffer is produced by a single stage.
+         if(FindBuffer(Tokens[1]) >= 0)
+            return false;
+         Stage.OutputBuffer = AddBuffer(Tokens[1]);
+         if(Stage.OutputBuffer < 0)
+            return false;
+         Stage.NbResults = 0;
+         m_NbStages++;
+         return true;
+         }
+
+      // Function that adds a logical buffer.
+      MIL_INT AddBuffer(const char* Name)
+         {
+         if(m_NbBuffers == PIPELINE_MAX_BUFFERS)
+            return -1;
+         SPipelineBuffer& Buffer = m_Buffers[m_NbBuffers];
+         strncpy(Buffer.Name, Name, PIPELINE_MAX_NAME_LENGTH - 1);
+         Buffer.Name[PIPELINE_MAX_NAME_LENGTH - 1] = 0;
+         Buffer.IsInput = false;
+         Buffer.IsOutput = false;
+         Buffer.FirstLevel = 0;
+         Buffer.LastLevel = 0;
+         Buffer.ProducerStage = -1;
+         Buffer.PhysicalBuffer = -1;
+         Buffer.MilRunBuffer = M_NULL;
+         return m_NbBuffers++;
+         }
+
+      // Function that returns true if a stage of the last run failed.
+      bool HasFailedStage() const
+         {
+         for(MIL_INT StageIdx = 0; StageIdx < m_NbStages; StageIdx++)
+            {
+            if(m_Stages[StageIdx].Failed)
+               return true;
+            }
+         return false;
+         }
+
+      // Function that finds a logical buffer by name.
+      MIL_INT FindBuffer(const char* Name) const
+         {
+         for(MIL_INT BufferIdx = 0; BufferIdx < m_NbBuffers; BufferIdx++)
+            {
+            if(strcmp(m_Buffers[BufferIdx].Name, Name) == 0)
+               return BufferIdx;
+            }
+         return -1;
+         }
+
+      // Function that returns the MIL buffer of a logical buffer.
+      MIL_ID GetMilBuffer(MIL_INT BufferIdx, const MIL_ID* pMilInputs, MIL_INT NbInputs) const
+         {
+         const SPipelineBuffer& Buffer = m_Buffers[BufferIdx];
+         if(Buffer.IsInput)
+            {
+            MIL_INT InputIdx = 0;
+            for(MIL_INT OtherIdx = 0; OtherIdx < BufferIdx; OtherIdx++)
+               {
+               if(m_Buffers[OtherIdx].IsInput)
+                  InputIdx++;
+               }
+            return InputIdx < NbInputs ? pMilInputs[InputIdx] : M_NULL;
+            }
+         return Buffer.MilRunBuffer;
+         }
+
+      // Function that returns the output size of a stage for a given first input size.
+      static void GetOutputSize(const SPipelineStage& Stage, MIL_INT InputSizeX, MIL_INT InputSizeY, MIL_INT* pSizeX, MIL_INT* pSizeY)
+         {
+         *pSizeX = InputSizeX;
+         *pSizeY = InputSizeY;
+         if(Stage.pType->OutputFormat == PIPELINE_OUTPUT_RESIZED)
+            {
+            MIL_DOUBLE Factor = GetStageParam(&Stage, "factor", 1.0);
+            *pSizeX = (MIL_INT)(InputSizeX * Factor);
+            *pSizeY = (MIL_INT)(InputSizeY * Factor);
+            }
+         }
+
+      // Function that sets the format of a logical buffer from a MIL buffer.
+      static void SetBufferFormat(SPipelineBuffer& Buffer, MIL_ID MilBuffer)
+         {
+         Buffer.SizeX = MbufInquire(MilBuffer, M_SIZE_X, M_NULL);
+         Buffer.SizeY = MbufInquire(MilBuffer, M_SIZE_Y, M_NULL);
+         Buffer.SizeBand = MbufInquire(MilBuffer, M_SIZE_BAND, M_NULL);
+         Buffer.Type = MbufInquire(MilBuffer, M_TYPE, M_NULL);
+         }
+
+      // Function that checks if a MIL buffer has the format of a logical buffer.
+      static bool HasSameFormat(MIL_ID MilBuffer, const SPipelineBuffer& Buffer)
+         {
+         return MbufInquire(MilBuffer, M_SIZE_X, M_NULL) == Buffer.SizeX &&
+                MbufInquire(MilBuffer, M_SIZE_Y, M_NULL) == Buffer.SizeY &&
+                MbufInquire(MilBuffer, M_SIZE_BAND, M_NULL) == Buffer.SizeBand &&
+                MbufInquire(MilBuffer, M_TYPE, M_NULL) == Buffer.Type;
+         }
+
+      // Function that returns the number of bytes of a logical buffer.
+      static MIL_INT GetBufferBytes(const SPipelineBuffer& Buffer)
+         {
+         return Buffer.SizeX * Buffer.SizeY * Buffer.SizeBand * (((Buffer.Type & 0xFF) + 7) / 8);
+         }
+
+      // Function that frees the children of the last run.
+      void FreeRunBuffers()
+         {
+         for(MIL_INT BufferIdx = 0; BufferIdx < m_NbBuffers; BufferIdx++)
+            {
+            if(m_Buffers[BufferIdx].MilRunBuffer != M_NULL)
+               {
+               MbufFree(m_Buffers[BufferIdx].MilRunBuffer);
+               m_Buffers[BufferIdx].MilRunBuffer = M_NULL;
+               }
+            }
+         }
+
+      // Function that frees the physical buffers.
+      void FreeBuffers()
+         {
+         FreeRunBuffers();
+         for(MIL_INT PhysicalIdx = 0; PhysicalIdx < m_NbPhysicalBuffers; PhysicalIdx++)
+            MbufFree(m_PhysicalBuffers[PhysicalIdx].MilBuffer);
+         m_NbPhysicalBuffers = 0;
+         }
+
+      const SPipelineStageType* m_pStageTypes;
+      MIL_INT                   m_NbStageTypes;
+
+      SPipelineStage            m_Stages[PIPELINE_MAX_STAGES];
+      MIL_INT                   m_NbStages;
+
+      SPipelineBuffer           m_Buffers[PIPELINE_MAX_BUFFERS];
+      MIL_INT                   m_NbBuffers;
+
+      SPipelinePhysicalBuffer   m_PhysicalBuffers[PIPELINE_MAX_BUFFERS];
+      MIL_INT                   m_NbPhysicalBuffers;
+
+      MIL_INT                   m_NbLevels;
+
+      CPipelineThreadPool*      m_pThreadPool;
+      MIL_INT                   m_ThreadPoolRole;
+   };
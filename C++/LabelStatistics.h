@@ -0,0 +1,312 @@
+﻿//***************************************************************************************/
+//
+// File name: LabelStatistics.h
+//
+// Synopsis:  Contains the per-label reduction engine used by the Chromasens_3DPIXA_M10PP3
+//            example to get the statistics of the regions of a 16-bit label
+//            image, such as the zones of influence of the peaks, over a 16-bit
+//            value image, without a blob analysis.
+//
+//            The rows are split in bands reduced by the workers of a thread
+//            pool, each in its own table indexed by the label, so that the
+//            pixels are read once and without synchronization. The tables are
+//            merged in band order at the end, which keeps the first position of
+//            the minimum and of the maximum in raster order. Without a pool, or
+//            when called from one of its workers, the rows are reduced serially.
+//            Label 0 is the background.
+//
+// Copyright © 1992-2024 Zebra Technologies Corp. and/or its affiliates
+// All Rights Reserved
+
+#include <string.h>
+
+static const MIL_INT LABEL_STATISTICS_MAX_BANDS     = 32;
+static const MIL_INT LABEL_STATISTICS_MIN_BAND_ROWS = 32;
+
+// Statistics of the pixels of a label.
+struct SLabelStatistics
+   {
+   MIL_INT    Count;
+   MIL_INT64  Sum;
+   MIL_UINT16 Min;
+   MIL_UINT16 Max;
+   MIL_INT32  MinX;      // First position of the minimum, in raster order.
+   MIL_INT32  MinY;
+   MIL_INT32  MaxX;      // First position of the maximum, in raster order.
+   MIL_INT32  MaxY;
+   MIL_INT32  BoxMinX;
+   MIL_INT32  BoxMinY;
+   MIL_INT32  BoxMaxX;
+   MIL_INT32  BoxMaxY;
+   };
+
+class CLabelStatistics;
+
+// Band of rows reduced by a worker, with its partial table.
+struct SLabelStatisticsBand
+   {
+   CLabelStatistics*  pEngine;
+   MIL_INT            StartY;
+   MIL_INT            EndY;
+   SLabelStatistics*  pTable;         // Indexed by the label.
+   MIL_INT            TableSize;
+   MIL_INT            NbOutOfRange;   // Pixels of a label above the maximum label.
+   };
+
+//////////////////////////////////////////////////////////////////////////
+// Class that calculates the statistics of each label of a label image.
+//////////////////////////////////////////////////////////////////////////
+class CLabelStatistics
+   {
+   public:
+      // Constructor.
+      CLabelStatistics()
+         : m_pLabels(NULL),
+           m_LabelPitch(0),
+           m_pValues(NULL),
+           m_ValuePitch(0),
+           m_SizeX(0),
+           m_MaxLabel(0),
+           m_NbLabels(0),
+           m_NbOutOfRange(0),
+           m_pThreadPool(NULL),
+           m_ThreadPoolRole(0),
+           m_NbBands(0)
+         {
+         memset(m_Bands, 0, sizeof(m_Bands));
+         }
+
+      // Destructor.
+      virtual ~CLabelStatistics()
+         {
+         for(MIL_INT BandIdx = 0; BandIdx < LABEL_STATISTICS_MAX_BANDS; BandIdx++)
+            delete [] m_Bands[BandIdx].pTable;
+         }
+
+      // Function that sets the pool whose workers reduce the bands, NULL to
+      // reduce the rows serially.
+      void SetThreadPool(CPipelineThreadPool* pThreadPool, MIL_INT Role)
+         {
+         m_pThreadPool = pThreadPool;
+         m_ThreadPoolRole = Role;
+         }
+
+      // Function that calculates the statistics of the labels 1 to MaxLabel of
+      // the label image over the value image. The pitches are in pixels. Returns
+      // the number of labels that have pixels.
+      MIL_INT Calculate(const MIL_UINT16* pLabels, MIL_INT LabelPitch, const MIL_UINT16* pValues, MIL_INT ValuePitch,
+                        MIL_INT SizeX, MIL_INT SizeY, MIL_INT MaxLabel)
+         {
+         m_pLabels = pLabels;
+         m_LabelPitch = LabelPitch;
+         m_pValues = pValues;
+         m_ValuePitch = ValuePitch;
+         m_SizeX = SizeX;
+         m_MaxLabel = MaxLabel > 0 ? MaxLabel : 0;
+
+         // Split the rows in bands, one per worker of the pool, each with a table
+         // of all the labels. A worker of the pool reduces the rows serially.
+         bool UseThreadPool = m_pThreadPool && m_pThreadPool->GetNbWorkers(m_ThreadPoolRole) > 0 && !m_pThreadPool->IsWorkerThread();
+         m_NbBands = UseThreadPool ? m_pThreadPool->GetNbWorkers(m_ThreadPoolRole) : 1;
+         if(m_NbBands > LABEL_STATISTICS_MAX_BANDS)
+            m_NbBands = LABEL_STATISTICS_MAX_BANDS;
+         if(m_NbBands > SizeY / LABEL_STATISTICS_MIN_BAND_ROWS)
+            m_NbBands = SizeY / LABEL_STATISTICS_MIN_BAND_ROWS;
+         if(m_NbBands < 1)
+            m_NbBands = 1;
+         for(MIL_INT BandIdx = 0; BandIdx < m_NbBands; BandIdx++)
+            {
+            SLabelStatisticsBand& Band = m_Bands[BandIdx];
+            Band.pEngine = this;
+            Band.StartY = SizeY * BandIdx / m_NbBands;
+            Band.EndY = SizeY * (BandIdx + 1) / m_NbBands;
+            if(Band.TableSize < m_MaxLabel + 1)
+               {
+               delete [] Band.pTable;
+               Band.pTable = new SLabelStatistics[m_MaxLabel + 1];
+               Band.TableSize = m_MaxLabel + 1;
+               }
+            }
+         RunBands();
+
+         // Merge the tables of the bands in the one of the first band.
+         SLabelStatistics* pTable = m_Bands[0].pTable;
+         m_NbOutOfRange = m_Bands[0].NbOutOfRange;
+         for(MIL_INT BandIdx = 1; BandIdx < m_NbBands; BandIdx++)
+            {
+            const SLabelStatistics* pBandTable = m_Bands[BandIdx].pTable;
+            for(MIL_INT Label = 1; Label <= m_MaxLabel; Label++)
+               Merge(&pTable[Label], pBandTable[Label]);
+            m_NbOutOfRange += m_Bands[BandIdx].NbOutOfRange;
+            }
+         m_NbLabels = 0;
+         for(MIL_INT Label = 1; Label <= m_MaxLabel; Label++)
+            {
+            if(pTable[Label].Count > 0)
+               m_NbLabels++;
+            }
+         return m_NbLabels;
+         }
+
+      // Function that returns the statistics of a label, from 1 to the maximum
+      // label. The count of a label without pixels is 0.
+      const SLabelStatistics& Get(MIL_INT Label) const {return m_Bands[0].pTable[Label];}
+
+      // Function that returns the mean value of a label.
+      MIL_DOUBLE GetMean(MIL_INT Label) const
+         {
+         const SLabelStatistics& Statistics = Get(Label);
+         return Statistics.Count > 0 ? (MIL_DOUBLE)Statistics.Sum / Statistics.Count : 0.0;
+         }
+
+      // Function that returns the number of labels that have pixels.
+      MIL_INT GetNbLabels() const {return m_NbLabels;}
+
+      // Function that returns the number of pixels of a label above the maximum
+      // label, which are not in the statistics.
+      MIL_INT GetNbOutOfRangePixels() const {return m_NbOutOfRange;}
+
+      // Task that reduces a band.
+      static void BandTask(void* pBandPtr)
+         {
+         SLabelStatisticsBand* pBand = (SLabelStatisticsBand*)pBandPtr;
+         pBand->pEngine->ReduceBand(pBand);
+         }
+
+   private:
+      // Disallow copy.
+      CLabelStatistics(const CLabelStatistics&);
+      CLabelStatistics& operator=(const CLabelStatistics&);
+
+      // Function that runs the bands in the pool, the first one in the calling
+      // thread, and waits for them.
+      void RunBands()
+         {
+         if(m_NbBands == 1)
+            {
+            ReduceBand(&m_Bands[0]);
+            return;
+            }
+         CThreadPoolBatch Batch;
+         for(MIL_INT BandIdx = 1; BandIdx < m_NbBands; BandIdx++)
+            m_pThreadPool->Submit(m_ThreadPoolRole, BandTask, &m_Bands[BandIdx], &Batch);
+         ReduceBand(&m_Bands[0]);
+         Batch.Wait();
+         }
+
+      // Function that reduces the rows of a band in its table.
+      void ReduceBand(SLabelStatisticsBand* pBand)
+         {
+         SLabelStatistics* pTable = pBand->pTable;
+         for(MIL_INT Label = 0; Label <= m_MaxLabel; Label++)
+            {
+            SLabelStatistics& Statistics = pTable[Label];
+            Statistics.Count = 0;
+            Statistics.Sum = 0;
+            Statistics.Min = MIL_UINT16_MAX;
+            Statistics.Max = 0;
+            Statistics.MinX = Statistics.MinY = -1;
+            Statistics.MaxX = Statistics.MaxY = -1;
+            Statistics.BoxMinX = Statistics.BoxMinY = 0x7FFFFFFF;
+            Statistics.BoxMaxX = Statistics.BoxMaxY = -1;
+            }
+         pBand->NbOutOfRange = 0;
+
+         MIL_UINT16 MaxLabel = (MIL_UINT16)m_MaxLabel;
+         for(MIL_INT y = pBand->StartY; y < pBand->EndY; y++)
+            {
+            const MIL_UINT16* pLabelRow = m_pLabels + y * m_LabelPitch;
+            const MIL_UINT16* pValueRow = m_pValues + y * m_ValuePitch;
+            MIL_INT32 y32 = (MIL_INT32)y;
+            for(MIL_INT x = 0; x < m_SizeX; x++)
+               {
+               MIL_UINT16 Label = pLabelRow[x];
+               if(Label == 0)
+                  continue;
+               if(Label > MaxLabel)
+                  {
+                  pBand->NbOutOfRange++;
+                  continue;
+                  }
+
+               // The rows are reduced in raster order, so the first position of an
+               // extremum is kept by the strict comparisons.
+               SLabelStatistics& Statistics = pTable[Label];
+               MIL_UINT16 Value = pValueRow[x];
+               MIL_INT32 x32 = (MIL_INT32)x;
+               if(Statistics.Count == 0)
+                  {
+                  Statistics.BoxMinY = y32;
+                  Statistics.Min = Value;
+                  Statistics.Max = Value;
+                  Statistics.MinX = Statistics.MaxX = x32;
+                  Statistics.MinY = Statistics.MaxY = y32;
+                  }
+               else if(Value < Statistics.Min)
+                  {
+                  Statistics.Min = Value;
+                  Statistics.MinX = x32;
+                  Statistics.MinY = y32;
+                  }
+               else if(Value > Statistics.Max)
+                  {
+                  Statistics.Max = Value;
+                  Statistics.MaxX = x32;
+                  Statistics.MaxY = y32;
+                  }
+               Statistics.Count++;
+               Statistics.Sum += Value;
+               if(x32 < Statistics.BoxMinX)
+                  Statistics.BoxMinX = x32;
+               if(x32 > Statistics.BoxMaxX)
+                  Statistics.BoxMaxX = x32;
+               Statistics.BoxMaxY = y32;
+               }
+            }
+         }
+
+      // Function that merges the statistics of a later band in the ones of an
+      // earlier band.
+      static void Merge(SLabelStatistics* pStatistics, const SLabelStatistics& Later)
+         {
+         if(Later.Count == 0)
+            return;
+         if(pStatistics->Count == 0)
+            {
+            *pStatistics = Later;
+            return;
+            }
+         pStatistics->Count += Later.Count;
+         pStatistics->Sum += Later.Sum;
+         if(Later.Min < pStatistics->Min)
+            {
+            pStatistics->Min = Later.Min;
+            pStatistics->MinX = Later.MinX;
+            pStatistics->MinY = Later.MinY;
+            }
+         if(Later.Max > pStatistics->Max)
+            {
+            pStatistics->Max = Later.Max;
+            pStatistics->MaxX = Later.MaxX;
+            pStatistics->MaxY = Later.MaxY;
+            }
+         if(Later.BoxMinX < pStatistics->BoxMinX)
+            pStatistics->BoxMinX = Later.BoxMinX;
+         if(Later.BoxMaxX > pStatistics->BoxMaxX)
+            pStatistics->BoxMaxX = Later.BoxMaxX;
+         pStatistics->BoxMaxY = Later.BoxMaxY;
+         }
+
+      const MIL_UINT16*    m_pLabels;
+      MIL_INT              m_LabelPitch;
+      const MIL_UINT16*    m_pValues;
+      MIL_INT              m_ValuePitch;
+      MIL_INT              m_SizeX;
+      MIL_INT              m_MaxLabel;
+      MIL_INT              m_NbLabels;
+      MIL_INT              m_NbOutOfRange;
+      CPipelineThreadPool* m_pThreadPool;
+      MIL_INT              m_ThreadPoolRole;
+      MIL_INT              m_NbBands;
+      SLabelStatisticsBand m_Bands[LABEL_STATISTICS_MAX_BANDS];
+   };
@@ -0,0 +1,455 @@
+﻿//***************************************************************************************/
+//
+// File name: LineSourceSimulator.h
+//
+// Synopsis:  Contains the line source simulator used by the Chromasens_3DPIXA_M10PP3
+//            example to stress the inspection at a given conveyor speed. A
+//            thread replays the rows of a recorded or synthetic frame in a
+//            ring of frame buffers, block of lines by block of lines, at the
+//            pace of a simulated encoder. The encoder can jitter, stall, and
+//            burst to catch up.
+//
+//            The completed frames are pushed to the consumer in a bounded
+//            stage queue, and the released frame buffers come back in a
+//            second one. The ready queue holds all the frame buffers but the
+//            one filled and the one processed, so its full policy decides what
+//            an overload does: the source blocks, like a grabber with
+//            backpressure, or drops the oldest or the newest completed frame,
+//            like a grabber that never waits. The frames are numbered as they
+//            start, so every dropped frame is a gap in the sequence taken by
+//            the consumer.
+//
+//            The consumer takes the completed frames in order and releases
+//            them once processed. A frame misses its deadline when it is
+//            released more than a nominal frame period after its completion,
+//            that is once the next frame would have been completed.
+//
+//            The pacing thread spins on the timer for the last milliseconds of
+//            each wait, so it should be placed on a dedicated core.
+//
+// Copyright © 1992-2024 Zebra Technologies Corp. and/or its affiliates
+// All Rights Reserved
+
+#include <string.h>
+
+static const MIL_INT    LINE_SOURCE_MIN_FRAMES = 3;       // One filled, one queued and one processed.
+static const MIL_INT    LINE_SOURCE_MAX_FRAMES = 8;
+static const MIL_DOUBLE LINE_SOURCE_SPIN_TIME  = 0.002;   // In s, of a wait spent spinning instead of sleeping.
+
+// Behavior of the simulated encoder and of the source.
+struct SLineSourceParams
+   {
+   MIL_DOUBLE LineRate;            // Nominal, in lines/s.
+   MIL_INT    LinesPerBlock;       // Lines delivered at once, like a transfer of the grabber.
+   MIL_DOUBLE Jitter;              // Of the delivery of a block, as a fraction of its period.
+   MIL_DOUBLE StallProbability;    // Per block.
+   MIL_DOUBLE StallDuration;       // In s.
+   MIL_DOUBLE BurstProbability;    // Per block.
+   MIL_INT    BurstLength;         // In lines.
+   MIL_DOUBLE BurstRateFactor;     // Of the line rate during a burst.
+   MIL_INT    NbFrames;            // Frames started before the source ends.
+   EQueueFullPolicy FullPolicy;    // Of the ready queue.
+   MIL_UINT32 Seed;
+   };
+
+// Statistics of a run of the source.
+struct SLineSourceStatistics
+   {
+   MIL_INT    NbFrames;            // Completed by the source.
+   MIL_INT    NbDroppedFrames;     // By the full policy of the ready queue.
+   MIL_INT    NbLostFrames;        // Missing in the sequence taken by the consumer.
+   MIL_INT    NbMissedDeadlines;
+   MIL_INT    NbStalls;
+   MIL_INT    NbBursts;
+   MIL_INT    MaxQueueDepth;       // Frames completed and not yet released.
+   MIL_DOUBLE MeanQueueDepth;      // At the completion of the frames.
+   MIL_DOUBLE QueueGrowth;         // Slope of the queue depth, in frames/s.
+   MIL_DOUBLE MaxLateness;         // Of the delivery of a block on its schedule, in s.
+   MIL_DOUBLE MeanLatency;         // From the completion to the release of a frame, in s.
+   MIL_DOUBLE MaxLatency;
+   MIL_DOUBLE MeanServiceTime;     // From the taking to the release of a frame, in s.
+   MIL_DOUBLE Duration;            // In s.
+   MIL_DOUBLE LineRate;            // Effective, in lines/s.
+   SStageQueueStatistics ReadyQueue;
+   };
+
+// Frame buffer of the ring.
+struct SLineSourceFrame
+   {
+   MIL_ID     MilImage;
+   MIL_UINT8* pData;
+   MIL_INT    PitchByte;
+   MIL_INT64  Sequence;
+   MIL_DOUBLE CompletionTime;
+   MIL_DOUBLE TakeTime;
+   };
+
+//////////////////////////////////////////////////////////////////////////
+// Class that delivers the rows of a frame at the pace of a simulated
+// encoder.
+//////////////////////////////////////////////////////////////////////////
+class CLineSourceSimulator
+   {
+   public:
+      // Constructor.
+      CLineSourceSimulator()
+         : m_pThreadRole(NULL),
+           m_MilThread(M_NULL),
+           m_pSourceData(NULL),
+           m_SourcePitchByte(0),
+           m_SourceSizeY(0),
+           m_RowSizeByte(0),
+           m_FrameSizeY(0),
+           m_NbFrameBuffers(0),
+           m_ReadyQueue("ready"),
+           m_FreeQueue("free"),
+           m_Stop(false),
+           m_RandomState(1)
+         {
+         memset(&m_Params, 0, sizeof(m_Params));
+         memset(m_Frames, 0, sizeof(m_Frames));
+         ResetStatistics();
+         MthrAlloc(M_DEFAULT_HOST, M_MUTEX, M_DEFAULT, M_NULL, M_NULL, &m_MilMutex);
+         }
+
+      // Destructor.
+      virtual ~CLineSourceSimulator()
+         {
+         Stop();
+         MthrFree(m_MilMutex);
+         }
+
+      // Function that starts replaying the source image in the frame buffers,
+      // which must have the same row layout. The source rows are replayed from
+      // the top again if it is shorter than the frames. The pacing thread is
+      // placed on the cores of a thread role if given.
+      bool Start(MIL_ID MilSourceImage, const MIL_ID* pMilFrameImages, MIL_INT NbFrameImages, const SLineSourceParams& Params,
+                 const SThreadRoleConfig* pThreadRole = NULL)
+         {
+         Stop();
+         if(NbFrameImages < LINE_SOURCE_MIN_FRAMES || NbFrameImages > LINE_SOURCE_MAX_FRAMES || Params.LineRate <= 0 || Params.NbFrames < 1)
+            return false;
+
+         m_pSourceData = (const MIL_UINT8*)MbufInquire(MilSourceImage, M_HOST_ADDRESS, M_NULL);
+         m_SourcePitchByte = MbufInquire(MilSourceImage, M_PITCH_BYTE, M_NULL);
+         m_SourceSizeY = MbufInquire(MilSourceImage, M_SIZE_Y, M_NULL);
+         m_RowSizeByte = m_SourcePitchByte;
+         m_FrameSizeY = MbufInquire(pMilFrameImages[0], M_SIZE_Y, M_NULL);
+         m_NbFrameBuffers = NbFrameImages;
+         m_ReadyQueue.Reset(NbFrameImages - 2, Params.FullPolicy);
+         m_FreeQueue.Reset(NbFrameImages, QUEUE_BLOCK);
+         for(MIL_INT FrameIdx = 0; FrameIdx < NbFrameImages; FrameIdx++)
+            {
+            SLineSourceFrame& Frame = m_Frames[FrameIdx];
+            Frame.MilImage = pMilFrameImages[FrameIdx];
+            Frame.pData = (MIL_UINT8*)MbufInquire(Frame.MilImage, M_HOST_ADDRESS, M_NULL);
+            Frame.PitchByte = MbufInquire(Frame.MilImage, M_PITCH_BYTE, M_NULL);
+            ReleaseFrameBuffer(FrameIdx);
+            if(!Frame.pData || MbufInquire(Frame.MilImage, M_SIZE_Y, M_NULL) != m_FrameSizeY)
+               return false;
+            if(Frame.PitchByte < m_RowSizeByte)
+               m_RowSizeByte = Frame.PitchByte;
+            }
+         if(!m_pSourceData)
+            return false;
+
+         m_Params = Params;
+         if(m_Params.LinesPerBlock < 1)
+            m_Params.LinesPerBlock = 1;
+         m_RandomState = Params.Seed ? Params.Seed : 1;
+         m_Stop = false;
+         m_pThreadRole = pThreadRole;
+         ResetStatistics();
+         m_FramePeriod = m_FrameSizeY / Params.LineRate;
+         MappTimer(M_DEFAULT, M_TIMER_READ, &m_StartTime);
+         MthrAlloc(M_DEFAULT_HOST, M_THREAD, M_DEFAULT, SourceThread, this, &m_MilThread);
+         return true;
+         }
+
+      // Function that stops the source, if started, and waits for its thread.
+      // With the block policy, the consumer must not hold back the frames.
+      void Stop()
+         {
+         if(!m_MilThread)
+            return;
+         Lock();
+         m_Stop = true;
+         Unlock();
+         MthrWait(m_MilThread, M_THREAD_END_WAIT, M_NULL);
+         MthrFree(m_MilThread);
+         m_MilThread = M_NULL;
+         }
+
+      // Function that waits for the next completed frame and takes it. Returns
+      // the index of its frame buffer, or -1 once the source has ended and all
+      // its frames were taken.
+      MIL_INT TakeFrame()
+         {
+         SStageItem Item;
+         if(!m_ReadyQueue.Pop(&Item, true))
+            return -1;
+         MappTimer(M_DEFAULT, M_TIMER_READ, &m_Frames[Item.Payload].TakeTime);
+         return Item.Payload;
+         }
+
+      // Function that returns the image of a frame buffer.
+      MIL_ID GetFrameImage(MIL_INT FrameIdx) const {return m_Frames[FrameIdx].MilImage;}
+
+      // Function that returns the time of the timer at which the last line of a
+      // taken frame was delivered.
+      MIL_DOUBLE GetFrameCompletionTime(MIL_INT FrameIdx) const {return m_Frames[FrameIdx].CompletionTime;}
+
+      // Function that returns the sequence number of a taken frame.
+      MIL_INT64 GetFrameSequence(MIL_INT FrameIdx) const {return m_Frames[FrameIdx].Sequence;}
+
+      // Function that returns the number of completed frames waiting for the consumer.
+      MIL_INT GetNbReadyFrames() const {return m_ReadyQueue.GetOccupancy();}
+
+      // Function that returns the queue of the completed frames.
+      const CStageQueue& GetReadyQueue() const {return m_ReadyQueue;}
+
+      // Function that gives a processed frame back to the source.
+      void ReleaseFrame(MIL_INT FrameIdx)
+         {
+         MIL_DOUBLE ReleaseTime;
+         MappTimer(M_DEFAULT, M_TIMER_READ, &ReleaseTime);
+         Lock();
+         SLineSourceFrame& Frame = m_Frames[FrameIdx];
+         MIL_DOUBLE Latency = ReleaseTime - Frame.CompletionTime;
+         m_LatencySum += Latency;
+         m_ServiceTimeSum += ReleaseTime - Frame.TakeTime;
+         if(Latency > m_Statistics.MaxLatency)
+            m_Statistics.MaxLatency = Latency;
+         if(Latency > m_FramePeriod)
+            m_Statistics.NbMissedDeadlines++;
+         m_NbReleasedFrames++;
+         m_QueueDepth--;
+         Unlock();
+         ReleaseFrameBuffer(FrameIdx);
+         }
+
+      // Function that returns the statistics of the current or last run.
+      void GetStatistics(SLineSourceStatistics* pStatistics)
+         {
+         Lock();
+         *pStatistics = m_Statistics;
+         if(m_NbReleasedFrames > 0)
+            {
+            pStatistics->MeanLatency = m_LatencySum / m_NbReleasedFrames;
+            pStatistics->MeanServiceTime = m_ServiceTimeSum / m_NbReleasedFrames;
+            }
+         if(m_Statistics.NbFrames > 0)
+            pStatistics->MeanQueueDepth = m_DepthSum / m_Statistics.NbFrames;
+
+         // Least-squares slope of the queue depth sampled at each completion.
+         MIL_DOUBLE NbSamples = (MIL_DOUBLE)m_Statistics.NbFrames;
+         MIL_DOUBLE Denominator = NbSamples * m_TimeSquareSum - m_TimeSum * m_TimeSum;
+         if(NbSamples > 1 && Denominator > 0)
+            pStatistics->QueueGrowth = (NbSamples * m_TimeDepthSum - m_TimeSum * m_DepthSum) / Denominator;
+         if(pStatistics->Duration > 0)
+            pStatistics->LineRate = (MIL_DOUBLE)m_NbDeliveredLines / pStatistics->Duration;
+         m_ReadyQueue.GetStatistics(&pStatistics->ReadyQueue);
+         pStatistics->NbDroppedFrames = (MIL_INT)pStatistics->ReadyQueue.NbDropped;
+         pStatistics->NbLostFrames = (MIL_INT)pStatistics->ReadyQueue.NbMissingItems;
+         Unlock();
+         }
+
+   private:
+      // Disallow copy.
+      CLineSourceSimulator(const CLineSourceSimulator&);
+      CLineSourceSimulator& operator=(const CLineSourceSimulator&);
+
+      void Lock()   {MthrControl(m_MilMutex, M_LOCK, M_DEFAULT);}
+      void Unlock() {MthrControl(m_MilMutex, M_UNLOCK, M_DEFAULT);}
+
+      // Function that returns a pseudo-random number from 0 to 1, excluded.
+      MIL_DOUBLE Random()
+         {
+         // Xorshift generator.
+         m_RandomState ^= m_RandomState << 13;
+         m_RandomState ^= m_RandomState >> 17;
+         m_RandomState ^= m_RandomState << 5;
+         return m_RandomState / 4294967296.0;
+         }
+
+      // Function that resets the statistics of a run.
+      void ResetStatistics()
+         {
+         memset(&m_Statistics, 0, sizeof(m_Statistics));
+         m_FramePeriod = 0.0;
+         m_StartTime = 0.0;
+         m_NbDeliveredLines = 0;
+         m_NbReleasedFrames = 0;
+         m_QueueDepth = 0;
+         m_LatencySum = 0.0;
+         m_ServiceTimeSum = 0.0;
+         m_DepthSum = 0.0;
+         m_TimeSum = 0.0;
+         m_TimeSquareSum = 0.0;
+         m_TimeDepthSum = 0.0;
+         }
+
+      // Function that waits until a time of the timer. Returns the lateness.
+      MIL_DOUBLE WaitUntil(MIL_DOUBLE Time)
+         {
+         MIL_DOUBLE CurrentTime;
+         MappTimer(M_DEFAULT, M_TIMER_READ, &CurrentTime);
+         if(Time - CurrentTime > LINE_SOURCE_SPIN_TIME)
+            MosSleep((MIL_INT)((Time - CurrentTime - LINE_SOURCE_SPIN_TIME) * 1000.0));
+         do
+            MappTimer(M_DEFAULT, M_TIMER_READ, &CurrentTime);
+         while(CurrentTime < Time);
+         return CurrentTime - Time;
+         }
+
+      // Function that gives a frame buffer back to the source.
+      void ReleaseFrameBuffer(MIL_INT FrameIdx)
+         {
+         SStageItem Item = {-1, FrameIdx, 0.0};
+         m_FreeQueue.Push(Item, NULL);
+         }
+
+      // Function that starts the next frame in a free frame buffer. The ready
+      // queue never holds all the buffers, so one is always free or about to be.
+      MIL_INT StartFrame(MIL_INT64 Sequence)
+         {
+         SStageItem Item;
+         m_FreeQueue.Pop(&Item, true);
+         m_Frames[Item.Payload].Sequence = Sequence;
+         return Item.Payload;
+         }
+
+      // Function that pushes a filled frame to the consumer. The frame buffer of
+      // a frame dropped by the full policy is freed at once.
+      void CompleteFrame(MIL_INT FrameIdx, MIL_DOUBLE CompletionTime)
+         {
+         SLineSourceFrame* pFrame = &m_Frames[FrameIdx];
+         pFrame->CompletionTime = CompletionTime;
+         SStageItem Item = {pFrame->Sequence, FrameIdx, CompletionTime};
+         SStageItem DroppedItem;
+         bool Dropped = m_ReadyQueue.Push(Item, &DroppedItem) != QUEUE_PUSHED;
+         if(Dropped)
+            ReleaseFrameBuffer(DroppedItem.Payload);
+
+         Lock();
+         m_QueueDepth += Dropped ? 0 : 1;
+         m_Statistics.NbFrames++;
+         if(m_QueueDepth > m_Statistics.MaxQueueDepth)
+            m_Statistics.MaxQueueDepth = m_QueueDepth;
+         MIL_DOUBLE Time = CompletionTime - m_StartTime;
+         m_DepthSum += m_QueueDepth;
+         m_TimeSum += Time;
+         m_TimeSquareSum += Time * Time;
+         m_TimeDepthSum += Time * m_QueueDepth;
+         Unlock();
+         }
+
+      // Thread function that delivers the frames at the pace of the encoder.
+      static MIL_UINT32 MFTYPE SourceThread(void* pSourcePtr)
+         {
+         CLineSourceSimulator* pSource = (CLineSourceSimulator*)pSourcePtr;
+         if(pSource->m_pThreadRole)
+            PlaceCurrentThread(*pSource->m_pThreadRole, 0);
+         MIL_INT64 NbStartedFrames = pSource->Run();
+
+         // Wake up the consumer waiting for a frame that will not come.
+         pSource->Lock();
+         MIL_DOUBLE EndTime;
+         MappTimer(M_DEFAULT, M_TIMER_READ, &EndTime);
+         pSource->m_Statistics.Duration = EndTime - pSource->m_StartTime;
+         pSource->Unlock();
+         pSource->m_ReadyQueue.Close(NbStartedFrames);
+         return 0;
+         }
+
+      // Function that delivers the frames. The schedule of the blocks follows the
+      // encoder; the jitter moves the delivery of a block without accumulating.
+      // Returns the number of frames started.
+      MIL_INT64 Run()
+         {
+         const SLineSourceParams& Params = m_Params;
+         MIL_DOUBLE Schedule = m_StartTime;
+         MIL_INT BurstLinesLeft = 0;
+         MIL_INT SourceRow = 0;
+         for(MIL_INT FrameIdx = 0; FrameIdx < Params.NbFrames; FrameIdx++)
+            {
+            SLineSourceFrame* pFrame = &m_Frames[StartFrame(FrameIdx)];
+            MIL_DOUBLE DeliveryTime = Schedule;
+            for(MIL_INT Row = 0; Row < m_FrameSizeY; Row += Params.LinesPerBlock)
+               {
+               MIL_INT NbLines = m_FrameSizeY - Row < Params.LinesPerBlock ? m_FrameSizeY - Row : Params.LinesPerBlock;
+
+               // Simulate the encoder.
+               if(Params.StallProbability > 0 && Random() < Params.StallProbability)
+                  {
+                  Schedule += Params.StallDuration;
+                  m_Statistics.NbStalls++;
+                  }
+               if(BurstLinesLeft <= 0 && Params.BurstProbability > 0 && Random() < Params.BurstProbability)
+                  {
+                  BurstLinesLeft = Params.BurstLength;
+                  m_Statistics.NbBursts++;
+                  }
+               MIL_DOUBLE BlockPeriod = NbLines / Params.LineRate;
+               if(BurstLinesLeft > 0)
+                  {
+                  if(Params.BurstRateFactor > 0)
+                     BlockPeriod /= Params.BurstRateFactor;
+                  BurstLinesLeft -= NbLines;
+                  }
+               Schedule += BlockPeriod;
+               DeliveryTime = Schedule + Params.Jitter * BlockPeriod * (2.0 * Random() - 1.0);
+
+               // Deliver the block.
+               MIL_DOUBLE Lateness = WaitUntil(DeliveryTime);
+               if(Lateness > m_Statistics.MaxLateness)
+                  m_Statistics.MaxLateness = Lateness;
+               for(MIL_INT LineIdx = 0; LineIdx < NbLines; LineIdx++)
+                  {
+                  memcpy(pFrame->pData + (Row + LineIdx) * pFrame->PitchByte, m_pSourceData + SourceRow * m_SourcePitchByte, m_RowSizeByte);
+                  SourceRow = (SourceRow + 1) % m_SourceSizeY;
+                  }
+               m_NbDeliveredLines += NbLines;
+
+               Lock();
+               bool Stop = m_Stop;
+               Unlock();
+               if(Stop)
+                  return FrameIdx;
+               }
+            CompleteFrame(pFrame - m_Frames, DeliveryTime);
+            }
+         return Params.NbFrames;
+         }
+
+      SLineSourceParams        m_Params;
+      const SThreadRoleConfig* m_pThreadRole;
+      MIL_ID                   m_MilThread;
+      const MIL_UINT8*         m_pSourceData;
+      MIL_INT                  m_SourcePitchByte;
+      MIL_INT                  m_SourceSizeY;
+      MIL_INT                  m_RowSizeByte;
+      MIL_INT                  m_FrameSizeY;
+      SLineSourceFrame         m_Frames[LINE_SOURCE_MAX_FRAMES];
+      MIL_INT                  m_NbFrameBuffers;
+      CStageQueue              m_ReadyQueue;         // Completed frames, to the consumer.
+      CStageQueue              m_FreeQueue;          // Free frame buffers, to the source.
+      bool                     m_Stop;
+      MIL_UINT32               m_RandomState;
+
+      // Statistics.
+      SLineSourceStatistics    m_Statistics;
+      MIL_DOUBLE               m_FramePeriod;
+      MIL_DOUBLE               m_StartTime;
+      MIL_INT                  m_NbDeliveredLines;
+      MIL_INT                  m_NbReleasedFrames;
+      MIL_INT                  m_QueueDepth;
+      MIL_DOUBLE               m_LatencySum;
+      MIL_DOUBLE               m_ServiceTimeSum;
+      MIL_DOUBLE               m_DepthSum;
+      MIL_DOUBLE               m_TimeSum;
+      MIL_DOUBLE               m_TimeSquareSum;
+      MIL_DOUBLE               m_TimeDepthSum;
+
+      MIL_ID                   m_MilMutex;
+   };
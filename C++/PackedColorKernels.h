@@ -0,0 +1,125 @@
+﻿//***************************************************************************************/
+//
+// File name: PackedColorKernels.h
+//
+// Synopsis:  Contains the packed color kernels used by the Chromasens_3DPIXA_M10PP3
+//            example. The color maps of the example are kept packed BGRA
+//            (M_BGR32 + M_PACKED), like the grab and the rectified images of
+//            the 3D API, so the workable area is cropped with a row copy. The
+//            kernels converting from or to another layout (gray rectified
+//            image, planar buffers) are fused with the crop and process 16
+//            pixels at a time with SSE2, so each pixel is read and written
+//            once.
+//
+// Copyright © 1992-2024 Zebra Technologies Corp. and/or its affiliates
+// All Rights Reserved
+
+#include <emmintrin.h>
+#include <string.h>
+
+static const MIL_INT PACKED_COLOR_PIXEL_SIZE = 4;   // B, G, R, A.
+
+//*****************************************************************************
+// CopyPackedColorCrop. Copies a region of a packed BGRA image, starting at
+//                      column OffsetX, in a packed BGRA image.
+//*****************************************************************************
+inline void CopyPackedColorCrop(const MIL_UINT8* pSrc, MIL_INT SrcPitchByte, MIL_INT OffsetX,
+                                MIL_UINT8* pDst, MIL_INT DstPitchByte, MIL_INT SizeX, MIL_INT SizeY)
+   {
+   for(MIL_INT y = 0; y < SizeY; y++)
+      memcpy(pDst + y * DstPitchByte, pSrc + y * SrcPitchByte + OffsetX * PACKED_COLOR_PIXEL_SIZE, SizeX * PACKED_COLOR_PIXEL_SIZE);
+   }
+
+//*****************************************************************************
+// DeinterleaveColorCrop. Splits a region of a packed BGRA image, starting at
+//                        column OffsetX, in three planes.
+//*****************************************************************************
+inline void DeinterleaveColorCrop(const MIL_UINT8* pSrc, MIL_INT SrcPitchByte, MIL_INT OffsetX,
+                                  MIL_UINT8* pRed, MIL_UINT8* pGreen, MIL_UINT8* pBlue, MIL_INT DstPitchByte,
+                                  MIL_INT SizeX, MIL_INT SizeY)
+   {
+   const __m128i ByteMask = _mm_set1_epi32(0xFF);
+   for(MIL_INT y = 0; y < SizeY; y++)
+      {
+      const MIL_UINT8* pSrcRow = pSrc + y * SrcPitchByte + OffsetX * PACKED_COLOR_PIXEL_SIZE;
+      MIL_UINT8* pRedRow = pRed + y * DstPitchByte;
+      MIL_UINT8* pGreenRow = pGreen + y * DstPitchByte;
+      MIL_UINT8* pBlueRow = pBlue + y * DstPitchByte;
+      MIL_INT x = 0;
+      for(; x + 16 <= SizeX; x += 16)
+         {
+         // Each 32-bit lane is a pixel; isolate a channel in the low byte of the
+         // lanes and pack the lanes down to bytes.
+         const __m128i* pPixels = (const __m128i*)(pSrcRow + x * PACKED_COLOR_PIXEL_SIZE);
+         __m128i Pixels0 = _mm_loadu_si128(pPixels);
+         __m128i Pixels1 = _mm_loadu_si128(pPixels + 1);
+         __m128i Pixels2 = _mm_loadu_si128(pPixels + 2);
+         __m128i Pixels3 = _mm_loadu_si128(pPixels + 3);
+         __m128i Blue  = _mm_packus_epi16(_mm_packs_epi32(_mm_and_si128(Pixels0, ByteMask), _mm_and_si128(Pixels1, ByteMask)),
+                                          _mm_packs_epi32(_mm_and_si128(Pixels2, ByteMask), _mm_and_si128(Pixels3, ByteMask)));
+         __m128i Green = _mm_packus_epi16(_mm_packs_epi32(_mm_and_si128(_mm_srli_epi32(Pixels0, 8), ByteMask), _mm_and_si128(_mm_srli_epi32(Pixels1, 8), ByteMask)),
+                                          _mm_packs_epi32(_mm_and_si128(_mm_srli_epi32(Pixels2, 8), ByteMask), _mm_and_si128(_mm_srli_epi32(Pixels3, 8), ByteMask)));
+         __m128i Red   = _mm_packus_epi16(_mm_packs_epi32(_mm_and_si128(_mm_srli_epi32(Pixels0, 16), ByteMask), _mm_and_si128(_mm_srli_epi32(Pixels1, 16), ByteMask)),
+                                          _mm_packs_epi32(_mm_and_si128(_mm_srli_epi32(Pixels2, 16), ByteMask), _mm_and_si128(_mm_srli_epi32(Pixels3, 16), ByteMask)));
+         _mm_storeu_si128((__m128i*)(pBlueRow + x), Blue);
+         _mm_storeu_si128((__m128i*)(pGreenRow + x), Green);
+         _mm_storeu_si128((__m128i*)(pRedRow + x), Red);
+         }
+      for(; x < SizeX; x++)
+         {
+         pBlueRow[x]  = pSrcRow[x * PACKED_COLOR_PIXEL_SIZE];
+         pGreenRow[x] = pSrcRow[x * PACKED_COLOR_PIXEL_SIZE + 1];
+         pRedRow[x]   = pSrcRow[x * PACKED_COLOR_PIXEL_SIZE + 2];
+         }
+      }
+   }
+
+//*****************************************************************************
+// InterleaveColorCrop. Merges a region of three planes, starting at column
+//                      OffsetX, in a packed BGRA image with an opaque alpha.
+//*****************************************************************************
+inline void InterleaveColorCrop(const MIL_UINT8* pRed, const MIL_UINT8* pGreen, const MIL_UINT8* pBlue, MIL_INT SrcPitchByte, MIL_INT OffsetX,
+                                MIL_UINT8* pDst, MIL_INT DstPitchByte, MIL_INT SizeX, MIL_INT SizeY)
+   {
+   const __m128i Alpha = _mm_set1_epi8((char)0xFF);
+   for(MIL_INT y = 0; y < SizeY; y++)
+      {
+      const MIL_UINT8* pRedRow = pRed + y * SrcPitchByte + OffsetX;
+      const MIL_UINT8* pGreenRow = pGreen + y * SrcPitchByte + OffsetX;
+      const MIL_UINT8* pBlueRow = pBlue + y * SrcPitchByte + OffsetX;
+      MIL_UINT8* pDstRow = pDst + y * DstPitchByte;
+      MIL_INT x = 0;
+      for(; x + 16 <= SizeX; x += 16)
+         {
+         __m128i Blue  = _mm_loadu_si128((const __m128i*)(pBlueRow + x));
+         __m128i Green = _mm_loadu_si128((const __m128i*)(pGreenRow + x));
+         __m128i Red   = _mm_loadu_si128((const __m128i*)(pRedRow + x));
+         __m128i BlueGreenLow  = _mm_unpacklo_epi8(Blue, Green);
+         __m128i BlueGreenHigh = _mm_unpackhi_epi8(Blue, Green);
+         __m128i RedAlphaLow   = _mm_unpacklo_epi8(Red, Alpha);
+         __m128i RedAlphaHigh  = _mm_unpackhi_epi8(Red, Alpha);
+         __m128i* pPixels = (__m128i*)(pDstRow + x * PACKED_COLOR_PIXEL_SIZE);
+         _mm_storeu_si128(pPixels,     _mm_unpacklo_epi16(BlueGreenLow, RedAlphaLow));
+         _mm_storeu_si128(pPixels + 1, _mm_unpackhi_epi16(BlueGreenLow, RedAlphaLow));
+         _mm_storeu_si128(pPixels + 2, _mm_unpacklo_epi16(BlueGreenHigh, RedAlphaHigh));
+         _mm_storeu_si128(pPixels + 3, _mm_unpackhi_epi16(BlueGreenHigh, RedAlphaHigh));
+         }
+      for(; x < SizeX; x++)
+         {
+         pDstRow[x * PACKED_COLOR_PIXEL_SIZE]     = pBlueRow[x];
+         pDstRow[x * PACKED_COLOR_PIXEL_SIZE + 1] = pGreenRow[x];
+         pDstRow[x * PACKED_COLOR_PIXEL_SIZE + 2] = pRedRow[x];
+         pDstRow[x * PACKED_COLOR_PIXEL_SIZE + 3] = 0xFF;
+         }
+      }
+   }
+
+//*****************************************************************************
+// ExpandGrayCrop. Copies a region of a gray image, starting at column OffsetX,
+//                 in the three channels of a packed BGRA image.
+//*****************************************************************************
+inline void ExpandGrayCrop(const MIL_UINT8* pSrc, MIL_INT SrcPitchByte, MIL_INT OffsetX,
+                           MIL_UINT8* pDst, MIL_INT DstPitchByte, MIL_INT SizeX, MIL_INT SizeY)
+   {
+   InterleaveColorCrop(pSrc, pSrc, pSrc, SrcPitchByte, OffsetX, pDst, DstPitchByte, SizeX, SizeY);
+   }
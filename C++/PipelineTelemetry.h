@@ -0,0 +1,377 @@
+﻿//***************************************************************************************/
+//
+// File name: PipelineTelemetry.h
+//
+// Synopsis:  Contains the live telemetry used by the Chromasens_3DPIXA_M10PP3
+//            example. After every scan, the pipeline publishes a sample of its
+//            counters and gauges (scan rate, scan and stage latencies, queue
+//            depths, dropped scans, valid coverage, defect and peak counts and
+//            memory high-water mark) in a ring of a named shared memory. A
+//            separate process, such as TelemetryReader, reads the ring without
+//            ever blocking the pipeline.
+//
+//            The ring has a single writer and no lock. Each slot holds a
+//            sequence number that is odd while the slot is written; a reader
+//            copies a slot and keeps the copy only if the sequence number of
+//            the slot did not change during the copy.
+//
+//            Shared memory layout:
+//               STelemetryRingHeader    WriteCount is the number of samples
+//                                       ever published; sample n is in slot
+//                                       n modulo NbSlots.
+//               NbSlots x
+//                  STelemetrySample     Sequence is 2n + 2 once sample n is
+//                                       written.
+//
+// Copyright © 1992-2024 Zebra Technologies Corp. and/or its affiliates
+// All Rights Reserved
+
+#include <string.h>
+
+static const MIL_UINT32 TELEMETRY_MAGIC       = 0x4D4C5443;   // "CTLM"
+static const MIL_UINT16 TELEMETRY_VERSION     = 2;
+static const MIL_INT    TELEMETRY_NB_SLOTS    = 256;
+static const MIL_INT    TELEMETRY_MAX_STAGES  = 16;
+static const MIL_INT    TELEMETRY_MAX_QUEUES  = 4;
+static const MIL_INT    TELEMETRY_NAME_LENGTH = 16;
+
+// Shared memory of the telemetry of the example, read by TelemetryReader.
+static const char*      TELEMETRY_SHARED_MEMORY = "Local\\Chromasens_3DPIXA_M10PP3_Telemetry";
+
+// Weight of the last interval in the averaged scan rate.
+static const MIL_DOUBLE TELEMETRY_RATE_SMOOTHING = 0.2;
+
+// Sample published after a scan. The counters are since the publisher was opened.
+struct STelemetrySample
+   {
+   volatile MIL_INT64 Sequence;            // Odd while the slot is written.
+   MIL_UINT64 ScanIdx;
+   MIL_DOUBLE Time;                        // In s, since the publisher was opened.
+   MIL_UINT32 RecipeIdx;
+   MIL_UINT32 Decision;                    // EQualityDecision of the scan.
+   MIL_UINT64 NbScans;
+   MIL_UINT64 NbDroppedScans;              // Not inspected: skipped by the quality gate or without valid data.
+   MIL_UINT64 NbFlaggedScans;              // Flagged for review or downgraded.
+   MIL_DOUBLE ScansPerSecond;              // Averaged over the last scans.
+   MIL_DOUBLE ScanLatency;                 // From the grab to the result, in s.
+   MIL_DOUBLE MaxScanLatency;              // In s.
+   MIL_DOUBLE ValidCoverage;               // Fraction of the pixels with valid 3D data.
+   MIL_UINT32 NbDefects;
+   MIL_UINT32 NbPeaks;
+   MIL_UINT64 MemoryHighWaterMark;         // Of the pipeline buffers, in bytes.
+   MIL_UINT32 NbStages;
+   MIL_UINT32 NbQueues;
+   char       StageNames[TELEMETRY_MAX_STAGES][TELEMETRY_NAME_LENGTH];
+   MIL_FLOAT  StageLatencies[TELEMETRY_MAX_STAGES];   // In s.
+   char       QueueNames[TELEMETRY_MAX_QUEUES][TELEMETRY_NAME_LENGTH];
+   MIL_FLOAT  QueueDepths[TELEMETRY_MAX_QUEUES];      // Mean of the samples of the scan.
+   };
+
+// Header of the ring.
+struct STelemetryRingHeader
+   {
+   MIL_UINT32 Magic;
+   MIL_UINT16 Version;
+   MIL_UINT16 HeaderSize;
+   MIL_UINT32 NbSlots;
+   MIL_UINT32 SampleSize;
+   volatile MIL_INT64 WriteCount;
+   MIL_UINT32 ProcessId;                   // Of the publisher.
+   MIL_UINT32 Reserved;
+   };
+
+//////////////////////////////////////////////////////////////////////////
+// Class that publishes the telemetry samples in a named shared memory.
+// The publisher is used from a single thread.
+//////////////////////////////////////////////////////////////////////////
+class CTelemetryPublisher
+   {
+   public:
+      // Constructor.
+      CTelemetryPublisher()
+         : m_hMapping(NULL),
+           m_pHeader(NULL),
+           m_pSlots(NULL),
+           m_StartTime(0.0),
+           m_LastPublishTime(-1.0),
+           m_PauseStartTime(-1.0),
+           m_GrabTime(0.0)
+         {
+         memset(&m_Sample, 0, sizeof(m_Sample));
+         memset(m_QueueDepthSums, 0, sizeof(m_QueueDepthSums));
+         memset(m_NbQueueSamples, 0, sizeof(m_NbQueueSamples));
+         }
+
+      // Destructor.
+      virtual ~CTelemetryPublisher()
+         {
+         Close();
+         }
+
+      // Function that creates the shared memory of the ring and restarts the counters.
+      bool Open(const char* Name)
+         {
+         Close();
+         MIL_UINT64 MappingSize = sizeof(STelemetryRingHeader) + TELEMETRY_NB_SLOTS * sizeof(STelemetrySample);
+         m_hMapping = CreateFileMappingA(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE, 0, (DWORD)MappingSize, Name);
+         if(!m_hMapping)
+            return false;
+         m_pHeader = (STelemetryRingHeader*)MapViewOfFile(m_hMapping, FILE_MAP_ALL_ACCESS, 0, 0, (size_t)MappingSize);
+         if(!m_pHeader)
+            {
+            Close();
+            return false;
+            }
+         m_pSlots = (STelemetrySample*)(m_pHeader + 1);
+
+         // Invalidate the slots before the header, in case a reader is attached.
+         m_pHeader->Magic = 0;
+         memset(m_pSlots, 0, TELEMETRY_NB_SLOTS * sizeof(STelemetrySample));
+         m_pHeader->Version = TELEMETRY_VERSION;
+         m_pHeader->HeaderSize = (MIL_UINT16)sizeof(STelemetryRingHeader);
+         m_pHeader->NbSlots = (MIL_UINT32)TELEMETRY_NB_SLOTS;
+         m_pHeader->SampleSize = (MIL_UINT32)sizeof(STelemetrySample);
+         m_pHeader->ProcessId = (MIL_UINT32)GetCurrentProcessId();
+         InterlockedExchange64((volatile LONGLONG*)&m_pHeader->WriteCount, 0);
+         InterlockedExchange((volatile LONG*)&m_pHeader->Magic, (LONG)TELEMETRY_MAGIC);
+
+         memset(&m_Sample, 0, sizeof(m_Sample));
+         MappTimer(M_DEFAULT, M_TIMER_READ, &m_StartTime);
+         m_LastPublishTime = -1.0;
+         m_PauseStartTime = -1.0;
+         return true;
+         }
+
+      // Function that closes the ring.
+      void Close()
+         {
+         if(m_pHeader)
+            UnmapViewOfFile(m_pHeader);
+         if(m_hMapping)
+            CloseHandle(m_hMapping);
+         m_hMapping = NULL;
+         m_pHeader = NULL;
+         m_pSlots = NULL;
+         }
+
+      // Function that starts the sample of a scan. The grab time is a MappTimer time.
+      void BeginScan(MIL_UINT64 ScanIdx, MIL_INT RecipeIdx, MIL_DOUBLE GrabTime)
+         {
+         m_Sample.ScanIdx = ScanIdx;
+         m_Sample.RecipeIdx = (MIL_UINT32)RecipeIdx;
+         m_Sample.ValidCoverage = 0.0;
+         m_Sample.NbDefects = 0;
+         m_Sample.NbPeaks = 0;
+         m_Sample.NbStages = 0;
+         m_Sample.NbQueues = 0;
+         m_GrabTime = GrabTime;
+         }
+
+      // Function that adds the latency of a stage, in s.
+      void SetStageLatency(const char* Name, MIL_DOUBLE Latency)
+         {
+         if(m_Sample.NbStages < (MIL_UINT32)TELEMETRY_MAX_STAGES)
+            {
+            CopyName(m_Sample.StageNames[m_Sample.NbStages], Name);
+            m_Sample.StageLatencies[m_Sample.NbStages++] = (MIL_FLOAT)Latency;
+            }
+         }
+
+      // Function that adds a sample of the depth of a queue. The depth published
+      // is the mean of the samples of the queue in the scan, so a queue can be
+      // sampled at each stage boundary.
+      void SetQueueDepth(const char* Name, MIL_DOUBLE Depth)
+         {
+         MIL_UINT32 QueueIdx = 0;
+         while(QueueIdx < m_Sample.NbQueues && strncmp(m_Sample.QueueNames[QueueIdx], Name, TELEMETRY_NAME_LENGTH - 1) != 0)
+            QueueIdx++;
+         if(QueueIdx == m_Sample.NbQueues)
+            {
+            if(QueueIdx == (MIL_UINT32)TELEMETRY_MAX_QUEUES)
+               return;
+            CopyName(m_Sample.QueueNames[m_Sample.NbQueues++], Name);
+            m_QueueDepthSums[QueueIdx] = 0.0;
+            m_NbQueueSamples[QueueIdx] = 0;
+            }
+         m_QueueDepthSums[QueueIdx] += Depth;
+         m_NbQueueSamples[QueueIdx]++;
+         m_Sample.QueueDepths[QueueIdx] = (MIL_FLOAT)(m_QueueDepthSums[QueueIdx] / m_NbQueueSamples[QueueIdx]);
+         }
+
+      // Functions that set the gauges of the scan.
+      void SetValidCoverage(MIL_DOUBLE Coverage) {m_Sample.ValidCoverage = Coverage;}
+      void SetNbDefects(MIL_INT NbDefects) {m_Sample.NbDefects = (MIL_UINT32)NbDefects;}
+      void SetNbPeaks(MIL_INT NbPeaks) {m_Sample.NbPeaks = (MIL_UINT32)NbPeaks;}
+
+      // Function that updates the memory high-water mark, in bytes.
+      void SetMemory(MIL_INT NbBytes)
+         {
+         if((MIL_UINT64)NbBytes > m_Sample.MemoryHighWaterMark)
+            m_Sample.MemoryHighWaterMark = (MIL_UINT64)NbBytes;
+         }
+
+      // Functions that exclude a wait that is not part of the processing, such as
+      // a user prompt, from the scan rate.
+      void Pause()
+         {
+         MappTimer(M_DEFAULT, M_TIMER_READ, &m_PauseStartTime);
+         }
+      void Resume()
+         {
+         if(m_PauseStartTime < 0.0)
+            return;
+         MIL_DOUBLE CurrentTime;
+         MappTimer(M_DEFAULT, M_TIMER_READ, &CurrentTime);
+         if(m_LastPublishTime >= 0.0)
+            m_LastPublishTime += CurrentTime - m_PauseStartTime;
+         m_PauseStartTime = -1.0;
+         }
+
+      // Function that ends the scan, updates the counters and publishes the sample.
+      // The sample is a copy to the shared memory; nothing waits for the readers.
+      void Publish(MIL_INT Decision, bool Dropped, bool Flagged)
+         {
+         MIL_DOUBLE CurrentTime;
+         MappTimer(M_DEFAULT, M_TIMER_READ, &CurrentTime);
+         m_Sample.Time = CurrentTime - m_StartTime;
+         m_Sample.Decision = (MIL_UINT32)Decision;
+         m_Sample.NbScans++;
+         if(Dropped)
+            m_Sample.NbDroppedScans++;
+         if(Flagged)
+            m_Sample.NbFlaggedScans++;
+         m_Sample.ScanLatency = CurrentTime - m_GrabTime;
+         if(m_Sample.ScanLatency > m_Sample.MaxScanLatency)
+            m_Sample.MaxScanLatency = m_Sample.ScanLatency;
+         if(m_LastPublishTime >= 0.0 && CurrentTime > m_LastPublishTime)
+            {
+            MIL_DOUBLE Rate = 1.0 / (CurrentTime - m_LastPublishTime);
+            m_Sample.ScansPerSecond = m_Sample.NbScans > 2 ? m_Sample.ScansPerSecond + TELEMETRY_RATE_SMOOTHING * (Rate - m_Sample.ScansPerSecond) : Rate;
+            }
+         m_LastPublishTime = CurrentTime;
+
+         if(!m_pHeader)
+            return;
+
+         // Mark the slot as being written, copy the sample after its sequence
+         // number, then mark it as written and publish it.
+         MIL_INT64 SampleIdx = m_pHeader->WriteCount;
+         STelemetrySample* pSlot = &m_pSlots[SampleIdx % TELEMETRY_NB_SLOTS];
+         InterlockedExchange64((volatile LONGLONG*)&pSlot->Sequence, 2 * SampleIdx + 1);
+         memcpy((MIL_UINT8*)pSlot + sizeof(MIL_INT64), (const MIL_UINT8*)&m_Sample + sizeof(MIL_INT64), sizeof(STelemetrySample) - sizeof(MIL_INT64));
+         InterlockedExchange64((volatile LONGLONG*)&pSlot->Sequence, 2 * SampleIdx + 2);
+         InterlockedExchange64((volatile LONGLONG*)&m_pHeader->WriteCount, SampleIdx + 1);
+         }
+
+   private:
+      // Disallow copy.
+      CTelemetryPublisher(const CTelemetryPublisher&);
+      CTelemetryPublisher& operator=(const CTelemetryPublisher&);
+
+      static void CopyName(char* pDst, const char* Name)
+         {
+         strncpy(pDst, Name, TELEMETRY_NAME_LENGTH - 1);
+         pDst[TELEMETRY_NAME_LENGTH - 1] = 0;
+         }
+
+      HANDLE                m_hMapping;
+      STelemetryRingHeader* m_pHeader;
+      STelemetrySample*     m_pSlots;
+      STelemetrySample      m_Sample;
+      MIL_DOUBLE            m_StartTime;
+      MIL_DOUBLE            m_LastPublishTime;   // Moved forward by the pauses since.
+      MIL_DOUBLE            m_PauseStartTime;    // Negative when not paused.
+      MIL_DOUBLE            m_GrabTime;
+      MIL_DOUBLE            m_QueueDepthSums[TELEMETRY_MAX_QUEUES];
+      MIL_INT               m_NbQueueSamples[TELEMETRY_MAX_QUEUES];
+   };
+
+//////////////////////////////////////////////////////////////////////////
+// Class that reads the telemetry samples from the shared memory, read only.
+//////////////////////////////////////////////////////////////////////////
+class CTelemetryReader
+   {
+   public:
+      // Constructor.
+      CTelemetryReader()
+         : m_hMapping(NULL),
+           m_pHeader(NULL),
+           m_pSlots(NULL)
+         {
+         }
+
+      // Destructor.
+      virtual ~CTelemetryReader()
+         {
+         Close();
+         }
+
+      // Function that opens the shared memory of a publisher. Returns false if
+      // no publisher created it.
+      bool Open(const char* Name)
+         {
+         Close();
+         m_hMapping = OpenFileMappingA(FILE_MAP_READ, FALSE, Name);
+         if(!m_hMapping)
+            return false;
+         m_pHeader = (const STelemetryRingHeader*)MapViewOfFile(m_hMapping, FILE_MAP_READ, 0, 0, 0);
+         if(!m_pHeader)
+            {
+            Close();
+            return false;
+            }
+         m_pSlots = (const STelemetrySample*)(m_pHeader + 1);
+         return true;
+         }
+
+      // Function that closes the shared memory.
+      void Close()
+         {
+         if(m_pHeader)
+            UnmapViewOfFile(m_pHeader);
+         if(m_hMapping)
+            CloseHandle(m_hMapping);
+         m_hMapping = NULL;
+         m_pHeader = NULL;
+         m_pSlots = NULL;
+         }
+
+      // Function that returns whether the ring is initialized by a publisher of
+      // this version.
+      bool IsValid() const
+         {
+         return m_pHeader && m_pHeader->Magic == TELEMETRY_MAGIC && m_pHeader->Version == TELEMETRY_VERSION &&
+                m_pHeader->NbSlots == (MIL_UINT32)TELEMETRY_NB_SLOTS && m_pHeader->SampleSize == (MIL_UINT32)sizeof(STelemetrySample);
+         }
+
+      // Function that returns the number of samples ever published.
+      MIL_INT64 GetWriteCount() const {return IsValid() ? m_pHeader->WriteCount : 0;}
+
+      // Function that returns the process identifier of the publisher.
+      MIL_UINT32 GetPublisherProcessId() const {return m_pHeader ? m_pHeader->ProcessId : 0;}
+
+      // Function that copies a sample. Returns false if the sample is not
+      // published yet, or was overwritten before or during the copy.
+      bool Read(MIL_INT64 SampleIdx, STelemetrySample* pSample) const
+         {
+         if(!IsValid() || SampleIdx < 0)
+            return false;
+         const STelemetrySample* pSlot = &m_pSlots[SampleIdx % TELEMETRY_NB_SLOTS];
+         MIL_INT64 Sequence = pSlot->Sequence;
+         if(Sequence != 2 * SampleIdx + 2)
+            return false;
+         MemoryBarrier();
+         memcpy(pSample, (const void*)pSlot, sizeof(STelemetrySample));
+         MemoryBarrier();
+         return pSlot->Sequence == Sequence;
+         }
+
+   private:
+      // Disallow copy.
+      CTelemetryReader(const CTelemetryReader&);
+      CTelemetryReader& operator=(const CTelemetryReader&);
+
+      HANDLE                      m_hMapping;
+      const STelemetryRingHeader* m_pHeader;
+      const STelemetrySample*     m_pSlots;
+   };
@@ -0,0 +1,556 @@
+﻿//***************************************************************************************/
+//
+// File name: PipelineThreadPool.h
+//
+// Synopsis:  Contains the pinned thread pool used by the Chromasens_3DPIXA_M10PP3
+//            example. Each thread role (acquisition, 3D, post-processing, host)
+//            is placed on a set of cores with a priority. The roles that own
+//            workers in the pool run the submitted tasks; every worker has its
+//            own queue and steals the oldest tasks of the other workers of its
+//            role when its queue is empty. The busy time of every worker is
+//            measured to report its utilization.
+//
+//            The roles without workers are dedicated threads, such as the
+//            acquisition and 3D threads, placed with PlaceCurrentThread().
+//
+// Copyright © 1992-2024 Zebra Technologies Corp. and/or its affiliates
+// All Rights Reserved
+
+#include <string.h>
+#if defined(_WIN32)
+   #include <windows.h>
+#else
+   #include <pthread.h>
+   #include <sched.h>
+   #include <unistd.h>
+#endif
+
+static const MIL_INT THREAD_POOL_MAX_WORKERS      = 64;
+static const MIL_INT THREAD_POOL_MAX_ROLES        = 8;
+static const MIL_INT THREAD_POOL_MAX_QUEUED_TASKS = 64;   // Per worker.
+static const MIL_INT THREAD_POOL_ALL_CORES        = -1;
+
+// Priority of the threads of a role, relative to the normal priority.
+enum EThreadPriority
+   {
+   THREAD_POOL_PRIORITY_LOWEST        = -2,
+   THREAD_POOL_PRIORITY_BELOW_NORMAL  = -1,
+   THREAD_POOL_PRIORITY_NORMAL        =  0,
+   THREAD_POOL_PRIORITY_ABOVE_NORMAL  =  1,
+   THREAD_POOL_PRIORITY_HIGHEST       =  2
+   };
+
+// Placement of the threads of a role. The cores are counted modulo the number
+// of processors.
+struct SThreadRoleConfig
+   {
+   const char*     Name;
+   MIL_INT         FirstCore;
+   MIL_INT         NbCores;         // 0 to leave the threads unpinned, THREAD_POOL_ALL_CORES for the remaining cores.
+   bool            PinEachThread;   // Pin each thread to a single core of the set instead of the whole set.
+   EThreadPriority Priority;
+   MIL_INT         NbThreads;       // Workers of the pool, THREAD_POOL_ALL_CORES for one per core of the set, 0 for a dedicated thread.
+   };
+
+// Function run by a worker of the pool.
+typedef void (*ThreadPoolTask)(void* pData);
+
+//////////////////////////////////////////////////////////////////////////
+// Class that counts the tasks of a batch until they are all done. A batch
+// is waited from a single thread.
+//////////////////////////////////////////////////////////////////////////
+class CThreadPoolBatch
+   {
+   public:
+      // Constructor. Allocates the synchronization objects.
+      CThreadPoolBatch()
+         : m_NbPending(0)
+         {
+         MthrAlloc(M_DEFAULT_HOST, M_MUTEX, M_DEFAULT, M_NULL, M_NULL, &m_MilMutex);
+         MthrAlloc(M_DEFAULT_HOST, M_EVENT, M_NOT_SIGNALED + M_AUTO_RESET, M_NULL, M_NULL, &m_MilDoneEvent);
+         }
+
+      // Destructor. Waits for the pending tasks.
+      virtual ~CThreadPoolBatch()
+         {
+         Wait();
+         MthrFree(m_MilDoneEvent);
+         MthrFree(m_MilMutex);
+         }
+
+      // Function that adds a task to the batch.
+      void Add()
+         {
+         MthrControl(m_MilMutex, M_LOCK, M_DEFAULT);
+         m_NbPending++;
+         MthrControl(m_MilMutex, M_UNLOCK, M_DEFAULT);
+         }
+
+      // Function that marks a task of the batch as done. The event is signaled
+      // before the mutex is released, so that the waiter, which can free the
+      // batch as soon as it sees no pending task, only does it once the unlock
+      // is the last access of the batch.
+      void Done()
+         {
+         MthrControl(m_MilMutex, M_LOCK, M_DEFAULT);
+         m_NbPending--;
+         MthrControl(m_MilDoneEvent, M_EVENT_SET, M_SIGNALED);
+         MthrControl(m_MilMutex, M_UNLOCK, M_DEFAULT);
+         }
+
+      // Function that waits until all the tasks of the batch are done.
+      void Wait()
+         {
+         MthrControl(m_MilMutex, M_LOCK, M_DEFAULT);
+         while(m_NbPending > 0)
+            {
+            MthrControl(m_MilMutex, M_UNLOCK, M_DEFAULT);
+            MthrWait(m_MilDoneEvent, M_EVENT_WAIT, M_NULL);
+            MthrControl(m_MilMutex, M_LOCK, M_DEFAULT);
+            }
+         MthrControl(m_MilMutex, M_UNLOCK, M_DEFAULT);
+         }
+
+   private:
+      // Disallow copy.
+      CThreadPoolBatch(const CThreadPoolBatch&);
+      CThreadPoolBatch& operator=(const CThreadPoolBatch&);
+
+      MIL_INT m_NbPending;
+      MIL_ID  m_MilMutex;
+      MIL_ID  m_MilDoneEvent;
+   };
+
+// Task queued in a worker.
+struct SThreadPoolTask
+   {
+   ThreadPoolTask    Function;
+   void*             pData;
+   CThreadPoolBatch* pBatch;
+   };
+
+class CPipelineThreadPool;
+
+// Worker of the pool, with its queue and its statistics. The owner takes the
+// newest task of its queue and the thieves take the oldest one.
+struct SThreadPoolWorker
+   {
+   CPipelineThreadPool* pPool;
+   MIL_INT              Role;
+   MIL_INT              RoleThreadIdx;
+   MIL_ID               MilThread;
+   MIL_ID               MilMutex;
+   SThreadPoolTask      Tasks[THREAD_POOL_MAX_QUEUED_TASKS];
+   MIL_INT              FirstTask;
+   MIL_INT              NbTasks;
+   MIL_DOUBLE           BusyTime;
+   MIL_INT              NbRunTasks;
+   MIL_INT              NbStolenTasks;
+#if defined(_WIN32)
+   DWORD                ThreadId;      // Set by the worker when it starts.
+#else
+   pthread_t            ThreadId;
+#endif
+   };
+
+// Role of the pool and its workers.
+struct SThreadPoolRole
+   {
+   SThreadRoleConfig Config;
+   MIL_INT           FirstWorker;
+   MIL_INT           NbWorkers;
+   MIL_INT           NextWorker;
+   MIL_INT           NbQueued;
+   MIL_INT           SumQueued;         // Of the depths seen by the submitted tasks, since the last take.
+   MIL_INT           NbQueueSamples;
+   MIL_ID            MilMutex;
+   MIL_ID            MilWorkEvent;
+   };
+
+//*****************************************************************************
+// GetNbProcessors. Returns the number of processors.
+//*****************************************************************************
+inline MIL_INT GetNbProcessors()
+   {
+#if defined(_WIN32)
+   SYSTEM_INFO SystemInfo;
+   GetSystemInfo(&SystemInfo);
+   return (MIL_INT)SystemInfo.dwNumberOfProcessors;
+#else
+   return (MIL_INT)sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+   }
+
+//*****************************************************************************
+// GetRoleCore. Returns the core of a role on which a thread of the role is
+//              pinned, or -1 if the thread is not pinned to a single core.
+//*****************************************************************************
+inline MIL_INT GetRoleCore(const SThreadRoleConfig& Config, MIL_INT RoleThreadIdx, MIL_INT NbProcessors)
+   {
+   MIL_INT NbCores = Config.NbCores == THREAD_POOL_ALL_CORES ? NbProcessors - Config.FirstCore % NbProcessors : Config.NbCores;
+   if(NbCores <= 0 || !Config.PinEachThread)
+      return -1;
+   return (Config.FirstCore + RoleThreadIdx % NbCores) % NbProcessors;
+   }
+
+//*****************************************************************************
+// GetRoleNbCores. Returns the number of cores of the set of a role, or the
+//                 number of processors if the role is not pinned.
+//*****************************************************************************
+inline MIL_INT GetRoleNbCores(const SThreadRoleConfig& Config, MIL_INT NbProcessors)
+   {
+   MIL_INT NbCores = Config.NbCores == THREAD_POOL_ALL_CORES ? NbProcessors - Config.FirstCore % NbProcessors : Config.NbCores;
+   if(NbCores <= 0 || NbCores > NbProcessors)
+      NbCores = NbProcessors;
+   return NbCores;
+   }
+
+//*****************************************************************************
+// PlaceCurrentThread. Pins the calling thread on the cores of its role and
+//                     sets its priority. The priority is only set on Windows.
+//*****************************************************************************
+inline void PlaceCurrentThread(const SThreadRoleConfig& Config, MIL_INT RoleThreadIdx)
+   {
+   MIL_INT NbProcessors = GetNbProcessors();
+   if(Config.NbCores != 0 && NbProcessors > 0)
+      {
+      // Get the cores of the thread.
+      MIL_INT FirstCore = GetRoleCore(Config, RoleThreadIdx, NbProcessors);
+      MIL_INT NbCores = 1;
+      if(FirstCore < 0)
+         {
+         FirstCore = Config.FirstCore % NbProcessors;
+         NbCores = GetRoleNbCores(Config, NbProcessors);
+         }
+
+#if defined(_WIN32)
+      DWORD_PTR AffinityMask = 0;
+      for(MIL_INT CoreIdx = 0; CoreIdx < NbCores; CoreIdx++)
+         {
+         MIL_INT Core = (FirstCore + CoreIdx) % NbProcessors;
+         if(Core < (MIL_INT)(sizeof(DWORD_PTR) * 8))
+            AffinityMask |= (DWORD_PTR)1 << Core;
+         }
+      if(AffinityMask)
+         SetThreadAffinityMask(GetCurrentThread(), AffinityMask);
+#else
+      cpu_set_t CoreSet;
+      CPU_ZERO(&CoreSet);
+      for(MIL_INT CoreIdx = 0; CoreIdx < NbCores; CoreIdx++)
+         CPU_SET((FirstCore + CoreIdx) % NbProcessors, &CoreSet);
+      pthread_setaffinity_np(pthread_self(), sizeof(CoreSet), &CoreSet);
+#endif
+      }
+
+#if defined(_WIN32)
+   SetThreadPriority(GetCurrentThread(), (int)Config.Priority);
+#endif
+   }
+
+//////////////////////////////////////////////////////////////////////////
+// Class that runs the tasks of the pipeline on workers pinned by role.
+//////////////////////////////////////////////////////////////////////////
+class CPipelineThreadPool
+   {
+   public:
+      // Constructor. Starts the workers of the roles.
+      CPipelineThreadPool(const SThreadRoleConfig* pRoles, MIL_INT NbRoles)
+         : m_NbRoles(0),
+           m_NbWorkers(0),
+           m_Stop(false)
+         {
+         MIL_INT NbProcessors = GetNbProcessors();
+         for(MIL_INT RoleIdx = 0; RoleIdx < NbRoles && RoleIdx < THREAD_POOL_MAX_ROLES; RoleIdx++)
+            {
+            SThreadPoolRole& Role = m_Roles[m_NbRoles++];
+            Role.Config = pRoles[RoleIdx];
+            Role.FirstWorker = m_NbWorkers;
+            Role.NbWorkers = Role.Config.NbThreads == THREAD_POOL_ALL_CORES ? GetRoleNbCores(Role.Config, NbProcessors) : Role.Config.NbThreads;
+            if(Role.NbWorkers > THREAD_POOL_MAX_WORKERS - m_NbWorkers)
+               Role.NbWorkers = THREAD_POOL_MAX_WORKERS - m_NbWorkers;
+            Role.NextWorker = 0;
+            Role.NbQueued = 0;
+            Role.SumQueued = 0;
+            Role.NbQueueSamples = 0;
+            MthrAlloc(M_DEFAULT_HOST, M_MUTEX, M_DEFAULT, M_NULL, M_NULL, &Role.MilMutex);
+            MthrAlloc(M_DEFAULT_HOST, M_EVENT, M_NOT_SIGNALED + M_AUTO_RESET, M_NULL, M_NULL, &Role.MilWorkEvent);
+
+            for(MIL_INT RoleThreadIdx = 0; RoleThreadIdx < Role.NbWorkers; RoleThreadIdx++)
+               {
+               SThreadPoolWorker& Worker = m_Workers[m_NbWorkers++];
+               memset(&Worker, 0, sizeof(Worker));
+               Worker.pPool = this;
+               Worker.Role = RoleIdx;
+               Worker.RoleThreadIdx = RoleThreadIdx;
+               MthrAlloc(M_DEFAULT_HOST, M_MUTEX, M_DEFAULT, M_NULL, M_NULL, &Worker.MilMutex);
+               }
+            }
+         ResetStatistics();
+
+         // Start the workers once they are all set, since they steal from each other.
+         for(MIL_INT WorkerIdx = 0; WorkerIdx < m_NbWorkers; WorkerIdx++)
+            MthrAlloc(M_DEFAULT_HOST, M_THREAD, M_DEFAULT, WorkerThread, &m_Workers[WorkerIdx], &m_Workers[WorkerIdx].MilThread);
+         }
+
+      // Destructor. The queued tasks are run before the workers stop.
+      virtual ~CPipelineThreadPool()
+         {
+         for(MIL_INT RoleIdx = 0; RoleIdx < m_NbRoles; RoleIdx++)
+            {
+            MthrControl(m_Roles[RoleIdx].MilMutex, M_LOCK, M_DEFAULT);
+            m_Stop = true;
+            MthrControl(m_Roles[RoleIdx].MilMutex, M_UNLOCK, M_DEFAULT);
+            MthrControl(m_Roles[RoleIdx].MilWorkEvent, M_EVENT_SET, M_SIGNALED);
+            }
+         for(MIL_INT WorkerIdx = 0; WorkerIdx < m_NbWorkers; WorkerIdx++)
+            {
+            MthrWait(m_Workers[WorkerIdx].MilThread, M_THREAD_END_WAIT, M_NULL);
+            MthrFree(m_Workers[WorkerIdx].MilThread);
+            MthrFree(m_Workers[WorkerIdx].MilMutex);
+            }
+         for(MIL_INT RoleIdx = 0; RoleIdx < m_NbRoles; RoleIdx++)
+            {
+            MthrFree(m_Roles[RoleIdx].MilWorkEvent);
+            MthrFree(m_Roles[RoleIdx].MilMutex);
+            }
+         }
+
+      // Function that queues a task in a worker of a role. The task is run in the
+      // calling thread if the role has no worker or if all its queues are full.
+      void Submit(MIL_INT Role, ThreadPoolTask Function, void* pData, CThreadPoolBatch* pBatch)
+         {
+         if(pBatch)
+            pBatch->Add();
+         SThreadPoolTask Task = {Function, pData, pBatch};
+
+         // Queue the task in the next worker, round robin, or the first one with room.
+         bool Queued = false;
+         if(Role >= 0 && Role < m_NbRoles && m_Roles[Role].NbWorkers > 0)
+            {
+            SThreadPoolRole& PoolRole = m_Roles[Role];
+            MthrControl(PoolRole.MilMutex, M_LOCK, M_DEFAULT);
+            MIL_INT StartWorker = PoolRole.NextWorker;
+            PoolRole.NextWorker = (PoolRole.NextWorker + 1) % PoolRole.NbWorkers;
+            MthrControl(PoolRole.MilMutex, M_UNLOCK, M_DEFAULT);
+            for(MIL_INT TryIdx = 0; TryIdx < PoolRole.NbWorkers && !Queued; TryIdx++)
+               {
+               SThreadPoolWorker& Worker = m_Workers[PoolRole.FirstWorker + (StartWorker + TryIdx) % PoolRole.NbWorkers];
+               MthrControl(Worker.MilMutex, M_LOCK, M_DEFAULT);
+               if(Worker.NbTasks < THREAD_POOL_MAX_QUEUED_TASKS)
+                  {
+                  Worker.Tasks[(Worker.FirstTask + Worker.NbTasks) % THREAD_POOL_MAX_QUEUED_TASKS] = Task;
+                  Worker.NbTasks++;
+                  Queued = true;
+                  }
+               MthrControl(Worker.MilMutex, M_UNLOCK, M_DEFAULT);
+               }
+            if(Queued)
+               {
+               MthrControl(PoolRole.MilMutex, M_LOCK, M_DEFAULT);
+               PoolRole.NbQueued++;
+               PoolRole.SumQueued += PoolRole.NbQueued;
+               PoolRole.NbQueueSamples++;
+               MthrControl(PoolRole.MilMutex, M_UNLOCK, M_DEFAULT);
+               MthrControl(PoolRole.MilWorkEvent, M_EVENT_SET, M_SIGNALED);
+               }
+            }
+         if(!Queued)
+            {
+            Function(pData);
+            if(pBatch)
+               pBatch->Done();
+            }
+         }
+
+      // Function that returns the number of workers of a role.
+      MIL_INT GetNbWorkers(MIL_INT Role) const
+         {
+         return Role >= 0 && Role < m_NbRoles ? m_Roles[Role].NbWorkers : 0;
+         }
+
+      // Function that returns the number of tasks queued for a role and not started.
+      MIL_INT GetNbQueued(MIL_INT Role)
+         {
+         if(Role < 0 || Role >= m_NbRoles)
+            return 0;
+         MthrControl(m_Roles[Role].MilMutex, M_LOCK, M_DEFAULT);
+         MIL_INT NbQueued = m_Roles[Role].NbQueued;
+         MthrControl(m_Roles[Role].MilMutex, M_UNLOCK, M_DEFAULT);
+         return NbQueued;
+         }
+
+      // Function that returns whether the calling thread is a worker of the pool.
+      // A worker must not wait for the tasks it submits, since all the workers
+      // could be waiting.
+      bool IsWorkerThread() const
+         {
+         for(MIL_INT WorkerIdx = 0; WorkerIdx < m_NbWorkers; WorkerIdx++)
+            {
+#if defined(_WIN32)
+            if(m_Workers[WorkerIdx].ThreadId == GetCurrentThreadId())
+#else
+            if(pthread_equal(m_Workers[WorkerIdx].ThreadId, pthread_self()))
+#endif
+               return true;
+            }
+         return false;
+         }
+
+      // Function that returns the mean number of tasks queued for a role, as seen
+      // by each task submitted since the last call, and restarts the mean.
+      MIL_DOUBLE TakeMeanQueued(MIL_INT Role)
+         {
+         if(Role < 0 || Role >= m_NbRoles)
+            return 0.0;
+         SThreadPoolRole& PoolRole = m_Roles[Role];
+         MthrControl(PoolRole.MilMutex, M_LOCK, M_DEFAULT);
+         MIL_DOUBLE MeanQueued = PoolRole.NbQueueSamples > 0 ? (MIL_DOUBLE)PoolRole.SumQueued / PoolRole.NbQueueSamples : 0.0;
+         PoolRole.SumQueued = 0;
+         PoolRole.NbQueueSamples = 0;
+         MthrControl(PoolRole.MilMutex, M_UNLOCK, M_DEFAULT);
+         return MeanQueued;
+         }
+
+      // Function that returns the placement of a role.
+      const SThreadRoleConfig& GetRoleConfig(MIL_INT Role) const {return m_Roles[Role].Config;}
+
+      // Function that restarts the measurement of the utilization.
+      void ResetStatistics()
+         {
+         MappTimer(M_DEFAULT, M_TIMER_READ, &m_StatisticsStartTime);
+         for(MIL_INT WorkerIdx = 0; WorkerIdx < m_NbWorkers; WorkerIdx++)
+            {
+            SThreadPoolWorker& Worker = m_Workers[WorkerIdx];
+            MthrControl(Worker.MilMutex, M_LOCK, M_DEFAULT);
+            Worker.BusyTime = 0.0;
+            Worker.NbRunTasks = 0;
+            Worker.NbStolenTasks = 0;
+            MthrControl(Worker.MilMutex, M_UNLOCK, M_DEFAULT);
+            }
+         }
+
+      // Function that prints the utilization of every worker since the last reset.
+      void PrintStatistics()
+         {
+         MIL_DOUBLE CurrentTime;
+         MappTimer(M_DEFAULT, M_TIMER_READ, &CurrentTime);
+         MIL_DOUBLE ElapsedTime = CurrentTime - m_StatisticsStartTime;
+         MIL_INT NbProcessors = GetNbProcessors();
+         MosPrintf(MIL_TEXT("Thread pool utilization over %.2f s:\n"), ElapsedTime);
+         MosPrintf(MIL_TEXT("   Role              Thread  Core  Tasks  Stolen    Busy (ms)  Utilization\n"));
+         for(MIL_INT WorkerIdx = 0; WorkerIdx < m_NbWorkers; WorkerIdx++)
+            {
+            SThreadPoolWorker& Worker = m_Workers[WorkerIdx];
+            const SThreadRoleConfig& Config = m_Roles[Worker.Role].Config;
+            MthrControl(Worker.MilMutex, M_LOCK, M_DEFAULT);
+            MIL_DOUBLE BusyTime = Worker.BusyTime;
+            MIL_INT NbRunTasks = Worker.NbRunTasks;
+            MIL_INT NbStolenTasks = Worker.NbStolenTasks;
+            MthrControl(Worker.MilMutex, M_UNLOCK, M_DEFAULT);
+            MIL_INT Core = GetRoleCore(Config, Worker.RoleThreadIdx, NbProcessors);
+            MosPrintf(MIL_TEXT("   %-16hs  %6d  "), Config.Name, (int)Worker.RoleThreadIdx);
+            if(Core >= 0)
+               MosPrintf(MIL_TEXT("%4d"), (int)Core);
+            else
+               MosPrintf(MIL_TEXT("   -"));
+            MosPrintf(MIL_TEXT("  %5d  %6d  %11.1f  %10.1f%%\n"), (int)NbRunTasks, (int)NbStolenTasks, BusyTime * 1000.0,
+                      ElapsedTime > 0.0 ? 100.0 * BusyTime / ElapsedTime : 0.0);
+            }
+         MosPrintf(MIL_TEXT("\n"));
+         }
+
+   private:
+      // Disallow copy.
+      CPipelineThreadPool(const CPipelineThreadPool&);
+      CPipelineThreadPool& operator=(const CPipelineThreadPool&);
+
+      // Function that takes a task from the queue of a worker, the newest one if
+      // the worker is the owner and the oldest one otherwise.
+      static bool TakeTask(SThreadPoolWorker* pWorker, bool Steal, SThreadPoolTask* pTask)
+         {
+         bool HasTask = false;
+         MthrControl(pWorker->MilMutex, M_LOCK, M_DEFAULT);
+         if(pWorker->NbTasks > 0)
+            {
+            if(Steal)
+               {
+               *pTask = pWorker->Tasks[pWorker->FirstTask];
+               pWorker->FirstTask = (pWorker->FirstTask + 1) % THREAD_POOL_MAX_QUEUED_TASKS;
+               }
+            else
+               *pTask = pWorker->Tasks[(pWorker->FirstTask + pWorker->NbTasks - 1) % THREAD_POOL_MAX_QUEUED_TASKS];
+            pWorker->NbTasks--;
+            HasTask = true;
+            }
+         MthrControl(pWorker->MilMutex, M_UNLOCK, M_DEFAULT);
+         return HasTask;
+         }
+
+      // Thread function of a worker. Runs the tasks of its queue, then the ones
+      // stolen from the other workers of its role, and sleeps when there are none.
+      static MIL_UINT32 MFTYPE WorkerThread(void* pWorkerPtr)
+         {
+         SThreadPoolWorker* pWorker = (SThreadPoolWorker*)pWorkerPtr;
+         CPipelineThreadPool* pPool = pWorker->pPool;
+         SThreadPoolRole& Role = pPool->m_Roles[pWorker->Role];
+#if defined(_WIN32)
+         pWorker->ThreadId = GetCurrentThreadId();
+#else
+         pWorker->ThreadId = pthread_self();
+#endif
+         PlaceCurrentThread(Role.Config, pWorker->RoleThreadIdx);
+
+         while(true)
+            {
+            // Take a task from the own queue, or steal one.
+            SThreadPoolTask Task;
+            bool Stolen = false;
+            bool HasTask = TakeTask(pWorker, false, &Task);
+            for(MIL_INT VictimIdx = 1; VictimIdx < Role.NbWorkers && !HasTask; VictimIdx++)
+               {
+               SThreadPoolWorker* pVictim = &pPool->m_Workers[Role.FirstWorker + (pWorker->RoleThreadIdx + VictimIdx) % Role.NbWorkers];
+               HasTask = Stolen = TakeTask(pVictim, true, &Task);
+               }
+
+            // Wake another worker if there are still queued tasks, or sleep.
+            MthrControl(Role.MilMutex, M_LOCK, M_DEFAULT);
+            if(HasTask)
+               Role.NbQueued--;
+            bool WakeOther = Role.NbQueued > 0 || pPool->m_Stop;
+            bool Stop = !HasTask && pPool->m_Stop && Role.NbQueued == 0;
+            MthrControl(Role.MilMutex, M_UNLOCK, M_DEFAULT);
+            if(WakeOther)
+               MthrControl(Role.MilWorkEvent, M_EVENT_SET, M_SIGNALED);
+            if(Stop)
+               break;
+            if(!HasTask)
+               {
+               MthrWait(Role.MilWorkEvent, M_EVENT_WAIT, M_NULL);
+               continue;
+               }
+
+            // Run the task.
+            MIL_DOUBLE StartTime;
+            MIL_DOUBLE EndTime;
+            MappTimer(M_DEFAULT, M_TIMER_READ, &StartTime);
+            Task.Function(Task.pData);
+            MappTimer(M_DEFAULT, M_TIMER_READ, &EndTime);
+            MthrControl(pWorker->MilMutex, M_LOCK, M_DEFAULT);
+            pWorker->BusyTime += EndTime - StartTime;
+            pWorker->NbRunTasks++;
+            if(Stolen)
+               pWorker->NbStolenTasks++;
+            MthrControl(pWorker->MilMutex, M_UNLOCK, M_DEFAULT);
+            if(Task.pBatch)
+               Task.pBatch->Done();
+            }
+         return 0;
+         }
+
+      SThreadPoolRole   m_Roles[THREAD_POOL_MAX_ROLES];
+      MIL_INT           m_NbRoles;
+      SThreadPoolWorker m_Workers[THREAD_POOL_MAX_WORKERS];
+      MIL_INT           m_NbWorkers;
+      MIL_DOUBLE        m_StatisticsStartTime;
+      bool              m_Stop;
+   };
@@ -0,0 +1,319 @@
+﻿//***************************************************************************************/
+//
+// File name: PushPullHoleFiller.h
+//
+// Synopsis:  Contains the push-pull hole filler used by the Chromasens_3DPIXA_M10PP3
+//            example. The valid pixels of the depth map are pushed down a
+//            pyramid where each level is the validity-weighted average of 2x2
+//            pixels of the finer level, with a weight clamped to 1. The levels
+//            are then pulled back up: the pixels of a level whose weight is
+//            below 1 are completed with the bilinear interpolation of the
+//            coarser level. Holes of any size are filled and the cost does not
+//            depend on their size, since the pyramid holds 4/3 of the pixels.
+//
+//            The smoothing replaces the finest levels by the interpolation of
+//            the coarser ones, which low-passes the valid pixels over about
+//            2^SmoothingLevels pixels. The pixels farther than the maximum fill
+//            distance (chessboard distance) from a valid pixel are left invalid.
+//
+//            Invalid input pixels are 0. Filled pixels are in [1, 65534] and
+//            the pixels left invalid are set to MIL_UINT16_MAX, like the kernel
+//            fill of the example. The depth map can be filled in place.
+//
+// Copyright © 1992-2024 Zebra Technologies Corp. and/or its affiliates
+// All Rights Reserved
+
+#include <string.h>
+
+static const MIL_INT PUSH_PULL_MAX_LEVELS = 32;
+
+// Level of the pyramid, stored in the buffers of the filler.
+struct SPushPullLevel
+   {
+   MIL_INT SizeX;
+   MIL_INT SizeY;
+   MIL_INT Offset;   // Of the first pixel in the value and weight buffers.
+   };
+
+//////////////////////////////////////////////////////////////////////////
+// Class that fills the holes of depth maps by push-pull interpolation. The
+// buffers are kept between the depth maps and only grow.
+//////////////////////////////////////////////////////////////////////////
+class CPushPullHoleFiller
+   {
+   public:
+      // Constructor.
+      CPushPullHoleFiller()
+         : m_pValues(NULL),
+           m_pWeights(NULL),
+           m_pDistances(NULL),
+           m_NbLevels(0),
+           m_NbPixels(0),
+           m_NbDistances(0)
+         {
+         }
+
+      // Destructor. Frees the buffers.
+      virtual ~CPushPullHoleFiller()
+         {
+         FreeBuffers();
+         }
+
+      // Function that fills the holes of a depth map. A maximum fill distance of 0
+      // fills every hole.
+      void Fill(const MIL_UINT16* pSrc, MIL_INT SrcPitch, MIL_UINT16* pDst, MIL_INT DstPitch,
+                MIL_INT SizeX, MIL_INT SizeY, MIL_INT SmoothingLevels, MIL_INT MaxFillDistance)
+         {
+         if(SizeX < 1 || SizeY < 1)
+            return;
+         SetLevels(SizeX, SizeY);
+
+         // Load the finest level and find the distance to the valid pixels.
+         bool HasValidPixel = LoadLevel(pSrc, SrcPitch);
+         if(MaxFillDistance > 0)
+            CalculateDistances(MaxFillDistance);
+
+         if(HasValidPixel)
+            {
+            // Push the valid pixels down to the coarsest level.
+            for(MIL_INT Level = 1; Level < m_NbLevels; Level++)
+               Push(m_Levels[Level - 1], m_Levels[Level]);
+
+            // Pull the filled values back up. The smoothed levels ignore their own values.
+            for(MIL_INT Level = m_NbLevels - 2; Level >= 0; Level--)
+               Pull(m_Levels[Level + 1], m_Levels[Level], Level < SmoothingLevels);
+            }
+
+         StoreLevel(pDst, DstPitch, HasValidPixel, MaxFillDistance);
+         }
+
+   private:
+      // Disallow copy.
+      CPushPullHoleFiller(const CPushPullHoleFiller&);
+      CPushPullHoleFiller& operator=(const CPushPullHoleFiller&);
+
+      // Function that sets the levels of a size and reallocates their buffers if
+      // they are too small, so that the depth maps of varying sizes reuse them.
+      void SetLevels(MIL_INT SizeX, MIL_INT SizeY)
+         {
+         if(m_NbLevels > 0 && m_Levels[0].SizeX == SizeX && m_Levels[0].SizeY == SizeY)
+            return;
+         MIL_INT Offset = 0;
+         m_NbLevels = 0;
+         while(m_NbLevels < PUSH_PULL_MAX_LEVELS)
+            {
+            SPushPullLevel& Level = m_Levels[m_NbLevels++];
+            Level.SizeX = SizeX;
+            Level.SizeY = SizeY;
+            Level.Offset = Offset;
+            Offset += SizeX * SizeY;
+            if(SizeX == 1 && SizeY == 1)
+               break;
+            SizeX = (SizeX + 1) / 2;
+            SizeY = (SizeY + 1) / 2;
+            }
+         if(Offset > m_NbPixels || m_Levels[0].SizeX * m_Levels[0].SizeY > m_NbDistances)
+            {
+            FreeBuffers();
+            m_NbPixels = Offset;
+            m_NbDistances = m_Levels[0].SizeX * m_Levels[0].SizeY;
+            m_pValues = new float[m_NbPixels];
+            m_pWeights = new float[m_NbPixels];
+            m_pDistances = new MIL_UINT16[m_NbDistances];
+            }
+         }
+
+      void FreeBuffers()
+         {
+         delete [] m_pValues;
+         delete [] m_pWeights;
+         delete [] m_pDistances;
+         m_pValues = NULL;
+         m_pWeights = NULL;
+         m_pDistances = NULL;
+         m_NbPixels = 0;
+         m_NbDistances = 0;
+         }
+
+      // Function that loads the depth map in the finest level. Returns false if
+      // no pixel is valid.
+      bool LoadLevel(const MIL_UINT16* pSrc, MIL_INT SrcPitch)
+         {
+         const SPushPullLevel& Level = m_Levels[0];
+         bool HasValidPixel = false;
+         for(MIL_INT y = 0; y < Level.SizeY; y++)
+            {
+            const MIL_UINT16* pSrcRow = pSrc + y * SrcPitch;
+            float* pValueRow = m_pValues + Level.Offset + y * Level.SizeX;
+            float* pWeightRow = m_pWeights + Level.Offset + y * Level.SizeX;
+            for(MIL_INT x = 0; x < Level.SizeX; x++)
+               {
+               bool IsValid = pSrcRow[x] != 0 && pSrcRow[x] != MIL_UINT16_MAX;
+               pValueRow[x] = IsValid ? (float)pSrcRow[x] : 0.0f;
+               pWeightRow[x] = IsValid ? 1.0f : 0.0f;
+               HasValidPixel = HasValidPixel || IsValid;
+               }
+            }
+         return HasValidPixel;
+         }
+
+      // Function that calculates the chessboard distance of each pixel to the
+      // nearest valid pixel, saturated above the maximum distance, in two passes.
+      void CalculateDistances(MIL_INT MaxDistance)
+         {
+         const SPushPullLevel& Level = m_Levels[0];
+         MIL_UINT16 Saturation = (MIL_UINT16)(MaxDistance < MIL_UINT16_MAX - 1 ? MaxDistance + 1 : MIL_UINT16_MAX - 1);
+         const float* pWeights = m_pWeights + Level.Offset;
+
+         // Forward pass, from the top left neighbors.
+         for(MIL_INT y = 0; y < Level.SizeY; y++)
+            {
+            MIL_UINT16* pRow = m_pDistances + y * Level.SizeX;
+            const MIL_UINT16* pPrevRow = pRow - Level.SizeX;
+            for(MIL_INT x = 0; x < Level.SizeX; x++)
+               {
+               if(pWeights[y * Level.SizeX + x] > 0.0f)
+                  {
+                  pRow[x] = 0;
+                  continue;
+                  }
+               MIL_UINT16 Distance = Saturation;
+               if(x > 0)
+                  Distance = MinDistance(Distance, pRow[x - 1], Saturation);
+               if(y > 0)
+                  {
+                  Distance = MinDistance(Distance, pPrevRow[x], Saturation);
+                  if(x > 0)
+                     Distance = MinDistance(Distance, pPrevRow[x - 1], Saturation);
+                  if(x < Level.SizeX - 1)
+                     Distance = MinDistance(Distance, pPrevRow[x + 1], Saturation);
+                  }
+               pRow[x] = Distance;
+               }
+            }
+
+         // Backward pass, from the bottom right neighbors.
+         for(MIL_INT y = Level.SizeY - 1; y >= 0; y--)
+            {
+            MIL_UINT16* pRow = m_pDistances + y * Level.SizeX;
+            const MIL_UINT16* pNextRow = pRow + Level.SizeX;
+            for(MIL_INT x = Level.SizeX - 1; x >= 0; x--)
+               {
+               MIL_UINT16 Distance = pRow[x];
+               if(Distance == 0)
+                  continue;
+               if(x < Level.SizeX - 1)
+                  Distance = MinDistance(Distance, pRow[x + 1], Saturation);
+               if(y < Level.SizeY - 1)
+                  {
+                  Distance = MinDistance(Distance, pNextRow[x], Saturation);
+                  if(x > 0)
+                     Distance = MinDistance(Distance, pNextRow[x - 1], Saturation);
+                  if(x < Level.SizeX - 1)
+                     Distance = MinDistance(Distance, pNextRow[x + 1], Saturation);
+                  }
+               pRow[x] = Distance;
+               }
+            }
+         }
+
+      // Function that returns the distance through a neighbor, if it is shorter.
+      static MIL_UINT16 MinDistance(MIL_UINT16 Distance, MIL_UINT16 NeighborDistance, MIL_UINT16 Saturation)
+         {
+         MIL_UINT16 Through = NeighborDistance < Saturation ? (MIL_UINT16)(NeighborDistance + 1) : Saturation;
+         return Through < Distance ? Through : Distance;
+         }
+
+      // Function that pushes a level to the coarser one. Each coarse pixel is the
+      // weighted average of the 2x2 fine pixels, with the sum of their weights
+      // clamped to 1.
+      void Push(const SPushPullLevel& Fine, const SPushPullLevel& Coarse)
+         {
+         for(MIL_INT y = 0; y < Coarse.SizeY; y++)
+            {
+            MIL_INT FineY0 = 2 * y;
+            MIL_INT FineY1 = FineY0 + 1 < Fine.SizeY ? FineY0 + 1 : FineY0;
+            const float* pValueRow0 = m_pValues + Fine.Offset + FineY0 * Fine.SizeX;
+            const float* pValueRow1 = m_pValues + Fine.Offset + FineY1 * Fine.SizeX;
+            const float* pWeightRow0 = m_pWeights + Fine.Offset + FineY0 * Fine.SizeX;
+            const float* pWeightRow1 = m_pWeights + Fine.Offset + FineY1 * Fine.SizeX;
+            float* pCoarseValueRow = m_pValues + Coarse.Offset + y * Coarse.SizeX;
+            float* pCoarseWeightRow = m_pWeights + Coarse.Offset + y * Coarse.SizeX;
+            for(MIL_INT x = 0; x < Coarse.SizeX; x++)
+               {
+               MIL_INT FineX0 = 2 * x;
+               MIL_INT FineX1 = FineX0 + 1 < Fine.SizeX ? FineX0 + 1 : FineX0;
+               float WeightSum = pWeightRow0[FineX0] + pWeightRow0[FineX1] + pWeightRow1[FineX0] + pWeightRow1[FineX1];
+               float ValueSum = pWeightRow0[FineX0] * pValueRow0[FineX0] + pWeightRow0[FineX1] * pValueRow0[FineX1] +
+                                pWeightRow1[FineX0] * pValueRow1[FineX0] + pWeightRow1[FineX1] * pValueRow1[FineX1];
+               pCoarseValueRow[x] = WeightSum > 0.0f ? ValueSum / WeightSum : 0.0f;
+               pCoarseWeightRow[x] = WeightSum < 1.0f ? WeightSum : 1.0f;
+               }
+            }
+         }
+
+      // Function that pulls the filled coarser level into a level. The pixels are
+      // completed by the bilinear interpolation of the coarse pixels, with the
+      // weights 3/4 and 1/4 of the 2x subsampling. A smoothed level only keeps the
+      // interpolation.
+      void Pull(const SPushPullLevel& Coarse, const SPushPullLevel& Fine, bool Smooth)
+         {
+         const float* pCoarseValues = m_pValues + Coarse.Offset;
+         for(MIL_INT y = 0; y < Fine.SizeY; y++)
+            {
+            // Get the coarse rows around the fine row.
+            MIL_INT CoarseY = y / 2;
+            MIL_INT OtherCoarseY = (y & 1) ? CoarseY + 1 : CoarseY - 1;
+            if(OtherCoarseY < 0 || OtherCoarseY >= Coarse.SizeY)
+               OtherCoarseY = CoarseY;
+            const float* pNearRow = pCoarseValues + CoarseY * Coarse.SizeX;
+            const float* pFarRow = pCoarseValues + OtherCoarseY * Coarse.SizeX;
+            float* pValueRow = m_pValues + Fine.Offset + y * Fine.SizeX;
+            float* pWeightRow = m_pWeights + Fine.Offset + y * Fine.SizeX;
+            for(MIL_INT x = 0; x < Fine.SizeX; x++)
+               {
+               float Weight = Smooth ? 0.0f : pWeightRow[x];
+               if(Weight >= 1.0f)
+                  continue;
+               MIL_INT CoarseX = x / 2;
+               MIL_INT OtherCoarseX = (x & 1) ? CoarseX + 1 : CoarseX - 1;
+               if(OtherCoarseX < 0 || OtherCoarseX >= Coarse.SizeX)
+                  OtherCoarseX = CoarseX;
+               float Interpolated = 0.5625f * pNearRow[CoarseX] + 0.1875f * (pNearRow[OtherCoarseX] + pFarRow[CoarseX]) + 0.0625f * pFarRow[OtherCoarseX];
+               pValueRow[x] = Weight * pValueRow[x] + (1.0f - Weight) * Interpolated;
+               pWeightRow[x] = 1.0f;
+               }
+            }
+         }
+
+      // Function that stores the filled finest level in the depth map. The pixels
+      // farther than the maximum fill distance are invalid.
+      void StoreLevel(MIL_UINT16* pDst, MIL_INT DstPitch, bool HasValidPixel, MIL_INT MaxFillDistance)
+         {
+         const SPushPullLevel& Level = m_Levels[0];
+         for(MIL_INT y = 0; y < Level.SizeY; y++)
+            {
+            MIL_UINT16* pDstRow = pDst + y * DstPitch;
+            const float* pValueRow = m_pValues + Level.Offset + y * Level.SizeX;
+            const MIL_UINT16* pDistanceRow = m_pDistances + y * Level.SizeX;
+            for(MIL_INT x = 0; x < Level.SizeX; x++)
+               {
+               if(!HasValidPixel || (MaxFillDistance > 0 && pDistanceRow[x] > MaxFillDistance))
+                  {
+                  pDstRow[x] = MIL_UINT16_MAX;
+                  continue;
+                  }
+               float Value = pValueRow[x] + 0.5f;
+               pDstRow[x] = Value < 1.0f ? 1 : Value >= (float)(MIL_UINT16_MAX - 1) ? (MIL_UINT16)(MIL_UINT16_MAX - 1) : (MIL_UINT16)Value;
+               }
+            }
+         }
+
+      float*         m_pValues;
+      float*         m_pWeights;
+      MIL_UINT16*    m_pDistances;
+      SPushPullLevel m_Levels[PUSH_PULL_MAX_LEVELS];
+      MIL_INT        m_NbLevels;
+      MIL_INT        m_NbPixels;      // Allocated in the value and weight buffers.
+      MIL_INT        m_NbDistances;   // Allocated in the distance buffer.
+   };
@@ -0,0 +1,453 @@
+﻿//***************************************************************************************/
+//
+// File name: ReferenceSurface.h
+//
+// Synopsis:  Contains the reference surface model used by the Chromasens_3DPIXA_M10PP3
+//            example to flatten the depth maps of the particle boards. The
+//            residual shape of a flat board, once its position is removed, is
+//            the geometry of the lens and of the fixture, which does not change
+//            from board to board. Every line of a line scan camera sees it
+//            through the same sensor columns, so it is modeled by a profile
+//            across the columns, learned as a robust running average over the
+//            flat scans and persisted between the runs. The model starts from
+//            the median of the profiles of its first flat scans, and a first
+//            scan too far from that median, such as a warped board, is dropped
+//            instead of learned.
+//
+//            For each scan, only the offset and the tilts of the board are fitted,
+//            on a sparse grid of samples, then the profile and the fitted plane
+//            are subtracted in one pass. The corrected depth map is biased to
+//            the middle of the gray levels, which its calibration maps to a
+//            height of 0.
+//
+// Copyright © 1992-2024 Zebra Technologies Corp. and/or its affiliates
+// All Rights Reserved
+
+#include <float.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const MIL_UINT32 REFERENCE_SURFACE_MAGIC                = 0x46525343;   // "CSRF"
+static const MIL_UINT32 REFERENCE_SURFACE_VERSION              = 1;
+static const MIL_INT    REFERENCE_SURFACE_BIAS                 = 32768;        // Gray level of a height of 0.
+static const MIL_INT    REFERENCE_SURFACE_MIN_SCANS            = 3;            // Learned before the model is ready.
+static const MIL_DOUBLE REFERENCE_SURFACE_LEARNING_RATE        = 0.05;         // Minimum weight of a scan in the average.
+static const MIL_DOUBLE REFERENCE_SURFACE_MAX_OUTLIER_FRACTION = 0.05;         // Of the samples, for a scan to be flat.
+static const MIL_INT    REFERENCE_SURFACE_FIT_STEP             = 8;            // Of the grid of the fitted samples, in pixels.
+static const MIL_INT    REFERENCE_SURFACE_LEARN_STEP           = 4;            // Of the rows averaged in the profile.
+static const MIL_DOUBLE REFERENCE_SURFACE_LEARN_DEVIATIONS     = 3.0;          // Farthest learned residual, in deviations of the fit.
+static const MIL_DOUBLE REFERENCE_SURFACE_WARMUP_DEVIATIONS    = 3.0;          // Farthest first scan, in median deviations from the median profile.
+static const MIL_DOUBLE REFERENCE_SURFACE_WARMUP_MIN_DEVIATION = 1.0;          // Of the first scans, in gray levels.
+
+// Header of a reference surface file, followed by the profile.
+struct SReferenceSurfaceHeader
+   {
+   MIL_UINT32 Magic;
+   MIL_UINT32 Version;
+   MIL_INT64  SizeX;
+   MIL_INT64  NbScans;
+   };
+
+// Position of a scan relative to the reference surface.
+struct SReferenceSurfaceFit
+   {
+   MIL_DOUBLE Offset;            // In gray levels, at the center of the region.
+   MIL_DOUBLE TiltX;             // In gray levels per pixel.
+   MIL_DOUBLE TiltY;
+   MIL_DOUBLE Deviation;         // Of the fitted samples, in gray levels.
+   MIL_DOUBLE OutlierFraction;   // Of the fitted samples.
+   bool       Learned;           // True if the scan updated the model.
+   };
+
+//////////////////////////////////////////////////////////////////////////
+// Class that learns the reference surface and subtracts it from the
+// depth maps.
+//////////////////////////////////////////////////////////////////////////
+class CReferenceSurface
+   {
+   public:
+      // Constructor.
+      CReferenceSurface()
+         : m_SizeX(0),
+           m_pProfile(NULL),
+           m_pWarmupProfiles(NULL),
+           m_NbScans(0)
+         {
+         }
+
+      // Destructor.
+      virtual ~CReferenceSurface()
+         {
+         delete [] m_pWarmupProfiles;
+         delete [] m_pProfile;
+         }
+
+      // Function that forgets the model and sets its number of columns.
+      void Reset(MIL_INT SizeX)
+         {
+         if(SizeX != m_SizeX)
+            {
+            delete [] m_pWarmupProfiles;
+            delete [] m_pProfile;
+            m_pProfile = new MIL_FLOAT[SizeX > 0 ? SizeX : 1];
+            m_pWarmupProfiles = new MIL_FLOAT[REFERENCE_SURFACE_MIN_SCANS * (SizeX > 0 ? SizeX : 1)];
+            m_SizeX = SizeX;
+            }
+         for(MIL_INT x = 0; x < m_SizeX; x++)
+            m_pProfile[x] = 0.0f;
+         m_NbScans = 0;
+         }
+
+      // Function that loads the model of a number of columns. The model is reset
+      // if the file is missing or of another size.
+      bool Load(const char* FilePath, MIL_INT SizeX)
+         {
+         Reset(SizeX);
+         FILE* pFile = NULL;
+         if(fopen_s(&pFile, FilePath, "rb") != 0 || pFile == NULL)
+            return false;
+         SReferenceSurfaceHeader Header;
+         bool Loaded = fread(&Header, sizeof(Header), 1, pFile) == 1 &&
+                       Header.Magic == REFERENCE_SURFACE_MAGIC &&
+                       Header.Version == REFERENCE_SURFACE_VERSION &&
+                       Header.SizeX == SizeX &&
+                       fread(m_pProfile, sizeof(MIL_FLOAT), SizeX, pFile) == (size_t)SizeX;
+         fclose(pFile);
+         if(Loaded)
+            {
+            // A model saved in warm-up restarts from its median for each of its first scans.
+            m_NbScans = (MIL_INT)Header.NbScans;
+            for(MIL_INT ScanIdx = 0; ScanIdx < m_NbScans && ScanIdx < REFERENCE_SURFACE_MIN_SCANS; ScanIdx++)
+               memcpy(m_pWarmupProfiles + ScanIdx * m_SizeX, m_pProfile, m_SizeX * sizeof(MIL_FLOAT));
+            }
+         else
+            Reset(SizeX);
+         return Loaded;
+         }
+
+      // Function that saves the model.
+      bool Save(const char* FilePath) const
+         {
+         FILE* pFile = NULL;
+         if(fopen_s(&pFile, FilePath, "wb") != 0 || pFile == NULL)
+            return false;
+         SReferenceSurfaceHeader Header = {REFERENCE_SURFACE_MAGIC, REFERENCE_SURFACE_VERSION, m_SizeX, m_NbScans};
+         bool Saved = fwrite(&Header, sizeof(Header), 1, pFile) == 1 &&
+                      fwrite(m_pProfile, sizeof(MIL_FLOAT), m_SizeX, pFile) == (size_t)m_SizeX;
+         fclose(pFile);
+         return Saved;
+         }
+
+      // Function that returns the number of scans learned.
+      MIL_INT GetNbScans() const {return m_NbScans;}
+
+      // Function that returns true once the model replaces the fit of the curve.
+      bool IsReady() const {return m_NbScans >= REFERENCE_SURFACE_MIN_SCANS;}
+
+      // Function that corrects a region of a 16-bit depth map, whose first column
+      // is column OffsetX of the model. The samples farther than the outlier
+      // distance, in gray levels, from the fitted surface are ignored. Until the
+      // model is ready, or if Learn is true, a flat scan updates the model before
+      // it is corrected; until the model is ready, the scans are learned only if
+      // they agree with the median of the first scans. The invalid pixels, 0 or
+      // 65535, are kept. The depth map can be corrected in place. Returns false,
+      // with the region copied uncorrected and the model unchanged, if the region
+      // does not fit in the columns of the model.
+      bool Correct(const MIL_UINT16* pSrc, MIL_INT SrcPitch, MIL_UINT16* pDst, MIL_INT DstPitch, MIL_INT SizeX, MIL_INT SizeY,
+                   MIL_INT OffsetX, MIL_DOUBLE OutlierDistance, bool Learn, SReferenceSurfaceFit* pFit)
+         {
+         if(OffsetX < 0 || OffsetX + SizeX > m_SizeX)
+            {
+            memset(pFit, 0, sizeof(*pFit));
+            for(MIL_INT y = 0; y < SizeY && pDst != pSrc; y++)
+               memcpy(pDst + y * DstPitch, pSrc + y * SrcPitch, SizeX * sizeof(MIL_UINT16));
+            return false;
+            }
+         const MIL_FLOAT* pProfile = m_pProfile + OffsetX;
+
+         // Fit the position of the scan, then again without the outliers of the first fit.
+         pFit->Offset = 0.0;
+         pFit->TiltX = 0.0;
+         pFit->TiltY = 0.0;
+         FitPlane(pSrc, SrcPitch, SizeX, SizeY, pProfile, -1.0, pFit);
+         FitPlane(pSrc, SrcPitch, SizeX, SizeY, pProfile, OutlierDistance, pFit);
+         pFit->Learned = false;
+         if((Learn || !IsReady()) && (!IsReady() || pFit->OutlierFraction <= REFERENCE_SURFACE_MAX_OUTLIER_FRACTION))
+            pFit->Learned = LearnProfile(pSrc, SrcPitch, SizeX, SizeY, OffsetX, *pFit);
+
+         // Subtract the profile and the plane in one pass. The terms of the columns
+         // are calculated once.
+         MIL_FLOAT* pColumnTerms = new MIL_FLOAT[SizeX];
+         MIL_DOUBLE CenterX = 0.5 * (SizeX - 1);
+         MIL_DOUBLE CenterY = 0.5 * (SizeY - 1);
+         for(MIL_INT x = 0; x < SizeX; x++)
+            pColumnTerms[x] = (MIL_FLOAT)(pProfile[x] + pFit->TiltX * (x - CenterX));
+         for(MIL_INT y = 0; y < SizeY; y++)
+            {
+            const MIL_UINT16* pSrcRow = pSrc + y * SrcPitch;
+            MIL_UINT16* pDstRow = pDst + y * DstPitch;
+            MIL_FLOAT RowTerm = (MIL_FLOAT)(REFERENCE_SURFACE_BIAS + 0.5 - pFit->Offset - pFit->TiltY * (y - CenterY));
+            for(MIL_INT x = 0; x < SizeX; x++)
+               {
+               MIL_UINT16 Value = pSrcRow[x];
+               if(Value != 0 && Value != MIL_UINT16_MAX)
+                  {
+                  MIL_FLOAT Corrected = Value - pColumnTerms[x] + RowTerm;
+                  Value = Corrected < 1.0f ? 1 : Corrected >= (MIL_FLOAT)(MIL_UINT16_MAX - 1) ? MIL_UINT16_MAX - 1 : (MIL_UINT16)Corrected;
+                  }
+               pDstRow[x] = Value;
+               }
+            }
+         delete [] pColumnTerms;
+         return true;
+         }
+
+   private:
+      // Disallow copy.
+      CReferenceSurface(const CReferenceSurface&);
+      CReferenceSurface& operator=(const CReferenceSurface&);
+
+      // Function that fits the plane of the scan, once the profile is subtracted,
+      // by least squares on a sparse grid of the valid pixels. With an outlier
+      // distance, the samples too far from the previous fit are ignored.
+      static void FitPlane(const MIL_UINT16* pSrc, MIL_INT SrcPitch, MIL_INT SizeX, MIL_INT SizeY, const MIL_FLOAT* pProfile,
+                           MIL_DOUBLE OutlierDistance, SReferenceSurfaceFit* pFit)
+         {
+         MIL_DOUBLE CenterX = 0.5 * (SizeX - 1);
+         MIL_DOUBLE CenterY = 0.5 * (SizeY - 1);
+         MIL_DOUBLE N = 0, Sx = 0, Sy = 0, Sxx = 0, Syy = 0, Sxy = 0, Sv = 0, Sxv = 0, Syv = 0, Srr = 0;
+         MIL_INT NbSamples = 0;
+         for(MIL_INT y = REFERENCE_SURFACE_FIT_STEP / 2; y < SizeY; y += REFERENCE_SURFACE_FIT_STEP)
+            {
+            const MIL_UINT16* pSrcRow = pSrc + y * SrcPitch;
+            MIL_DOUBLE dy = y - CenterY;
+            for(MIL_INT x = REFERENCE_SURFACE_FIT_STEP / 2; x < SizeX; x += REFERENCE_SURFACE_FIT_STEP)
+               {
+               if(pSrcRow[x] == 0 || pSrcRow[x] == MIL_UINT16_MAX)
+                  continue;
+               MIL_DOUBLE dx = x - CenterX;
+               MIL_DOUBLE Value = pSrcRow[x] - pProfile[x];
+               NbSamples++;
+               MIL_DOUBLE Residual = Value - (pFit->Offset + pFit->TiltX * dx + pFit->TiltY * dy);
+               if(OutlierDistance >= 0 && fabs(Residual) > OutlierDistance)
+                  continue;
+               Srr += Residual * Residual;
+               N++;
+               Sx += dx;
+               Sy += dy;
+               Sxx += dx * dx;
+               Syy += dy * dy;
+               Sxy += dx * dy;
+               Sv += Value;
+               Sxv += dx * Value;
+               Syv += dy * Value;
+               }
+            }
+         pFit->OutlierFraction = NbSamples > 0 ? (NbSamples - N) / NbSamples : 0.0;
+
+         // The deviation is measured from the previous fit, close enough once the
+         // outliers are removed.
+         pFit->Deviation = N > 0 ? sqrt(Srr / N) : 0.0;
+
+         // Solve the normal equations by Cramer's rule; a degenerate grid only
+         // fits the offset.
+         MIL_DOUBLE Determinant = N * (Sxx * Syy - Sxy * Sxy) - Sx * (Sx * Syy - Sxy * Sy) + Sy * (Sx * Sxy - Sxx * Sy);
+         if(fabs(Determinant) > 1e-9 * (N * N * N + 1.0))
+            {
+            pFit->Offset = (Sv * (Sxx * Syy - Sxy * Sxy) - Sx * (Sxv * Syy - Sxy * Syv) + Sy * (Sxv * Sxy - Sxx * Syv)) / Determinant;
+            pFit->TiltX = (N * (Sxv * Syy - Sxy * Syv) - Sv * (Sx * Syy - Sxy * Sy) + Sy * (Sx * Syv - Sxv * Sy)) / Determinant;
+            pFit->TiltY = (N * (Sxx * Syv - Sxv * Sxy) - Sx * (Sx * Syv - Sxv * Sy) + Sv * (Sx * Sxy - Sxx * Sy)) / Determinant;
+            }
+         else
+            {
+            pFit->Offset = N > 0 ? Sv / N : 0.0;
+            pFit->TiltX = 0.0;
+            pFit->TiltY = 0.0;
+            }
+         }
+
+      // Function that averages the residual of each column over a subset of the
+      // rows and blends it in the profile. Once the model is ready, the residuals
+      // too far from the profile, such as the defects, are not learned; before,
+      // the profile of the scan is added to the first scans instead. The line
+      // through the residuals is removed first, since the fit of each scan absorbs
+      // it. Returns false if no column was learned or the scan was dropped.
+      bool LearnProfile(const MIL_UINT16* pSrc, MIL_INT SrcPitch, MIL_INT SizeX, MIL_INT SizeY, MIL_INT OffsetX,
+                        const SReferenceSurfaceFit& Fit)
+         {
+         MIL_FLOAT* pProfile = m_pProfile + OffsetX;
+         MIL_DOUBLE* pSums = new MIL_DOUBLE[SizeX];
+         MIL_INT* pCounts = new MIL_INT[SizeX];
+         memset(pSums, 0, SizeX * sizeof(MIL_DOUBLE));
+         memset(pCounts, 0, SizeX * sizeof(MIL_INT));
+         MIL_DOUBLE CenterX = 0.5 * (SizeX - 1);
+         MIL_DOUBLE CenterY = 0.5 * (SizeY - 1);
+         MIL_DOUBLE LearnDistance = REFERENCE_SURFACE_LEARN_DEVIATIONS * Fit.Deviation;
+         for(MIL_INT y = 0; y < SizeY; y += REFERENCE_SURFACE_LEARN_STEP)
+            {
+            const MIL_UINT16* pSrcRow = pSrc + y * SrcPitch;
+            MIL_DOUBLE RowPlane = Fit.Offset + Fit.TiltY * (y - CenterY);
+            for(MIL_INT x = 0; x < SizeX; x++)
+               {
+               if(pSrcRow[x] == 0 || pSrcRow[x] == MIL_UINT16_MAX)
+                  continue;
+               MIL_DOUBLE Residual = pSrcRow[x] - RowPlane - Fit.TiltX * (x - CenterX);
+               if(IsReady() && fabs(Residual - pProfile[x]) > LearnDistance)
+                  continue;
+               pSums[x] += Residual;
+               pCounts[x]++;
+               }
+            }
+
+         // Fit the line through the mean residuals of the columns.
+         MIL_DOUBLE N = 0, Sx = 0, Sxx = 0, Sv = 0, Sxv = 0;
+         for(MIL_INT x = 0; x < SizeX; x++)
+            {
+            if(pCounts[x] == 0)
+               continue;
+            pSums[x] /= pCounts[x];
+            N++;
+            Sx += x;
+            Sxx += (MIL_DOUBLE)x * x;
+            Sv += pSums[x];
+            Sxv += x * pSums[x];
+            }
+         MIL_DOUBLE Denominator = N * Sxx - Sx * Sx;
+         MIL_DOUBLE Slope = Denominator > 0 ? (N * Sxv - Sx * Sv) / Denominator : 0.0;
+         MIL_DOUBLE Intercept = N > 0 ? (Sv - Slope * Sx) / N : 0.0;
+
+         // Keep the first scans apart, for their median.
+         if(!IsReady())
+            {
+            bool Learned = N > 0 && AddWarmupProfile(pSums, pCounts, SizeX, OffsetX, Intercept, Slope);
+            delete [] pCounts;
+            delete [] pSums;
+            return Learned;
+            }
+
+         // Blend the scan in the running average.
+         MIL_DOUBLE Weight = 1.0 / (m_NbScans + 1);
+         if(Weight < REFERENCE_SURFACE_LEARNING_RATE)
+            Weight = REFERENCE_SURFACE_LEARNING_RATE;
+         for(MIL_INT x = 0; x < SizeX; x++)
+            {
+            if(pCounts[x] > 0)
+               pProfile[x] += (MIL_FLOAT)(Weight * (pSums[x] - Intercept - Slope * x - pProfile[x]));
+            }
+         delete [] pCounts;
+         delete [] pSums;
+         if(N == 0)
+            return false;
+         m_NbScans++;
+         return true;
+         }
+
+      // Function that adds the profile of a scan to the first scans, at index
+      // m_NbScans, and sets the profile to their median. Once the model would be
+      // ready, the first scans whose median deviation from the profile is more
+      // than REFERENCE_SURFACE_WARMUP_DEVIATIONS times the median one are dropped,
+      // so that the model stays in warm-up until enough scans agree. Returns
+      // false if the added scan was dropped.
+      bool AddWarmupProfile(const MIL_DOUBLE* pMeans, const MIL_INT* pCounts, MIL_INT SizeX, MIL_INT OffsetX,
+                            MIL_DOUBLE Intercept, MIL_DOUBLE Slope)
+         {
+         MIL_FLOAT* pWarmupProfile = m_pWarmupProfiles + m_NbScans * m_SizeX;
+         for(MIL_INT x = 0; x < m_SizeX; x++)
+            pWarmupProfile[x] = FLT_MAX;
+         for(MIL_INT x = 0; x < SizeX; x++)
+            {
+            if(pCounts[x] > 0)
+               pWarmupProfile[OffsetX + x] = (MIL_FLOAT)(pMeans[x] - Intercept - Slope * x);
+            }
+         MIL_INT AddedIdx = m_NbScans++;
+         SetWarmupMedian();
+         if(!IsReady())
+            return true;
+
+         // Measure the median deviation of each first scan from the median profile.
+         MIL_FLOAT* pDistances = new MIL_FLOAT[m_SizeX > 0 ? m_SizeX : 1];
+         MIL_FLOAT Deviations[REFERENCE_SURFACE_MIN_SCANS];
+         MIL_FLOAT SortedDeviations[REFERENCE_SURFACE_MIN_SCANS];
+         for(MIL_INT ScanIdx = 0; ScanIdx < m_NbScans; ScanIdx++)
+            {
+            const MIL_FLOAT* pScanProfile = m_pWarmupProfiles + ScanIdx * m_SizeX;
+            MIL_INT NbDistances = 0;
+            for(MIL_INT x = 0; x < m_SizeX; x++)
+               {
+               if(pScanProfile[x] != FLT_MAX)
+                  pDistances[NbDistances++] = (MIL_FLOAT)fabs(pScanProfile[x] - m_pProfile[x]);
+               }
+            Deviations[ScanIdx] = Median(pDistances, NbDistances);
+            SortedDeviations[ScanIdx] = Deviations[ScanIdx];
+            }
+         delete [] pDistances;
+
+         // Drop the first scans too far from the others.
+         MIL_DOUBLE MaxDeviation = Median(SortedDeviations, m_NbScans);
+         if(MaxDeviation < REFERENCE_SURFACE_WARMUP_MIN_DEVIATION)
+            MaxDeviation = REFERENCE_SURFACE_WARMUP_MIN_DEVIATION;
+         MaxDeviation *= REFERENCE_SURFACE_WARMUP_DEVIATIONS;
+         bool AddedKept = true;
+         MIL_INT NbKept = 0;
+         for(MIL_INT ScanIdx = 0; ScanIdx < m_NbScans; ScanIdx++)
+            {
+            if(Deviations[ScanIdx] > MaxDeviation)
+               {
+               if(ScanIdx == AddedIdx)
+                  AddedKept = false;
+               continue;
+               }
+            if(NbKept != ScanIdx)
+               memcpy(m_pWarmupProfiles + NbKept * m_SizeX, m_pWarmupProfiles + ScanIdx * m_SizeX, m_SizeX * sizeof(MIL_FLOAT));
+            NbKept++;
+            }
+         if(NbKept != m_NbScans)
+            {
+            m_NbScans = NbKept;
+            SetWarmupMedian();
+            }
+         return AddedKept;
+         }
+
+      // Function that sets each column of the profile to the median of the first
+      // scans that learned it. The columns that none learned are kept.
+      void SetWarmupMedian()
+         {
+         MIL_FLOAT Values[REFERENCE_SURFACE_MIN_SCANS];
+         for(MIL_INT x = 0; x < m_SizeX; x++)
+            {
+            MIL_INT NbValues = 0;
+            for(MIL_INT ScanIdx = 0; ScanIdx < m_NbScans; ScanIdx++)
+               {
+               MIL_FLOAT Value = m_pWarmupProfiles[ScanIdx * m_SizeX + x];
+               if(Value != FLT_MAX)
+                  Values[NbValues++] = Value;
+               }
+            if(NbValues > 0)
+               m_pProfile[x] = Median(Values, NbValues);
+            }
+         }
+
+      // Function that returns the median of values, which are sorted.
+      static MIL_FLOAT Median(MIL_FLOAT* pValues, MIL_INT NbValues)
+         {
+         if(NbValues == 0)
+            return 0.0f;
+         qsort(pValues, (size_t)NbValues, sizeof(MIL_FLOAT), CompareValues);
+         MIL_INT Middle = NbValues / 2;
+         return NbValues % 2 ? pValues[Middle] : 0.5f * (pValues[Middle - 1] + pValues[Middle]);
+         }
+      static int CompareValues(const void* pA, const void* pB)
+         {
+         MIL_FLOAT A = *(const MIL_FLOAT*)pA;
+         MIL_FLOAT B = *(const MIL_FLOAT*)pB;
+         return A < B ? -1 : A > B ? 1 : 0;
+         }
+
+      MIL_INT    m_SizeX;
+      MIL_FLOAT* m_pProfile;          // In gray levels.
+      MIL_FLOAT* m_pWarmupProfiles;   // Of the first scans, FLT_MAX in the columns they did not learn.
+      MIL_INT    m_NbScans;
+   };
@@ -0,0 +1,312 @@
+﻿//***************************************************************************************/
+//
+// File name: RegressionBenchmark.h
+//
+// Synopsis:  Contains the regression benchmark used by the Chromasens_3DPIXA_M10PP3
+//            example. The values measured by a run, the scalar results of the
+//            inspections, the stage durations and the memory used, are compared
+//            with the golden values of a previous run, and the depth maps with
+//            golden depth maps. A value fails if it differs from its golden value
+//            by more than the tolerance of its kind, or if it has no golden
+//            value. The golden values are only recorded by a run created to
+//            record them.
+//
+//            The golden values are kept in a text file, one "<key> <value>" line
+//            per value. The golden depth maps are kept in files compressed by
+//            CDepthMapCodec.
+//
+// Copyright © 1992-2024 Zebra Technologies Corp. and/or its affiliates
+// All Rights Reserved
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const MIL_INT BENCHMARK_MAX_VALUES     = 128;
+static const MIL_INT BENCHMARK_MAX_KEY_LENGTH = 64;
+
+// Kind of value, which sets how it is compared with its golden value.
+enum EBenchmarkCheck
+   {
+   BENCHMARK_RESULT,      // Relative difference within the result tolerance.
+   BENCHMARK_TIME,        // Not slower than the time tolerance.
+   BENCHMARK_MEMORY,      // Not larger than the memory tolerance.
+   BENCHMARK_DEPTH_MAP    // Fraction of differing pixels, compared with the depth map limit.
+   };
+
+// Tolerances of the comparison with the golden values.
+struct SBenchmarkThresholds
+   {
+   MIL_DOUBLE ResultTolerance;         // Relative.
+   MIL_DOUBLE DepthTolerance;          // Gray levels of a depth map pixel.
+   MIL_DOUBLE DepthMaxDiffFraction;    // Of the pixels that differ by more than the depth tolerance.
+   MIL_DOUBLE TimeTolerance;           // Relative slowdown.
+   MIL_DOUBLE MinTimeDifference;       // Slowdown ignored below it, in seconds.
+   MIL_DOUBLE MemoryTolerance;         // Relative growth.
+   };
+
+// Value measured by a run.
+struct SBenchmarkValue
+   {
+   char            Key[BENCHMARK_MAX_KEY_LENGTH];
+   EBenchmarkCheck Check;
+   MIL_DOUBLE      Value;
+   MIL_DOUBLE      GoldenValue;
+   bool            HasGolden;
+   bool            Passed;
+   };
+
+//////////////////////////////////////////////////////////////////////////
+// Class that compares the values of a benchmark run with golden values.
+//////////////////////////////////////////////////////////////////////////
+class CRegressionBenchmark
+   {
+   public:
+      // Constructor. A recording run records the golden values instead of
+      // comparing with them.
+      CRegressionBenchmark(const SBenchmarkThresholds& Thresholds, bool Recording)
+         : m_Thresholds(Thresholds),
+           m_NbValues(0),
+           m_NbGoldenValues(0),
+           m_Recording(Recording)
+         {
+         }
+
+      // Destructor.
+      virtual ~CRegressionBenchmark()
+         {
+         }
+
+      // Function that loads the golden values. Returns false if there are none, in
+      // which case every value without a golden value fails.
+      bool LoadGolden(const char* FilePath)
+         {
+         m_NbGoldenValues = 0;
+         FILE* pFile = NULL;
+         if(fopen_s(&pFile, FilePath, "r") != 0 || pFile == NULL)
+            return false;
+         char Line[256];
+         while(fgets(Line, sizeof(Line), pFile) && m_NbGoldenValues < BENCHMARK_MAX_VALUES)
+            {
+            // Split the line in its key and its value.
+            char* pKey = strtok(Line, " \t\r\n");
+            char* pValue = pKey ? strtok(NULL, " \t\r\n") : NULL;
+            if(!pValue || pKey[0] == '#')
+               continue;
+            SBenchmarkValue& Golden = m_GoldenValues[m_NbGoldenValues++];
+            strncpy(Golden.Key, pKey, BENCHMARK_MAX_KEY_LENGTH - 1);
+            Golden.Key[BENCHMARK_MAX_KEY_LENGTH - 1] = 0;
+            Golden.Value = atof(pValue);
+            }
+         fclose(pFile);
+         return m_NbGoldenValues > 0;
+         }
+
+      // Function that saves the values of the run as the golden values.
+      bool SaveGolden(const char* FilePath) const
+         {
+         FILE* pFile = NULL;
+         if(fopen_s(&pFile, FilePath, "w") != 0 || pFile == NULL)
+            return false;
+         fprintf(pFile, "# Golden values of the Chromasens_3DPIXA_M10PP3 regression benchmark.\n");
+         for(MIL_INT ValueIdx = 0; ValueIdx < m_NbValues; ValueIdx++)
+            {
+            if(m_Values[ValueIdx].Check != BENCHMARK_DEPTH_MAP)
+               fprintf(pFile, "%s %.9g\n", m_Values[ValueIdx].Key, m_Values[ValueIdx].Value);
+            }
+         fclose(pFile);
+         return true;
+         }
+
+      // Function that returns true if the run records the golden values.
+      bool IsRecording() const {return m_Recording;}
+
+      // Function that adds a value of the run and compares it with its golden value.
+      void AddValue(const char* Key, MIL_DOUBLE Value, EBenchmarkCheck Check)
+         {
+         if(m_NbValues == BENCHMARK_MAX_VALUES)
+            return;
+         SBenchmarkValue& NewValue = m_Values[m_NbValues++];
+         strncpy(NewValue.Key, Key, BENCHMARK_MAX_KEY_LENGTH - 1);
+         NewValue.Key[BENCHMARK_MAX_KEY_LENGTH - 1] = 0;
+         NewValue.Check = Check;
+         NewValue.Value = Value;
+         NewValue.GoldenValue = 0.0;
+         NewValue.HasGolden = false;
+         for(MIL_INT GoldenIdx = 0; GoldenIdx < m_NbGoldenValues && !NewValue.HasGolden; GoldenIdx++)
+            {
+            if(strcmp(m_GoldenValues[GoldenIdx].Key, NewValue.Key) == 0)
+               {
+               NewValue.GoldenValue = m_GoldenValues[GoldenIdx].Value;
+               NewValue.HasGolden = true;
+               }
+            }
+         NewValue.Passed = m_Recording || IsWithinTolerance(NewValue);
+         }
+
+      // Function that compares a 16-bit depth map with its golden depth map, or
+      // records it. A pixel differs if only one of the two is valid or if they
+      // differ by more than the depth tolerance.
+      void AddDepthMap(const char* Key, MIL_ID MilDepthMap, const char* GoldenFilePath)
+         {
+         MIL_INT SizeX = MbufInquire(MilDepthMap, M_SIZE_X, M_NULL);
+         MIL_INT SizeY = MbufInquire(MilDepthMap, M_SIZE_Y, M_NULL);
+         MIL_INT Pitch = MbufInquire(MilDepthMap, M_PITCH, M_NULL);
+         const MIL_UINT16* pData = (const MIL_UINT16*)MbufInquire(MilDepthMap, M_HOST_ADDRESS, M_NULL);
+         CDepthMapCodec Codec;
+
+         if(m_Recording)
+            {
+            // Write the golden depth map.
+            MIL_INT MaxStreamSize = CDepthMapCodec::GetMaxEncodedSize(SizeX, SizeY);
+            MIL_UINT8* pStream = new MIL_UINT8[MaxStreamSize];
+            MIL_INT StreamSize = Codec.Encode(pData, SizeX, SizeY, Pitch, pStream, MaxStreamSize);
+            FILE* pFile = NULL;
+            bool Written = false;
+            if(StreamSize > 0 && fopen_s(&pFile, GoldenFilePath, "wb") == 0 && pFile != NULL)
+               {
+               Written = fwrite(pStream, 1, StreamSize, pFile) == (size_t)StreamSize;
+               fclose(pFile);
+               }
+            delete [] pStream;
+            if(!Written)
+               MosPrintf(MIL_TEXT("Unable to write the golden depth map %hs.\n"), GoldenFilePath);
+            AddValue(Key, 0.0, BENCHMARK_DEPTH_MAP);
+            return;
+            }
+
+         // Read and decode the golden depth map.
+         MIL_UINT8* pStream = NULL;
+         MIL_INT StreamSize = ReadWholeFile(GoldenFilePath, &pStream);
+         SDepthMapCodecHeader Header;
+         MIL_DOUBLE DiffFraction = 1.0;
+         if(StreamSize > 0 && CDepthMapCodec::GetHeader(pStream, StreamSize, &Header) && (MIL_INT)Header.SizeX == SizeX && (MIL_INT)Header.SizeY == SizeY)
+            {
+            MIL_UINT16* pGoldenData = new MIL_UINT16[SizeX * SizeY];
+            if(Codec.Decode(pStream, StreamSize, pGoldenData, SizeX))
+               {
+               // Count the differing pixels.
+               MIL_INT NbDiffPixels = 0;
+               for(MIL_INT y = 0; y < SizeY; y++)
+                  {
+                  const MIL_UINT16* pRow = pData + y * Pitch;
+                  const MIL_UINT16* pGoldenRow = pGoldenData + y * SizeX;
+                  for(MIL_INT x = 0; x < SizeX; x++)
+                     {
+                     MIL_INT Diff = (MIL_INT)pRow[x] - (MIL_INT)pGoldenRow[x];
+                     if((pRow[x] == 0) != (pGoldenRow[x] == 0) || Diff > m_Thresholds.DepthTolerance || -Diff > m_Thresholds.DepthTolerance)
+                        NbDiffPixels++;
+                     }
+                  }
+               DiffFraction = (MIL_DOUBLE)NbDiffPixels / (SizeX * SizeY);
+               }
+            delete [] pGoldenData;
+            }
+         delete [] pStream;
+         AddValue(Key, DiffFraction, BENCHMARK_DEPTH_MAP);
+         }
+
+      // Function that returns the number of values that failed, including the
+      // golden values that the run did not measure.
+      MIL_INT GetNbFailures() const
+         {
+         MIL_INT NbFailures = 0;
+         for(MIL_INT ValueIdx = 0; ValueIdx < m_NbValues; ValueIdx++)
+            {
+            if(!m_Values[ValueIdx].Passed)
+               NbFailures++;
+            }
+         for(MIL_INT GoldenIdx = 0; GoldenIdx < m_NbGoldenValues; GoldenIdx++)
+            {
+            if(!IsMeasured(m_GoldenValues[GoldenIdx].Key))
+               NbFailures++;
+            }
+         return NbFailures;
+         }
+
+      // Function that prints the values of the run with their golden values.
+      void PrintReport() const
+         {
+         MosPrintf(MIL_TEXT("   Value                                   Measured      Golden  Status\n"));
+         for(MIL_INT ValueIdx = 0; ValueIdx < m_NbValues; ValueIdx++)
+            {
+            const SBenchmarkValue& Value = m_Values[ValueIdx];
+            MIL_DOUBLE Scale = Value.Check == BENCHMARK_TIME ? 1000.0 : Value.Check == BENCHMARK_MEMORY ? 1.0 / 1048576.0 : 1.0;
+            MIL_CONST_TEXT_PTR Unit = Value.Check == BENCHMARK_TIME ? MIL_TEXT("ms") : Value.Check == BENCHMARK_MEMORY ? MIL_TEXT("MB") : MIL_TEXT("  ");
+            MIL_CONST_TEXT_PTR Status = m_Recording ? MIL_TEXT("recorded") : Value.Passed ? MIL_TEXT("ok") : MIL_TEXT("FAILED");
+            if(Value.HasGolden || Value.Check == BENCHMARK_DEPTH_MAP)
+               MosPrintf(MIL_TEXT("   %-36hs %11.3f %11.3f %s  %s\n"), Value.Key, Value.Value * Scale,
+                         Value.Check == BENCHMARK_DEPTH_MAP ? m_Thresholds.DepthMaxDiffFraction : Value.GoldenValue * Scale, Unit, Status);
+            else
+               MosPrintf(MIL_TEXT("   %-36hs %11.3f %11hs %s  %s\n"), Value.Key, Value.Value * Scale, "-", Unit, Status);
+            }
+         for(MIL_INT GoldenIdx = 0; GoldenIdx < m_NbGoldenValues; GoldenIdx++)
+            {
+            if(!IsMeasured(m_GoldenValues[GoldenIdx].Key))
+               MosPrintf(MIL_TEXT("   %-36hs %11hs %11.4g     MISSING\n"), m_GoldenValues[GoldenIdx].Key, "-", m_GoldenValues[GoldenIdx].Value);
+            }
+         }
+
+   private:
+      // Disallow copy.
+      CRegressionBenchmark(const CRegressionBenchmark&);
+      CRegressionBenchmark& operator=(const CRegressionBenchmark&);
+
+      // Function that returns true if the run measured a value.
+      bool IsMeasured(const char* Key) const
+         {
+         for(MIL_INT ValueIdx = 0; ValueIdx < m_NbValues; ValueIdx++)
+            {
+            if(strcmp(m_Values[ValueIdx].Key, Key) == 0)
+               return true;
+            }
+         return false;
+         }
+
+      // Function that returns true if a value is within the tolerance of its kind.
+      // A value without golden value fails, except the depth maps.
+      bool IsWithinTolerance(const SBenchmarkValue& Value) const
+         {
+         if(Value.Check == BENCHMARK_DEPTH_MAP)
+            return Value.Value <= m_Thresholds.DepthMaxDiffFraction;
+         if(!Value.HasGolden)
+            return false;
+
+         MIL_DOUBLE Difference = Value.Value - Value.GoldenValue;
+         MIL_DOUBLE Magnitude = Value.GoldenValue < 0 ? -Value.GoldenValue : Value.GoldenValue;
+         switch(Value.Check)
+            {
+            case BENCHMARK_RESULT:
+               return (Difference < 0 ? -Difference : Difference) <= m_Thresholds.ResultTolerance * Magnitude;
+            case BENCHMARK_TIME:
+               return Difference <= m_Thresholds.MinTimeDifference || Difference <= m_Thresholds.TimeTolerance * Magnitude;
+            case BENCHMARK_MEMORY:
+               return Difference <= m_Thresholds.MemoryTolerance * Magnitude;
+            default:
+               return false;
+            }
+         }
+
+      // Function that reads a whole file. Returns its size, 0 if it cannot be read.
+      static MIL_INT ReadWholeFile(const char* FilePath, MIL_UINT8** ppData)
+         {
+         FILE* pFile = NULL;
+         if(fopen_s(&pFile, FilePath, "rb") != 0 || pFile == NULL)
+            return 0;
+         fseek(pFile, 0, SEEK_END);
+         MIL_INT Size = (MIL_INT)ftell(pFile);
+         fseek(pFile, 0, SEEK_SET);
+         *ppData = new MIL_UINT8[Size > 0 ? Size : 1];
+         if(Size <= 0 || fread(*ppData, 1, Size, pFile) != (size_t)Size)
+            Size = 0;
+         fclose(pFile);
+         return Size;
+         }
+
+      SBenchmarkThresholds m_Thresholds;
+      SBenchmarkValue      m_Values[BENCHMARK_MAX_VALUES];
+      MIL_INT              m_NbValues;
+      SBenchmarkValue      m_GoldenValues[BENCHMARK_MAX_VALUES];
+      MIL_INT              m_NbGoldenValues;
+      bool                 m_Recording;
+   };
@@ -0,0 +1,179 @@
+﻿//***************************************************************************************/
+//
+// File name: ScanQualityGate.h
+//
+// Synopsis:  Contains the scan quality gate used by the Chromasens_3DPIXA_M10PP3
+//            example. Right after the 3D calculation, a subsampled read of the
+//            depth map gives the valid coverage, a correlation confidence and a
+//            coarse height histogram. From them, the gate decides if the scan
+//            is inspected normally, inspected with downgraded results, flagged
+//            for review or skipped, and reports why.
+//
+//            The 3D API does not output its correlation coefficients, so the
+//            confidence is estimated from the local consistency of the
+//            disparity: a sampled pixel is consistent when its right and bottom
+//            neighbors are valid and within a small disparity step of it. Poor
+//            correlation, dust and missing texture all produce isolated valid
+//            pixels and noisy disparity, which lower that ratio.
+//
+// Copyright © 1992-2024 Zebra Technologies Corp. and/or its affiliates
+// All Rights Reserved
+
+static const MIL_INT QUALITY_GATE_NB_BINS = 16;
+
+// Decision of the gate, from the best to the worst.
+enum EQualityDecision
+   {
+   QUALITY_PASS,        // The scan is inspected normally.
+   QUALITY_DOWNGRADE,   // The scan is inspected but its results are less reliable.
+   QUALITY_FLAG,        // The scan is inspected and flagged for review.
+   QUALITY_SKIP         // The scan is not inspected.
+   };
+
+// Reasons of the decision, combined.
+enum EQualityReason
+   {
+   QUALITY_REASON_NONE           = 0,
+   QUALITY_REASON_EMPTY          = 1,   // Almost no valid pixels.
+   QUALITY_REASON_LOW_COVERAGE   = 2,   // Not enough valid pixels.
+   QUALITY_REASON_LOW_CONFIDENCE = 4,   // Noisy or isolated disparity values.
+   QUALITY_REASON_RANGE_CLIPPED  = 8    // Too many heights at the limits of the disparity range.
+   };
+
+// Thresholds of the gate. Coverages and fractions are between 0 and 1.
+struct SQualityGateThresholds
+   {
+   MIL_INT    SampleStep;             // Subsampling step of the read, in pixels.
+   MIL_INT    MaxConsistentStep;      // Maximum disparity step between consistent neighbors, in gray levels.
+   MIL_DOUBLE SkipCoverage;           // Skip below this coverage.
+   MIL_DOUBLE SkipConfidence;         // Skip below this confidence.
+   MIL_DOUBLE FlagCoverage;           // Flag below this coverage.
+   MIL_DOUBLE FlagClippedFraction;    // Flag above this fraction of heights in the end bins.
+   MIL_DOUBLE DowngradeConfidence;    // Downgrade below this confidence.
+   };
+
+// Result of the gate for a scan.
+struct SScanQuality
+   {
+   MIL_INT          NbSamples;
+   MIL_DOUBLE       Coverage;
+   MIL_DOUBLE       Confidence;
+   MIL_DOUBLE       ClippedFraction;
+   MIL_INT          Histogram[QUALITY_GATE_NB_BINS];
+   EQualityDecision Decision;
+   MIL_INT          Reasons;
+   };
+
+//////////////////////////////////////////////////////////////////////////
+// Class that evaluates the quality of the depth map of a scan.
+//////////////////////////////////////////////////////////////////////////
+class CScanQualityGate
+   {
+   public:
+      // Constructor.
+      CScanQualityGate(const SQualityGateThresholds& Thresholds)
+         : m_Thresholds(Thresholds)
+         {
+         if(m_Thresholds.SampleStep < 1)
+            m_Thresholds.SampleStep = 1;
+         }
+
+      // Function that evaluates the 16-bit depth map, where 0 is an invalid pixel.
+      // Returns the decision.
+      EQualityDecision Evaluate(MIL_ID MilDepthMap, SScanQuality* pQuality) const
+         {
+         MIL_INT SizeX = MbufInquire(MilDepthMap, M_SIZE_X, M_NULL);
+         MIL_INT SizeY = MbufInquire(MilDepthMap, M_SIZE_Y, M_NULL);
+         MIL_INT Pitch = MbufInquire(MilDepthMap, M_PITCH, M_NULL);
+         const MIL_UINT16* pData = (const MIL_UINT16*)MbufInquire(MilDepthMap, M_HOST_ADDRESS, M_NULL);
+
+         // Read the samples. The last row and column are not sampled so that
+         // every sample has a right and a bottom neighbor.
+         MIL_INT NbValid = 0;
+         MIL_INT NbConsistent = 0;
+         memset(pQuality->Histogram, 0, sizeof(pQuality->Histogram));
+         pQuality->NbSamples = 0;
+         for(MIL_INT y = 0; y < SizeY - 1; y += m_Thresholds.SampleStep)
+            {
+            const MIL_UINT16* pRow = pData + y * Pitch;
+            for(MIL_INT x = 0; x < SizeX - 1; x += m_Thresholds.SampleStep)
+               {
+               pQuality->NbSamples++;
+               MIL_INT Value = pRow[x];
+               if(Value == 0)
+                  continue;
+
+               NbValid++;
+               pQuality->Histogram[(Value - 1) * QUALITY_GATE_NB_BINS / 65535]++;
+               MIL_INT RightValue = pRow[x + 1];
+               MIL_INT BottomValue = pRow[x + Pitch];
+               if(RightValue != 0 && BottomValue != 0 &&
+                  labs((long)(RightValue - Value)) <= m_Thresholds.MaxConsistentStep &&
+                  labs((long)(BottomValue - Value)) <= m_Thresholds.MaxConsistentStep)
+                  NbConsistent++;
+               }
+            }
+
+         pQuality->Coverage = pQuality->NbSamples > 0 ? (MIL_DOUBLE)NbValid / pQuality->NbSamples : 0.0;
+         pQuality->Confidence = NbValid > 0 ? (MIL_DOUBLE)NbConsistent / NbValid : 0.0;
+         pQuality->ClippedFraction = NbValid > 0 ? (MIL_DOUBLE)(pQuality->Histogram[0] + pQuality->Histogram[QUALITY_GATE_NB_BINS - 1]) / NbValid : 0.0;
+
+         // Take the decision, the worst one wins.
+         pQuality->Reasons = QUALITY_REASON_NONE;
+         pQuality->Decision = QUALITY_PASS;
+         if(pQuality->Coverage < m_Thresholds.SkipCoverage)
+            SetDecision(pQuality, QUALITY_SKIP, QUALITY_REASON_EMPTY);
+         else
+            {
+            if(pQuality->Confidence < m_Thresholds.SkipConfidence)
+               SetDecision(pQuality, QUALITY_SKIP, QUALITY_REASON_LOW_CONFIDENCE);
+            else if(pQuality->Confidence < m_Thresholds.DowngradeConfidence)
+               SetDecision(pQuality, QUALITY_DOWNGRADE, QUALITY_REASON_LOW_CONFIDENCE);
+            if(pQuality->Coverage < m_Thresholds.FlagCoverage)
+               SetDecision(pQuality, QUALITY_FLAG, QUALITY_REASON_LOW_COVERAGE);
+            if(pQuality->ClippedFraction > m_Thresholds.FlagClippedFraction)
+               SetDecision(pQuality, QUALITY_FLAG, QUALITY_REASON_RANGE_CLIPPED);
+            }
+         return pQuality->Decision;
+         }
+
+      // Function that prints the measures, the decision and its reasons.
+      static void PrintReport(const SScanQuality& Quality)
+         {
+         static MIL_CONST_TEXT_PTR DECISION_NAMES[] = {MIL_TEXT("pass"), MIL_TEXT("downgrade"), MIL_TEXT("flag"), MIL_TEXT("skip")};
+         MosPrintf(MIL_TEXT("Scan quality: %s (coverage %.1f%%, confidence %.2f, clipped %.1f%%, %d samples).\n"),
+                   DECISION_NAMES[Quality.Decision], Quality.Coverage * 100.0, Quality.Confidence,
+                   Quality.ClippedFraction * 100.0, (int)Quality.NbSamples);
+         if(Quality.Reasons & QUALITY_REASON_EMPTY)
+            MosPrintf(MIL_TEXT("   The scan holds almost no valid 3D data.\n"));
+         if(Quality.Reasons & QUALITY_REASON_LOW_COVERAGE)
+            MosPrintf(MIL_TEXT("   The valid 3D data does not cover enough of the scan.\n"));
+         if(Quality.Reasons & QUALITY_REASON_LOW_CONFIDENCE)
+            MosPrintf(MIL_TEXT("   The disparity is noisy; the object may lack texture or be dusty.\n"));
+         if(Quality.Reasons & QUALITY_REASON_RANGE_CLIPPED)
+            MosPrintf(MIL_TEXT("   Many heights are at the limits of the disparity range.\n"));
+
+         // Print the coarse height histogram, from dStart to dEnd.
+         MIL_INT NbValid = 0;
+         for(MIL_INT BinIdx = 0; BinIdx < QUALITY_GATE_NB_BINS; BinIdx++)
+            NbValid += Quality.Histogram[BinIdx];
+         if(NbValid > 0)
+            {
+            MosPrintf(MIL_TEXT("   Height histogram (%%):"));
+            for(MIL_INT BinIdx = 0; BinIdx < QUALITY_GATE_NB_BINS; BinIdx++)
+               MosPrintf(MIL_TEXT(" %.0f"), 100.0 * Quality.Histogram[BinIdx] / NbValid);
+            MosPrintf(MIL_TEXT("\n"));
+            }
+         }
+
+   private:
+      // Function that keeps the worst decision and adds the reason.
+      static void SetDecision(SScanQuality* pQuality, EQualityDecision Decision, EQualityReason Reason)
+         {
+         if(Decision > pQuality->Decision)
+            pQuality->Decision = Decision;
+         pQuality->Reasons |= Reason;
+         }
+
+      SQualityGateThresholds m_Thresholds;
+   };
@@ -0,0 +1,407 @@
+﻿//***************************************************************************************/
+//
+// File name: ScanResultStream.h
+//
+// Synopsis:  Contains the binary result stream used by the Chromasens_3DPIXA_M10PP3
+//            example. For every scan, a compact record holds the quality decision,
+//            every defect blob (bounding box, area and minimum height) and the
+//            peak statistics. The records are appended to a ring that is either
+//            a file or a named shared memory; both are mapped in memory so that
+//            writing a record is a single copy.
+//
+//            Record layout, all values little endian:
+//               SScanResultHeader       RecordSize includes the header and
+//                                       the blocks, padded to 16 bytes.
+//               NbBlocks x
+//                  SScanResultBlockHeader
+//                  Block data           Arrays of NbItems values, one array
+//                                       per field (struct of arrays).
+//
+//            Ring layout:
+//               SScanResultRingHeader   WriteCount is the number of bytes ever
+//                                       written; a record starts at WriteCount
+//                                       modulo Capacity. It is updated after
+//                                       the record is copied.
+//               Capacity bytes          Records. A record never wraps; the end
+//                                       of the ring is skipped with a padding
+//                                       record instead.
+//
+// Copyright © 1992-2024 Zebra Technologies Corp. and/or its affiliates
+// All Rights Reserved
+
+static const MIL_UINT32 SCAN_RESULT_MAGIC         = 0x52443343;   // "C3DR"
+static const MIL_UINT32 SCAN_RESULT_PADDING_MAGIC = 0x44415043;   // "CPAD"
+static const MIL_UINT32 SCAN_RESULT_RING_MAGIC    = 0x47524443;   // "CDRG"
+static const MIL_UINT16 SCAN_RESULT_VERSION       = 1;
+static const MIL_INT    SCAN_RESULT_ALIGNMENT     = 16;
+static const MIL_INT    SCAN_RESULT_MAX_DEFECTS   = 4096;
+
+// Types of the blocks of a record.
+enum EScanResultBlock
+   {
+   SCAN_RESULT_BLOCK_DEFECTS = 1,   // BoxMinX, BoxMinY, BoxMaxX, BoxMaxY, Area (MIL_INT32) and MinHeight (MIL_FLOAT, in mm).
+   SCAN_RESULT_BLOCK_PEAKS   = 2    // One SScanResultPeaks.
+   };
+
+// Header of a record.
+struct SScanResultHeader
+   {
+   MIL_UINT32 Magic;
+   MIL_UINT16 Version;
+   MIL_UINT16 NbBlocks;
+   MIL_UINT32 RecordSize;
+   MIL_UINT32 RecipeIdx;
+   MIL_UINT64 ScanIdx;
+   MIL_DOUBLE Time;          // In s.
+   MIL_UINT32 Decision;      // EQualityDecision of the scan.
+   MIL_UINT32 Reasons;       // EQualityReason flags of the scan.
+   };
+
+// Header of a block.
+struct SScanResultBlockHeader
+   {
+   MIL_UINT32 Type;
+   MIL_UINT32 BlockSize;     // Includes this header.
+   MIL_UINT32 NbItems;
+   MIL_UINT32 Reserved;
+   };
+
+// Peak statistics of a scan.
+struct SScanResultPeaks
+   {
+   MIL_UINT32 NbPeaks;
+   MIL_FLOAT  GlobalDensity;     // In peak/cm^2.
+   MIL_FLOAT  MaxLocalDensity;   // In peak/cm^2.
+   MIL_UINT32 Reserved;
+   };
+
+// Header of the ring.
+struct SScanResultRingHeader
+   {
+   MIL_UINT32 Magic;
+   MIL_UINT16 Version;
+   MIL_UINT16 HeaderSize;
+   MIL_UINT64 Capacity;
+   volatile MIL_INT64 WriteCount;
+   MIL_UINT64 NbRecords;
+   };
+
+//////////////////////////////////////////////////////////////////////////
+// Class that builds the result record of a scan in a preallocated buffer.
+//////////////////////////////////////////////////////////////////////////
+class CScanResultRecord
+   {
+   public:
+      // Constructor.
+      CScanResultRecord()
+         : m_pBuffer(new MIL_UINT8[GetMaxRecordSize()]),
+           m_NbDefects(0),
+           m_HasPeaks(false),
+           m_OffsetX(0),
+           m_OffsetY(0),
+           m_pScratch(NULL),
+           m_ScratchSize(0)
+         {
+         memset(&m_Header, 0, sizeof(m_Header));
+         memset(&m_Peaks, 0, sizeof(m_Peaks));
+         }
+
+      // Destructor.
+      virtual ~CScanResultRecord()
+         {
+         delete [] m_pScratch;
+         delete [] m_pBuffer;
+         }
+
+      // Function that starts the record of a scan.
+      void Reset(MIL_UINT64 ScanIdx, MIL_INT RecipeIdx)
+         {
+         memset(&m_Header, 0, sizeof(m_Header));
+         m_Header.ScanIdx = ScanIdx;
+         m_Header.RecipeIdx = (MIL_UINT32)RecipeIdx;
+         MappTimer(M_DEFAULT, M_TIMER_READ, &m_Header.Time);
+         m_OffsetX = 0;
+         m_OffsetY = 0;
+         m_NbDefects = 0;
+         m_HasPeaks = false;
+         }
+
+      // Function that sets the position of the inspected image in the scan. The
+      // defect positions are moved by it.
+      void SetOffset(MIL_INT OffsetX, MIL_INT OffsetY)
+         {
+         m_OffsetX = OffsetX;
+         m_OffsetY = OffsetY;
+         }
+
+      // Function that sets the quality decision of the scan.
+      void SetQuality(MIL_INT Decision, MIL_INT Reasons)
+         {
+         m_Header.Decision = (MIL_UINT32)Decision;
+         m_Header.Reasons = (MIL_UINT32)Reasons;
+         }
+
+      // Function that gets the included blobs of a blob result as defects. The
+      // M_BOX and M_MIN_PIXEL features must be calculated. The minimum pixel
+      // is converted to mm with the calibration of the depth map. Only the
+      // first SCAN_RESULT_MAX_DEFECTS blobs are kept.
+      void SetDefects(MIL_ID MilBlobResult, MIL_DOUBLE WorldPosZ, MIL_DOUBLE GrayLevelSizeZ, MIL_DOUBLE ZMultFactor)
+         {
+         MIL_INT NbBlobs;
+         MblobGetResult(MilBlobResult, M_GENERAL, M_NUMBER + M_TYPE_MIL_INT, &NbBlobs);
+         m_NbDefects = NbBlobs < SCAN_RESULT_MAX_DEFECTS ? NbBlobs : SCAN_RESULT_MAX_DEFECTS;
+         if(m_NbDefects == 0)
+            return;
+
+         // The results are read for all the blobs, so they go through a scratch
+         // array of the blob count before the kept ones are copied to the record.
+         if(m_ScratchSize < NbBlobs)
+            {
+            delete [] m_pScratch;
+            m_pScratch = new MIL_INT32[NbBlobs];
+            m_ScratchSize = NbBlobs;
+            }
+         static const MIL_INT DEFECT_FEATURES[] = {M_BOX_X_MIN, M_BOX_Y_MIN, M_BOX_X_MAX, M_BOX_Y_MAX, M_AREA};
+         for(MIL_INT ArrayIdx = 0; ArrayIdx < 5; ArrayIdx++)
+            {
+            MblobGetResult(MilBlobResult, M_DEFAULT, DEFECT_FEATURES[ArrayIdx] + M_TYPE_MIL_INT32, m_pScratch);
+            memcpy(GetDefectArray(ArrayIdx), m_pScratch, m_NbDefects * sizeof(MIL_INT32));
+            }
+
+         MIL_INT32* pBoxMinX = GetDefectArray(0);
+         MIL_INT32* pBoxMinY = GetDefectArray(1);
+         MIL_INT32* pBoxMaxX = GetDefectArray(2);
+         MIL_INT32* pBoxMaxY = GetDefectArray(3);
+         MIL_FLOAT* pMinHeight = (MIL_FLOAT*)GetDefectArray(5);
+         MblobGetResult(MilBlobResult, M_DEFAULT, M_MIN_PIXEL + M_TYPE_MIL_INT32, m_pScratch);
+         for(MIL_INT DefectIdx = 0; DefectIdx < m_NbDefects; DefectIdx++)
+            {
+            pBoxMinX[DefectIdx] += (MIL_INT32)m_OffsetX;
+            pBoxMaxX[DefectIdx] += (MIL_INT32)m_OffsetX;
+            pBoxMinY[DefectIdx] += (MIL_INT32)m_OffsetY;
+            pBoxMaxY[DefectIdx] += (MIL_INT32)m_OffsetY;
+            pMinHeight[DefectIdx] = (MIL_FLOAT)((m_pScratch[DefectIdx] * GrayLevelSizeZ + WorldPosZ) / ZMultFactor);
+            }
+         }
+
+      // Function that sets the peak statistics.
+      void SetPeaks(MIL_INT NbPeaks, MIL_DOUBLE GlobalDensity, MIL_DOUBLE MaxLocalDensity)
+         {
+         m_Peaks.NbPeaks = (MIL_UINT32)NbPeaks;
+         m_Peaks.GlobalDensity = (MIL_FLOAT)GlobalDensity;
+         m_Peaks.MaxLocalDensity = (MIL_FLOAT)MaxLocalDensity;
+         m_HasPeaks = true;
+         }
+
+      // Function that finishes the record. Returns its data and its size.
+      const MIL_UINT8* Finish(MIL_INT* pRecordSize)
+         {
+         MIL_UINT8* pData = m_pBuffer + sizeof(SScanResultHeader);
+         m_Header.NbBlocks = 0;
+
+         // The defect arrays are already in place, only the header is written.
+         if(m_NbDefects > 0)
+            {
+            SScanResultBlockHeader* pBlockHeader = (SScanResultBlockHeader*)pData;
+            pBlockHeader->Type = SCAN_RESULT_BLOCK_DEFECTS;
+            pBlockHeader->BlockSize = (MIL_UINT32)(sizeof(SScanResultBlockHeader) + 6 * m_NbDefects * sizeof(MIL_INT32));
+            pBlockHeader->NbItems = (MIL_UINT32)m_NbDefects;
+            pBlockHeader->Reserved = 0;
+            CompactDefectArrays();
+            pData += pBlockHeader->BlockSize;
+            m_Header.NbBlocks++;
+            }
+
+         if(m_HasPeaks)
+            {
+            SScanResultBlockHeader* pBlockHeader = (SScanResultBlockHeader*)pData;
+            pBlockHeader->Type = SCAN_RESULT_BLOCK_PEAKS;
+            pBlockHeader->BlockSize = (MIL_UINT32)(sizeof(SScanResultBlockHeader) + sizeof(SScanResultPeaks));
+            pBlockHeader->NbItems = 1;
+            pBlockHeader->Reserved = 0;
+            memcpy(pBlockHeader + 1, &m_Peaks, sizeof(SScanResultPeaks));
+            pData += pBlockHeader->BlockSize;
+            m_Header.NbBlocks++;
+            }
+
+         // Pad the record and write its header.
+         MIL_INT RecordSize = pData - m_pBuffer;
+         MIL_INT PaddedSize = (RecordSize + SCAN_RESULT_ALIGNMENT - 1) / SCAN_RESULT_ALIGNMENT * SCAN_RESULT_ALIGNMENT;
+         memset(pData, 0, PaddedSize - RecordSize);
+         m_Header.Magic = SCAN_RESULT_MAGIC;
+         m_Header.Version = SCAN_RESULT_VERSION;
+         m_Header.RecordSize = (MIL_UINT32)PaddedSize;
+         memcpy(m_pBuffer, &m_Header, sizeof(m_Header));
+         *pRecordSize = PaddedSize;
+         return m_pBuffer;
+         }
+
+      // Function that returns the size of the largest record.
+      static MIL_INT GetMaxRecordSize()
+         {
+         MIL_INT MaxSize = sizeof(SScanResultHeader) +
+                           sizeof(SScanResultBlockHeader) + 6 * SCAN_RESULT_MAX_DEFECTS * sizeof(MIL_INT32) +
+                           sizeof(SScanResultBlockHeader) + sizeof(SScanResultPeaks);
+         return (MaxSize + SCAN_RESULT_ALIGNMENT - 1) / SCAN_RESULT_ALIGNMENT * SCAN_RESULT_ALIGNMENT;
+         }
+
+   private:
+      // Disallow copy.
+      CScanResultRecord(const CScanResultRecord&);
+      CScanResultRecord& operator=(const CScanResultRecord&);
+
+      // Function that returns a defect array. The arrays are filled at their
+      // position for the maximum number of defects, then compacted.
+      MIL_INT32* GetDefectArray(MIL_INT ArrayIdx)
+         {
+         MIL_INT32* pFirstArray = (MIL_INT32*)(m_pBuffer + sizeof(SScanResultHeader) + sizeof(SScanResultBlockHeader));
+         return pFirstArray + ArrayIdx * SCAN_RESULT_MAX_DEFECTS;
+         }
+
+      // Function that moves the defect arrays next to each other.
+      void CompactDefectArrays()
+         {
+         MIL_INT32* pFirstArray = GetDefectArray(0);
+         for(MIL_INT ArrayIdx = 1; ArrayIdx < 6; ArrayIdx++)
+            memmove(pFirstArray + ArrayIdx * m_NbDefects, GetDefectArray(ArrayIdx), m_NbDefects * sizeof(MIL_INT32));
+         }
+
+      MIL_UINT8*        m_pBuffer;
+      SScanResultHeader m_Header;
+      MIL_INT           m_NbDefects;
+      SScanResultPeaks  m_Peaks;
+      bool              m_HasPeaks;
+      MIL_INT           m_OffsetX;
+      MIL_INT           m_OffsetY;
+      MIL_INT32*        m_pScratch;      // Results of all the blobs, for one feature.
+      MIL_INT           m_ScratchSize;
+   };
+
+//////////////////////////////////////////////////////////////////////////
+// Class that appends the records to a ring mapped from a file or from a
+// named shared memory.
+//////////////////////////////////////////////////////////////////////////
+class CScanResultRing
+   {
+   public:
+      // Constructor.
+      CScanResultRing()
+         : m_hFile(INVALID_HANDLE_VALUE),
+           m_hMapping(NULL),
+           m_pHeader(NULL),
+           m_pData(NULL)
+         {
+         }
+
+      // Destructor.
+      virtual ~CScanResultRing()
+         {
+         Close();
+         }
+
+      // Function that opens the ring in a file. The records of an existing ring
+      // of the same capacity are kept.
+      bool OpenFile(const char* FilePath, MIL_INT Capacity)
+         {
+         Close();
+         m_hFile = CreateFileA(FilePath, GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, NULL, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+         if(m_hFile == INVALID_HANDLE_VALUE)
+            return false;
+         return Map(m_hFile, NULL, Capacity);
+         }
+
+      // Function that opens the ring in a named shared memory.
+      bool OpenSharedMemory(const char* Name, MIL_INT Capacity)
+         {
+         Close();
+         return Map(INVALID_HANDLE_VALUE, Name, Capacity);
+         }
+
+      // Function that closes the ring.
+      void Close()
+         {
+         if(m_pHeader)
+            UnmapViewOfFile(m_pHeader);
+         if(m_hMapping)
+            CloseHandle(m_hMapping);
+         if(m_hFile != INVALID_HANDLE_VALUE)
+            CloseHandle(m_hFile);
+         m_hFile = INVALID_HANDLE_VALUE;
+         m_hMapping = NULL;
+         m_pHeader = NULL;
+         m_pData = NULL;
+         }
+
+      // Function that appends a record. Returns false if the ring is not open
+      // or the record is larger than the ring.
+      bool Write(const MIL_UINT8* pRecord, MIL_INT RecordSize)
+         {
+         if(!m_pHeader || (MIL_UINT64)RecordSize > m_pHeader->Capacity)
+            return false;
+
+         // Skip the end of the ring if the record does not fit before it.
+         MIL_INT64 WriteCount = m_pHeader->WriteCount;
+         MIL_INT64 Position = WriteCount % (MIL_INT64)m_pHeader->Capacity;
+         MIL_INT64 Remaining = (MIL_INT64)m_pHeader->Capacity - Position;
+         if(Remaining < RecordSize)
+            {
+            SScanResultHeader* pPadding = (SScanResultHeader*)(m_pData + Position);
+            pPadding->Magic = SCAN_RESULT_PADDING_MAGIC;
+            pPadding->Version = SCAN_RESULT_VERSION;
+            pPadding->NbBlocks = 0;
+            pPadding->RecordSize = (MIL_UINT32)Remaining;
+            WriteCount += Remaining;
+            Position = 0;
+            }
+
+         // Copy the record, then publish it.
+         memcpy(m_pData + Position, pRecord, RecordSize);
+         m_pHeader->NbRecords++;
+         InterlockedExchange64((volatile LONGLONG*)&m_pHeader->WriteCount, WriteCount + RecordSize);
+         return true;
+         }
+
+      // Function that returns the number of records ever written.
+      MIL_UINT64 GetNbRecords() const {return m_pHeader ? m_pHeader->NbRecords : 0;}
+
+   private:
+      // Disallow copy.
+      CScanResultRing(const CScanResultRing&);
+      CScanResultRing& operator=(const CScanResultRing&);
+
+      // Function that maps the ring and initializes its header if needed.
+      bool Map(HANDLE hFile, const char* Name, MIL_INT Capacity)
+         {
+         Capacity = Capacity / SCAN_RESULT_ALIGNMENT * SCAN_RESULT_ALIGNMENT;
+         MIL_UINT64 MappingSize = sizeof(SScanResultRingHeader) + (MIL_UINT64)Capacity;
+         m_hMapping = CreateFileMappingA(hFile, NULL, PAGE_READWRITE, (DWORD)(MappingSize >> 32), (DWORD)(MappingSize & 0xFFFFFFFF), Name);
+         if(!m_hMapping)
+            {
+            Close();
+            return false;
+            }
+         m_pHeader = (SScanResultRingHeader*)MapViewOfFile(m_hMapping, FILE_MAP_ALL_ACCESS, 0, 0, (size_t)MappingSize);
+         if(!m_pHeader)
+            {
+            Close();
+            return false;
+            }
+         m_pData = (MIL_UINT8*)m_pHeader + sizeof(SScanResultRingHeader);
+
+         if(m_pHeader->Magic != SCAN_RESULT_RING_MAGIC || m_pHeader->Version != SCAN_RESULT_VERSION || m_pHeader->Capacity != (MIL_UINT64)Capacity)
+            {
+            m_pHeader->Magic = SCAN_RESULT_RING_MAGIC;
+            m_pHeader->Version = SCAN_RESULT_VERSION;
+            m_pHeader->HeaderSize = (MIL_UINT16)sizeof(SScanResultRingHeader);
+            m_pHeader->Capacity = (MIL_UINT64)Capacity;
+            m_pHeader->WriteCount = 0;
+            m_pHeader->NbRecords = 0;
+            }
+         return true;
+         }
+
+      HANDLE                 m_hFile;
+      HANDLE                 m_hMapping;
+      SScanResultRingHeader* m_pHeader;
+      MIL_UINT8*             m_pData;
+   };
@@ -0,0 +1,728 @@
+﻿//***************************************************************************************/
+//
+// File name: ScanShardRing.h
+//
+// Synopsis:  Contains the multi-process scan sharding used by the
+//            Chromasens_3DPIXA_M10PP3 example. The acquisition process writes
+//            the depth map of each scan in a ring of frame slots of a named
+//            shared memory. Worker processes, started with
+//            SCAN_SHARD_WORKER_ARGUMENT and their index on the command line,
+//            claim the slots, run the inspection and write its result in the
+//            slot, and the acquisition process takes the results in sequence
+//            order. The header also holds data of the acquisition process for
+//            the workers, such as the calibration of the depth maps.
+//
+//            A worker claims a slot by an atomic exchange of its state with a
+//            state that holds the index of the worker, so the acquisition
+//            process always knows the scan in flight of each worker. When a
+//            worker process ends, or holds a scan past the timeout, it is
+//            terminated, its scan is marked lost and it is restarted; no other
+//            scan is affected. Scan n is in slot n modulo NbSlots, so a slot is
+//            written again only once its result is taken.
+//
+//            Shared memory layout:
+//               SScanShardRingHeader    Padded to SCAN_SHARD_SLOT_ALIGNMENT.
+//               NbSlots x SlotSize bytes:
+//                  SScanShardSlot       State, scan and result, padded to
+//                                       SCAN_SHARD_SLOT_ALIGNMENT.
+//                  Depth map            16-bit, FrameSizeX x FrameSizeY.
+//
+// Copyright © 1992-2024 Zebra Technologies Corp. and/or its affiliates
+// All Rights Reserved
+
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+static const MIL_UINT32 SCAN_SHARD_MAGIC          = 0x44485343;   // "CSHD"
+static const MIL_UINT16 SCAN_SHARD_VERSION        = 2;
+static const MIL_INT    SCAN_SHARD_MAX_WORKERS    = 16;
+static const MIL_INT    SCAN_SHARD_MAX_SLOTS      = 64;
+static const MIL_INT    SCAN_SHARD_MAX_RESTARTS   = 3;        // Of a worker, after which it is left stopped.
+static const MIL_INT    SCAN_SHARD_SLOT_ALIGNMENT = 4096;
+static const MIL_INT    SCAN_SHARD_MAX_USER_DATA  = 1024;     // In bytes.
+static const DWORD      SCAN_SHARD_STOP_TIMEOUT   = 5000;     // In ms, before the workers are terminated.
+static const MIL_INT    SCAN_SHARD_POLL_PERIOD    = 10;       // In ms, while waiting for the workers to be ready.
+
+// Shared memory of the frame ring of the example. The semaphore and the event of
+// the ring have the same name with a suffix.
+static const char*      SCAN_SHARD_SHARED_MEMORY = "Local\\Chromasens_3DPIXA_M10PP3_Shards";
+
+// Argument of the command line of a worker process, followed by its index.
+static const char*      SCAN_SHARD_WORKER_ARGUMENT = "-shardworker";
+
+// States of a slot. A claimed slot is in SCAN_SHARD_CLAIMED plus the index of its worker.
+enum EScanShardSlotState
+   {
+   SCAN_SHARD_FREE    = 0,   // Written by the acquisition process.
+   SCAN_SHARD_READY   = 1,   // Claimed by the first worker.
+   SCAN_SHARD_DONE    = 2,   // Holds the result of its worker.
+   SCAN_SHARD_LOST    = 3,   // Its worker failed.
+   SCAN_SHARD_CLAIMED = 16
+   };
+
+// Result of a scan. The worker sets the result of the inspection; the scan is
+// set by the ring.
+struct SScanShardResult
+   {
+   MIL_INT64  Sequence;
+   MIL_UINT32 RecipeIdx;
+   MIL_UINT32 WorkerIdx;
+   MIL_UINT32 Lost;            // The worker failed; no result of the inspection is set.
+   MIL_UINT32 Succeeded;       // The pipeline ran.
+   MIL_UINT32 Decision;        // EQualityDecision of the scan.
+   MIL_UINT32 NbDefects;
+   MIL_UINT32 NbPeaks;
+   MIL_UINT32 Reserved;
+   MIL_DOUBLE ValidCoverage;
+   MIL_DOUBLE ProcessTime;     // In the worker, in s.
+   MIL_DOUBLE WriteTime;       // MappTimer time of the acquisition process at which the scan was written.
+   };
+
+// Header of a slot.
+struct SScanShardSlot
+   {
+   volatile LONG    State;
+   MIL_UINT32       RecipeIdx;
+   MIL_INT64        Sequence;
+   MIL_UINT32       SizeX;
+   MIL_UINT32       SizeY;
+   MIL_DOUBLE       WriteTime;
+   SScanShardResult Result;
+   };
+
+// Header of the ring.
+struct SScanShardRingHeader
+   {
+   MIL_UINT32    Magic;
+   MIL_UINT16    Version;
+   MIL_UINT16    HeaderSize;
+   MIL_UINT32    NbSlots;
+   MIL_UINT32    NbWorkers;
+   MIL_UINT64    SlotSize;
+   MIL_UINT32    FrameSizeX;
+   MIL_UINT32    FrameSizeY;
+   MIL_UINT32    UserDataSize;
+   MIL_UINT32    ProcessId;                             // Of the acquisition process.
+   volatile LONG Stopped;                               // Set once all the results are taken.
+   volatile LONG WorkerProcessIds[SCAN_SHARD_MAX_WORKERS];   // Set by each worker once it is ready.
+   MIL_UINT8     UserData[SCAN_SHARD_MAX_USER_DATA];    // Of the acquisition process, for the workers.
+   };
+
+// Worker process, seen from the acquisition process.
+struct SScanShardWorkerProcess
+   {
+   HANDLE     hProcess;     // NULL if the worker is stopped.
+   MIL_INT    NbScans;
+   MIL_INT    NbLostScans;
+   MIL_INT    NbRestarts;
+   MIL_DOUBLE ProcessTime;  // Of its scans, in s.
+   };
+
+//*****************************************************************************
+// GetScanShardSlotsOffset. Returns the offset of the first slot in the ring.
+//*****************************************************************************
+inline MIL_UINT64 GetScanShardSlotsOffset()
+   {
+   return (sizeof(SScanShardRingHeader) + SCAN_SHARD_SLOT_ALIGNMENT - 1) / SCAN_SHARD_SLOT_ALIGNMENT * SCAN_SHARD_SLOT_ALIGNMENT;
+   }
+
+//*****************************************************************************
+// GetScanShardFrameOffset. Returns the offset of the depth map in a slot.
+//*****************************************************************************
+inline MIL_UINT64 GetScanShardFrameOffset()
+   {
+   return (sizeof(SScanShardSlot) + SCAN_SHARD_SLOT_ALIGNMENT - 1) / SCAN_SHARD_SLOT_ALIGNMENT * SCAN_SHARD_SLOT_ALIGNMENT;
+   }
+
+//*****************************************************************************
+// GetScanShardObjectName. Builds the name of a synchronization object of a ring.
+//*****************************************************************************
+inline void GetScanShardObjectName(char* pObjectName, const char* Name, const char* Suffix)
+   {
+   sprintf_s(pObjectName, MAX_PATH, "%s_%s", Name, Suffix);
+   }
+
+//////////////////////////////////////////////////////////////////////////
+// Class that writes the scans in the ring, starts and supervises the worker
+// processes and takes the results in sequence order. It is used from a single
+// thread of the acquisition process.
+//////////////////////////////////////////////////////////////////////////
+class CScanShardDispatcher
+   {
+   public:
+      // Constructor.
+      CScanShardDispatcher()
+         : m_hMapping(NULL),
+           m_pHeader(NULL),
+           m_pSlots(NULL),
+           m_SlotSize(0),
+           m_NbSlots(0),
+           m_hReadySemaphore(NULL),
+           m_hDoneEvent(NULL),
+           m_NbWorkers(0),
+           m_ScanTimeout(0.0),
+           m_NextSequence(0),
+           m_NextResultSequence(0)
+         {
+         memset(m_Workers, 0, sizeof(m_Workers));
+         memset(m_LostWorkers, 0, sizeof(m_LostWorkers));
+         }
+
+      // Destructor.
+      virtual ~CScanShardDispatcher()
+         {
+         Close();
+         }
+
+      // Function that creates the shared memory of the ring, for scans of up to
+      // FrameSizeX x FrameSizeY pixels, and its synchronization objects. The
+      // user data, of up to SCAN_SHARD_MAX_USER_DATA bytes, is given to the
+      // workers.
+      bool Open(const char* Name, MIL_INT NbSlots, MIL_INT FrameSizeX, MIL_INT FrameSizeY, const void* pUserData, MIL_INT UserDataSize)
+         {
+         Close();
+         if(NbSlots < 1 || NbSlots > SCAN_SHARD_MAX_SLOTS || FrameSizeX < 1 || FrameSizeY < 1 || UserDataSize < 0 || UserDataSize > SCAN_SHARD_MAX_USER_DATA)
+            return false;
+         m_NbSlots = NbSlots;
+         MIL_UINT64 FrameSize = (MIL_UINT64)FrameSizeX * FrameSizeY * sizeof(MIL_UINT16);
+         m_SlotSize = (GetScanShardFrameOffset() + FrameSize + SCAN_SHARD_SLOT_ALIGNMENT - 1) / SCAN_SHARD_SLOT_ALIGNMENT * SCAN_SHARD_SLOT_ALIGNMENT;
+         MIL_UINT64 MappingSize = GetScanShardSlotsOffset() + m_NbSlots * m_SlotSize;
+         m_hMapping = CreateFileMappingA(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE, (DWORD)(MappingSize >> 32), (DWORD)MappingSize, Name);
+         if(!m_hMapping)
+            return false;
+         m_pHeader = (SScanShardRingHeader*)MapViewOfFile(m_hMapping, FILE_MAP_ALL_ACCESS, 0, 0, (size_t)MappingSize);
+         char ObjectName[MAX_PATH];
+         GetScanShardObjectName(ObjectName, Name, "Ready");
+         m_hReadySemaphore = CreateSemaphoreA(NULL, 0, 0x7FFFFFFF, ObjectName);
+         GetScanShardObjectName(ObjectName, Name, "Done");
+         m_hDoneEvent = CreateEventA(NULL, FALSE, FALSE, ObjectName);
+         if(!m_pHeader || !m_hReadySemaphore || !m_hDoneEvent)
+            {
+            Close();
+            return false;
+            }
+         m_pSlots = (MIL_UINT8*)m_pHeader + GetScanShardSlotsOffset();
+
+         // Free the slots before the header is valid, in case an old worker is attached.
+         m_pHeader->Magic = 0;
+         for(MIL_INT SlotIdx = 0; SlotIdx < m_NbSlots; SlotIdx++)
+            {
+            memset(GetSlot(SlotIdx), 0, sizeof(SScanShardSlot));
+            m_ObservedSequences[SlotIdx] = -1;
+            }
+         m_pHeader->Version = SCAN_SHARD_VERSION;
+         m_pHeader->HeaderSize = (MIL_UINT16)sizeof(SScanShardRingHeader);
+         m_pHeader->NbSlots = (MIL_UINT32)m_NbSlots;
+         m_pHeader->NbWorkers = 0;
+         m_pHeader->SlotSize = m_SlotSize;
+         m_pHeader->FrameSizeX = (MIL_UINT32)FrameSizeX;
+         m_pHeader->FrameSizeY = (MIL_UINT32)FrameSizeY;
+         m_pHeader->UserDataSize = (MIL_UINT32)UserDataSize;
+         if(UserDataSize > 0)
+            memcpy(m_pHeader->UserData, pUserData, UserDataSize);
+         m_pHeader->ProcessId = (MIL_UINT32)GetCurrentProcessId();
+         m_pHeader->Stopped = 0;
+         memset((void*)m_pHeader->WorkerProcessIds, 0, sizeof(m_pHeader->WorkerProcessIds));
+         InterlockedExchange((volatile LONG*)&m_pHeader->Magic, (LONG)SCAN_SHARD_MAGIC);
+         m_NextSequence = 0;
+         m_NextResultSequence = 0;
+         return true;
+         }
+
+      // Function that stops the workers and closes the ring. The workers are
+      // given SCAN_SHARD_STOP_TIMEOUT to end before they are terminated.
+      void Close()
+         {
+         if(m_pHeader)
+            {
+            InterlockedExchange(&m_pHeader->Stopped, 1);
+            if(m_NbWorkers > 0)
+               ReleaseSemaphore(m_hReadySemaphore, (LONG)m_NbWorkers, NULL);
+            }
+         for(MIL_INT WorkerIdx = 0; WorkerIdx < m_NbWorkers; WorkerIdx++)
+            {
+            SScanShardWorkerProcess& Worker = m_Workers[WorkerIdx];
+            if(Worker.hProcess)
+               {
+               if(WaitForSingleObject(Worker.hProcess, SCAN_SHARD_STOP_TIMEOUT) != WAIT_OBJECT_0)
+                  TerminateProcess(Worker.hProcess, 1);
+               CloseHandle(Worker.hProcess);
+               Worker.hProcess = NULL;
+               }
+            }
+         if(m_hDoneEvent)
+            CloseHandle(m_hDoneEvent);
+         if(m_hReadySemaphore)
+            CloseHandle(m_hReadySemaphore);
+         if(m_pHeader)
+            UnmapViewOfFile(m_pHeader);
+         if(m_hMapping)
+            CloseHandle(m_hMapping);
+         m_hDoneEvent = NULL;
+         m_hReadySemaphore = NULL;
+         m_pHeader = NULL;
+         m_hMapping = NULL;
+         m_pSlots = NULL;
+         }
+
+      // Function that starts the worker processes. A scan held by a worker for
+      // more than the scan timeout, in s, is lost; 0 for no timeout. Returns
+      // the number of started workers.
+      MIL_INT StartWorkers(MIL_INT NbWorkers, MIL_DOUBLE ScanTimeout)
+         {
+         if(!m_pHeader)
+            return 0;
+         m_NbWorkers = NbWorkers < SCAN_SHARD_MAX_WORKERS ? NbWorkers : SCAN_SHARD_MAX_WORKERS;
+         m_ScanTimeout = ScanTimeout;
+         m_pHeader->NbWorkers = (MIL_UINT32)m_NbWorkers;
+         MIL_INT NbStartedWorkers = 0;
+         for(MIL_INT WorkerIdx = 0; WorkerIdx < m_NbWorkers; WorkerIdx++)
+            {
+            memset(&m_Workers[WorkerIdx], 0, sizeof(SScanShardWorkerProcess));
+            if(StartWorker(WorkerIdx))
+               NbStartedWorkers++;
+            }
+         return NbStartedWorkers;
+         }
+
+      // Function that waits until the running workers are ready to claim the
+      // scans, or the timeout, in ms. Returns the number of ready workers.
+      MIL_INT WaitForWorkers(MIL_INT Timeout)
+         {
+         for(MIL_INT WaitTime = 0; ; WaitTime += SCAN_SHARD_POLL_PERIOD)
+            {
+            Supervise();
+            MIL_INT NbReadyWorkers = 0;
+            MIL_INT NbRunningWorkers = 0;
+            for(MIL_INT WorkerIdx = 0; WorkerIdx < m_NbWorkers; WorkerIdx++)
+               {
+               if(m_Workers[WorkerIdx].hProcess)
+                  NbRunningWorkers++;
+               if(m_Workers[WorkerIdx].hProcess && m_pHeader->WorkerProcessIds[WorkerIdx] != 0)
+                  NbReadyWorkers++;
+               }
+            if(NbReadyWorkers == NbRunningWorkers || WaitTime >= Timeout)
+               return NbReadyWorkers;
+            MosSleep(SCAN_SHARD_POLL_PERIOD);
+            }
+         }
+
+      // Function that returns whether the slot of the next scan still holds a
+      // scan whose result is not taken.
+      bool IsFull() const
+         {
+         return m_NextSequence - m_NextResultSequence >= m_NbSlots;
+         }
+
+      // Function that returns the number of scans written whose result is not taken.
+      MIL_INT64 GetNbPending() const {return m_NextSequence - m_NextResultSequence;}
+
+      // Function that writes a scan in its slot and makes it claimable. The ring
+      // must not be full. Returns the sequence number of the scan, or -1 if it
+      // does not fit in a slot.
+      MIL_INT64 Write(MIL_INT RecipeIdx, const void* pDepthMap, MIL_INT DepthPitchByte, MIL_INT SizeX, MIL_INT SizeY)
+         {
+         if(!m_pHeader || IsFull() || SizeX > (MIL_INT)m_pHeader->FrameSizeX || SizeY > (MIL_INT)m_pHeader->FrameSizeY)
+            return -1;
+         MIL_INT SlotIdx = (MIL_INT)(m_NextSequence % m_NbSlots);
+         SScanShardSlot* pSlot = GetSlot(SlotIdx);
+         pSlot->RecipeIdx = (MIL_UINT32)RecipeIdx;
+         pSlot->Sequence = m_NextSequence;
+         pSlot->SizeX = (MIL_UINT32)SizeX;
+         pSlot->SizeY = (MIL_UINT32)SizeY;
+         MappTimer(M_DEFAULT, M_TIMER_READ, &pSlot->WriteTime);
+         memset(&pSlot->Result, 0, sizeof(pSlot->Result));
+
+         // Copy the rows at the pitch of the slot.
+         MIL_INT SlotDepthPitchByte = GetDepthPitchByte();
+         MIL_UINT8* pSlotDepthMap = GetDepthMap(SlotIdx);
+         for(MIL_INT y = 0; y < SizeY; y++)
+            memcpy(pSlotDepthMap + y * SlotDepthPitchByte, (const MIL_UINT8*)pDepthMap + y * DepthPitchByte, SizeX * sizeof(MIL_UINT16));
+
+         // Publish the slot, then wake a worker.
+         InterlockedExchange(&pSlot->State, SCAN_SHARD_READY);
+         ReleaseSemaphore(m_hReadySemaphore, 1, NULL);
+         return m_NextSequence++;
+         }
+
+      // Function that takes the result of the next scan in sequence order.
+      // Returns false if the scan is not done yet.
+      bool TakeResult(SScanShardResult* pResult)
+         {
+         if(!m_pHeader || m_NextResultSequence == m_NextSequence)
+            return false;
+         MIL_INT SlotIdx = (MIL_INT)(m_NextResultSequence % m_NbSlots);
+         SScanShardSlot* pSlot = GetSlot(SlotIdx);
+         LONG State = pSlot->State;
+         if(State != SCAN_SHARD_DONE && State != SCAN_SHARD_LOST)
+            return false;
+         MemoryBarrier();
+         if(State == SCAN_SHARD_DONE)
+            {
+            *pResult = pSlot->Result;
+            SScanShardWorkerProcess& Worker = m_Workers[pResult->WorkerIdx % SCAN_SHARD_MAX_WORKERS];
+            Worker.NbScans++;
+            Worker.ProcessTime += pResult->ProcessTime;
+            }
+         else
+            {
+            memset(pResult, 0, sizeof(*pResult));
+            pResult->Sequence = pSlot->Sequence;
+            pResult->RecipeIdx = pSlot->RecipeIdx;
+            pResult->WorkerIdx = (MIL_UINT32)m_LostWorkers[SlotIdx];
+            pResult->Lost = 1;
+            pResult->WriteTime = pSlot->WriteTime;
+            m_Workers[m_LostWorkers[SlotIdx]].NbLostScans++;
+            }
+         InterlockedExchange(&pSlot->State, SCAN_SHARD_FREE);
+         m_NextResultSequence++;
+         return true;
+         }
+
+      // Function that waits until a worker completes a scan or ends, or the
+      // timeout, in ms, then recovers the scans of the failed workers.
+      void Wait(DWORD Timeout)
+         {
+         HANDLE Handles[SCAN_SHARD_MAX_WORKERS + 1];
+         DWORD NbHandles = 0;
+         Handles[NbHandles++] = m_hDoneEvent;
+         for(MIL_INT WorkerIdx = 0; WorkerIdx < m_NbWorkers; WorkerIdx++)
+            {
+            if(m_Workers[WorkerIdx].hProcess)
+               Handles[NbHandles++] = m_Workers[WorkerIdx].hProcess;
+            }
+         WaitForMultipleObjects(NbHandles, Handles, FALSE, Timeout);
+         Supervise();
+         }
+
+      // Function that returns the number of lost scans.
+      MIL_INT GetNbLostScans() const
+         {
+         MIL_INT NbLostScans = 0;
+         for(MIL_INT WorkerIdx = 0; WorkerIdx < m_NbWorkers; WorkerIdx++)
+            NbLostScans += m_Workers[WorkerIdx].NbLostScans;
+         return NbLostScans;
+         }
+
+      // Function that returns the mean time of a scan in a worker, in s.
+      MIL_DOUBLE GetMeanProcessTime() const
+         {
+         MIL_INT NbScans = 0;
+         MIL_DOUBLE ProcessTime = 0.0;
+         for(MIL_INT WorkerIdx = 0; WorkerIdx < m_NbWorkers; WorkerIdx++)
+            {
+            NbScans += m_Workers[WorkerIdx].NbScans;
+            ProcessTime += m_Workers[WorkerIdx].ProcessTime;
+            }
+         return NbScans > 0 ? ProcessTime / NbScans : 0.0;
+         }
+
+      // Function that prints the statistics of the workers.
+      void PrintStatistics() const
+         {
+         MosPrintf(MIL_TEXT("   Worker  Scans  Lost  Restarts  Mean time (ms)\n"));
+         for(MIL_INT WorkerIdx = 0; WorkerIdx < m_NbWorkers; WorkerIdx++)
+            {
+            const SScanShardWorkerProcess& Worker = m_Workers[WorkerIdx];
+            MosPrintf(MIL_TEXT("   %6d  %5d  %4d  %8d  %14.1f%hs\n"), (int)WorkerIdx, (int)Worker.NbScans, (int)Worker.NbLostScans, (int)Worker.NbRestarts,
+                      Worker.NbScans > 0 ? Worker.ProcessTime * 1000.0 / Worker.NbScans : 0.0, Worker.hProcess ? "" : "  (stopped)");
+            }
+         }
+
+   private:
+      // Disallow copy.
+      CScanShardDispatcher(const CScanShardDispatcher&);
+      CScanShardDispatcher& operator=(const CScanShardDispatcher&);
+
+      SScanShardSlot* GetSlot(MIL_INT SlotIdx) const {return (SScanShardSlot*)(m_pSlots + SlotIdx * m_SlotSize);}
+      MIL_UINT8* GetDepthMap(MIL_INT SlotIdx) const {return (MIL_UINT8*)GetSlot(SlotIdx) + GetScanShardFrameOffset();}
+      MIL_INT GetDepthPitchByte() const {return (MIL_INT)m_pHeader->FrameSizeX * sizeof(MIL_UINT16);}
+
+      // Function that starts the process of a worker, with the same executable
+      // and working directory as this process.
+      bool StartWorker(MIL_INT WorkerIdx)
+         {
+         char ExecutablePath[MAX_PATH];
+         char CommandLine[2 * MAX_PATH];
+         if(GetModuleFileNameA(NULL, ExecutablePath, MAX_PATH) == 0)
+            return false;
+         sprintf_s(CommandLine, sizeof(CommandLine), "\"%s\" %s %d", ExecutablePath, SCAN_SHARD_WORKER_ARGUMENT, (int)WorkerIdx);
+         InterlockedExchange(&m_pHeader->WorkerProcessIds[WorkerIdx], 0);
+
+         STARTUPINFOA StartupInfo;
+         PROCESS_INFORMATION ProcessInfo;
+         memset(&StartupInfo, 0, sizeof(StartupInfo));
+         StartupInfo.cb = sizeof(StartupInfo);
+         if(!CreateProcessA(ExecutablePath, CommandLine, NULL, NULL, FALSE, 0, NULL, NULL, &StartupInfo, &ProcessInfo))
+            return false;
+         CloseHandle(ProcessInfo.hThread);
+         m_Workers[WorkerIdx].hProcess = ProcessInfo.hProcess;
+         return true;
+         }
+
+      // Function that terminates the workers that hold a scan past the timeout,
+      // marks the scans of the ended workers lost and restarts them. When no
+      // worker is left, the ready scans are lost too, so that the results
+      // still come in sequence order.
+      void Supervise()
+         {
+         MIL_DOUBLE CurrentTime;
+         MappTimer(M_DEFAULT, M_TIMER_READ, &CurrentTime);
+
+         // The claim time of a scan is when it is first seen claimed.
+         for(MIL_INT SlotIdx = 0; SlotIdx < m_NbSlots; SlotIdx++)
+            {
+            const SScanShardSlot* pSlot = GetSlot(SlotIdx);
+            LONG State = pSlot->State;
+            if(State < SCAN_SHARD_CLAIMED)
+               continue;
+            MIL_INT WorkerIdx = State - SCAN_SHARD_CLAIMED;
+            if(pSlot->Sequence != m_ObservedSequences[SlotIdx] || State != m_ObservedStates[SlotIdx])
+               {
+               m_ObservedSequences[SlotIdx] = pSlot->Sequence;
+               m_ObservedStates[SlotIdx] = State;
+               m_ClaimTimes[SlotIdx] = CurrentTime;
+               }
+            else if(m_ScanTimeout > 0.0 && CurrentTime - m_ClaimTimes[SlotIdx] > m_ScanTimeout && WorkerIdx < m_NbWorkers && m_Workers[WorkerIdx].hProcess)
+               {
+               TerminateProcess(m_Workers[WorkerIdx].hProcess, 1);
+               WaitForSingleObject(m_Workers[WorkerIdx].hProcess, SCAN_SHARD_STOP_TIMEOUT);
+               }
+            }
+
+         MIL_INT NbRunningWorkers = 0;
+         for(MIL_INT WorkerIdx = 0; WorkerIdx < m_NbWorkers; WorkerIdx++)
+            {
+            SScanShardWorkerProcess& Worker = m_Workers[WorkerIdx];
+            if(Worker.hProcess && WaitForSingleObject(Worker.hProcess, 0) == WAIT_OBJECT_0)
+               {
+               CloseHandle(Worker.hProcess);
+               Worker.hProcess = NULL;
+               InterlockedExchange(&m_pHeader->WorkerProcessIds[WorkerIdx], 0);
+
+               // Only the scan in flight of the worker is lost; a scan that it
+               // completed before it ended keeps its result.
+               for(MIL_INT SlotIdx = 0; SlotIdx < m_NbSlots; SlotIdx++)
+                  {
+                  LONG ClaimedState = (LONG)(SCAN_SHARD_CLAIMED + WorkerIdx);
+                  if(InterlockedCompareExchange(&GetSlot(SlotIdx)->State, SCAN_SHARD_LOST, ClaimedState) == ClaimedState)
+                     m_LostWorkers[SlotIdx] = WorkerIdx;
+                  }
+               if(Worker.NbRestarts < SCAN_SHARD_MAX_RESTARTS && !m_pHeader->Stopped)
+                  {
+                  Worker.NbRestarts++;
+                  StartWorker(WorkerIdx);
+                  }
+               }
+            if(Worker.hProcess)
+               NbRunningWorkers++;
+            }
+
+         if(NbRunningWorkers == 0)
+            {
+            for(MIL_INT SlotIdx = 0; SlotIdx < m_NbSlots; SlotIdx++)
+               {
+               if(InterlockedCompareExchange(&GetSlot(SlotIdx)->State, SCAN_SHARD_LOST, SCAN_SHARD_READY) == SCAN_SHARD_READY)
+                  m_LostWorkers[SlotIdx] = 0;
+               }
+            }
+         }
+
+      HANDLE                  m_hMapping;
+      SScanShardRingHeader*   m_pHeader;
+      MIL_UINT8*              m_pSlots;
+      MIL_UINT64              m_SlotSize;
+      MIL_INT                 m_NbSlots;
+      HANDLE                  m_hReadySemaphore;   // Counts the scans to claim.
+      HANDLE                  m_hDoneEvent;        // Set by a worker after each scan.
+      MIL_INT                 m_NbWorkers;
+      MIL_DOUBLE              m_ScanTimeout;
+      MIL_INT64               m_NextSequence;
+      MIL_INT64               m_NextResultSequence;
+      SScanShardWorkerProcess m_Workers[SCAN_SHARD_MAX_WORKERS];
+      MIL_INT64               m_ObservedSequences[SCAN_SHARD_MAX_SLOTS];
+      LONG                    m_ObservedStates[SCAN_SHARD_MAX_SLOTS];
+      MIL_DOUBLE              m_ClaimTimes[SCAN_SHARD_MAX_SLOTS];
+      MIL_INT                 m_LostWorkers[SCAN_SHARD_MAX_SLOTS];
+   };
+
+//////////////////////////////////////////////////////////////////////////
+// Class that claims the scans of the ring in a worker process and writes
+// their results. It is used from a single thread of the worker.
+//////////////////////////////////////////////////////////////////////////
+class CScanShardWorker
+   {
+   public:
+      // Constructor.
+      CScanShardWorker()
+         : m_hMapping(NULL),
+           m_pHeader(NULL),
+           m_pSlots(NULL),
+           m_hReadySemaphore(NULL),
+           m_hDoneEvent(NULL),
+           m_hAcquisitionProcess(NULL),
+           m_WorkerIdx(0),
+           m_AcquisitionEnded(false)
+         {
+         }
+
+      // Destructor.
+      virtual ~CScanShardWorker()
+         {
+         Detach();
+         }
+
+      // Function that returns the index of the worker given on the command line
+      // of this process, or -1 if the process is not a worker.
+      static MIL_INT GetCommandLineWorkerIdx()
+         {
+         const char* pArgument = strstr(GetCommandLineA(), SCAN_SHARD_WORKER_ARGUMENT);
+         if(!pArgument)
+            return -1;
+         return (MIL_INT)atoi(pArgument + strlen(SCAN_SHARD_WORKER_ARGUMENT));
+         }
+
+      // Function that opens the ring of an acquisition process. Returns false
+      // if no acquisition process created it.
+      bool Attach(const char* Name, MIL_INT WorkerIdx)
+         {
+         Detach();
+         m_WorkerIdx = WorkerIdx;
+         m_AcquisitionEnded = false;
+         m_hMapping = OpenFileMappingA(FILE_MAP_ALL_ACCESS, FALSE, Name);
+         if(!m_hMapping)
+            return false;
+         m_pHeader = (SScanShardRingHeader*)MapViewOfFile(m_hMapping, FILE_MAP_ALL_ACCESS, 0, 0, 0);
+         if(!m_pHeader || m_pHeader->Magic != SCAN_SHARD_MAGIC || m_pHeader->Version != SCAN_SHARD_VERSION ||
+            m_pHeader->HeaderSize != (MIL_UINT16)sizeof(SScanShardRingHeader) || WorkerIdx < 0 || WorkerIdx >= (MIL_INT)m_pHeader->NbWorkers)
+            {
+            Detach();
+            return false;
+            }
+         m_pSlots = (MIL_UINT8*)m_pHeader + GetScanShardSlotsOffset();
+         char ObjectName[MAX_PATH];
+         GetScanShardObjectName(ObjectName, Name, "Ready");
+         m_hReadySemaphore = OpenSemaphoreA(SYNCHRONIZE | SEMAPHORE_MODIFY_STATE, FALSE, ObjectName);
+         GetScanShardObjectName(ObjectName, Name, "Done");
+         m_hDoneEvent = OpenEventA(SYNCHRONIZE | EVENT_MODIFY_STATE, FALSE, ObjectName);
+         m_hAcquisitionProcess = OpenProcess(SYNCHRONIZE, FALSE, m_pHeader->ProcessId);
+         if(!m_hReadySemaphore || !m_hDoneEvent || !m_hAcquisitionProcess)
+            {
+            Detach();
+            return false;
+            }
+         return true;
+         }
+
+      // Function that closes the ring.
+      void Detach()
+         {
+         if(m_hAcquisitionProcess)
+            CloseHandle(m_hAcquisitionProcess);
+         if(m_hDoneEvent)
+            CloseHandle(m_hDoneEvent);
+         if(m_hReadySemaphore)
+            CloseHandle(m_hReadySemaphore);
+         if(m_pHeader)
+            UnmapViewOfFile(m_pHeader);
+         if(m_hMapping)
+            CloseHandle(m_hMapping);
+         m_hAcquisitionProcess = NULL;
+         m_hDoneEvent = NULL;
+         m_hReadySemaphore = NULL;
+         m_pHeader = NULL;
+         m_hMapping = NULL;
+         m_pSlots = NULL;
+         }
+
+      // Function that tells the acquisition process that the worker claims the scans.
+      void SetReady()
+         {
+         InterlockedExchange(&m_pHeader->WorkerProcessIds[m_WorkerIdx], (LONG)GetCurrentProcessId());
+         }
+
+      // Function that returns whether the acquisition process stopped the
+      // workers or ended.
+      bool IsStopped() const {return !m_pHeader || m_pHeader->Stopped != 0 || m_AcquisitionEnded;}
+
+      // Functions that return the parameters of the ring.
+      MIL_INT GetNbWorkers() const {return (MIL_INT)m_pHeader->NbWorkers;}
+      MIL_INT GetNbSlots() const {return (MIL_INT)m_pHeader->NbSlots;}
+      MIL_INT GetFrameSizeX() const {return (MIL_INT)m_pHeader->FrameSizeX;}
+      MIL_INT GetFrameSizeY() const {return (MIL_INT)m_pHeader->FrameSizeY;}
+      MIL_INT GetUserDataSize() const {return (MIL_INT)m_pHeader->UserDataSize;}
+      const void* GetUserData() const {return m_pHeader->UserData;}
+
+      // Function that waits for a scan to claim, or the timeout, in ms, and
+      // claims the ready scan of the lowest sequence number. Returns the index
+      // of its slot, or -1 if no scan was claimed.
+      MIL_INT Claim(DWORD Timeout)
+         {
+         if(IsStopped())
+            return -1;
+         HANDLE Handles[2] = {m_hReadySemaphore, m_hAcquisitionProcess};
+         if(WaitForMultipleObjects(2, Handles, FALSE, Timeout) == WAIT_OBJECT_0 + 1)
+            {
+            m_AcquisitionEnded = true;
+            return -1;
+            }
+
+         // The semaphore only wakes the workers; a claim that loses the race
+         // to another worker looks for the next ready scan.
+         LONG ClaimedState = (LONG)(SCAN_SHARD_CLAIMED + m_WorkerIdx);
+         for(;;)
+            {
+            MIL_INT ReadySlotIdx = -1;
+            for(MIL_INT SlotIdx = 0; SlotIdx < GetNbSlots(); SlotIdx++)
+               {
+               const SScanShardSlot* pSlot = GetSlot(SlotIdx);
+               if(pSlot->State == SCAN_SHARD_READY && (ReadySlotIdx < 0 || pSlot->Sequence < GetSlot(ReadySlotIdx)->Sequence))
+                  ReadySlotIdx = SlotIdx;
+               }
+            if(ReadySlotIdx < 0)
+               return -1;
+            if(InterlockedCompareExchange(&GetSlot(ReadySlotIdx)->State, ClaimedState, SCAN_SHARD_READY) == SCAN_SHARD_READY)
+               return ReadySlotIdx;
+            }
+         }
+
+      // Functions that return the scan of a claimed slot. The pitches are in pixels.
+      MIL_INT64 GetSequence(MIL_INT SlotIdx) const {return GetSlot(SlotIdx)->Sequence;}
+      MIL_INT GetRecipeIdx(MIL_INT SlotIdx) const {return (MIL_INT)GetSlot(SlotIdx)->RecipeIdx;}
+      MIL_INT GetSizeX(MIL_INT SlotIdx) const {return (MIL_INT)GetSlot(SlotIdx)->SizeX;}
+      MIL_INT GetSizeY(MIL_INT SlotIdx) const {return (MIL_INT)GetSlot(SlotIdx)->SizeY;}
+      MIL_INT GetPitch() const {return (MIL_INT)m_pHeader->FrameSizeX;}
+      MIL_UINT16* GetDepthMap(MIL_INT SlotIdx) const {return (MIL_UINT16*)((MIL_UINT8*)GetSlot(SlotIdx) + GetScanShardFrameOffset());}
+
+      // Function that writes the result of a claimed scan and releases its slot
+      // to the acquisition process.
+      void Complete(MIL_INT SlotIdx, const SScanShardResult& Result)
+         {
+         SScanShardSlot* pSlot = GetSlot(SlotIdx);
+         pSlot->Result = Result;
+         pSlot->Result.Sequence = pSlot->Sequence;
+         pSlot->Result.RecipeIdx = pSlot->RecipeIdx;
+         pSlot->Result.WorkerIdx = (MIL_UINT32)m_WorkerIdx;
+         pSlot->Result.Lost = 0;
+         pSlot->Result.WriteTime = pSlot->WriteTime;
+         InterlockedCompareExchange(&pSlot->State, SCAN_SHARD_DONE, (LONG)(SCAN_SHARD_CLAIMED + m_WorkerIdx));
+         SetEvent(m_hDoneEvent);
+         }
+
+   private:
+      // Disallow copy.
+      CScanShardWorker(const CScanShardWorker&);
+      CScanShardWorker& operator=(const CScanShardWorker&);
+
+      SScanShardSlot* GetSlot(MIL_INT SlotIdx) const {return (SScanShardSlot*)(m_pSlots + SlotIdx * m_pHeader->SlotSize);}
+
+      HANDLE                m_hMapping;
+      SScanShardRingHeader* m_pHeader;
+      MIL_UINT8*            m_pSlots;
+      HANDLE                m_hReadySemaphore;
+      HANDLE                m_hDoneEvent;
+      HANDLE                m_hAcquisitionProcess;
+      MIL_INT               m_WorkerIdx;
+      bool                  m_AcquisitionEnded;
+   };
@@ -0,0 +1,348 @@
+﻿//***************************************************************************************/
+//
+// File name: StageQueue.h
+//
+// Synopsis:  Contains the bounded queue used by the Chromasens_3DPIXA_M10PP3 example
+//            between the stages that run concurrently. The queue is a ring of a
+//            fixed capacity, so its memory stays bounded under overload. The
+//            producers and the consumer claim the cells with interlocked
+//            compare-exchanges on their positions, without lock; several
+//            producers may push at once, for a single consumer.
+//
+//            When the queue is full, a push blocks until the consumer pops,
+//            drops the oldest queued item to make room, or drops the pushed
+//            item, as set by the full policy. A dropped item is given back to
+//            the producer so the buffer it refers to can be reused.
+//
+//            Each item carries the sequence number of its scan, set by the
+//            first stage. The consumer counts the gaps in the sequence, so a
+//            scan lost anywhere before the queue is accounted for.
+//
+// Copyright © 1992-2024 Zebra Technologies Corp. and/or its affiliates
+// All Rights Reserved
+
+#include <string.h>
+
+// Behavior of a push on a full queue.
+enum EQueueFullPolicy
+   {
+   QUEUE_BLOCK,          // Wait until the consumer pops an item.
+   QUEUE_DROP_OLDEST,    // Drop the oldest queued item; the freshest scans are kept.
+   QUEUE_DROP_NEWEST     // Drop the pushed item; the queued scans are kept.
+   };
+
+// Result of a push.
+enum EQueuePushResult
+   {
+   QUEUE_PUSHED,
+   QUEUE_PUSHED_DROPPING_OLDEST,   // The oldest item was dropped to make room.
+   QUEUE_DROPPED                   // The pushed item was dropped.
+   };
+
+// Item of a queue.
+struct SStageItem
+   {
+   MIL_INT64  Sequence;    // Of the scan, consecutive at the first stage.
+   MIL_INT    Payload;     // Index of the buffer of the scan.
+   MIL_DOUBLE Time;        // Time of the timer at which the scan entered the first stage.
+   };
+
+// Statistics of a queue.
+struct SStageQueueStatistics
+   {
+   MIL_INT64  NbPushed;
+   MIL_INT64  NbPopped;
+   MIL_INT64  NbDropped;          // By the full policy.
+   MIL_INT64  NbBlockedPushes;    // That waited for room.
+   MIL_INT64  NbGaps;             // In the sequence of the popped items.
+   MIL_INT64  NbMissingItems;     // Sequence numbers skipped by the gaps.
+   MIL_INT    Capacity;
+   MIL_INT    MaxOccupancy;
+   MIL_DOUBLE MeanOccupancy;      // Sampled at each push.
+   };
+
+// Cell of the ring. The turn of a cell is its position when it is free for the
+// producer, and its position + 1 when it holds an item for the consumer.
+struct SStageQueueCell
+   {
+   volatile MIL_INT64 Turn;
+   SStageItem         Item;
+   };
+
+//////////////////////////////////////////////////////////////////////////
+// Class that passes the items of the scans from stage to stage.
+//////////////////////////////////////////////////////////////////////////
+class CStageQueue
+   {
+   public:
+      // Constructor. The queue is empty until it is reset with a capacity.
+      CStageQueue(const char* Name)
+         : m_Name(Name),
+           m_pCells(NULL),
+           m_Capacity(0),
+           m_Policy(QUEUE_BLOCK)
+         {
+         MthrAlloc(M_DEFAULT_HOST, M_EVENT, M_NOT_SIGNALED + M_AUTO_RESET, M_NULL, M_NULL, &m_MilNotEmptyEvent);
+         MthrAlloc(M_DEFAULT_HOST, M_EVENT, M_NOT_SIGNALED + M_AUTO_RESET, M_NULL, M_NULL, &m_MilNotFullEvent);
+         Reset(1, QUEUE_BLOCK);
+         }
+
+      // Destructor.
+      virtual ~CStageQueue()
+         {
+         delete [] m_pCells;
+         MthrFree(m_MilNotFullEvent);
+         MthrFree(m_MilNotEmptyEvent);
+         }
+
+      // Function that empties the queue, sets its capacity and full policy, and
+      // clears its statistics. No stage may use the queue meanwhile.
+      void Reset(MIL_INT Capacity, EQueueFullPolicy Policy)
+         {
+         if(Capacity < 1)
+            Capacity = 1;
+         if(Capacity != m_Capacity)
+            {
+            delete [] m_pCells;
+            m_pCells = new SStageQueueCell[Capacity];
+            m_Capacity = Capacity;
+            }
+         for(MIL_INT CellIdx = 0; CellIdx < m_Capacity; CellIdx++)
+            m_pCells[CellIdx].Turn = CellIdx;
+         m_Policy = Policy;
+         m_PushPosition = 0;
+         m_PopPosition = 0;
+         m_Closed = 0;
+         m_EndSequence = 0;
+         m_LastSequence = -1;
+         m_NbPushed = 0;
+         m_NbDropped = 0;
+         m_NbBlockedPushes = 0;
+         m_OccupancySum = 0;
+         m_MaxOccupancy = 0;
+         m_NbPopped = 0;
+         m_NbGaps = 0;
+         m_NbMissingItems = 0;
+         MthrControl(m_MilNotEmptyEvent, M_EVENT_SET, M_NOT_SIGNALED);
+         MthrControl(m_MilNotFullEvent, M_EVENT_SET, M_NOT_SIGNALED);
+         }
+
+      // Function that pushes an item, from any producer, as set by the full
+      // policy. The item dropped, the oldest or the pushed one, is copied in
+      // pDroppedItem if given.
+      EQueuePushResult Push(const SStageItem& Item, SStageItem* pDroppedItem)
+         {
+         EQueuePushResult Result = QUEUE_PUSHED;
+         bool Blocked = false;
+         while(!TryPush(Item))
+            {
+            SStageItem OldestItem;
+            if(m_Policy == QUEUE_DROP_NEWEST)
+               {
+               if(pDroppedItem)
+                  *pDroppedItem = Item;
+               InterlockedIncrement64((volatile LONGLONG*)&m_NbDropped);
+               return QUEUE_DROPPED;
+               }
+            else if(m_Policy == QUEUE_DROP_OLDEST)
+               {
+               // Make room; the consumer may have made it first.
+               if(TryPop(&OldestItem))
+                  {
+                  if(pDroppedItem)
+                     *pDroppedItem = OldestItem;
+                  InterlockedIncrement64((volatile LONGLONG*)&m_NbDropped);
+                  Result = QUEUE_PUSHED_DROPPING_OLDEST;
+                  }
+               }
+            else
+               {
+               Blocked = true;
+               MthrWait(m_MilNotFullEvent, M_EVENT_WAIT, M_NULL);
+               }
+            }
+
+         // A pop may have signaled a single blocked producer for several cells.
+         if(Blocked)
+            {
+            InterlockedIncrement64((volatile LONGLONG*)&m_NbBlockedPushes);
+            if(GetOccupancy() < m_Capacity)
+               MthrControl(m_MilNotFullEvent, M_EVENT_SET, M_SIGNALED);
+            }
+
+         // Sample the occupancy.
+         MIL_INT64 Occupancy = GetOccupancy();
+         InterlockedIncrement64((volatile LONGLONG*)&m_NbPushed);
+         InterlockedExchangeAdd64((volatile LONGLONG*)&m_OccupancySum, Occupancy);
+         MIL_INT64 MaxOccupancy = m_MaxOccupancy;
+         while(Occupancy > MaxOccupancy &&
+               InterlockedCompareExchange64((volatile LONGLONG*)&m_MaxOccupancy, Occupancy, MaxOccupancy) != MaxOccupancy)
+            MaxOccupancy = m_MaxOccupancy;
+
+         MthrControl(m_MilNotEmptyEvent, M_EVENT_SET, M_SIGNALED);
+         return Result;
+         }
+
+      // Function that pops the oldest item, from the consumer. If Wait is true,
+      // waits for an item until the queue is closed. Returns false if there is
+      // no item.
+      bool Pop(SStageItem* pItem, bool Wait)
+         {
+         while(true)
+            {
+            // The closing is read first so the items pushed before it are popped.
+            bool Closed = m_Closed != 0;
+            if(TryPop(pItem))
+               break;
+            if(Closed)
+               {
+               // The scans lost after the last popped one are missing too.
+               if(m_EndSequence > m_LastSequence + 1)
+                  {
+                  m_NbGaps++;
+                  m_NbMissingItems += m_EndSequence - m_LastSequence - 1;
+                  m_LastSequence = m_EndSequence - 1;
+                  }
+               return false;
+               }
+            if(!Wait)
+               return false;
+            MthrWait(m_MilNotEmptyEvent, M_EVENT_WAIT, M_NULL);
+            }
+         MthrControl(m_MilNotFullEvent, M_EVENT_SET, M_SIGNALED);
+
+         // Account for the scans lost before the consumer.
+         m_NbPopped++;
+         if(pItem->Sequence > m_LastSequence + 1)
+            {
+            m_NbGaps++;
+            m_NbMissingItems += pItem->Sequence - m_LastSequence - 1;
+            }
+         if(pItem->Sequence > m_LastSequence)
+            m_LastSequence = pItem->Sequence;
+         return true;
+         }
+
+      // Function that tells the consumer that no item will be pushed anymore, and
+      // the sequence number that the next scan would have had.
+      void Close(MIL_INT64 EndSequence)
+         {
+         m_EndSequence = EndSequence;
+         InterlockedExchange((volatile LONG*)&m_Closed, 1);
+         MthrControl(m_MilNotEmptyEvent, M_EVENT_SET, M_SIGNALED);
+         }
+
+      // Function that returns the number of queued items, or claimed by a push or
+      // a pop in progress.
+      MIL_INT GetOccupancy() const
+         {
+         MIL_INT64 PopPosition = m_PopPosition;
+         MIL_INT64 Occupancy = m_PushPosition - PopPosition;
+         return Occupancy > 0 ? (MIL_INT)Occupancy : 0;
+         }
+
+      // Function that returns the statistics of the queue.
+      void GetStatistics(SStageQueueStatistics* pStatistics) const
+         {
+         pStatistics->NbPushed = m_NbPushed;
+         pStatistics->NbPopped = m_NbPopped;
+         pStatistics->NbDropped = m_NbDropped;
+         pStatistics->NbBlockedPushes = m_NbBlockedPushes;
+         pStatistics->NbGaps = m_NbGaps;
+         pStatistics->NbMissingItems = m_NbMissingItems;
+         pStatistics->Capacity = m_Capacity;
+         pStatistics->MaxOccupancy = (MIL_INT)m_MaxOccupancy;
+         pStatistics->MeanOccupancy = m_NbPushed > 0 ? (MIL_DOUBLE)m_OccupancySum / m_NbPushed : 0.0;
+         }
+
+      // Function that prints the statistics of the queue.
+      void PrintStatistics() const
+         {
+         static const char* POLICY_NAMES[] = {"block", "drop oldest", "drop newest"};
+         SStageQueueStatistics Statistics;
+         GetStatistics(&Statistics);
+         MosPrintf(MIL_TEXT("   Queue %hs (%hs): %d pushed, %d popped, %d dropped, %d blocked pushes, occupancy mean %.2f max %d of %d,\n")
+                   MIL_TEXT("   %d scans missing in %d gaps of the sequence.\n"),
+                   m_Name, POLICY_NAMES[m_Policy], (int)Statistics.NbPushed, (int)Statistics.NbPopped, (int)Statistics.NbDropped,
+                   (int)Statistics.NbBlockedPushes, Statistics.MeanOccupancy, (int)Statistics.MaxOccupancy, (int)Statistics.Capacity,
+                   (int)Statistics.NbMissingItems, (int)Statistics.NbGaps);
+         }
+
+   private:
+      // Disallow copy.
+      CStageQueue(const CStageQueue&);
+      CStageQueue& operator=(const CStageQueue&);
+
+      // Function that claims the next cell for the producer and fills it. Returns
+      // false if the queue is full.
+      bool TryPush(const SStageItem& Item)
+         {
+         MIL_INT64 Position = m_PushPosition;
+         while(true)
+            {
+            SStageQueueCell& Cell = m_pCells[Position % m_Capacity];
+            MIL_INT64 Turn = Cell.Turn;
+            if(Turn == Position)
+               {
+               if(InterlockedCompareExchange64((volatile LONGLONG*)&m_PushPosition, Position + 1, Position) == Position)
+                  {
+                  Cell.Item = Item;
+                  InterlockedExchange64((volatile LONGLONG*)&Cell.Turn, Position + 1);
+                  return true;
+                  }
+               }
+            else if(Turn < Position)
+               return false;
+            Position = m_PushPosition;
+            }
+         }
+
+      // Function that claims the oldest filled cell and empties it. Returns false
+      // if the queue is empty.
+      bool TryPop(SStageItem* pItem)
+         {
+         MIL_INT64 Position = m_PopPosition;
+         while(true)
+            {
+            SStageQueueCell& Cell = m_pCells[Position % m_Capacity];
+            MIL_INT64 Turn = Cell.Turn;
+            if(Turn == Position + 1)
+               {
+               if(InterlockedCompareExchange64((volatile LONGLONG*)&m_PopPosition, Position + 1, Position) == Position)
+                  {
+                  *pItem = Cell.Item;
+                  InterlockedExchange64((volatile LONGLONG*)&Cell.Turn, Position + m_Capacity);
+                  return true;
+                  }
+               }
+            else if(Turn < Position + 1)
+               return false;
+            Position = m_PopPosition;
+            }
+         }
+
+      const char*        m_Name;
+      SStageQueueCell*   m_pCells;
+      MIL_INT            m_Capacity;
+      EQueueFullPolicy   m_Policy;
+      volatile MIL_INT64 m_PushPosition;
+      volatile MIL_INT64 m_PopPosition;
+      volatile MIL_INT32 m_Closed;
+      MIL_INT64          m_EndSequence;
+
+      // Statistics of the producers.
+      volatile MIL_INT64 m_NbPushed;
+      volatile MIL_INT64 m_NbDropped;
+      volatile MIL_INT64 m_NbBlockedPushes;
+      volatile MIL_INT64 m_OccupancySum;
+      volatile MIL_INT64 m_MaxOccupancy;
+
+      // Statistics of the consumer.
+      MIL_INT64          m_LastSequence;
+      MIL_INT64          m_NbPopped;
+      MIL_INT64          m_NbGaps;
+      MIL_INT64          m_NbMissingItems;
+
+      MIL_ID             m_MilNotEmptyEvent;   // Signaled when an item is pushed or the queue is closed.
+      MIL_ID             m_MilNotFullEvent;    // Signaled when an item is popped.
+   };
@@ -0,0 +1,235 @@
+﻿//***************************************************************************************/
+//
+// File name: SyntheticScene.h
+//
+// Synopsis:  Contains the synthetic scene generator used by the Chromasens_3DPIXA_M10PP3
+//            example to benchmark the processing of frames larger than the ones
+//            of the camera. It generates a 16-bit disparity map, 0 for the
+//            invalid pixels, and a matching color image of any size, with a
+//            planar tilt, a horizontal curve, depressions, sand-paper-like peaks,
+//            noise and holes. The generation is deterministic for a given seed.
+//
+//            Like the disparity maps, a higher gray level is a peak and a lower
+//            gray level is a depression.
+//
+// Copyright © 1992-2024 Zebra Technologies Corp. and/or its affiliates
+// All Rights Reserved
+
+#include <math.h>
+
+// Parameters of a synthetic scene. The heights are in gray levels and the
+// sizes in pixels.
+struct SSyntheticSceneParams
+   {
+   MIL_INT    SizeX;
+   MIL_INT    SizeY;
+   MIL_DOUBLE BaseLevel;          // At the center of the scene.
+   MIL_DOUBLE TiltX;              // Per pixel.
+   MIL_DOUBLE TiltY;              // Per pixel.
+   MIL_DOUBLE CurveAmplitude;     // Of the horizontal curve at the left and right borders.
+   MIL_DOUBLE NoiseAmplitude;     // Uniform noise, from -amplitude to +amplitude.
+   MIL_DOUBLE HoleFraction;       // Of the pixels that are invalid.
+   MIL_DOUBLE HoleRadius;
+   MIL_INT    NbDepressions;
+   MIL_DOUBLE DepressionDepth;
+   MIL_DOUBLE DepressionRadius;
+   MIL_DOUBLE PeakDensity;        // Peaks per megapixel.
+   MIL_DOUBLE PeakHeight;
+   MIL_DOUBLE PeakRadius;
+   MIL_UINT32 Seed;
+   };
+
+//////////////////////////////////////////////////////////////////////////
+// Class that generates synthetic disparity and color frames.
+//////////////////////////////////////////////////////////////////////////
+class CSyntheticSceneGenerator
+   {
+   public:
+      // Constructor.
+      CSyntheticSceneGenerator(const SSyntheticSceneParams& Params)
+         : m_Params(Params),
+           m_RandomState(Params.Seed ? Params.Seed : 1),
+           m_NbHolePixels(0)
+         {
+         }
+
+      // Destructor.
+      virtual ~CSyntheticSceneGenerator()
+         {
+         }
+
+      // Function that generates the scene in a 16-bit unsigned disparity map and,
+      // if given, in a packed BGRA (M_BGR32) color image, both of the size of the
+      // scene.
+      void Generate(MIL_ID MilDisparityImage, MIL_ID MilColorImage)
+         {
+         m_RandomState = m_Params.Seed ? m_Params.Seed : 1;
+         MIL_UINT16* pData = (MIL_UINT16*)MbufInquire(MilDisparityImage, M_HOST_ADDRESS, M_NULL);
+         MIL_INT Pitch = MbufInquire(MilDisparityImage, M_PITCH, M_NULL);
+
+         GenerateSurface(pData, Pitch);
+
+         // Add the peaks and the depressions.
+         MIL_INT NbPeaks = (MIL_INT)(m_Params.PeakDensity * m_Params.SizeX * m_Params.SizeY / 1000000.0);
+         for(MIL_INT PeakIdx = 0; PeakIdx < NbPeaks; PeakIdx++)
+            AddCone(pData, Pitch, RandomPosition(m_Params.SizeX), RandomPosition(m_Params.SizeY), m_Params.PeakRadius, m_Params.PeakHeight);
+         for(MIL_INT DepressionIdx = 0; DepressionIdx < m_Params.NbDepressions; DepressionIdx++)
+            AddBowl(pData, Pitch, RandomPosition(m_Params.SizeX), RandomPosition(m_Params.SizeY), m_Params.DepressionRadius, -m_Params.DepressionDepth);
+
+         AddHoles(pData, Pitch);
+
+         if(MilColorImage)
+            GenerateColor(pData, Pitch, MilColorImage);
+         }
+
+      // Function that returns the fraction of invalid pixels of the last scene.
+      MIL_DOUBLE GetHoleFraction() const
+         {
+         return (MIL_DOUBLE)m_NbHolePixels / (m_Params.SizeX * m_Params.SizeY);
+         }
+
+   private:
+      // Disallow copy.
+      CSyntheticSceneGenerator(const CSyntheticSceneGenerator&);
+      CSyntheticSceneGenerator& operator=(const CSyntheticSceneGenerator&);
+
+      // Function that returns a pseudo-random number from 0 to 1, excluded.
+      MIL_DOUBLE Random()
+         {
+         // Xorshift generator.
+         m_RandomState ^= m_RandomState << 13;
+         m_RandomState ^= m_RandomState >> 17;
+         m_RandomState ^= m_RandomState << 5;
+         return m_RandomState / 4294967296.0;
+         }
+
+      MIL_DOUBLE RandomPosition(MIL_INT Size) {return Random() * Size;}
+
+      // Function that returns a gray level clipped to the valid disparities.
+      static MIL_UINT16 ClipGray(MIL_DOUBLE Value)
+         {
+         if(Value < 1.0)
+            return 1;
+         if(Value > 65535.0)
+            return 65535;
+         return (MIL_UINT16)(Value + 0.5);
+         }
+
+      // Function that generates the tilted and curved surface with its noise.
+      void GenerateSurface(MIL_UINT16* pData, MIL_INT Pitch)
+         {
+         MIL_DOUBLE CenterX = 0.5 * (m_Params.SizeX - 1);
+         MIL_DOUBLE CenterY = 0.5 * (m_Params.SizeY - 1);
+         MIL_DOUBLE* pRowProfile = new MIL_DOUBLE[m_Params.SizeX];
+         for(MIL_INT x = 0; x < m_Params.SizeX; x++)
+            {
+            MIL_DOUBLE NormalizedX = CenterX > 0 ? (x - CenterX) / CenterX : 0.0;
+            pRowProfile[x] = m_Params.TiltX * (x - CenterX) + m_Params.CurveAmplitude * NormalizedX * NormalizedX;
+            }
+         for(MIL_INT y = 0; y < m_Params.SizeY; y++)
+            {
+            MIL_UINT16* pRow = pData + y * Pitch;
+            MIL_DOUBLE RowLevel = m_Params.BaseLevel + m_Params.TiltY * (y - CenterY);
+            for(MIL_INT x = 0; x < m_Params.SizeX; x++)
+               pRow[x] = ClipGray(RowLevel + pRowProfile[x] + m_Params.NoiseAmplitude * (2.0 * Random() - 1.0));
+            }
+         delete [] pRowProfile;
+         }
+
+      // Function that adds a cone, with its height at the center.
+      void AddCone(MIL_UINT16* pData, MIL_INT Pitch, MIL_DOUBLE CenterX, MIL_DOUBLE CenterY, MIL_DOUBLE Radius, MIL_DOUBLE Height)
+         {
+         MIL_INT StartX, EndX, StartY, EndY;
+         GetDiscBox(CenterX, CenterY, Radius, &StartX, &EndX, &StartY, &EndY);
+         for(MIL_INT y = StartY; y <= EndY; y++)
+            {
+            for(MIL_INT x = StartX; x <= EndX; x++)
+               {
+               MIL_DOUBLE Distance = sqrt((x - CenterX) * (x - CenterX) + (y - CenterY) * (y - CenterY));
+               if(Distance < Radius)
+                  pData[y * Pitch + x] = ClipGray(pData[y * Pitch + x] + Height * (1.0 - Distance / Radius));
+               }
+            }
+         }
+
+      // Function that adds a paraboloid bowl, with its height at the center.
+      void AddBowl(MIL_UINT16* pData, MIL_INT Pitch, MIL_DOUBLE CenterX, MIL_DOUBLE CenterY, MIL_DOUBLE Radius, MIL_DOUBLE Height)
+         {
+         MIL_INT StartX, EndX, StartY, EndY;
+         GetDiscBox(CenterX, CenterY, Radius, &StartX, &EndX, &StartY, &EndY);
+         MIL_DOUBLE RadiusSquare = Radius * Radius;
+         for(MIL_INT y = StartY; y <= EndY; y++)
+            {
+            for(MIL_INT x = StartX; x <= EndX; x++)
+               {
+               MIL_DOUBLE DistanceSquare = (x - CenterX) * (x - CenterX) + (y - CenterY) * (y - CenterY);
+               if(DistanceSquare < RadiusSquare)
+                  pData[y * Pitch + x] = ClipGray(pData[y * Pitch + x] + Height * (1.0 - DistanceSquare / RadiusSquare));
+               }
+            }
+         }
+
+      // Function that invalidates random discs until the hole fraction is reached.
+      void AddHoles(MIL_UINT16* pData, MIL_INT Pitch)
+         {
+         m_NbHolePixels = 0;
+         MIL_DOUBLE HoleFraction = m_Params.HoleFraction < 1.0 ? m_Params.HoleFraction : 1.0;
+         MIL_DOUBLE HoleRadius = m_Params.HoleRadius > 1.0 ? m_Params.HoleRadius : 1.0;
+         MIL_INT NbTargetPixels = (MIL_INT)(HoleFraction * m_Params.SizeX * m_Params.SizeY);
+         MIL_DOUBLE RadiusSquare = HoleRadius * HoleRadius;
+         while(m_NbHolePixels < NbTargetPixels)
+            {
+            MIL_DOUBLE CenterX = RandomPosition(m_Params.SizeX);
+            MIL_DOUBLE CenterY = RandomPosition(m_Params.SizeY);
+            MIL_INT StartX, EndX, StartY, EndY;
+            GetDiscBox(CenterX, CenterY, HoleRadius, &StartX, &EndX, &StartY, &EndY);
+            for(MIL_INT y = StartY; y <= EndY && m_NbHolePixels < NbTargetPixels; y++)
+               {
+               for(MIL_INT x = StartX; x <= EndX && m_NbHolePixels < NbTargetPixels; x++)
+                  {
+                  MIL_UINT16& Pixel = pData[y * Pitch + x];
+                  if(Pixel != 0 && (x - CenterX) * (x - CenterX) + (y - CenterY) * (y - CenterY) <= RadiusSquare)
+                     {
+                     Pixel = 0;
+                     m_NbHolePixels++;
+                     }
+                  }
+               }
+            }
+         }
+
+      // Function that generates a sand colored image shaded by the height, black
+      // in the holes. The color image is packed BGRA, like the color maps of the
+      // example.
+      void GenerateColor(const MIL_UINT16* pData, MIL_INT Pitch, MIL_ID MilColorImage)
+         {
+         MIL_UINT8* pColorData = (MIL_UINT8*)MbufInquire(MilColorImage, M_HOST_ADDRESS, M_NULL);
+         MIL_INT ColorPitchByte = MbufInquire(MilColorImage, M_PITCH_BYTE, M_NULL);
+         for(MIL_INT y = 0; y < m_Params.SizeY; y++)
+            {
+            const MIL_UINT16* pRow = pData + y * Pitch;
+            MIL_UINT8* pColorRow = pColorData + y * ColorPitchByte;
+            for(MIL_INT x = 0; x < m_Params.SizeX; x++)
+               {
+               MIL_INT Shade = pRow[x] ? 64 + (pRow[x] >> 9) : 0;
+               pColorRow[4 * x]     = (MIL_UINT8)(0.6 * Shade);
+               pColorRow[4 * x + 1] = (MIL_UINT8)(0.85 * Shade);
+               pColorRow[4 * x + 2] = (MIL_UINT8)Shade;
+               pColorRow[4 * x + 3] = 0xFF;
+               }
+            }
+         }
+
+      // Function that returns the pixels of the box of a disc, clipped to the scene.
+      void GetDiscBox(MIL_DOUBLE CenterX, MIL_DOUBLE CenterY, MIL_DOUBLE Radius, MIL_INT* pStartX, MIL_INT* pEndX, MIL_INT* pStartY, MIL_INT* pEndY) const
+         {
+         *pStartX = CenterX - Radius > 0 ? (MIL_INT)(CenterX - Radius) : 0;
+         *pStartY = CenterY - Radius > 0 ? (MIL_INT)(CenterY - Radius) : 0;
+         *pEndX = CenterX + Radius < m_Params.SizeX - 1 ? (MIL_INT)(CenterX + Radius) : m_Params.SizeX - 1;
+         *pEndY = CenterY + Radius < m_Params.SizeY - 1 ? (MIL_INT)(CenterY + Radius) : m_Params.SizeY - 1;
+         }
+
+      SSyntheticSceneParams m_Params;
+      MIL_UINT32            m_RandomState;
+      MIL_INT               m_NbHolePixels;
+   };
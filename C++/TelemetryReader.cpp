@@ -0,0 +1,142 @@
+﻿//***************************************************************************************/
+//
+// File name: TelemetryReader.cpp
+//
+// Synopsis:  This program prints the live telemetry that the Chromasens_3DPIXA_M10PP3
+//            example publishes after every scan (see PipelineTelemetry.h). It
+//            maps the shared memory read only and never waits for the example,
+//            so it can be started, stopped or stalled at any time without
+//            affecting the inspection. No MIL application is allocated.
+//
+//            Usage: TelemetryReader [-stages] [shared memory name]
+//               -stages   Also prints the latency of every stage of each scan.
+//
+// Copyright © 1992-2024 Zebra Technologies Corp. and/or its affiliates
+// All Rights Reserved
+
+#include <windows.h>
+#include <mil.h>
+#include <stdio.h>
+#include <string.h>
+#include <conio.h>
+#include "PipelineTelemetry.h"
+
+static const DWORD READER_POLL_PERIOD       = 100;    // In ms.
+static const DWORD READER_OPEN_RETRY_PERIOD = 1000;   // In ms.
+
+// Names of the EQualityDecision values of the example.
+static const char* DECISION_NAMES[] = {"pass", "downgrade", "flag", "skip"};
+static const MIL_UINT32 NB_DECISION_NAMES = sizeof(DECISION_NAMES) / sizeof(DECISION_NAMES[0]);
+
+//*****************************************************************************
+// Function prototypes.
+//*****************************************************************************
+void PrintSampleHeader();
+void PrintSample(const STelemetrySample& Sample, bool PrintStages);
+
+//*****************************************************************************
+// Main.
+//*****************************************************************************
+int main(int argc, char* argv[])
+   {
+   const char* Name = TELEMETRY_SHARED_MEMORY;
+   bool PrintStages = false;
+   for(int ArgIdx = 1; ArgIdx < argc; ArgIdx++)
+      {
+      if(strcmp(argv[ArgIdx], "-stages") == 0)
+         PrintStages = true;
+      else
+         Name = argv[ArgIdx];
+      }
+   printf("Reading the telemetry of %s.\nPress any key to end.\n\n", Name);
+
+   CTelemetryReader Reader;
+   MIL_UINT32 PublisherProcessId = 0;
+   MIL_INT64 NextSampleIdx = 0;
+   bool Waiting = false;
+   while(!_kbhit())
+      {
+      // Open the shared memory once a publisher has initialized it. It is also
+      // reopened when a publisher initializes it again.
+      if(!Reader.IsValid())
+         {
+         if(!Reader.Open(Name) || !Reader.IsValid())
+            {
+            if(!Waiting)
+               printf("Waiting for the example to publish...\n");
+            Waiting = true;
+            Sleep(READER_OPEN_RETRY_PERIOD);
+            continue;
+            }
+         Waiting = false;
+         }
+
+      // Start from the latest sample of a new publisher.
+      MIL_INT64 WriteCount = Reader.GetWriteCount();
+      if(Reader.GetPublisherProcessId() != PublisherProcessId || WriteCount < NextSampleIdx)
+         {
+         PublisherProcessId = Reader.GetPublisherProcessId();
+         NextSampleIdx = WriteCount > 0 ? WriteCount - 1 : 0;
+         printf("\nPublished by process %u.\n", (unsigned int)PublisherProcessId);
+         PrintSampleHeader();
+         }
+
+      // Print the new samples. The samples overwritten before being read are lost.
+      if(WriteCount - NextSampleIdx > TELEMETRY_NB_SLOTS)
+         {
+         printf("%lld samples were overwritten before being read.\n", (long long)(WriteCount - TELEMETRY_NB_SLOTS - NextSampleIdx));
+         NextSampleIdx = WriteCount - TELEMETRY_NB_SLOTS;
+         }
+      for(; NextSampleIdx < WriteCount; NextSampleIdx++)
+         {
+         STelemetrySample Sample;
+         if(Reader.Read(NextSampleIdx, &Sample))
+            PrintSample(Sample, PrintStages);
+         else
+            printf("Sample %lld was overwritten while being read.\n", (long long)NextSampleIdx);
+         }
+      Sleep(READER_POLL_PERIOD);
+      }
+   _getch();
+
+   return 0;
+   }
+
+//*****************************************************************************
+// PrintSampleHeader. Prints the header of the sample table.
+//*****************************************************************************
+void PrintSampleHeader()
+   {
+   printf("  Scan  Recipe  Decision   Scans/s  Latency (ms)  Max (ms)  Coverage  Defects  Peaks  Dropped  Flagged  Memory (MB)  Queues\n");
+   }
+
+//*****************************************************************************
+// PrintSample. Prints a sample and, optionally, the latency of its stages.
+//*****************************************************************************
+void PrintSample(const STelemetrySample& Sample, bool PrintStages)
+   {
+   printf("%6llu  %6u  %-9s  %7.2f  %12.1f  %8.1f  %7.1f%%  %7u  %5u  %7llu  %7llu  %11.1f ",
+          (unsigned long long)Sample.ScanIdx,
+          (unsigned int)Sample.RecipeIdx,
+          Sample.Decision < NB_DECISION_NAMES ? DECISION_NAMES[Sample.Decision] : "?",
+          Sample.ScansPerSecond,
+          Sample.ScanLatency * 1000.0,
+          Sample.MaxScanLatency * 1000.0,
+          Sample.ValidCoverage * 100.0,
+          (unsigned int)Sample.NbDefects,
+          (unsigned int)Sample.NbPeaks,
+          (unsigned long long)Sample.NbDroppedScans,
+          (unsigned long long)Sample.NbFlaggedScans,
+          Sample.MemoryHighWaterMark / (1024.0 * 1024.0));
+   for(MIL_UINT32 QueueIdx = 0; QueueIdx < Sample.NbQueues && QueueIdx < (MIL_UINT32)TELEMETRY_MAX_QUEUES; QueueIdx++)
+      printf(" %s=%.1f", Sample.QueueNames[QueueIdx], Sample.QueueDepths[QueueIdx]);
+   printf("\n");
+
+   if(PrintStages)
+      {
+      printf("       ");
+      for(MIL_UINT32 StageIdx = 0; StageIdx < Sample.NbStages && StageIdx < (MIL_UINT32)TELEMETRY_MAX_STAGES; StageIdx++)
+         printf(" %s %.1f ms%s", Sample.StageNames[StageIdx], Sample.StageLatencies[StageIdx] * 1000.0, StageIdx + 1 < Sample.NbStages ? "," : "");
+      printf("\n");
+      }
+   }